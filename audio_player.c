@@ -5,6 +5,7 @@
 #include "oscillator.h"
 #include "breakpoints.h"
 #include "audio_player.h"
+#include "trace.h"
 
 
 /* Internal function declarations */
@@ -22,18 +23,19 @@ static int audio_player_callback(
 /* 
  * new_audio_player(): 
  * Creates a malloc'ed AudioPlayer struct with the given settings, initalizes
- * its audio stream, and opens its output file if specified
+ * its audio stream, and starts recording to its output file if specified
  *
  * When done with this AudioPlayer, the user must call free_audio_player() to
  * free its resources.
  *
- * outfilename: The name of the file to write audio to. If NULL, no file will
- *              be written
+ * recording:   A pointer to the RecorderSettings of the file to write audio
+ *              to. If NULL, no file will be written
+ * samplerate:  The sample rate to generate audio at
  *
  * return:      A malloc'ed pointer to an initialized AudioPlayer with the given
                 settings and
  */
-AudioPlayer* new_audio_player(char* outfilename, int samplerate) {
+AudioPlayer* new_audio_player(RecorderSettings* recording, int samplerate) {
     AudioPlayer* player = (AudioPlayer*) malloc(sizeof(AudioPlayer));
     if(player == NULL) {
         printf("Error allocating AudioPlayer\n");
@@ -41,27 +43,16 @@ AudioPlayer* new_audio_player(char* outfilename, int samplerate) {
     }
 
     player->osc_list = NULL;
+    player->viz = NULL;
+    player->profile = NULL;
     player->samplerate = samplerate;
 
 
-    //If outfile is NULL, disable file output
-    if(outfilename == NULL)
-        player->write_output = 0;
-    else { // Otherwise, setup libsndfile file
-        player->write_output = 1;
-
-        player->sfinfo.samplerate = samplerate;
-        player->sfinfo.channels = 1;
-        // A float-based wave file
-        player->sfinfo.format = SF_FORMAT_WAV | SF_FORMAT_FLOAT;
-
-        // Open file pointer
-        if((player->outfile = sf_open(outfilename, SFM_WRITE, &player->sfinfo)) == NULL) {
-            printf("Error opening output file.\n");
-            puts(sf_strerror(NULL));
-            free(player);
-            return NULL;
-        }
+    // If there's an output file, start recording to it
+    player->recorder = NULL;
+    if(recording != NULL && (player->recorder = new_recorder(recording, samplerate)) == NULL) {
+        free(player);
+        return NULL;
     }
 
     PaError err;
@@ -69,6 +60,8 @@ AudioPlayer* new_audio_player(char* outfilename, int samplerate) {
     // Initialize PortAudio
     if((err = Pa_Initialize()) != paNoError) {
         printf("PortAudio init error: %s\n", Pa_GetErrorText(err));
+        if(player->recorder != NULL)
+            free_recorder(player->recorder);
         free(player);
         return NULL;
     }
@@ -77,6 +70,8 @@ AudioPlayer* new_audio_player(char* outfilename, int samplerate) {
     PaStreamParameters outputParameters;
     if((outputParameters.device = Pa_GetDefaultOutputDevice()) == paNoDevice) {
         printf("PortAudio: no default output device\n");
+        if(player->recorder != NULL)
+            free_recorder(player->recorder);
         free(player);
         return NULL;
     }
@@ -93,10 +88,13 @@ AudioPlayer* new_audio_player(char* outfilename, int samplerate) {
             paFramesPerBufferUnspecified, 0, audio_player_callback, player);
     if(err != paNoError) {
         printf("Error opening PortAudio stream: %s\n", Pa_GetErrorText(err));
+        if(player->recorder != NULL)
+            free_recorder(player->recorder);
         free(player);
         return NULL;
     }
 
+    pthread_mutex_init(&player->osc_list_lock, NULL);
 
     return player;
 }
@@ -169,9 +167,16 @@ static int audio_player_callback(
         void* userData) {
 
 
+    uint64_t trace_start = trace_begin();
+    trace_thread_name("audio");
+
     // Get AudioPlayer from data
     AudioPlayer* player = (AudioPlayer*) userData;
 
+    // If enabled, start profiling the callback
+    if(player->profile != NULL)
+        profile_callback_start(player->profile);
+
     // Cast output buffer to float 
     float* out = (float*) outputBuffer;
 
@@ -179,30 +184,34 @@ static int audio_player_callback(
     // Lock the oscillator list so the list isn't changed until we're done
     pthread_mutex_lock(&player->osc_list_lock);
 
-    OscilNode* curr;
-    float val;
-    // For each sample
-    for(int i = 0; i < framesPerBuffer; i++) {
-        val = 0;
-        
-        // Tick each oscillator in list and sum their values
-        curr = player->osc_list;
-        while(curr != NULL) {
-            val += oscil_tick(curr->osc);
-            curr = curr->next;
-        }
+    // The output samples are the summed oscillator values
+    oscil_list_mix(player->osc_list, out, framesPerBuffer);
+
+    // If enabled, publish what's playing for displaying
+    if(player->viz != NULL)
+        viz_tap_capture(player->viz, player->osc_list, out, framesPerBuffer);
 
-        // The output sample is the summed oscillator values
-        out[i] = val;
+    /* Count the voices sounding, to profile the callback by. Notes waiting to
+     * start and expired notes cost next to nothing, so they aren't counted. */
+    int voices = 0;
+    if(player->profile != NULL) {
+        for(OscilNode* curr = player->osc_list; curr != NULL; curr = curr->next) {
+            if(curr->osc->curr_sample >= 0 && !oscil_expired(curr->osc))
+                voices++;
+        }
     }
 
     // Done, so unlock the oscillator list
     pthread_mutex_unlock(&player->osc_list_lock);
 
-    // If enabled, write to output file
-    if(player->write_output)
-        sf_write_float(player->outfile, out, framesPerBuffer);
+    // If enabled, hand the block to be written to the output file
+    if(player->recorder != NULL)
+        recorder_write(player->recorder, out, framesPerBuffer);
+
+    if(player->profile != NULL)
+        profile_callback_end(player->profile, voices, framesPerBuffer);
 
+    trace_end("audio callback", trace_start);
     return 0;
 }
 
@@ -220,20 +229,14 @@ static int audio_player_callback(
  *
  */
 void synch_update(AudioPlayer* player) {
-    //Iterate through osc_list
-    OscilNode* curr = player->osc_list;
-    while(curr != NULL) {
-        //If oscillator is expired, remove it
-        if(oscil_expired(curr->osc)) {
-            OscilNode* temp = curr->next;
+    uint64_t start = trace_begin();
 
-            oscil_list_remove(&player->osc_list, curr->osc->id);
+    // The callback may be reading the list, so lock it while it's modified
+    pthread_mutex_lock(&player->osc_list_lock);
+    oscil_list_remove_expired(&player->osc_list);
+    pthread_mutex_unlock(&player->osc_list_lock);
 
-            curr = temp;
-        }
-        else
-            curr = curr->next;
-    }
+    trace_end("synch_update", start);
 }
 
 
@@ -297,8 +300,9 @@ void free_audio_player(AudioPlayer* player) {
         curr = temp;
     }
 
-    // Close the output file
-    sf_close(player->outfile);
+    // Finish writing and close the output file, if there is one
+    if(player->recorder != NULL)
+        free_recorder(player->recorder);
 
 
     // Close the stream
@@ -312,6 +316,8 @@ void free_audio_player(AudioPlayer* player) {
         printf("PortAudio Termination error: %s\n", Pa_GetErrorText(err));
     }
 
+    pthread_mutex_destroy(&player->osc_list_lock);
+
     // Free the overall AudioPlayer
     free(player);
 }
@@ -5,6 +5,9 @@
 #include <portaudio.h>
 
 #include "oscillator.h"
+#include "viz_tap.h"
+#include "callback_profile.h"
+#include "recorder.h"
 
 
 /*
@@ -12,7 +15,7 @@
  * Contains:
  * - A collection of Oscillators to generate audio
  * - PortAudio systems to play the audio in realtime
- * - libsndfile systems to write the file in realtime
+ * - A Recorder to write the audio to a file on another thread
  *
  * See oscillator.h for more information on how Oscillators generate audio.
  *
@@ -32,15 +35,22 @@ typedef struct audio_player {
      * and in the callback function. */
     pthread_mutex_t osc_list_lock;
 
+    /* If not NULL, a snapshot of the voices and output is published to this
+     * at the end of each block, for displaying. Set before starting the
+     * stream. */
+    VizTap* viz;
+
+    /* If not NULL, each callback's time and hardware counters are recorded
+     * in this. Set before starting the stream. */
+    CallbackProfile* profile;
 
 
-    /**** File output (libsndfile) ****/
-    /* Note: At least on my computer, writing to a file can take up enough
-     * resources to cause buffer underruns. This is why it can be disabled. */
 
-    int write_output; // Boolean, whether or not to write to an output file
-    SF_INFO sfinfo; // libsndfile info about the output file
-    SNDFILE* outfile; // libsndfile file pointer to the output file
+    /**** File output (libsndfile) ****/
+    /* Writing to a file can take up enough time to cause buffer underruns,
+     * so the callback only hands each block to the Recorder, which writes it
+     * on a thread of its own. NULL if no file is written. */
+    Recorder* recorder;
 
 
 
@@ -63,18 +73,19 @@ typedef struct audio_player {
 /* 
  * new_audio_player(): 
  * Creates a malloc'ed AudioPlayer struct with the given settings, initalizes
- * its audio stream, and opens its output file if specified
+ * its audio stream, and starts recording to its output file if specified
  *
  * When done with this AudioPlayer, the user must call free_audio_player() to
  * free its resources.
  *
- * outfilename: The name of the file to write audio to. If NULL, no file will
- *              be written
+ * recording:   A pointer to the RecorderSettings of the file to write audio
+ *              to. If NULL, no file will be written
+ * samplerate:  The sample rate to generate audio at
  *
  * return:      A malloc'ed pointer to an initialized AudioPlayer with the given
                 settings and
  */
-AudioPlayer* new_audio_player(char* outfilename, int samplerate);
+AudioPlayer* new_audio_player(RecorderSettings* recording, int samplerate);
 
 
 /* add_osc():
@@ -0,0 +1,310 @@
+#include "batch.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sndfile.h>
+
+#include "composer.h"
+#include "render.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+// The number of samples rendered and written at a time
+#define BLOCK_FRAMES 4096
+
+// The longest line, and filename within it, a manifest can have
+#define MAX_LINE 4096
+
+
+/*
+ * Batch:
+ * Everything the jobs of a batch share.
+ */
+typedef struct batch {
+    BatchJob* jobs;
+    int num_jobs;
+
+    Instruments* instruments;
+    LandscapeSettings settings;
+    int strategy;
+    int samplerate;
+} Batch;
+
+
+/* Internal function declarations */
+BatchJob* load_manifest(char* filename, int* num_jobs);
+void free_manifest(BatchJob* jobs, int num_jobs);
+void render_job(void* arg, int task, int worker);
+int render_to_file(Batch* batch, BatchJob* job);
+
+
+
+/*
+ * run_batch():
+ * Renders every job in a manifest file to a .wav file, as fast as they can
+ * be computed rather than in realtime, then prints a summary of how long
+ * they took.
+ *
+ * The manifest has one job per line, as its image, duration in seconds, seed
+ * and output file, separated by whitespace:
+ *
+ *     photos/lake.png 60 1 out/lake.wav
+ *
+ * Blank lines and lines starting with # are skipped.
+ *
+ * The jobs run on a pool of threads, which take over jobs from each other
+ * when theirs run out. The lookup tables, breakpoints and keys are loaded
+ * once and shared by every job. Rendering a job with the same image, duration
+ * and seed always gives the same audio.
+ *
+ * manifest:    The manifest file to read
+ * settings:    A pointer to the LandscapeSettings to load each image with
+ * scale:       A pointer to the ScaleSettings to make the keys with
+ * strategy:    The SelectStrategy to choose regions with
+ * threads:     The number of threads to render on, 0 for one per processor
+ * samplerate:  The sample rate to render at
+ *
+ * return:      0 if every job was rendered, 1 otherwise
+ */
+int run_batch(char* manifest, LandscapeSettings* settings, ScaleSettings* scale, int strategy, int threads, int samplerate) {
+    Batch batch;
+    batch.jobs = load_manifest(manifest, &batch.num_jobs);
+    if(batch.jobs == NULL)
+        return 1;
+
+    batch.instruments = load_instruments(samplerate, scale);
+    if(batch.instruments == NULL) {
+        free_manifest(batch.jobs, batch.num_jobs);
+        return 1;
+    }
+
+    /* The jobs already run in parallel, so each analyzes its image on one
+     * thread, and nothing is displayed */
+    batch.settings = *settings;
+    batch.settings.keep_display = 0;
+    batch.settings.threads = 1;
+    batch.strategy = strategy;
+    batch.samplerate = samplerate;
+
+    if(threads <= 0)
+        threads = count_cpus();
+    if(threads > batch.num_jobs)
+        threads = batch.num_jobs;
+
+    printf("Rendering %d jobs on %d threads...\n", batch.num_jobs, threads);
+
+    double start = now_seconds();
+    run_tasks(batch.num_jobs, threads, render_job, &batch);
+    double wall = now_seconds() - start;
+
+    /* Sum up the audio rendered by the jobs that succeeded */
+    int rendered = 0;
+    double audio = 0;
+    for(int i = 0; i < batch.num_jobs; i++) {
+        if(!batch.jobs[i].failed) {
+            rendered++;
+            audio += batch.jobs[i].duration;
+        }
+    }
+
+    printf("\nRendered %d of %d jobs\n", rendered, batch.num_jobs);
+    printf("%.1f s of audio in %.2f s: %.1f audio-seconds per wall-second\n",
+            audio, wall, wall > 0 ? audio / wall : 0);
+
+    free_instruments(batch.instruments);
+    free_manifest(batch.jobs, batch.num_jobs);
+
+    return rendered != batch.num_jobs;
+}
+
+
+
+
+/*
+ * load_manifest():
+ * Reads the jobs of a batch from a manifest file. See run_batch() for the
+ * format.
+ *
+ * The user must call free_manifest() on the returned array.
+ *
+ * filename:    The manifest file to read
+ * num_jobs:    Pointer to an int to set to the number of jobs
+ *
+ * return:      A malloc'ed array of BatchJobs, or NULL on error or if the
+ *              manifest has no jobs
+ */
+BatchJob* load_manifest(char* filename, int* num_jobs) {
+    FILE* file = fopen(filename, "r");
+    if(file == NULL) {
+        printf("Error opening manifest %s\n", filename);
+        return NULL;
+    }
+
+    BatchJob* jobs = NULL;
+    int len = 0;
+    int count = 0;
+
+    char line[MAX_LINE];
+    char image[MAX_LINE];
+    char output[MAX_LINE];
+    int line_num = 0;
+    while(fgets(line, MAX_LINE, file)) {
+        line_num++;
+
+        // Skip blank lines and comments
+        char* start = line + strspn(line, " \t\r\n");
+        if(*start == '\0' || *start == '#')
+            continue;
+
+        // If we've filled the existing allocation, reallocate with more space
+        if(count == len) {
+            len = len > 0 ? len*2 : 16;
+            BatchJob* more = (BatchJob*) realloc(jobs, sizeof(BatchJob) * len);
+            if(more == NULL) {
+                printf("Out of memory reading manifest %s\n", filename);
+                free_manifest(jobs, count);
+                fclose(file);
+                return NULL;
+            }
+            jobs = more;
+        }
+
+        BatchJob* job = jobs + count;
+        if(sscanf(start, "%4095s %f %u %4095s", image, &job->duration, &job->seed, output) != 4
+                || job->duration <= 0) {
+            printf("Error reading manifest %s, line %d: expected an image, a positive "
+                    "duration, a seed and an output file\n", filename, line_num);
+            free_manifest(jobs, count);
+            fclose(file);
+            return NULL;
+        }
+
+        job->image = strdup(image);
+        job->output = strdup(output);
+        job->failed = 0;
+        job->seconds = 0;
+        count++;
+        if(job->image == NULL || job->output == NULL) {
+            printf("Out of memory reading manifest %s\n", filename);
+            free_manifest(jobs, count);
+            fclose(file);
+            return NULL;
+        }
+    }
+
+    fclose(file);
+
+    if(count == 0) {
+        printf("No jobs in manifest %s\n", filename);
+        free(jobs);
+        return NULL;
+    }
+
+    *num_jobs = count;
+    return jobs;
+}
+
+
+/*
+ * free_manifest():
+ * Frees an array of BatchJobs and their filenames.
+ *
+ * jobs:        The array of BatchJobs
+ * num_jobs:    The number of jobs in the array
+ */
+void free_manifest(BatchJob* jobs, int num_jobs) {
+    for(int i = 0; i < num_jobs; i++) {
+        free(jobs[i].image);
+        free(jobs[i].output);
+    }
+    free(jobs);
+}
+
+
+/*
+ * render_job():
+ * Renders one job of a batch and times it. A TaskFunction for run_tasks().
+ *
+ * arg:         Pointer to the Batch
+ * task:        The index of the job to render
+ * worker:      The index of the thread rendering it
+ */
+void render_job(void* arg, int task, int worker) {
+    Batch* batch = (Batch*) arg;
+    BatchJob* job = batch->jobs + task;
+
+    uint64_t trace_start = trace_begin();
+    double start = now_seconds();
+    job->failed = render_to_file(batch, job);
+    job->seconds = now_seconds() - start;
+    trace_end("render job", trace_start);
+
+    if(job->failed)
+        printf("[%d/%d] Failed to render %s\n", task+1, batch->num_jobs, job->image);
+    else
+        printf("[%d/%d] %s -> %s: %.1f s of audio in %.2f s (%.1fx realtime)\n",
+                task+1, batch->num_jobs, job->image, job->output, job->duration,
+                job->seconds, job->seconds > 0 ? job->duration / job->seconds : 0);
+}
+
+
+/*
+ * render_to_file():
+ * Loads and analyzes a job's image, then renders its piece to its output
+ * file.
+ *
+ * batch:       Pointer to the Batch
+ * job:         Pointer to the BatchJob to render
+ *
+ * return:      0 on success, 1 on error
+ */
+int render_to_file(Batch* batch, BatchJob* job) {
+    Landscape* landscape = load_landscape(job->image, &batch->settings);
+    if(landscape == NULL)
+        return 1;
+
+    Composer* composer = new_composer(batch->instruments, batch->strategy, landscape->warmth, job->seed);
+    Renderer* renderer = composer != NULL ? new_renderer(composer, landscape->index, batch->samplerate) : NULL;
+    if(renderer == NULL) {
+        if(composer != NULL)
+            free_composer(composer);
+        free_landscape(landscape);
+        return 1;
+    }
+
+    // A float-based mono wave file, as the AudioPlayer writes
+    SF_INFO sfinfo;
+    sfinfo.samplerate = batch->samplerate;
+    sfinfo.channels = 1;
+    sfinfo.format = SF_FORMAT_WAV | SF_FORMAT_FLOAT;
+    SNDFILE* outfile = sf_open(job->output, SFM_WRITE, &sfinfo);
+    if(outfile == NULL) {
+        printf("Error opening output file %s: %s\n", job->output, sf_strerror(NULL));
+        free_renderer(renderer);
+        free_composer(composer);
+        free_landscape(landscape);
+        return 1;
+    }
+
+    int err = 0;
+    float block[BLOCK_FRAMES];
+    long long remaining = (long long) (job->duration * batch->samplerate);
+    while(remaining > 0 && !err) {
+        int frames = remaining < BLOCK_FRAMES ? remaining : BLOCK_FRAMES;
+        render_audio(renderer, block, frames);
+        if(sf_write_float(outfile, block, frames) != frames) {
+            printf("Error writing output file %s: %s\n", job->output, sf_strerror(outfile));
+            err = 1;
+        }
+        remaining -= frames;
+    }
+
+    sf_close(outfile);
+    free_renderer(renderer);
+    free_composer(composer);
+    free_landscape(landscape);
+
+    return err;
+}
+
@@ -0,0 +1,54 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "composer.h"
+#include "landscape.h"
+
+/*
+ * BatchJob:
+ * One piece to render in a batch: an image, how long to play it for, the seed
+ * of its random numbers, and the .wav file to write it to.
+ */
+typedef struct batch_job {
+    char* image;
+    float duration; // In seconds
+    unsigned int seed;
+    char* output;
+
+    // Set once the job has run
+    int failed; // Boolean, whether the job couldn't be rendered
+    double seconds; // The wall clock time the job took
+} BatchJob;
+
+
+
+/*
+ * run_batch():
+ * Renders every job in a manifest file to a .wav file, as fast as they can
+ * be computed rather than in realtime, then prints a summary of how long
+ * they took.
+ *
+ * The manifest has one job per line, as its image, duration in seconds, seed
+ * and output file, separated by whitespace:
+ *
+ *     photos/lake.png 60 1 out/lake.wav
+ *
+ * Blank lines and lines starting with # are skipped.
+ *
+ * The jobs run on a pool of threads, which take over jobs from each other
+ * when theirs run out. The lookup tables, breakpoints and keys are loaded
+ * once and shared by every job. Rendering a job with the same image, duration
+ * and seed always gives the same audio.
+ *
+ * manifest:    The manifest file to read
+ * settings:    A pointer to the LandscapeSettings to load each image with
+ * scale:       A pointer to the ScaleSettings to make the keys with
+ * strategy:    The SelectStrategy to choose regions with
+ * threads:     The number of threads to render on, 0 for one per processor
+ * samplerate:  The sample rate to render at
+ *
+ * return:      0 if every job was rendered, 1 otherwise
+ */
+int run_batch(char* manifest, LandscapeSettings* settings, ScaleSettings* scale, int strategy, int threads, int samplerate);
+
+#endif
@@ -0,0 +1,161 @@
+/*
+ * decode_bench:
+ * Measures how fast PNG files decode with LodePNG's own inflate compared to
+ * the inflate backend compiled into zlib_backend.c, with and without the
+ * trusted mode that skips checksums.
+ *
+ * Each decode is repeated until it has run for at least MIN_SECONDS, and the
+ * fastest run is reported, as MB/s of compressed file read and of RGBA pixels
+ * produced. The backend's output is checked against LodePNG's.
+ *
+ * Usage: ./bench/decode_bench image.png [image2.png ...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "image.h"
+#include "zlib_backend.h"
+
+#define MIN_SECONDS 1.0
+#define MIN_RUNS 3
+
+
+/* Internal function declarations */
+double now();
+unsigned char* decode_lodepng(char* filename, unsigned int* w, unsigned int* h, int trusted);
+unsigned char* decode_backend(char* filename, unsigned int* w, unsigned int* h, int trusted);
+double time_decode(unsigned char* (*decode)(char*, unsigned int*, unsigned int*, int),
+        char* filename, int trusted, unsigned char* expected);
+
+
+int main(int argc, char** argv) {
+    if(argc < 2) {
+        printf("Usage: %s image.png [image2.png ...]\n", argv[0]);
+        return 1;
+    }
+
+    printf("backend: %s\n", zlib_backend_name());
+    printf("%-32s %-18s %10s %10s %10s\n", "file", "decoder", "ms", "in MB/s", "out MB/s");
+
+    int failed = 0;
+    for(int i = 1; i < argc; i++) {
+        char* filename = argv[i];
+
+        FILE* file = fopen(filename, "rb");
+        if(file == NULL) {
+            printf("Error opening %s\n", filename);
+            failed = 1;
+            continue;
+        }
+        fseek(file, 0, SEEK_END);
+        double in_mb = ftell(file) / 1e6;
+        fclose(file);
+
+        // LodePNG's own output is the reference the others must match
+        unsigned int w, h;
+        unsigned char* expected = decode_lodepng(filename, &w, &h, 0);
+        if(expected == NULL) {
+            printf("Error decoding %s\n", filename);
+            failed = 1;
+            continue;
+        }
+        double out_mb = (double) w * h * 4 / 1e6;
+
+        char* names[] = {"lodepng", "lodepng trusted", "backend", "backend trusted"};
+        for(int d = 0; d < 4; d++) {
+            double secs = time_decode(d < 2 ? decode_lodepng : decode_backend, filename, d % 2, expected);
+            if(secs < 0) {
+                printf("%-32s %-18s output differs from lodepng\n", filename, names[d]);
+                failed = 1;
+                continue;
+            }
+            printf("%-32s %-18s %10.1f %10.1f %10.1f\n", filename, names[d],
+                    secs*1000, in_mb/secs, out_mb/secs);
+        }
+
+        free(expected);
+    }
+
+    return failed;
+}
+
+
+
+/*
+ * now():
+ * Returns a monotonic time in seconds.
+ */
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/*
+ * decode_lodepng():
+ * Decodes the file to RGBA with LodePNG's own inflate, in the same way as
+ * load_imagefile() without a backend.
+ */
+unsigned char* decode_lodepng(char* filename, unsigned int* w, unsigned int* h, int trusted) {
+    unsigned char* data;
+    size_t size;
+    if(lodepng_load_file(&data, &size, filename) != 0)
+        return NULL;
+
+    LodePNGState state;
+    lodepng_state_init(&state);
+    state.decoder.ignore_crc = trusted;
+    state.decoder.zlibsettings.ignore_adler32 = trusted;
+
+    unsigned char* pixels = NULL;
+    unsigned err = lodepng_decode(&pixels, w, h, &state, data, size);
+    lodepng_state_cleanup(&state);
+    free(data);
+
+    if(err) {
+        free(pixels);
+        return NULL;
+    }
+    return pixels;
+}
+
+
+/*
+ * decode_backend():
+ * Decodes the file with load_imagefile(), which uses the compiled in backend.
+ */
+unsigned char* decode_backend(char* filename, unsigned int* w, unsigned int* h, int trusted) {
+    return load_imagefile(filename, w, h, trusted);
+}
+
+
+/*
+ * time_decode():
+ * Returns the fastest time out of repeated decodes of the file, or -1 if the
+ * decoded pixels don't match the expected ones.
+ */
+double time_decode(unsigned char* (*decode)(char*, unsigned int*, unsigned int*, int),
+        char* filename, int trusted, unsigned char* expected) {
+    double best = -1;
+    double total = 0;
+    for(int run = 0; run < MIN_RUNS || total < MIN_SECONDS; run++) {
+        unsigned int w, h;
+        double start = now();
+        unsigned char* pixels = decode(filename, &w, &h, trusted);
+        double secs = now() - start;
+
+        int same = pixels != NULL && memcmp(pixels, expected, (size_t) w*h*4) == 0;
+        free(pixels);
+        if(!same)
+            return -1;
+
+        total += secs;
+        if(best < 0 || secs < best)
+            best = secs;
+    }
+    return best;
+}
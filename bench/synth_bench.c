@@ -0,0 +1,393 @@
+/*
+ * synth_bench:
+ * Measures the audio and image analysis code the program spends its time in:
+ * oscil_tick() on its own, the mix the audio callback does for 1, 8, 64 and
+ * 512 voices, get_timeval() on envelopes of increasing numbers of
+ * breakpoints, lookup table generation, and the image statistics, both the
+ * per-pixel functions of image.c and the Pyramid the regions are analyzed
+ * from.
+ *
+ * Everything runs on generated data, seeded so every run measures the same
+ * work. Each measurement is repeated until it has run for at least
+ * MIN_SECONDS, and the fastest pass is reported.
+ *
+ * The results are printed as CSV, one measurement per line as
+ *
+ *     benchmark,param,value,unit
+ *
+ * so runs can be appended to a file and compared over time, such as with
+ * "./bench/synth_bench >> bench_results.csv".
+ *
+ * Usage: ./bench/synth_bench
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "breakpoints.h"
+#include "image.h"
+#include "oscillator.h"
+#include "pyramid.h"
+#include "rng.h"
+#include "thread_pool.h"
+
+#define SAMPLE_RATE 48000
+#define MIN_SECONDS 0.5
+#define MIN_RUNS 3
+
+// The samples mixed per call, as in the audio callback
+#define BLOCK_FRAMES 256
+
+// The samples ticked or mixed per timed pass, one second of audio
+#define PASS_FRAMES SAMPLE_RATE
+
+// The times looked up per timed pass of get_timeval()
+#define LOOKUPS 4096
+
+// The width and height of the generated image
+#define IMAGE_SIZE 1024
+
+// The width and height of each region of the image, as in main.c
+#define REGION_SIZE 50
+
+#define BENCH_SEED 1
+
+
+/* Internal function declarations */
+void report(char* benchmark, int param, double value, char* unit);
+Breakpoints* make_envelope(int len);
+OscilNode* make_voices(int voices, float* tab, Breakpoints* bp);
+void restart_expired(OscilNode* voices);
+double time_tick(float* tab, Breakpoints* bp);
+double time_mix(OscilNode* voices);
+double time_timeval(Breakpoints* bp, float* times);
+double time_table(int temp);
+double time_image_stat(Image* image, int stat);
+double time_pyramid(unsigned char* rawpix);
+double time_region_stats(Pyramid* pyramid);
+
+
+int main() {
+    Rng rng;
+    seed_rng(&rng, BENCH_SEED);
+
+    float* tab = gen_warmth_tab(SAMPLE_RATE, 7);
+    Breakpoints* bp = make_envelope(8); // As many as resources/bps/bp2.txt
+    if(tab == NULL || bp == NULL) {
+        printf("Error making lookup table or envelope\n");
+        return 1;
+    }
+
+    printf("benchmark,param,value,unit\n");
+
+    /* One Oscillator */
+    report("oscil_tick", 1, time_tick(tab, bp) * 1e9 / PASS_FRAMES, "ns/sample");
+
+    /* The callback's mix, reported per sample of output, per voice, and as
+     * how many voices one core could keep up with in realtime */
+    int voice_counts[] = {1, 8, 64, 512};
+    for(int i = 0; i < 4; i++) {
+        OscilNode* voices = make_voices(voice_counts[i], tab, bp);
+        double secs = time_mix(voices);
+        oscil_list_free(voices);
+
+        double voice_ns = secs * 1e9 / PASS_FRAMES / voice_counts[i];
+        report("mix", voice_counts[i], secs * 1e9 / PASS_FRAMES, "ns/sample");
+        report("mix_per_voice", voice_counts[i], voice_ns, "ns/voice-sample");
+        report("voices_per_core", voice_counts[i], 1e9 / voice_ns / SAMPLE_RATE, "voices");
+    }
+
+    /* Envelope lookups at random times, with more and more breakpoints */
+    float times[LOOKUPS];
+    for(int i = 0; i < LOOKUPS; i++)
+        times[i] = rng_float(&rng);
+    int bp_counts[] = {2, 8, 64, 512};
+    for(int i = 0; i < 4; i++) {
+        Breakpoints* envelope = make_envelope(bp_counts[i]);
+        if(envelope == NULL)
+            return 1;
+        report("get_timeval", bp_counts[i], time_timeval(envelope, times) * 1e9 / LOOKUPS, "ns/call");
+        free_breakpoints(envelope);
+    }
+
+    /* Lookup tables, from the warmest to the coldest */
+    for(int temp = 0; temp < 8; temp += 7)
+        report("gen_warmth_tab", temp, time_table(temp) * 1e9 / SAMPLE_RATE, "ns/sample");
+
+    /* Image statistics of a generated image */
+    unsigned char* rawpix = (unsigned char*) malloc(IMAGE_SIZE * IMAGE_SIZE * 4);
+    if(rawpix == NULL) {
+        printf("Error allocating image\n");
+        return 1;
+    }
+    for(int i = 0; i < IMAGE_SIZE * IMAGE_SIZE * 4; i++)
+        rawpix[i] = rng_next(&rng) >> 24;
+    double pixels = (double) IMAGE_SIZE * IMAGE_SIZE;
+
+    Image* image = load_to_image(rawpix, IMAGE_SIZE, IMAGE_SIZE);
+    char* stats[] = {"avg_perc_brightness", "avg_warmth", "tot_avg_warmth"};
+    for(int stat = 0; stat < 3; stat++)
+        report(stats[stat], IMAGE_SIZE, pixels / time_image_stat(image, stat), "pixels/s");
+    free_image(image);
+
+    report("build_pyramid", IMAGE_SIZE, pixels / time_pyramid(rawpix), "pixels/s");
+    Pyramid* pyramid = build_pyramid(rawpix, IMAGE_SIZE, IMAGE_SIZE, 0, 1);
+    if(pyramid == NULL)
+        return 1;
+    double region_pixels = (double) (IMAGE_SIZE / REGION_SIZE * REGION_SIZE) * (IMAGE_SIZE / REGION_SIZE * REGION_SIZE);
+    report("pyramid_region_stats", REGION_SIZE, region_pixels / time_region_stats(pyramid), "pixels/s");
+    free_pyramid(pyramid);
+
+    free(rawpix);
+    free_breakpoints(bp);
+    free(tab);
+    return 0;
+}
+
+
+
+/*
+ * report():
+ * Prints one measurement as a line of CSV.
+ */
+void report(char* benchmark, int param, double value, char* unit) {
+    printf("%s,%d,%.6g,%s\n", benchmark, param, value, unit);
+}
+
+
+/*
+ * make_envelope():
+ * Returns a malloc'ed envelope of the given number of breakpoints, from 0 to
+ * 1 in time, rising to full volume and falling back to 0.
+ */
+Breakpoints* make_envelope(int len) {
+    Breakpoints* bp = (Breakpoints*) malloc(sizeof(Breakpoints));
+    Breakpoint* list = (Breakpoint*) malloc(sizeof(Breakpoint) * len);
+    if(bp == NULL || list == NULL) {
+        printf("Error allocating Breakpoints\n");
+        free(bp);
+        free(list);
+        return NULL;
+    }
+    for(int i = 0; i < len; i++) {
+        list[i].time = i / (float) (len-1);
+        list[i].val = 1 - 2 * abs(i - (len-1) / 2) / (float) (len-1);
+    }
+    bp->list = list;
+    bp->len = len;
+    bp->maxtime = 1;
+    return bp;
+}
+
+
+/*
+ * make_voices():
+ * Returns a list of Oscillators playing notes of 3 to 10 seconds across the
+ * range of the keys, each already partway through its note, so their
+ * envelopes are at different points.
+ */
+OscilNode* make_voices(int voices, float* tab, Breakpoints* bp) {
+    Rng rng;
+    seed_rng(&rng, BENCH_SEED);
+
+    OscilNode* head = NULL;
+    for(int i = 0; i < voices; i++) {
+        float freq = 65 + rng_float(&rng) * 2000;
+        float length = 3 + rng_float(&rng) * 7;
+        Oscillator* osc = new_osc(i, tab, SAMPLE_RATE, bp, SAMPLE_RATE, freq, 0.1, length, 0);
+        osc->curr_sample = rng_float(&rng) * osc->slength;
+        oscil_list_add(&head, osc);
+    }
+    return head;
+}
+
+
+/*
+ * restart_expired():
+ * Starts every Oscillator that has finished its note over, so the number of
+ * voices playing stays the same.
+ */
+void restart_expired(OscilNode* voices) {
+    for(OscilNode* curr = voices; curr != NULL; curr = curr->next) {
+        if(oscil_expired(curr->osc))
+            curr->osc->curr_sample = 0;
+    }
+}
+
+
+/*
+ * time_tick():
+ * Returns the fastest time to tick one Oscillator PASS_FRAMES times.
+ */
+double time_tick(float* tab, Breakpoints* bp) {
+    OscilNode* voice = make_voices(1, tab, bp);
+    double best = -1;
+    double total = 0;
+    volatile float sink = 0;
+    for(int run = 0; run < MIN_RUNS || total < MIN_SECONDS; run++) {
+        float sum = 0;
+        double start = now_seconds();
+        for(int i = 0; i < PASS_FRAMES; i++) {
+            sum += oscil_tick(voice->osc);
+            if(oscil_expired(voice->osc))
+                voice->osc->curr_sample = 0;
+        }
+        double secs = now_seconds() - start;
+        sink += sum;
+
+        total += secs;
+        if(best < 0 || secs < best)
+            best = secs;
+    }
+    oscil_list_free(voice);
+    return best;
+}
+
+
+/*
+ * time_mix():
+ * Returns the fastest time to mix PASS_FRAMES samples of the given voices,
+ * BLOCK_FRAMES at a time.
+ */
+double time_mix(OscilNode* voices) {
+    float out[BLOCK_FRAMES];
+    double best = -1;
+    double total = 0;
+    for(int run = 0; run < MIN_RUNS || total < MIN_SECONDS; run++) {
+        double start = now_seconds();
+        for(int i = 0; i < PASS_FRAMES; i += BLOCK_FRAMES) {
+            oscil_list_mix(voices, out, BLOCK_FRAMES);
+            restart_expired(voices);
+        }
+        double secs = now_seconds() - start;
+
+        total += secs;
+        if(best < 0 || secs < best)
+            best = secs;
+    }
+    return best;
+}
+
+
+/*
+ * time_timeval():
+ * Returns the fastest time to look up the envelope at each of LOOKUPS times.
+ */
+double time_timeval(Breakpoints* bp, float* times) {
+    double best = -1;
+    double total = 0;
+    volatile float sink = 0;
+    for(int run = 0; run < MIN_RUNS || total < MIN_SECONDS; run++) {
+        float sum = 0;
+        double start = now_seconds();
+        for(int i = 0; i < LOOKUPS; i++)
+            sum += get_timeval(bp, times[i]);
+        double secs = now_seconds() - start;
+        sink += sum;
+
+        total += secs;
+        if(best < 0 || secs < best)
+            best = secs;
+    }
+    return best;
+}
+
+
+/*
+ * time_table():
+ * Returns the fastest time to generate a warmth table for the sample rate.
+ */
+double time_table(int temp) {
+    double best = -1;
+    double total = 0;
+    for(int run = 0; run < MIN_RUNS || total < MIN_SECONDS; run++) {
+        double start = now_seconds();
+        float* tab = gen_warmth_tab(SAMPLE_RATE, temp);
+        double secs = now_seconds() - start;
+        free(tab);
+
+        total += secs;
+        if(best < 0 || secs < best)
+            best = secs;
+    }
+    return best;
+}
+
+
+/*
+ * time_image_stat():
+ * Returns the fastest time to compute a statistic of the whole image: 0 for
+ * avg_perc_brightness(), 1 for avg_warmth() and 2 for tot_avg_warmth().
+ */
+double time_image_stat(Image* image, int stat) {
+    double best = -1;
+    double total = 0;
+    volatile float sink = 0;
+    for(int run = 0; run < MIN_RUNS || total < MIN_SECONDS; run++) {
+        double start = now_seconds();
+        if(stat == 0)
+            sink += avg_perc_brightness(image, 0, 0, image->width, image->height);
+        else if(stat == 1)
+            sink += avg_warmth(image, 0, 0, image->width, image->height);
+        else
+            sink += tot_avg_warmth(image);
+        double secs = now_seconds() - start;
+
+        total += secs;
+        if(best < 0 || secs < best)
+            best = secs;
+    }
+    return best;
+}
+
+
+/*
+ * time_pyramid():
+ * Returns the fastest time to build a full resolution Pyramid of the image on
+ * one thread.
+ */
+double time_pyramid(unsigned char* rawpix) {
+    double best = -1;
+    double total = 0;
+    for(int run = 0; run < MIN_RUNS || total < MIN_SECONDS; run++) {
+        double start = now_seconds();
+        Pyramid* pyramid = build_pyramid(rawpix, IMAGE_SIZE, IMAGE_SIZE, 0, 1);
+        double secs = now_seconds() - start;
+        if(pyramid != NULL)
+            free_pyramid(pyramid);
+
+        total += secs;
+        if(best < 0 || secs < best)
+            best = secs;
+    }
+    return best;
+}
+
+
+/*
+ * time_region_stats():
+ * Returns the fastest time to compute the statistics of every region of the
+ * image from its Pyramid, at full resolution.
+ */
+double time_region_stats(Pyramid* pyramid) {
+    double best = -1;
+    double total = 0;
+    volatile float sink = 0;
+    for(int run = 0; run < MIN_RUNS || total < MIN_SECONDS; run++) {
+        float brightness, warmth, variance;
+        double start = now_seconds();
+        for(int y = 0; y + REGION_SIZE <= IMAGE_SIZE; y += REGION_SIZE) {
+            for(int x = 0; x + REGION_SIZE <= IMAGE_SIZE; x += REGION_SIZE) {
+                pyramid_region_stats(pyramid, x, y, REGION_SIZE, REGION_SIZE, REGION_SIZE,
+                        &brightness, &warmth, &variance);
+                sink += brightness + warmth + variance;
+            }
+        }
+        double secs = now_seconds() - start;
+
+        total += secs;
+        if(best < 0 || secs < best)
+            best = secs;
+    }
+    return best;
+}
@@ -0,0 +1,241 @@
+/*
+ * unfilter_bench:
+ * Measures how fast LodePNG unfilters PNG scanlines of each filter type, for
+ * 3 and 4 byte pixels, and checks the results against a plain implementation
+ * of the PNG specification. If given PNG files, also times decoding them.
+ *
+ * Built twice by "make bench": once as is, using the SIMD unfilter code in
+ * lodepng.c when the compiler targets SSE2, SSSE3 or NEON, and once with
+ * LODEPNG_NO_SIMD, which is LodePNG's stock portable code.
+ *
+ * Usage: ./bench/unfilter_bench [image.png ...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lodepng.h"
+
+#define LINE_PIXELS 4096 // Pixels per scanline tested
+#define LINES 256 // Scanlines unfiltered per timed pass
+#define MIN_SECONDS 0.5
+
+
+/* Internal function declarations */
+double now();
+const char* simd_name();
+unsigned char reference_paeth(int a, int b, int c);
+void reference_unfilter(unsigned char* recon, unsigned char* scanline, unsigned char* precon,
+        int bytewidth, int type, int length);
+int check_filter(int bytewidth, int type);
+double time_filter(int bytewidth, int type);
+double time_decode(char* filename);
+
+
+int main(int argc, char** argv) {
+    printf("unfilter: %s\n", simd_name());
+
+    int failed = 0;
+    char* names[] = {"None", "Sub", "Up", "Average", "Paeth"};
+    printf("%-10s %5s %10s\n", "filter", "bpp", "MB/s");
+    for(int bytewidth = 3; bytewidth <= 4; bytewidth++) {
+        for(int type = 0; type < 5; type++) {
+            if(!check_filter(bytewidth, type)) {
+                printf("%-10s %5d results differ from the PNG specification\n", names[type], bytewidth);
+                failed = 1;
+                continue;
+            }
+            printf("%-10s %5d %10.1f\n", names[type], bytewidth, time_filter(bytewidth, type));
+        }
+    }
+
+    for(int i = 1; i < argc; i++) {
+        double secs = time_decode(argv[i]);
+        if(secs < 0) {
+            printf("Error decoding %s\n", argv[i]);
+            failed = 1;
+        }
+        else
+            printf("decode %s: %.1f ms\n", argv[i], secs*1000);
+    }
+
+    return failed;
+}
+
+
+
+/*
+ * now():
+ * Returns a monotonic time in seconds.
+ */
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/*
+ * simd_name():
+ * Returns which unfilter code lodepng.c was compiled with, by the same rules
+ * lodepng.c uses.
+ */
+const char* simd_name() {
+    #if defined(LODEPNG_NO_SIMD)
+    return "portable";
+    #elif defined(__SSSE3__)
+    return "ssse3";
+    #elif defined(__SSE2__)
+    return "sse2";
+    #elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    return "neon";
+    #else
+    return "portable";
+    #endif
+}
+
+
+/*
+ * reference_paeth():
+ * The Paeth predictor exactly as the PNG specification gives it.
+ */
+unsigned char reference_paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a);
+    int pb = abs(p - b);
+    int pc = abs(p - c);
+    if(pa <= pb && pa <= pc)
+        return a;
+    else if(pb <= pc)
+        return b;
+    return c;
+}
+
+
+/*
+ * reference_unfilter():
+ * Unfilters a scanline as the PNG specification describes, a byte at a time.
+ * precon may be NULL for the first scanline.
+ */
+void reference_unfilter(unsigned char* recon, unsigned char* scanline, unsigned char* precon,
+        int bytewidth, int type, int length) {
+    for(int i = 0; i < length; i++) {
+        int a = i >= bytewidth ? recon[i-bytewidth] : 0;
+        int b = precon ? precon[i] : 0;
+        int c = (precon && i >= bytewidth) ? precon[i-bytewidth] : 0;
+
+        int pred = 0;
+        if(type == 1)
+            pred = a;
+        else if(type == 2)
+            pred = b;
+        else if(type == 3)
+            pred = (a + b) / 2;
+        else if(type == 4)
+            pred = reference_paeth(a, b, c);
+        recon[i] = scanline[i] + pred;
+    }
+}
+
+
+/*
+ * check_filter():
+ * Unfilters random scanlines of many lengths with LodePNG and the reference,
+ * with and without a previous scanline, and in place. Returns 1 if they all
+ * match.
+ */
+int check_filter(int bytewidth, int type) {
+    int maxlen = 67 * bytewidth;
+    unsigned char* scanline = (unsigned char*) malloc(maxlen);
+    unsigned char* precon = (unsigned char*) malloc(maxlen);
+    unsigned char* recon = (unsigned char*) malloc(maxlen);
+    unsigned char* expected = (unsigned char*) malloc(maxlen);
+
+    int ok = 1;
+    for(int trial = 0; trial < 200 && ok; trial++) {
+        int length = (1 + rand() % 67) * bytewidth;
+        for(int i = 0; i < length; i++) {
+            scanline[i] = rand();
+            precon[i] = rand();
+        }
+
+        for(int first = 0; first <= 1 && ok; first++) {
+            unsigned char* prev = first ? NULL : precon;
+            reference_unfilter(expected, scanline, prev, bytewidth, type, length);
+
+            lodepng_unfilter_scanline(recon, scanline, prev, bytewidth, type, length);
+            ok = memcmp(recon, expected, length) == 0;
+
+            // In place, as LodePNG itself does it
+            memcpy(recon, scanline, length);
+            lodepng_unfilter_scanline(recon, recon, prev, bytewidth, type, length);
+            ok = ok && memcmp(recon, expected, length) == 0;
+        }
+    }
+
+    free(scanline);
+    free(precon);
+    free(recon);
+    free(expected);
+    return ok;
+}
+
+
+/*
+ * time_filter():
+ * Returns how many MB of scanlines of the given filter type LodePNG unfilters
+ * per second, each one using the one before as its previous scanline.
+ */
+double time_filter(int bytewidth, int type) {
+    size_t length = (size_t) LINE_PIXELS * bytewidth;
+    unsigned char* data = (unsigned char*) malloc(length * LINES);
+    unsigned char* out = (unsigned char*) malloc(length * LINES);
+    for(size_t i = 0; i < length * LINES; i++)
+        data[i] = rand();
+
+    double best = -1;
+    double total = 0;
+    while(total < MIN_SECONDS) {
+        double start = now();
+        for(int y = 0; y < LINES; y++) {
+            lodepng_unfilter_scanline(out + y*length, data + y*length,
+                    y == 0 ? NULL : out + (y-1)*length, bytewidth, type, length);
+        }
+        double secs = now() - start;
+        total += secs;
+        if(best < 0 || secs < best)
+            best = secs;
+    }
+
+    free(data);
+    free(out);
+    return length * LINES / 1e6 / best;
+}
+
+
+/*
+ * time_decode():
+ * Returns the fastest time out of repeated decodes of the file to RGBA, or -1
+ * on error.
+ */
+double time_decode(char* filename) {
+    double best = -1;
+    double total = 0;
+    for(int run = 0; run < 3 || total < MIN_SECONDS; run++) {
+        unsigned char* pixels;
+        unsigned w, h;
+        double start = now();
+        unsigned err = lodepng_decode32_file(&pixels, &w, &h, filename);
+        double secs = now() - start;
+        free(pixels);
+        if(err)
+            return -1;
+
+        total += secs;
+        if(best < 0 || secs < best)
+            best = secs;
+    }
+    return best;
+}
@@ -33,7 +33,7 @@ float get_timeval(Breakpoints* bp, float time) {
             break; 
 
     // If we're at the last one, then just use that
-    if(i == bp->len)
+    if(i == bp->len-1)
         return bp->list[i].val;
    
 
@@ -82,6 +82,10 @@ float get_percentval(Breakpoints* bp, float percentage) {
  */
 Breakpoints* load_bp_file(char* filename) {
     FILE* file = fopen(filename, "r"); 
+    if(file == NULL) {
+        printf("Error opening breakpoint file %s\n", filename);
+        return NULL;
+    }
 
     Breakpoints* bp = (Breakpoints*) malloc(sizeof(Breakpoints));
 
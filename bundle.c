@@ -0,0 +1,291 @@
+#include "bundle.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define BUNDLE_MAGIC "ALBNDL\0\0"
+#define BYTE_ORDER_MARK 0x01020304
+
+// The longest path find_bundle() returns
+#define MAX_PATH 4096
+
+
+/* Internal function declarations */
+size_t item_size(BundleItem* item);
+
+
+
+/*
+ * find_bundle():
+ * Returns the path of the bundle file next to the running executable, so it's
+ * found whatever the working directory is. Where the executable can't be
+ * found, that's BUNDLE_FILENAME in the working directory.
+ *
+ * The user must free() the returned string.
+ *
+ * return:      The malloc'ed path, or NULL on error
+ */
+char* find_bundle() {
+    char* path = (char*) malloc(MAX_PATH);
+    if(path == NULL)
+        return NULL;
+
+    ssize_t len = -1;
+    #ifdef __linux__
+    len = readlink("/proc/self/exe", path, MAX_PATH - sizeof(BUNDLE_FILENAME) - 1);
+    #endif
+
+    // Replace the executable's name with the bundle's
+    char* slash = NULL;
+    if(len > 0) {
+        path[len] = '\0';
+        slash = strrchr(path, '/');
+    }
+    if(slash != NULL)
+        strcpy(slash + 1, BUNDLE_FILENAME);
+    else
+        strcpy(path, BUNDLE_FILENAME);
+
+    return path;
+}
+
+
+
+/*
+ * open_bundle():
+ * Maps the given bundle file into memory, if it's a complete bundle written
+ * with the current BUNDLE_VERSION on a machine of the same byte order.
+ *
+ * The user must call close_bundle() on the returned struct, and stop using
+ * its resources then.
+ *
+ * filename:    The bundle file to map
+ *
+ * return:      A malloc'ed ResourceBundle, or NULL if there's no valid bundle
+ */
+ResourceBundle* open_bundle(char* filename) {
+    #ifdef _WIN32
+    return NULL;
+    #else
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0)
+        return NULL;
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size < sizeof(BundleHeader)) {
+        close(fd);
+        return NULL;
+    }
+    size_t size = st.st_size;
+
+    unsigned char* data = (unsigned char*) mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED)
+        return NULL;
+
+    /* Make sure the file is complete and for this program version */
+    BundleHeader* header = (BundleHeader*) data;
+    BundleEntry* entries = (BundleEntry*) (data + sizeof(BundleHeader));
+    if(memcmp(header->magic, BUNDLE_MAGIC, 8) != 0 || header->version != BUNDLE_VERSION ||
+            header->byte_order != BYTE_ORDER_MARK || header->size != size ||
+            (size - sizeof(BundleHeader)) / sizeof(BundleEntry) < header->num_entries) {
+        printf("Ignoring invalid or outdated resource bundle %s\n", filename);
+        munmap(data, size);
+        return NULL;
+    }
+
+    // Make sure every entry's data is within the file
+    for(uint32_t i = 0; i < header->num_entries; i++) {
+        size_t floats = entries[i].type == BUNDLE_BREAKPOINTS ? 2 : 1;
+        if(entries[i].offset > size || (size - entries[i].offset) / sizeof(float) / floats < entries[i].count
+                || entries[i].name[BUNDLE_NAME_LEN-1] != '\0') {
+            printf("Ignoring invalid resource bundle %s\n", filename);
+            munmap(data, size);
+            return NULL;
+        }
+    }
+
+    ResourceBundle* bundle = (ResourceBundle*) malloc(sizeof(ResourceBundle));
+    if(bundle == NULL) {
+        printf("Error allocating ResourceBundle\n");
+        munmap(data, size);
+        return NULL;
+    }
+    bundle->data = data;
+    bundle->size = size;
+    bundle->entries = entries;
+    bundle->num_entries = header->num_entries;
+
+    return bundle;
+    #endif
+}
+
+
+
+/*
+ * bundle_floats():
+ * Finds a resource in a bundle and returns its data.
+ *
+ * bundle:      A pointer to the ResourceBundle
+ * type:        The BundleType of the resource
+ * name:        The name of the resource
+ * count:       Pointer to an int in which the resource's count will be stored
+ *
+ * return:      A pointer to the resource's floats in the mapping, or NULL if
+ *              the bundle doesn't have it
+ */
+float* bundle_floats(ResourceBundle* bundle, int type, char* name, int* count) {
+    for(int i = 0; i < bundle->num_entries; i++) {
+        BundleEntry* entry = bundle->entries + i;
+        if(entry->type == type && strcmp(entry->name, name) == 0) {
+            *count = entry->count;
+            return (float*) (bundle->data + entry->offset);
+        }
+    }
+    return NULL;
+}
+
+
+
+/*
+ * bundle_breakpoints():
+ * Finds a breakpoint envelope in a bundle and returns a malloc'ed
+ * Breakpoints struct whose list points into the mapping.
+ *
+ * The user must free() the returned struct, rather than calling
+ * free_breakpoints() on it.
+ *
+ * bundle:      A pointer to the ResourceBundle
+ * name:        The name of the envelope
+ *
+ * return:      A malloc'ed Breakpoints, or NULL if the bundle doesn't have it
+ */
+Breakpoints* bundle_breakpoints(ResourceBundle* bundle, char* name) {
+    int count;
+    float* data = bundle_floats(bundle, BUNDLE_BREAKPOINTS, name, &count);
+    if(data == NULL || count == 0)
+        return NULL;
+
+    Breakpoints* bp = (Breakpoints*) malloc(sizeof(Breakpoints));
+    if(bp == NULL) {
+        printf("Error allocating Breakpoints\n");
+        return NULL;
+    }
+    bp->list = (Breakpoint*) data;
+    bp->len = count;
+    bp->maxtime = bp->list[count-1].time;
+
+    return bp;
+}
+
+
+
+/*
+ * close_bundle():
+ * Unmaps the given bundle, and frees the passed pointer.
+ *
+ * bundle:      A pointer to the ResourceBundle to close
+ */
+void close_bundle(ResourceBundle* bundle) {
+    #ifndef _WIN32
+    munmap(bundle->data, bundle->size);
+    #endif
+    free(bundle);
+}
+
+
+
+/*
+ * write_bundle():
+ * Writes the given resources to a bundle file, replacing any existing one.
+ *
+ * filename:    The bundle file to write
+ * items:       The resources to write
+ * num_items:   The number of resources
+ *
+ * return:      0 on success, 1 on error
+ */
+int write_bundle(char* filename, BundleItem* items, int num_items) {
+    /* Write to a temporary file and rename it over the bundle when done, so a
+     * run never maps a half-written file */
+    size_t name_len = strlen(filename);
+    char* tempname = (char*) malloc(name_len + 5);
+    BundleEntry* entries = (BundleEntry*) calloc(num_items, sizeof(BundleEntry));
+    FILE* file = NULL;
+    if(tempname != NULL && entries != NULL) {
+        sprintf(tempname, "%s.tmp", filename);
+        file = fopen(tempname, "wb");
+    }
+    if(file == NULL) {
+        printf("Error writing resource bundle %s\n", filename);
+        free(tempname);
+        free(entries);
+        return 1;
+    }
+
+    /* Lay out the entries' data after the entry table, each starting on a
+     * multiple of 8 bytes */
+    uint64_t offset = sizeof(BundleHeader) + num_items * sizeof(BundleEntry);
+    for(int i = 0; i < num_items; i++) {
+        strncpy(entries[i].name, items[i].name, BUNDLE_NAME_LEN-1);
+        entries[i].type = items[i].type;
+        entries[i].count = items[i].count;
+        entries[i].offset = offset;
+        offset = (offset + item_size(items + i) + 7) & ~(uint64_t) 7;
+    }
+
+    BundleHeader header;
+    memset(&header, 0, sizeof(BundleHeader));
+    memcpy(header.magic, BUNDLE_MAGIC, 8);
+    header.version = BUNDLE_VERSION;
+    header.byte_order = BYTE_ORDER_MARK;
+    header.num_entries = num_items;
+    header.size = offset;
+
+    int err = fwrite(&header, sizeof(BundleHeader), 1, file) != 1;
+    err |= fwrite(entries, sizeof(BundleEntry), num_items, file) != num_items;
+    for(int i = 0; i < num_items && !err; i++) {
+        size_t size = item_size(items + i);
+        char padding[8] = {0};
+        err |= fwrite(items[i].data, 1, size, file) != size;
+        err |= fwrite(padding, 1, (8 - size % 8) % 8, file) != (8 - size % 8) % 8;
+    }
+    err |= fclose(file) != 0;
+
+    #ifdef _WIN32
+    remove(filename);
+    #endif
+    if(err || rename(tempname, filename) != 0) {
+        printf("Error writing resource bundle %s\n", filename);
+        remove(tempname);
+        err = 1;
+    }
+
+    free(tempname);
+    free(entries);
+    return err;
+}
+
+
+
+
+/*
+ * item_size():
+ * Returns the size in bytes of a BundleItem's data.
+ *
+ * item:        A pointer to the BundleItem
+ *
+ * return:      The size of its data
+ */
+size_t item_size(BundleItem* item) {
+    size_t floats = item->type == BUNDLE_BREAKPOINTS ? 2 : 1;
+    return item->count * floats * sizeof(float);
+}
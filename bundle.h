@@ -0,0 +1,161 @@
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "breakpoints.h"
+
+// Bump whenever the layout of a bundle file changes
+#define BUNDLE_VERSION 1
+
+// The bundle's filename, looked for next to the executable
+#define BUNDLE_FILENAME "resources.albundle"
+
+// The longest name of an entry, including the terminating '\0'
+#define BUNDLE_NAME_LEN 24
+
+
+/* What an entry of a bundle holds */
+typedef enum bundle_type {
+    BUNDLE_BREAKPOINTS, // count Breakpoints, time and value floats in turn
+    BUNDLE_KEY, // count frequencies, as floats
+    BUNDLE_TABLE // A lookup table of count floats
+} BundleType;
+
+
+/*
+ * BundleHeader:
+ * The start of a bundle file, followed by its BundleEntries and then their
+ * data. All in the byte order of the machine that wrote it.
+ */
+typedef struct bundle_header {
+    char magic[8];
+    uint32_t version; // BUNDLE_VERSION
+    uint32_t byte_order; // Checks the file was written on a compatible machine
+    uint32_t num_entries;
+    uint32_t reserved;
+    uint64_t size; // The size of the whole file, to detect truncation
+} BundleHeader;
+
+
+/*
+ * BundleEntry:
+ * Where one named resource is in a bundle file.
+ */
+typedef struct bundle_entry {
+    char name[BUNDLE_NAME_LEN];
+    uint32_t type; // A BundleType
+    uint32_t count; // The number of items, as described by the type
+    uint64_t offset; // From the start of the file, a multiple of 8
+} BundleEntry;
+
+
+/*
+ * ResourceBundle:
+ * A bundle file mapped read-only into memory. Its resources are used straight
+ * from the mapping, so nothing is parsed or copied when it's opened.
+ */
+typedef struct resource_bundle {
+    unsigned char* data;
+    size_t size;
+
+    BundleEntry* entries;
+    int num_entries;
+} ResourceBundle;
+
+
+/*
+ * BundleItem:
+ * One resource to write into a bundle with write_bundle().
+ */
+typedef struct bundle_item {
+    char* name;
+    int type; // A BundleType
+    int count;
+    float* data; // The items' floats, 2 per item for BUNDLE_BREAKPOINTS
+} BundleItem;
+
+
+
+/*
+ * find_bundle():
+ * Returns the path of the bundle file next to the running executable, so it's
+ * found whatever the working directory is. Where the executable can't be
+ * found, that's BUNDLE_FILENAME in the working directory.
+ *
+ * The user must free() the returned string.
+ *
+ * return:      The malloc'ed path, or NULL on error
+ */
+char* find_bundle();
+
+
+/*
+ * open_bundle():
+ * Maps the given bundle file into memory, if it's a complete bundle written
+ * with the current BUNDLE_VERSION on a machine of the same byte order.
+ *
+ * The user must call close_bundle() on the returned struct, and stop using
+ * its resources then.
+ *
+ * filename:    The bundle file to map
+ *
+ * return:      A malloc'ed ResourceBundle, or NULL if there's no valid bundle
+ */
+ResourceBundle* open_bundle(char* filename);
+
+
+/*
+ * bundle_floats():
+ * Finds a resource in a bundle and returns its data.
+ *
+ * bundle:      A pointer to the ResourceBundle
+ * type:        The BundleType of the resource
+ * name:        The name of the resource
+ * count:       Pointer to an int in which the resource's count will be stored
+ *
+ * return:      A pointer to the resource's floats in the mapping, or NULL if
+ *              the bundle doesn't have it
+ */
+float* bundle_floats(ResourceBundle* bundle, int type, char* name, int* count);
+
+
+/*
+ * bundle_breakpoints():
+ * Finds a breakpoint envelope in a bundle and returns a malloc'ed
+ * Breakpoints struct whose list points into the mapping.
+ *
+ * The user must free() the returned struct, rather than calling
+ * free_breakpoints() on it.
+ *
+ * bundle:      A pointer to the ResourceBundle
+ * name:        The name of the envelope
+ *
+ * return:      A malloc'ed Breakpoints, or NULL if the bundle doesn't have it
+ */
+Breakpoints* bundle_breakpoints(ResourceBundle* bundle, char* name);
+
+
+/*
+ * close_bundle():
+ * Unmaps the given bundle, and frees the passed pointer.
+ *
+ * bundle:      A pointer to the ResourceBundle to close
+ */
+void close_bundle(ResourceBundle* bundle);
+
+
+/*
+ * write_bundle():
+ * Writes the given resources to a bundle file, replacing any existing one.
+ *
+ * filename:    The bundle file to write
+ * items:       The resources to write
+ * num_items:   The number of resources
+ *
+ * return:      0 on success, 1 on error
+ */
+int write_bundle(char* filename, BundleItem* items, int num_items);
+
+#endif
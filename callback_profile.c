@@ -0,0 +1,328 @@
+#include "callback_profile.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+// The widest bar drawn in the histogram
+#define BAR_WIDTH 40
+
+static const char* COUNTER_NAMES[NUM_COUNTERS] = {
+    "cycles", "instructions", "L1D misses", "LLC misses", "branch misses"
+};
+
+
+/* Internal function declarations */
+uint64_t profile_now();
+void open_counters(CallbackProfile* profile);
+int read_counters(CallbackProfile* profile, uint64_t* counts);
+
+
+
+/*
+ * new_callback_profile():
+ * Creates a malloc'ed CallbackProfile with nothing recorded yet. The counters
+ * are opened by the first callback, as they count the thread that opens them.
+ *
+ * The user must call free_callback_profile() on the returned struct.
+ *
+ * samplerate:  The sample rate of the stream, to tell how long each
+ *              callback's audio lasts
+ *
+ * return:      A malloc'ed CallbackProfile, or NULL on error
+ */
+CallbackProfile* new_callback_profile(int samplerate) {
+    CallbackProfile* profile = (CallbackProfile*) calloc(1, sizeof(CallbackProfile));
+    if(profile == NULL) {
+        printf("Error allocating CallbackProfile\n");
+        return NULL;
+    }
+
+    profile->samplerate = samplerate;
+    profile->leader = -1;
+    for(int i = 0; i < NUM_COUNTERS; i++)
+        profile->fds[i] = -1;
+
+    return profile;
+}
+
+
+
+/*
+ * profile_callback_start():
+ * Records the time and counters at the start of a callback. Must be called
+ * by the audio thread only.
+ *
+ * profile:     A pointer to the CallbackProfile
+ */
+void profile_callback_start(CallbackProfile* profile) {
+    if(!profile->opened)
+        open_counters(profile);
+
+    profile->started = read_counters(profile, profile->start_counts) == 0;
+    profile->start_ns = profile_now();
+}
+
+
+
+/*
+ * profile_callback_end():
+ * Records the time and counters at the end of a callback, against the number
+ * of voices it mixed. Must be called by the audio thread only.
+ *
+ * profile:     A pointer to the CallbackProfile
+ * voices:      The number of voices sounding, not counting notes waiting
+ *              to start or already expired
+ * frames:      The number of samples in the callback's block
+ */
+void profile_callback_end(CallbackProfile* profile, int voices, int frames) {
+    uint64_t ns = profile_now() - profile->start_ns;
+    uint64_t counts[NUM_COUNTERS];
+    int counted = profile->started && read_counters(profile, counts) == 0;
+
+    VoiceProfile* voice = profile->voices +
+        (voices < PROFILE_MAX_VOICES ? voices : PROFILE_MAX_VOICES);
+    voice->callbacks++;
+    voice->frames += frames;
+    voice->ns += ns;
+    if(counted) {
+        for(int i = 0; i < NUM_COUNTERS; i++) {
+            if(profile->fds[i] >= 0)
+                voice->counts[i] += counts[i] - profile->start_counts[i];
+        }
+    }
+
+    // Under 1us in the first bucket, then one per power of 2
+    int bucket = 0;
+    for(uint64_t us = ns / 1000; us > 0 && bucket < PROFILE_TIME_BUCKETS - 1; us >>= 1)
+        bucket++;
+    profile->histogram[bucket]++;
+
+    if(ns * profile->samplerate > (uint64_t) frames * 1000000000)
+        profile->late++;
+}
+
+
+
+/*
+ * print_callback_profile():
+ * Prints the time histogram, and a table of the time and counters per sample
+ * for each number of voices. Must only be called once the stream has stopped.
+ *
+ * profile:     A pointer to the CallbackProfile
+ */
+void print_callback_profile(CallbackProfile* profile) {
+    unsigned long long callbacks = 0;
+    unsigned long long most = 0;
+    for(int i = 0; i < PROFILE_TIME_BUCKETS; i++) {
+        callbacks += profile->histogram[i];
+        if(profile->histogram[i] > most)
+            most = profile->histogram[i];
+    }
+
+    printf("\nAudio callback profile: %llu callbacks, %llu late\n", callbacks, profile->late);
+    if(callbacks == 0)
+        return;
+
+    /* The time histogram, from the first bucket used to the last */
+    int first = 0;
+    int last = PROFILE_TIME_BUCKETS - 1;
+    while(profile->histogram[first] == 0)
+        first++;
+    while(profile->histogram[last] == 0)
+        last--;
+
+    printf("\n%-16s %10s\n", "time", "callbacks");
+    for(int i = first; i <= last; i++) {
+        char range[32];
+        if(i == 0)
+            snprintf(range, sizeof(range), "< 1us");
+        else if(i == PROFILE_TIME_BUCKETS - 1)
+            snprintf(range, sizeof(range), ">= %lluus", 1ULL << (i - 1));
+        else
+            snprintf(range, sizeof(range), "%llu-%lluus", 1ULL << (i - 1), 1ULL << i);
+
+        int width = (int) (profile->histogram[i] * BAR_WIDTH / most);
+        printf("%-16s %10llu ", range, profile->histogram[i]);
+        for(int j = 0; j < width; j++)
+            putchar('#');
+        putchar('\n');
+    }
+
+    if(profile->num_open == 0)
+        printf("\nHardware counters unavailable (%s), so only times are shown\n",
+                strerror(profile->error));
+    else {
+        printf("\nCounters unavailable:");
+        for(int i = 0; i < NUM_COUNTERS; i++) {
+            if(profile->fds[i] < 0)
+                printf(" %s", COUNTER_NAMES[i]);
+        }
+        printf(profile->num_open == NUM_COUNTERS ? " none\n" : "\n");
+    }
+
+    /* Per number of voices: the time of each callback and the share of its
+     * audio's length it took, then the time and counters per sample */
+    printf("\n%6s %10s %10s %7s %9s %9s %6s %9s %9s %9s\n", "voices", "callbacks",
+            "us/call", "load %", "ns/samp", "cyc/samp", "IPC", "L1D/samp", "LLC/samp",
+            "br/samp");
+    for(int v = 0; v <= PROFILE_MAX_VOICES; v++) {
+        VoiceProfile* voice = profile->voices + v;
+        if(voice->callbacks == 0)
+            continue;
+
+        double frames = voice->frames > 0 ? voice->frames : 1;
+        double load = voice->ns * (double) profile->samplerate / (frames * 1e7);
+        printf("%5d%s %10llu %10.1f %7.1f %9.1f", v, v == PROFILE_MAX_VOICES ? "+" : " ",
+                voice->callbacks, voice->ns / (voice->callbacks * 1e3), load,
+                voice->ns / frames);
+
+        for(int i = 0; i < NUM_COUNTERS; i++) {
+            int width = i == COUNTER_INSTRUCTIONS ? 6 : 9;
+            if(profile->fds[i] < 0 || (i == COUNTER_INSTRUCTIONS && profile->fds[COUNTER_CYCLES] < 0))
+                printf(" %*s", width, "-");
+            else if(i == COUNTER_INSTRUCTIONS) {
+                double cycles = voice->counts[COUNTER_CYCLES];
+                printf(" %*.2f", width, cycles > 0 ? voice->counts[i] / cycles : 0);
+            }
+            else
+                printf(" %*.2f", width, voice->counts[i] / frames);
+        }
+        putchar('\n');
+    }
+}
+
+
+
+/*
+ * free_callback_profile():
+ * Closes the counters and frees the CallbackProfile.
+ *
+ * profile:     A pointer to the CallbackProfile
+ */
+void free_callback_profile(CallbackProfile* profile) {
+    #ifdef __linux__
+    for(int i = 0; i < NUM_COUNTERS; i++) {
+        if(profile->fds[i] >= 0)
+            close(profile->fds[i]);
+    }
+    #endif
+    free(profile);
+}
+
+
+
+
+/*
+ * profile_now():
+ * Returns a monotonic time in nanoseconds.
+ */
+uint64_t profile_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/*
+ * open_counters():
+ * Opens as many of the counters as the CPU and kernel allow, in one group
+ * counting the calling thread in user space, and starts them. Records why if
+ * none could be opened.
+ */
+void open_counters(CallbackProfile* profile) {
+    profile->opened = 1;
+
+    #ifdef __linux__
+    static const struct { uint32_t type; uint64_t config; } COUNTERS[NUM_COUNTERS] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+            (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES}
+    };
+
+    int err = 0;
+    for(int i = 0; i < NUM_COUNTERS; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = COUNTERS[i].type;
+        attr.config = COUNTERS[i].config;
+        attr.read_format = PERF_FORMAT_GROUP;
+        attr.disabled = profile->leader < 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        // This thread, on any CPU
+        int fd = syscall(SYS_perf_event_open, &attr, 0, -1, profile->leader, 0);
+        if(fd < 0) {
+            err = errno;
+            continue;
+        }
+
+        profile->fds[i] = fd;
+        if(profile->leader < 0)
+            profile->leader = fd;
+        profile->num_open++;
+    }
+
+    if(profile->leader >= 0 &&
+            ioctl(profile->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP) == 0)
+        return;
+
+    // Not printed here, as this runs in the audio callback
+    profile->error = profile->leader < 0 ? err : errno;
+    for(int i = 0; i < NUM_COUNTERS; i++) {
+        if(profile->fds[i] >= 0)
+            close(profile->fds[i]);
+        profile->fds[i] = -1;
+    }
+    profile->leader = -1;
+    profile->num_open = 0;
+    #else
+    profile->error = ENOSYS;
+    #endif
+}
+
+
+/*
+ * read_counters():
+ * Reads every open counter at once. The counters that aren't open are left
+ * as they are.
+ *
+ * counts:      Where to store the counters' values, one per counter
+ *
+ * return:      0 on success, 1 if no counters are open or they can't be read
+ */
+int read_counters(CallbackProfile* profile, uint64_t* counts) {
+    if(profile->leader < 0)
+        return 1;
+
+    #ifdef __linux__
+    // The number of values, then each value in the order they were opened
+    uint64_t values[NUM_COUNTERS + 1];
+    ssize_t size = (profile->num_open + 1) * sizeof(uint64_t);
+    if(read(profile->leader, values, size) != size || values[0] != (uint64_t) profile->num_open)
+        return 1;
+
+    int next = 1;
+    for(int i = 0; i < NUM_COUNTERS; i++) {
+        if(profile->fds[i] >= 0)
+            counts[i] = values[next++];
+    }
+    return 0;
+    #else
+    return 1;
+    #endif
+}
@@ -0,0 +1,131 @@
+#ifndef CALLBACK_PROFILE_H
+#define CALLBACK_PROFILE_H
+
+#include <stdint.h>
+
+/*
+ * Profiling of the audio callback: how long each callback takes, as a
+ * histogram, and on Linux what the CPU's hardware counters say about it,
+ * read with perf_event_open at the start and end of each callback. Both are
+ * grouped by how many voices were being mixed, so the cost of the mix loop
+ * can be seen as the voices add up.
+ *
+ * The counters only count the audio thread, and only in user space. Reading
+ * them is a system call at each end of the callback, so they add a few
+ * microseconds to every callback while profiling. If they can't be opened,
+ * e.g. if /proc/sys/kernel/perf_event_paranoid is above 2 or in a virtual
+ * machine without them, only the times are recorded.
+ */
+
+// The most voices counted on their own. More are counted together.
+#define PROFILE_MAX_VOICES 256
+
+// The buckets of the time histogram: under 1us, 1-2us, 2-4us and so on
+#define PROFILE_TIME_BUCKETS 20
+
+// The hardware counters read
+#define COUNTER_CYCLES 0
+#define COUNTER_INSTRUCTIONS 1
+#define COUNTER_L1D_MISSES 2
+#define COUNTER_LLC_MISSES 3
+#define COUNTER_BRANCH_MISSES 4
+#define NUM_COUNTERS 5
+
+
+/*
+ * VoiceProfile:
+ * The totals of every callback that mixed one number of voices.
+ */
+typedef struct voice_profile {
+    unsigned long long callbacks;
+    unsigned long long frames;
+    unsigned long long ns;
+    unsigned long long counts[NUM_COUNTERS];
+} VoiceProfile;
+
+
+/*
+ * CallbackProfile:
+ * The profile of the audio callback so far. Only written by the audio
+ * thread, and only read once the stream has stopped.
+ */
+typedef struct callback_profile {
+    int samplerate;
+
+    /* The counters' file descriptors, or -1 for those that couldn't be
+     * opened. The first one opened leads the group, which is read at once. */
+    int fds[NUM_COUNTERS];
+    int leader;
+    int num_open;
+    int opened; // Whether opening them has been tried yet
+    int error; // The errno of opening them, if none could be
+
+    // The times and counts at the start of the current callback
+    uint64_t start_ns;
+    uint64_t start_counts[NUM_COUNTERS];
+    int started; // Whether the counts at the start were read
+
+    VoiceProfile voices[PROFILE_MAX_VOICES + 1];
+    unsigned long long histogram[PROFILE_TIME_BUCKETS];
+    unsigned long long late; // Callbacks that took longer than their audio lasts
+} CallbackProfile;
+
+
+
+/*
+ * new_callback_profile():
+ * Creates a malloc'ed CallbackProfile with nothing recorded yet. The counters
+ * are opened by the first callback, as they count the thread that opens them.
+ *
+ * The user must call free_callback_profile() on the returned struct.
+ *
+ * samplerate:  The sample rate of the stream, to tell how long each
+ *              callback's audio lasts
+ *
+ * return:      A malloc'ed CallbackProfile, or NULL on error
+ */
+CallbackProfile* new_callback_profile(int samplerate);
+
+
+/*
+ * profile_callback_start():
+ * Records the time and counters at the start of a callback. Must be called
+ * by the audio thread only.
+ *
+ * profile:     A pointer to the CallbackProfile
+ */
+void profile_callback_start(CallbackProfile* profile);
+
+
+/*
+ * profile_callback_end():
+ * Records the time and counters at the end of a callback, against the number
+ * of voices it mixed. Must be called by the audio thread only.
+ *
+ * profile:     A pointer to the CallbackProfile
+ * voices:      The number of voices sounding, not counting notes waiting
+ *              to start or already expired
+ * frames:      The number of samples in the callback's block
+ */
+void profile_callback_end(CallbackProfile* profile, int voices, int frames);
+
+
+/*
+ * print_callback_profile():
+ * Prints the time histogram, and a table of the time and counters per sample
+ * for each number of voices. Must only be called once the stream has stopped.
+ *
+ * profile:     A pointer to the CallbackProfile
+ */
+void print_callback_profile(CallbackProfile* profile);
+
+
+/*
+ * free_callback_profile():
+ * Closes the counters and frees the CallbackProfile.
+ *
+ * profile:     A pointer to the CallbackProfile
+ */
+void free_callback_profile(CallbackProfile* profile);
+
+#endif
@@ -0,0 +1,416 @@
+#include "composer.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "oscillator.h"
+#include "trace.h"
+
+
+/* Internal function declarations */
+float randfloat(Composer* composer, float beg, float end);
+int randint(Composer* composer, int beg, int end);
+float percent_in_range(float perc, float beg, float end);
+Key* copy_key(float* freqs, int len);
+
+
+
+/*
+ * load_instruments():
+ * Generates the keys, and maps the breakpoints and lookup tables from the
+ * resource bundle next to the executable (see bundle.h). Without a bundle,
+ * or if it lacks them or has tables for another sample rate, loads the
+ * breakpoint file from the resources folder and generates the tables.
+ *
+ * The keys are C, D and E major and harmonic minor, computed in the given
+ * tuning, unless the settings fix one key to use instead. A key file given in
+ * the settings is taken from the bundle if it has a key of that name, such as
+ * "gmin", and read from the file otherwise.
+ *
+ * The user must call free_instruments() on the returned struct.
+ *
+ * samplerate:  The sample rate the notes will be played at
+ * scale:       A pointer to the ScaleSettings to make the keys with
+ *
+ * return:      A malloc'ed Instruments, or NULL on error
+ */
+Instruments* load_instruments(int samplerate, ScaleSettings* scale) {
+    Instruments* instruments = (Instruments*) calloc(1, sizeof(Instruments));
+    if(instruments == NULL) {
+        printf("Error allocating Instruments\n");
+        return NULL;
+    }
+
+    /* Map the resource bundle, which is found next to the executable
+     * whatever the working directory */
+    uint64_t start = trace_begin();
+    char* bundle_file = find_bundle();
+    if(bundle_file != NULL) {
+        instruments->bundle = open_bundle(bundle_file);
+        free(bundle_file);
+    }
+    trace_end("open bundle", start);
+
+    /* Load the amplitude breakpoints for the Oscillators */
+    if(instruments->bundle != NULL)
+        instruments->bp = bundle_breakpoints(instruments->bundle, ENVELOPE_NAME);
+    instruments->mapped_bp = instruments->bp != NULL;
+    if(!instruments->mapped_bp)
+        instruments->bp = load_bp_file(ENVELOPE_FILE);
+    if(instruments->bp == NULL) {
+        printf("Error loading breakpoint file\n");
+        free_instruments(instruments);
+        return NULL;
+    }
+
+    /* Load lookup tables, from the most harmonics to the fewest, using the
+     * bundle's only if it has them all at this length */
+    instruments->tablen = samplerate; //Table length as SR supports freqs down to 1
+    instruments->mapped_tabs = instruments->bundle != NULL;
+    for(int i = 0; i < NUM_TABS && instruments->mapped_tabs; i++) {
+        char name[BUNDLE_NAME_LEN];
+        snprintf(name, BUNDLE_NAME_LEN, "warmth%d", NUM_TABS-1 - i);
+        int count;
+        instruments->tabs[i] = bundle_floats(instruments->bundle, BUNDLE_TABLE, name, &count);
+        instruments->mapped_tabs = instruments->tabs[i] != NULL && count == instruments->tablen;
+    }
+    start = trace_begin();
+    for(int i = 0; i < NUM_TABS && !instruments->mapped_tabs; i++) {
+        instruments->tabs[i] = gen_warmth_tab(instruments->tablen, NUM_TABS-1 - i);
+        if(instruments->tabs[i] == NULL) {
+            printf("Error loading table\n");
+            free_instruments(instruments);
+            return NULL;
+        }
+    }
+    trace_end(instruments->mapped_tabs ? "map tables" : "generate tables", start);
+
+    /* Make C, D and E major and harmonic minor keys */
+    int roots[NUM_KEYS] = {0, 2, 4};
+    for(int i = 0; i < NUM_KEYS; i++) {
+        instruments->major_keys[i] = make_key(roots[i], MODE_MAJOR, KEY_LOW_OCTAVE, KEY_OCTAVES, scale->tuning);
+        instruments->harmonic_keys[i] = make_key(roots[i], MODE_HARMONIC, KEY_LOW_OCTAVE, KEY_OCTAVES, scale->tuning);
+        if(instruments->major_keys[i] == NULL || instruments->harmonic_keys[i] == NULL) {
+            printf("Error making key\n");
+            free_instruments(instruments);
+            return NULL;
+        }
+    }
+
+    /* Load or make the key to always use, if there is one */
+    float* freqs = NULL;
+    int len;
+    if(scale->key_file != NULL && instruments->bundle != NULL)
+        freqs = bundle_floats(instruments->bundle, BUNDLE_KEY, scale->key_file, &len);
+    if(freqs != NULL)
+        instruments->fixed_key = copy_key(freqs, len);
+    else if(scale->key_file != NULL)
+        instruments->fixed_key = load_key(scale->key_file);
+    else if(scale->root >= 0)
+        instruments->fixed_key = make_key(scale->root, scale->mode, KEY_LOW_OCTAVE, KEY_OCTAVES, scale->tuning);
+    if((scale->key_file != NULL || scale->root >= 0) && instruments->fixed_key == NULL) {
+        free_instruments(instruments);
+        return NULL;
+    }
+
+    return instruments;
+}
+
+
+
+/*
+ * free_instruments():
+ * Frees the given Instruments and everything in them.
+ *
+ * instruments: A pointer to the Instruments to free
+ */
+void free_instruments(Instruments* instruments) {
+    if(instruments->mapped_bp)
+        free(instruments->bp);
+    else if(instruments->bp != NULL)
+        free_breakpoints(instruments->bp);
+
+    for(int i = 0; i < NUM_TABS && !instruments->mapped_tabs; i++)
+        free(instruments->tabs[i]);
+
+    for(int i = 0; i < NUM_KEYS; i++) {
+        if(instruments->major_keys[i] != NULL)
+            free_key(instruments->major_keys[i]);
+        if(instruments->harmonic_keys[i] != NULL)
+            free_key(instruments->harmonic_keys[i]);
+    }
+    if(instruments->fixed_key != NULL)
+        free_key(instruments->fixed_key);
+
+    if(instruments->bundle != NULL)
+        close_bundle(instruments->bundle);
+
+    free(instruments);
+}
+
+
+
+/*
+ * parse_strategy():
+ * Converts the name of a region selection strategy to its SelectStrategy value.
+ *
+ * name:        The name of the strategy, as given on the command line
+ *
+ * return:      The SelectStrategy, or -1 if the name isn't recognized
+ */
+int parse_strategy(char* name) {
+    char* names[] = {"random", "dark", "bright", "cold", "warm", "busy"};
+    for(int i = 0; i < 6; i++) {
+        if(strcmp(name, names[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+
+
+/*
+ * new_composer():
+ * Creates a malloc'ed Composer, and picks the key of the piece from the
+ * overall warmth of the image: a harmonic minor key if it's cold, or a major
+ * key if it's warm. If the Instruments have a fixed key, that's used instead.
+ *
+ * The user must call free_composer() on the returned struct.
+ *
+ * instruments: A pointer to the Instruments to compose with
+ * strategy:    The SelectStrategy to choose regions with
+ * warmth:      The overall warmth of the image
+ * seed:        The seed of the Composer's random numbers
+ *
+ * return:      A malloc'ed Composer, or NULL on error
+ */
+Composer* new_composer(Instruments* instruments, int strategy, float warmth, unsigned int seed) {
+    Composer* composer = (Composer*) malloc(sizeof(Composer));
+    if(composer == NULL) {
+        printf("Error allocating Composer\n");
+        return NULL;
+    }
+    composer->instruments = instruments;
+    composer->strategy = strategy;
+    seed_rng(&composer->rng, seed);
+
+    // If a key is given, always use it
+    if(instruments->fixed_key != NULL)
+        composer->key = instruments->fixed_key;
+    // If image is cold overall, choose a harmonic minor key
+    else if(warmth < 0)
+        composer->key = instruments->harmonic_keys[randint(composer, 0, NUM_KEYS)];
+    // If image is warm overall, choose a major key
+    else
+        composer->key = instruments->major_keys[randint(composer, 0, NUM_KEYS)];
+
+    return composer;
+}
+
+
+
+/*
+ * free_composer():
+ * Frees the given Composer, but not its Instruments.
+ *
+ * composer:    A pointer to the Composer to free
+ */
+void free_composer(Composer* composer) {
+    free(composer);
+}
+
+
+
+/*
+ * choose_region():
+ * Picks the next region of the image to generate notes from, using the
+ * FeatureIndex and its pyramid so no pixels need to be read.
+ *
+ * SELECT_RANDOM picks a region at any position in the image, not only on the
+ * index's grid, and computes its features from the pyramid. The other
+ * strategies pick randomly from the quarter of the cells with the lowest or
+ * highest value of one feature.
+ *
+ * composer:    A pointer to the Composer
+ * index:       The FeatureIndex of the image
+ *
+ * return:      A pointer to the chosen region's features, valid until the
+ *              next call
+ */
+RegionFeatures* choose_region(Composer* composer, FeatureIndex* index) {
+    int num_cells = index->cols * index->rows;
+    int quarter = num_cells / 4;
+    if(quarter == 0)
+        quarter = 1;
+
+    int strategy = composer->strategy;
+    if(strategy == SELECT_DARK)
+        return get_sorted_cell(index, FEATURE_BRIGHTNESS, randint(composer, 0, quarter));
+    else if(strategy == SELECT_BRIGHT)
+        return get_sorted_cell(index, FEATURE_BRIGHTNESS, randint(composer, num_cells-quarter, num_cells));
+    else if(strategy == SELECT_COLD)
+        return get_sorted_cell(index, FEATURE_WARMTH, randint(composer, 0, quarter));
+    else if(strategy == SELECT_WARM)
+        return get_sorted_cell(index, FEATURE_WARMTH, randint(composer, num_cells-quarter, num_cells));
+    else if(strategy == SELECT_BUSY)
+        return get_sorted_cell(index, FEATURE_VARIANCE, randint(composer, num_cells-quarter, num_cells));
+
+    Pyramid* pyramid = index->pyramid;
+    int x = randint(composer, 0, pyramid->width - index->cell_w + 1);
+    int y = randint(composer, 0, pyramid->height - index->cell_h + 1);
+    get_region(index, x, y, &composer->random_region);
+    return &composer->random_region;
+}
+
+
+
+/*
+ * compose_notes():
+ * Composes the notes to play for a region of the image. Brighter regions give
+ * higher notes and more of them, and warmer regions give notes with fewer
+ * high harmonics.
+ *
+ * composer:    A pointer to the Composer
+ * region:      The features of the region, as from choose_region()
+ * notes:       An array of MAX_NOTES Notes to fill in
+ *
+ * return:      The number of notes composed
+ */
+int compose_notes(Composer* composer, RegionFeatures* region, Note* notes) {
+    Key* key = composer->key;
+
+    /* Look up the average brightness and warmth of this region
+     * Average brightness is between 0 and 1 */
+    float avg_brightness = region->brightness;
+    int avg_warm = region->warmth;
+
+    /* Pick number of notes to generate
+     * If the brightness is low, then the notes will be lower in frequency.
+     * Generate fewer to avoid as much clashing between them. */
+    int num_notes;
+    if(avg_brightness < 0.5)
+        num_notes = randint(composer, 1, MAX_NOTES);
+    else
+        num_notes = randint(composer, 1, MAX_NOTES+1);
+
+    /* Generate each note */
+    for(int i = 0; i < num_notes; i++) {
+        Note* note = notes + i;
+
+        /* Pick a brightness value near the calculated average. Ensure
+         * brightness values is between 0 and 1. Then use this to choose
+         * from the higher or lower end of the frequency list */
+        float brightness = randfloat(composer, 0.5*avg_brightness, 1.2*avg_brightness);
+        if(brightness > 1)
+            brightness = 1;
+        int freq_ind = percent_in_range(brightness, 0, key->len);
+        if(freq_ind >= key->len)
+            freq_ind = key->len-1;
+        note->freq = key->freqs[freq_ind];
+
+        /* Higher notes (from brighter colors) tend to be louder, so
+         * calculate an amplitude that decreases as brightness increases.
+         * 0.4 is a hardcoded base amplitude so everything isn't really loud */
+        note->amplitude = 0.4 * ((1-brightness) * 0.7 + 0.3);
+
+        /* Pick a warmth value nearby the calculated average. Process the
+         * warmth value so it's between 0 & 1, then use that to pick an
+         * appropriate lookup table from the list of tables. */
+        float warmth = randint(composer, avg_warm-10, avg_warm+10);
+        warmth -= 30; // Adjust where warmth maps to arr of harmonic content
+        if(warmth < -100) // min value: -100
+            warmth = -100;
+        if(warmth > 100) // max value: 100
+            warmth = 100;
+        warmth += 100; // warmth between 0 and 200
+        warmth /= 200.0; //warmth between 0 and 1
+
+        int ind = NUM_TABS*warmth; // Lookup table index
+        if(ind >= NUM_TABS) // The very warmest use the last table
+            ind = NUM_TABS-1;
+        note->tab = composer->instruments->tabs[ind];
+
+        // Pick random future start time and note length
+        note->start = randfloat(composer, 0.1, 5);
+        note->length = randfloat(composer, 3, 10);
+    }
+
+    return num_notes;
+}
+
+
+
+
+/*
+ * randfloat():
+ * Returns a random float in the range specified, including the start of the range
+ * but not the end
+ *
+ * composer:    The Composer whose random numbers to use
+ * beg:         the lower end of the range to generate from
+ * end:         the upper end of the range to generate from
+ *
+ * return:      A randomly generated float in the range given
+ */
+float randfloat(Composer* composer, float beg, float end) {
+    return rng_float(&composer->rng) * (end-beg) + beg;
+}
+
+/*
+ * randint():
+ * Returns a random integer in the range specified, not-including the end of the range.
+ *
+ * composer:    The Composer whose random numbers to use
+ * beg:         the lower end of the range to generate from, inclusive
+ * end:         the higher end of the range to generate from, exclusive
+ *
+ * return:      A randomly generated int in the range given
+ */
+int randint(Composer* composer, int beg, int end) {
+    return (int) rng_below(&composer->rng, end-beg) + beg;
+}
+
+
+/*
+ * copy_key():
+ * Copies the given frequencies into a malloc'ed Key struct.
+ *
+ * The user must call free_key() on this struct.
+ *
+ * freqs:       The frequencies
+ * len:         The number of frequencies
+ *
+ * return:      A malloc'ed Key struct, or NULL on error
+ */
+Key* copy_key(float* freqs, int len) {
+    Key* key = (Key*) malloc(sizeof(Key));
+    float* copy = (float*) malloc(sizeof(float) * len);
+    if(key == NULL || copy == NULL) {
+        printf("Error allocating Key\n");
+        free(key);
+        free(copy);
+        return NULL;
+    }
+    memcpy(copy, freqs, sizeof(float) * len);
+    key->freqs = copy;
+    key->len = len;
+    return key;
+}
+
+
+/*
+ * percent_in_range():
+ * Returns a float that is a certain percentage through the given range.
+ *
+ * Ex: if the range was 0-10, perc=0.5 would return halfway through the range: 5
+ *
+ * perc:        The percentage, between 0 and 1, of how far through the range we go
+ * beg:         The beginning of the range
+ * end:         The end of the range
+ *
+ * return:      The float at a certain percentage of the way through the given range.
+ */
+float percent_in_range(float perc, float beg, float end) {
+    return perc*(end-beg) + beg;
+}
@@ -0,0 +1,223 @@
+#ifndef COMPOSER_H
+#define COMPOSER_H
+
+#include "breakpoints.h"
+#include "bundle.h"
+#include "key.h"
+#include "region_index.h"
+#include "rng.h"
+
+// How many seconds pass between choosing each region and its notes
+#define STEP_SECONDS 6
+
+// The most notes generated for one region
+#define MAX_NOTES 3
+
+// The number of lookup tables, from most to fewest high harmonics
+#define NUM_TABS 8
+
+// The number of major and of harmonic minor keys to choose from
+#define NUM_KEYS 3
+
+// The amplitude envelope of every note, by its name in the resource bundle
+#define ENVELOPE_NAME "bp2"
+#define ENVELOPE_FILE "resources/bps/bp2.txt"
+
+// The range of every key, 5 octaves up from the root in octave 2
+#define KEY_LOW_OCTAVE 2
+#define KEY_OCTAVES 5
+
+
+/* How to choose the next region of the image. Apart from SELECT_RANDOM, each
+ * strategy picks randomly from the quarter of the regions that best match it */
+typedef enum select_strategy {
+    SELECT_RANDOM,
+    SELECT_DARK,
+    SELECT_BRIGHT,
+    SELECT_COLD,
+    SELECT_WARM,
+    SELECT_BUSY
+} SelectStrategy;
+
+
+/*
+ * ScaleSettings:
+ * Options for which keys load_instruments() makes.
+ */
+typedef struct scale_settings {
+    int tuning; // The Tuning of every key
+
+    /* The root, in semitones above C, and ScaleMode of the key to always
+     * compose in, or a root of -1 to choose the key from the image */
+    int root;
+    int mode;
+
+    /* A text file of the frequencies to always compose with instead, as read
+     * by load_key(), or the name of a key in the resource bundle, or NULL */
+    char* key_file;
+} ScaleSettings;
+
+
+/*
+ * Instruments:
+ * The lookup tables, amplitude breakpoints and keys notes are made from. Only
+ * read once loaded, so one Instruments can be shared by any number of
+ * Composers, on any number of threads.
+ *
+ * The breakpoints and tables are used in place from the resource bundle when
+ * there is one, and only read from text files or generated without it.
+ */
+typedef struct instruments {
+    // Lookup tables from the coldest sound (most harmonics) to the warmest
+    float* tabs[NUM_TABS];
+    int tablen;
+
+    Breakpoints* bp; // The amplitude envelope of every note
+
+    Key* major_keys[NUM_KEYS];
+    Key* harmonic_keys[NUM_KEYS];
+
+    // The key to compose in whatever the image, or NULL to choose by image
+    Key* fixed_key;
+
+    /* The resource bundle, or NULL if there isn't one, and whether the
+     * breakpoints and tables point into it */
+    ResourceBundle* bundle;
+    int mapped_bp;
+    int mapped_tabs;
+} Instruments;
+
+
+/*
+ * Note:
+ * One note to play, as the settings of the Oscillator that plays it.
+ */
+typedef struct note {
+    float* tab; // The lookup table, one of the Instruments' tabs
+    float freq;
+    float amplitude;
+    float length; // In seconds
+    float start; // Seconds from when the note is composed until it starts
+} Note;
+
+
+/*
+ * Composer:
+ * Chooses regions of an image and composes notes from them. Holds the key of
+ * the piece and the state of its random numbers, so two Composers with the
+ * same seed compose the same notes.
+ */
+typedef struct composer {
+    Instruments* instruments;
+    Key* key;
+    int strategy; // The SelectStrategy to choose regions with
+    RegionFeatures random_region; // The last region chosen by SELECT_RANDOM
+
+    Rng rng; // The state of the random number generator
+} Composer;
+
+
+
+/*
+ * load_instruments():
+ * Generates the keys, and maps the breakpoints and lookup tables from the
+ * resource bundle next to the executable (see bundle.h). Without a bundle,
+ * or if it lacks them or has tables for another sample rate, loads the
+ * breakpoint file from the resources folder and generates the tables.
+ *
+ * The keys are C, D and E major and harmonic minor, computed in the given
+ * tuning, unless the settings fix one key to use instead. A key file given in
+ * the settings is taken from the bundle if it has a key of that name, such as
+ * "gmin", and read from the file otherwise.
+ *
+ * The user must call free_instruments() on the returned struct.
+ *
+ * samplerate:  The sample rate the notes will be played at
+ * scale:       A pointer to the ScaleSettings to make the keys with
+ *
+ * return:      A malloc'ed Instruments, or NULL on error
+ */
+Instruments* load_instruments(int samplerate, ScaleSettings* scale);
+
+
+/*
+ * free_instruments():
+ * Frees the given Instruments and everything in them.
+ *
+ * instruments: A pointer to the Instruments to free
+ */
+void free_instruments(Instruments* instruments);
+
+
+/*
+ * parse_strategy():
+ * Converts the name of a region selection strategy to its SelectStrategy value.
+ *
+ * name:        The name of the strategy, as given on the command line
+ *
+ * return:      The SelectStrategy, or -1 if the name isn't recognized
+ */
+int parse_strategy(char* name);
+
+
+/*
+ * new_composer():
+ * Creates a malloc'ed Composer, and picks the key of the piece from the
+ * overall warmth of the image: a harmonic minor key if it's cold, or a major
+ * key if it's warm. If the Instruments have a fixed key, that's used instead.
+ *
+ * The user must call free_composer() on the returned struct.
+ *
+ * instruments: A pointer to the Instruments to compose with
+ * strategy:    The SelectStrategy to choose regions with
+ * warmth:      The overall warmth of the image
+ * seed:        The seed of the Composer's random numbers
+ *
+ * return:      A malloc'ed Composer, or NULL on error
+ */
+Composer* new_composer(Instruments* instruments, int strategy, float warmth, unsigned int seed);
+
+
+/*
+ * free_composer():
+ * Frees the given Composer, but not its Instruments.
+ *
+ * composer:    A pointer to the Composer to free
+ */
+void free_composer(Composer* composer);
+
+
+/*
+ * choose_region():
+ * Picks the next region of the image to generate notes from, using the
+ * FeatureIndex and its pyramid so no pixels need to be read.
+ *
+ * SELECT_RANDOM picks a region at any position in the image, not only on the
+ * index's grid, and computes its features from the pyramid. The other
+ * strategies pick randomly from the quarter of the cells with the lowest or
+ * highest value of one feature.
+ *
+ * composer:    A pointer to the Composer
+ * index:       The FeatureIndex of the image
+ *
+ * return:      A pointer to the chosen region's features, valid until the
+ *              next call
+ */
+RegionFeatures* choose_region(Composer* composer, FeatureIndex* index);
+
+
+/*
+ * compose_notes():
+ * Composes the notes to play for a region of the image. Brighter regions give
+ * higher notes and more of them, and warmer regions give notes with fewer
+ * high harmonics.
+ *
+ * composer:    A pointer to the Composer
+ * region:      The features of the region, as from choose_region()
+ * notes:       An array of MAX_NOTES Notes to fill in
+ *
+ * return:      The number of notes composed
+ */
+int compose_notes(Composer* composer, RegionFeatures* region, Note* notes);
+
+#endif
@@ -0,0 +1,554 @@
+#include "export.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <sys/stat.h>
+#include <sndfile.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+#include "composer.h"
+#include "render.h"
+#include "thread_pool.h"
+#include "trace.h"
+#include "viz_tap.h"
+#include "lodepng.h"
+#include "zlib_backend.h"
+
+// The largest frame to export, the image is averaged down until it fits
+#define EXPORT_MAX_W 1280
+#define EXPORT_MAX_H 720
+
+/* The number of frames rendered for each thread before they're encoded. One
+ * chunk is encoded while the next one's audio is rendered. */
+#define FRAMES_PER_THREAD 8
+
+// The longest path of an output file
+#define MAX_PATH 4096
+
+
+/*
+ * ExportFrame:
+ * What one frame of video shows, recorded as its audio is rendered.
+ */
+typedef struct export_frame {
+    RegionFeatures region; // The region selected at the end of the frame
+    int has_region; // Boolean, whether a region has been selected yet
+    VizSnapshot viz; // Only filled in if the visualization is shown
+
+    int failed; // Boolean, set if the frame couldn't be written
+} ExportFrame;
+
+
+/*
+ * Export:
+ * Everything the threads encoding the frames share.
+ */
+typedef struct export {
+    ExportSettings* settings;
+    char* dir;
+
+    // The image averaged down to the frame size, as char RGB pixels
+    unsigned char* background;
+    int width;
+    int height;
+    int scale; // The number of image pixels across each frame pixel
+
+    unsigned char** canvases; // A frame to draw on for each thread
+} Export;
+
+
+/*
+ * ExportChunk:
+ * A chunk of frames, numbered from first, to render and then encode.
+ */
+typedef struct export_chunk {
+    Export* export;
+    ExportFrame* frames;
+    int first;
+    int count;
+} ExportChunk;
+
+
+/* Internal function declarations */
+unsigned char* shrink_display(Landscape* landscape, int* width, int* height, int* scale);
+int make_dir(char* dir);
+int render_chunk(ExportChunk* chunk, Renderer* renderer, VizTap* tap, float* block,
+        SNDFILE* outfile, int samplerate);
+void encode_frame(void* arg, int task, int worker);
+void draw_frame_rect(Export* export, unsigned char* canvas, RegionFeatures* region);
+void draw_frame_viz(Export* export, unsigned char* canvas, VizSnapshot* snapshot);
+void blend_rect(Export* export, unsigned char* canvas, int x, int y, int w, int h,
+        int r, int g, int b, int a);
+
+
+
+/*
+ * run_export():
+ * Renders a piece offline, as fast as it can be computed rather than in
+ * realtime, as a .wav file and a sequence of PNG frames of what graphics mode
+ * would show: the image, the selected region, and optionally the
+ * visualization of the notes and output. Nothing is displayed, so no window
+ * or screen is needed.
+ *
+ * The output directory is created if need be, and gets audio.wav and
+ * frame_000000.png, frame_000001.png and so on, which line up with the audio
+ * at the given frame rate. They can be joined into a video with, say,
+ *
+ *     ffmpeg -framerate 30 -i out/frame_%06d.png -i out/audio.wav out.mp4
+ *
+ * The frames are the image averaged down by powers of 2 until it fits in
+ * 1280x720. The audio is rendered a chunk of frames at a time, and each
+ * chunk's frames are then drawn and encoded on a pool of threads, which is
+ * where nearly all the time goes, while the next chunk's audio is rendered.
+ *
+ * image:       The image file to render from
+ * dir:         The directory to write the audio and frames to
+ * export:      A pointer to the ExportSettings to render with
+ * settings:    A pointer to the LandscapeSettings to load the image with
+ * scale:       A pointer to the ScaleSettings to make the keys with
+ * strategy:    The SelectStrategy to choose regions with
+ * samplerate:  The sample rate to render at
+ *
+ * return:      0 on success, 1 on error
+ */
+int run_export(char* image, char* dir, ExportSettings* export, LandscapeSettings* settings,
+        ScaleSettings* scale, int strategy, int samplerate) {
+    if(make_dir(dir))
+        return 1;
+
+    // The frames are drawn from the image's display pixels
+    LandscapeSettings load_settings = *settings;
+    load_settings.keep_display = 1;
+    Landscape* landscape = load_landscape(image, &load_settings);
+    if(landscape == NULL)
+        return 1;
+
+    Export job;
+    job.settings = export;
+    job.dir = dir;
+    job.background = shrink_display(landscape, &job.width, &job.height, &job.scale);
+
+    int threads = export->threads > 0 ? export->threads : count_cpus();
+    int chunk = threads * FRAMES_PER_THREAD;
+    ExportFrame* frames = (ExportFrame*) malloc(sizeof(ExportFrame) * chunk * 2);
+    job.canvases = (unsigned char**) calloc(threads, sizeof(unsigned char*));
+    int err = job.background == NULL || frames == NULL || job.canvases == NULL;
+    for(int i = 0; i < threads && !err; i++) {
+        job.canvases[i] = (unsigned char*) malloc(job.width * job.height * 3);
+        err = job.canvases[i] == NULL;
+    }
+    if(err)
+        printf("Error allocating frames\n");
+
+    Instruments* instruments = err ? NULL : load_instruments(samplerate, scale);
+    Composer* composer = instruments != NULL ?
+        new_composer(instruments, strategy, landscape->warmth, export->seed) : NULL;
+    Renderer* renderer = composer != NULL ? new_renderer(composer, landscape->index, samplerate) : NULL;
+    VizTap* tap = renderer != NULL && export->show_viz ? new_viz_tap() : NULL;
+
+    // Enough samples for the longest frame
+    float* block = (float*) malloc(sizeof(float) * (samplerate / export->fps + 1));
+
+    // A float-based mono wave file, as the AudioPlayer writes
+    char path[MAX_PATH];
+    snprintf(path, MAX_PATH, "%s/audio.wav", dir);
+    SNDFILE* outfile = NULL;
+    if(renderer != NULL && (tap != NULL || !export->show_viz) && block != NULL) {
+        SF_INFO sfinfo;
+        sfinfo.samplerate = samplerate;
+        sfinfo.channels = 1;
+        sfinfo.format = SF_FORMAT_WAV | SF_FORMAT_FLOAT;
+        outfile = sf_open(path, SFM_WRITE, &sfinfo);
+        if(outfile == NULL)
+            printf("Error opening output file %s: %s\n", path, sf_strerror(NULL));
+    }
+    err = outfile == NULL;
+
+    /* The audio is cut at whole frames, so the video and audio are the same
+     * length */
+    int num_frames = export->duration * export->fps;
+    if(num_frames < 1)
+        num_frames = 1;
+
+    if(!err)
+        printf("Exporting %d frames of %dx%d to %s on %d threads...\n",
+                num_frames, job.width, job.height, dir, threads);
+
+    // Two chunks, so one can be rendered while the other is encoded
+    ExportChunk chunks[2];
+    for(int i = 0; i < 2; i++) {
+        chunks[i].export = &job;
+        chunks[i].frames = frames + i*chunk;
+    }
+
+    double start = now_seconds();
+    int done = 0;
+    ExportChunk* encoding = NULL;
+    for(int c = 0; (done < num_frames || encoding != NULL) && !err; c ^= 1) {
+        // Render the next chunk's audio while the last one is encoded
+        ExportChunk* rendering = NULL;
+        if(done < num_frames) {
+            rendering = chunks + c;
+            rendering->first = done;
+            rendering->count = num_frames - done < chunk ? num_frames - done : chunk;
+            err = render_chunk(rendering, renderer, tap, block, outfile, samplerate);
+            done += rendering->count;
+        }
+
+        if(encoding != NULL) {
+            finish_tasks();
+            for(int i = 0; i < encoding->count; i++)
+                err |= encoding->frames[i].failed;
+            printf("\rExported %d of %d frames", encoding->first + encoding->count, num_frames);
+            fflush(stdout);
+        }
+
+        // Draw and encode the chunk's frames
+        encoding = err ? NULL : rendering;
+        if(encoding != NULL)
+            start_tasks(encoding->count, threads, encode_frame, encoding);
+    }
+
+    if(done > 0)
+        printf("\n");
+    if(!err) {
+        double wall = now_seconds() - start;
+        double audio = num_frames / (double) export->fps;
+        printf("%d frames and %.1f s of audio in %.2f s: %.1fx realtime\n",
+                num_frames, audio, wall, wall > 0 ? audio / wall : 0);
+    }
+
+    if(outfile != NULL)
+        sf_close(outfile);
+    free(block);
+    if(tap != NULL)
+        free_viz_tap(tap);
+    if(renderer != NULL)
+        free_renderer(renderer);
+    if(composer != NULL)
+        free_composer(composer);
+    if(instruments != NULL)
+        free_instruments(instruments);
+    if(job.canvases != NULL) {
+        for(int i = 0; i < threads; i++)
+            free(job.canvases[i]);
+        free(job.canvases);
+    }
+    free(frames);
+    free(job.background);
+    free_landscape(landscape);
+
+    return err;
+}
+
+
+
+
+/*
+ * shrink_display():
+ * Averages a Landscape's display pixels down by powers of 2 until they fit in
+ * the largest frame size. The width and height are then rounded down to even
+ * numbers, which most video encoders need, and the alpha channel is dropped,
+ * as the frames are opaque.
+ *
+ * The user must free() the returned pixels.
+ *
+ * landscape:   A pointer to the Landscape, which must have display pixels
+ * width:       Pointer to an int to set to the width of the pixels
+ * height:      Pointer to an int to set to the height of the pixels
+ * scale:       Pointer to an int to set to the number of image pixels across
+ *              each of the returned pixels
+ *
+ * return:      The malloc'ed char RGB pixels, or NULL on error
+ */
+unsigned char* shrink_display(Landscape* landscape, int* width, int* height, int* scale) {
+    int dw = landscape->display_w;
+    int dh = landscape->display_h;
+    unsigned char* display = landscape->display;
+
+    int level = 0;
+    while(((dw + (1 << level) - 1) >> level) > EXPORT_MAX_W || ((dh + (1 << level) - 1) >> level) > EXPORT_MAX_H)
+        level++;
+    int factor = 1 << level;
+    int full_w = (dw + factor - 1) >> level;
+    int full_h = (dh + factor - 1) >> level;
+
+    int w = full_w > 1 ? full_w & ~1 : full_w;
+    int h = full_h > 1 ? full_h & ~1 : full_h;
+
+    unsigned char* pixels = (unsigned char*) malloc(w * h * 3);
+    unsigned long long* sums = (unsigned long long*) malloc(full_w * 3 * sizeof(unsigned long long));
+    if(pixels == NULL || sums == NULL) {
+        free(pixels);
+        free(sums);
+        return NULL;
+    }
+
+    /* Sum each block of display pixels, a row of blocks at a time, then
+     * divide by the pixels in the block, which is fewer at the edges */
+    for(int y = 0; y < h; y++) {
+        memset(sums, 0, full_w * 3 * sizeof(unsigned long long));
+        int y_end = (y+1) * factor < dh ? (y+1) * factor : dh;
+        for(int sy = y * factor; sy < y_end; sy++) {
+            unsigned char* row = display + (size_t) sy * dw * 4;
+            for(int sx = 0; sx < dw; sx++) {
+                for(int c = 0; c < 3; c++)
+                    sums[(sx >> level) * 3 + c] += row[sx*4 + c];
+            }
+        }
+
+        for(int x = 0; x < w; x++) {
+            int x_end = (x+1) * factor < dw ? (x+1) * factor : dw;
+            int count = (x_end - x * factor) * (y_end - y * factor);
+            for(int c = 0; c < 3; c++)
+                pixels[((size_t) y * w + x) * 3 + c] = sums[x*3 + c] / count;
+        }
+    }
+
+    free(sums);
+
+    *width = w;
+    *height = h;
+    *scale = landscape->display_scale * factor;
+    return pixels;
+}
+
+
+/*
+ * make_dir():
+ * Creates a directory, if it doesn't already exist.
+ *
+ * dir:         The directory to create
+ *
+ * return:      0 on success, 1 on error
+ */
+int make_dir(char* dir) {
+    #ifdef _WIN32
+    int err = _mkdir(dir);
+    #else
+    int err = mkdir(dir, 0755);
+    #endif
+    if(err != 0 && errno != EEXIST) {
+        printf("Error creating directory %s: %s\n", dir, strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+
+/*
+ * render_chunk():
+ * Renders the audio of a chunk of frames a frame at a time, writes it to the
+ * output file, and notes what each frame shows at its end.
+ *
+ * chunk:       Pointer to the ExportChunk to render
+ * renderer:    The Renderer to render with
+ * tap:         The VizTap to capture the visualization with, or NULL
+ * block:       A buffer big enough for the longest frame's samples
+ * outfile:     The audio file to write to
+ * samplerate:  The sample rate of the audio
+ *
+ * return:      0 on success, 1 on error
+ */
+int render_chunk(ExportChunk* chunk, Renderer* renderer, VizTap* tap, float* block,
+        SNDFILE* outfile, int samplerate) {
+    int fps = chunk->export->settings->fps;
+    for(int i = 0; i < chunk->count; i++) {
+        int f = chunk->first + i;
+        int frames = (long long) (f+1) * samplerate / fps - (long long) f * samplerate / fps;
+        uint64_t trace_start = trace_begin();
+        render_audio(renderer, block, frames);
+        trace_end("render audio", trace_start);
+        if(sf_write_float(outfile, block, frames) != frames) {
+            printf("\nError writing output file %s/audio.wav: %s\n", chunk->export->dir,
+                    sf_strerror(outfile));
+            return 1;
+        }
+
+        ExportFrame* frame = chunk->frames + i;
+        frame->has_region = renderer->region != NULL;
+        if(frame->has_region)
+            frame->region = *renderer->region;
+        if(tap != NULL) {
+            viz_tap_capture(tap, renderer->osc_list, block, frames);
+            frame->viz = *viz_tap_read(tap);
+        }
+        frame->failed = 0;
+    }
+    return 0;
+}
+
+
+/*
+ * encode_frame():
+ * Draws one frame of a chunk on the thread's canvas and writes it as a PNG
+ * file. A TaskFunction for start_tasks().
+ *
+ * arg:         Pointer to the ExportChunk
+ * task:        The index of the frame in the chunk
+ * worker:      The index of the thread encoding it
+ */
+void encode_frame(void* arg, int task, int worker) {
+    ExportChunk* chunk = (ExportChunk*) arg;
+    Export* export = chunk->export;
+    ExportFrame* frame = chunk->frames + task;
+    unsigned char* canvas = export->canvases[worker];
+    uint64_t start = trace_begin();
+
+    memcpy(canvas, export->background, export->width * export->height * 3);
+    if(export->settings->show_rect && frame->has_region)
+        draw_frame_rect(export, canvas, &frame->region);
+    if(export->settings->show_viz)
+        draw_frame_viz(export, canvas, &frame->viz);
+
+    char path[MAX_PATH];
+    snprintf(path, MAX_PATH, "%s/frame_%06d.png", export->dir, chunk->first + task);
+    /* Encoding is nearly all of the time. The frames are always RGB, so
+     * LodePNG needn't scan them for a smaller color type. Filtering every row
+     * with the up filter, rather than trying each filter on each row, is much
+     * faster and compresses photos about as well. Deflating is done with the
+     * faster backend when there is one. */
+    LodePNGState state;
+    lodepng_state_init(&state);
+    state.info_raw.colortype = LCT_RGB;
+    state.info_png.color.colortype = LCT_RGB;
+    state.encoder.auto_convert = 0;
+    state.encoder.filter_strategy = LFS_TWO;
+    use_zlib_compress_backend(&state.encoder.zlibsettings);
+
+    unsigned char* png = NULL;
+    size_t size = 0;
+    unsigned error = lodepng_encode(&png, &size, canvas, export->width, export->height, &state);
+    if(!error)
+        error = lodepng_save_file(png, size, path);
+    free(png);
+    lodepng_state_cleanup(&state);
+    if(error) {
+        printf("\nError writing frame %s: %s\n", path, lodepng_error_text(error));
+        frame->failed = 1;
+    }
+    trace_end("encode frame", start);
+}
+
+
+/*
+ * draw_frame_rect():
+ * Draws the outline of the selected region on a frame, in white, as graphics
+ * mode does.
+ *
+ * export:      Pointer to the Export
+ * canvas:      The frame's pixels
+ * region:      The region to outline, in image pixels
+ */
+void draw_frame_rect(Export* export, unsigned char* canvas, RegionFeatures* region) {
+    int x = region->x / export->scale;
+    int y = region->y / export->scale;
+    int w = region->w / export->scale;
+    int h = region->h / export->scale;
+    if(w < 1)
+        w = 1;
+    if(h < 1)
+        h = 1;
+
+    blend_rect(export, canvas, x, y, w, 1, 255, 255, 255, 255);
+    blend_rect(export, canvas, x, y+h-1, w, 1, 255, 255, 255, 255);
+    blend_rect(export, canvas, x, y, 1, h, 255, 255, 255, 255);
+    blend_rect(export, canvas, x+w-1, y, 1, h, 255, 255, 255, 255);
+}
+
+
+/*
+ * draw_frame_viz():
+ * Draws a snapshot of the audio over the bottom quarter of a frame, the same
+ * way graphics mode draws it over the window: a scope of the output, and a
+ * bar for each note playing, placed by its frequency, whose height is its
+ * amplitude now and whose outline is its base amplitude.
+ *
+ * export:      Pointer to the Export
+ * canvas:      The frame's pixels
+ * snapshot:    The snapshot to draw
+ */
+void draw_frame_viz(Export* export, unsigned char* canvas, VizSnapshot* snapshot) {
+    int w = export->width;
+    int h = export->height / 4;
+    int top = export->height - h;
+
+    blend_rect(export, canvas, 0, top, w, h, 0, 0, 0, 160);
+
+    /* The scope, a vertical line from the lowest to the highest sample of
+     * each point */
+    int mid = top + h/2;
+    for(int i = 0; i < SCOPE_POINTS; i++) {
+        int x = i * w / SCOPE_POINTS;
+        float lo = snapshot->scope_min[i] < -1 ? -1 : snapshot->scope_min[i];
+        float hi = snapshot->scope_max[i] > 1 ? 1 : snapshot->scope_max[i];
+        int y_hi = mid - hi*(h/2);
+        int y_lo = mid - lo*(h/2);
+        blend_rect(export, canvas, x, y_hi, 1, y_lo - y_hi + 1, 120, 200, 255, 200);
+    }
+
+    /* The notes, placed on a log scale of frequency */
+    float octaves = log2f(VIZ_MAX_FREQ / (float) VIZ_MIN_FREQ);
+    for(int i = 0; i < snapshot->num_voices; i++) {
+        VizVoice* voice = snapshot->voices + i;
+        float pos = log2f(voice->freq / VIZ_MIN_FREQ) / octaves;
+        if(pos < 0)
+            pos = 0;
+        if(pos > 1)
+            pos = 1;
+        int x = pos * (w - VIZ_BAR_W);
+
+        int full = voice->amplitude / VIZ_MAX_AMP * h;
+        int now = voice->level / VIZ_MAX_AMP * h;
+        full = full > h ? h : full;
+        now = now > h ? h : now;
+
+        if(full > 0) {
+            int y = top + h - full;
+            blend_rect(export, canvas, x, y, VIZ_BAR_W, 1, 255, 200, 120, 90);
+            blend_rect(export, canvas, x, top + h - 1, VIZ_BAR_W, 1, 255, 200, 120, 90);
+            blend_rect(export, canvas, x, y, 1, full, 255, 200, 120, 90);
+            blend_rect(export, canvas, x + VIZ_BAR_W - 1, y, 1, full, 255, 200, 120, 90);
+        }
+        blend_rect(export, canvas, x, top + h - now, VIZ_BAR_W, now, 255, 200, 120, 220);
+    }
+}
+
+
+/*
+ * blend_rect():
+ * Blends a color over a rectangle of a frame, clipped to the frame.
+ *
+ * export:      Pointer to the Export
+ * canvas:      The frame's pixels
+ * x:           The top left x coordinate of the rectangle
+ * y:           The top left y coordinate of the rectangle
+ * w:           The width of the rectangle
+ * h:           The height of the rectangle
+ * r, g, b:     The color to blend
+ * a:           The opacity of the color, between 0 and 255
+ */
+void blend_rect(Export* export, unsigned char* canvas, int x, int y, int w, int h,
+        int r, int g, int b, int a) {
+    int x_end = x + w < export->width ? x + w : export->width;
+    int y_end = y + h < export->height ? y + h : export->height;
+    if(x < 0)
+        x = 0;
+    if(y < 0)
+        y = 0;
+
+    int color[3] = {r, g, b};
+    for(int py = y; py < y_end; py++) {
+        unsigned char* pixel = canvas + ((size_t) py * export->width + x) * 3;
+        for(int px = x; px < x_end; px++, pixel += 3) {
+            for(int c = 0; c < 3; c++)
+                pixel[c] = (pixel[c] * (255 - a) + color[c] * a) / 255;
+        }
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include "composer.h"
+#include "landscape.h"
+
+/*
+ * ExportSettings:
+ * Options for what run_export() renders.
+ */
+typedef struct export_settings {
+    float duration; // In seconds
+    int fps; // Frames of video per second
+
+    unsigned int seed; // The seed of the piece's random numbers
+
+    // Booleans, whether to draw the selected region and the visualization
+    int show_rect;
+    int show_viz;
+
+    // The number of threads to encode frames on, 0 for one per processor
+    int threads;
+} ExportSettings;
+
+
+
+/*
+ * run_export():
+ * Renders a piece offline, as fast as it can be computed rather than in
+ * realtime, as a .wav file and a sequence of PNG frames of what graphics mode
+ * would show: the image, the selected region, and optionally the
+ * visualization of the notes and output. Nothing is displayed, so no window
+ * or screen is needed.
+ *
+ * The output directory is created if need be, and gets audio.wav and
+ * frame_000000.png, frame_000001.png and so on, which line up with the audio
+ * at the given frame rate. They can be joined into a video with, say,
+ *
+ *     ffmpeg -framerate 30 -i out/frame_%06d.png -i out/audio.wav out.mp4
+ *
+ * The frames are the image averaged down by powers of 2 until it fits in
+ * 1280x720. The audio is rendered a chunk of frames at a time, and each
+ * chunk's frames are then drawn and encoded on a pool of threads, which is
+ * where nearly all the time goes.
+ *
+ * image:       The image file to render from
+ * dir:         The directory to write the audio and frames to
+ * export:      A pointer to the ExportSettings to render with
+ * settings:    A pointer to the LandscapeSettings to load the image with
+ * scale:       A pointer to the ScaleSettings to make the keys with
+ * strategy:    The SelectStrategy to choose regions with
+ * samplerate:  The sample rate to render at
+ *
+ * return:      0 on success, 1 on error
+ */
+int run_export(char* image, char* dir, ExportSettings* export, LandscapeSettings* settings,
+        ScaleSettings* scale, int strategy, int samplerate);
+
+#endif
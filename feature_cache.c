@@ -0,0 +1,273 @@
+#include "feature_cache.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mapped_file.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define CACHE_MAGIC "ALFEAT\0\0"
+#define BYTE_ORDER_MARK 0x01020304
+
+
+/* Internal function declarations */
+char* cache_filename(char* image_filename, char* suffix);
+size_t cache_size(CacheLevel* levels, int num_levels);
+
+
+
+/*
+ * hash_file():
+ * Computes a 64-bit hash of the contents of the given file, used to check that
+ * a cache file was made from the same image.
+ *
+ * filename:    The file to hash
+ * hash:        Pointer to an integer in which the hash will be stored
+ *
+ * return:      0 on success, 1 on error
+ */
+int hash_file(char* filename, uint64_t* hash) {
+    MappedFile* file = map_file(filename);
+    if(file == NULL)
+        return 1;
+    unsigned char* data = file->data;
+    size_t size = file->size;
+
+    /* FNV-1a, but on 8 bytes at a time instead of 1 so it keeps up with the
+     * disk, with an extra shift to mix the high bits back into the low ones */
+    uint64_t h = 14695981039346656037ULL ^ size;
+    size_t i = 0;
+    for(; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        h = (h ^ word) * 1099511628211ULL;
+        h ^= h >> 29;
+    }
+    for(; i < size; i++)
+        h = (h ^ data[i]) * 1099511628211ULL;
+
+    unmap_file(file);
+
+    *hash = h;
+    return 0;
+}
+
+
+
+/*
+ * load_feature_cache():
+ * Maps the cache file of the given image into memory, if there is a valid one,
+ * and returns a Pyramid whose levels point into the mapped file. Nothing is
+ * copied or decoded, and the mapping is released by free_pyramid().
+ *
+ * A cache file is only used if its hash matches the given one and it was
+ * written with the current ANALYSIS_VERSION.
+ *
+ * image_filename:  The filename of the image, not of the cache file
+ * hash:            hash_file() of the image
+ * brightness:      Pointer to a float in which the image's average brightness
+ *                  will be stored
+ * warmth:          Pointer to a float in which the image's average warmth will
+ *                  be stored
+ *
+ * return:          A malloc'ed Pyramid, or NULL if there is no valid cache file
+ */
+Pyramid* load_feature_cache(char* image_filename, uint64_t hash, float* brightness, float* warmth) {
+    #ifdef _WIN32
+    return NULL;
+    #else
+    char* filename = cache_filename(image_filename, "");
+    if(filename == NULL)
+        return NULL;
+
+    int fd = open(filename, O_RDONLY);
+    free(filename);
+    if(fd < 0)
+        return NULL;
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size < sizeof(CacheHeader)) {
+        close(fd);
+        return NULL;
+    }
+    size_t size = st.st_size;
+
+    unsigned char* data = (unsigned char*) mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED)
+        return NULL;
+
+    /* Make sure the file is complete and for this image and program version */
+    CacheHeader* header = (CacheHeader*) data;
+    CacheLevel* levels = (CacheLevel*) (data + sizeof(CacheHeader));
+    if(memcmp(header->magic, CACHE_MAGIC, 8) != 0 || header->version != ANALYSIS_VERSION ||
+            header->byte_order != BYTE_ORDER_MARK || header->hash != hash ||
+            header->num_levels <= 0 ||
+            size < sizeof(CacheHeader) + header->num_levels*sizeof(CacheLevel) ||
+            size != cache_size(levels, header->num_levels)) {
+        munmap(data, size);
+        return NULL;
+    }
+
+    Pyramid* pyramid = (Pyramid*) malloc(sizeof(Pyramid));
+    PyramidLevel* pyr_levels = (PyramidLevel*) malloc(sizeof(PyramidLevel) * header->num_levels);
+    if(pyramid == NULL || pyr_levels == NULL) {
+        printf("Error allocating Pyramid\n");
+        free(pyramid);
+        free(pyr_levels);
+        munmap(data, size);
+        return NULL;
+    }
+
+    pyramid->levels = pyr_levels;
+    pyramid->num_levels = header->num_levels;
+    pyramid->width = header->width;
+    pyramid->height = header->height;
+    pyramid->shift = header->shift;
+    pyramid->mapped = data;
+    pyramid->mapped_size = size;
+
+    // Point each level's planes at their place in the file
+    float* plane = (float*) (levels + header->num_levels);
+    for(int l = 0; l < header->num_levels; l++) {
+        size_t samples = (size_t) levels[l].width * levels[l].height;
+        pyr_levels[l].width = levels[l].width;
+        pyr_levels[l].height = levels[l].height;
+        pyr_levels[l].bright = plane;
+        pyr_levels[l].bright2 = plane + samples;
+        pyr_levels[l].warmth = plane + 2*samples;
+        plane += 3*samples;
+    }
+
+    *brightness = header->brightness;
+    *warmth = header->warmth;
+
+    return pyramid;
+    #endif
+}
+
+
+
+/*
+ * save_feature_cache():
+ * Writes the given Pyramid and overall stats to the cache file of the given
+ * image, replacing any existing one.
+ *
+ * image_filename:  The filename of the image, not of the cache file
+ * hash:            hash_file() of the image
+ * pyramid:         The image's Pyramid
+ * brightness:      The image's average brightness
+ * warmth:          The image's average warmth
+ *
+ * return:          0 on success, 1 on error
+ */
+int save_feature_cache(char* image_filename, uint64_t hash, Pyramid* pyramid,
+        float brightness, float warmth) {
+    #ifdef _WIN32
+    return 1;
+    #else
+    /* Write to a temporary file and rename it over the cache file when done, so
+     * another run never maps a half-written file */
+    char* filename = cache_filename(image_filename, "");
+    char* tempname = cache_filename(image_filename, ".tmp");
+    FILE* file = tempname ? fopen(tempname, "wb") : NULL;
+    if(file == NULL) {
+        printf("Error writing feature cache for %s\n", image_filename);
+        free(filename);
+        free(tempname);
+        return 1;
+    }
+
+    CacheHeader header;
+    memset(&header, 0, sizeof(CacheHeader));
+    memcpy(header.magic, CACHE_MAGIC, 8);
+    header.version = ANALYSIS_VERSION;
+    header.byte_order = BYTE_ORDER_MARK;
+    header.hash = hash;
+    header.width = pyramid->width;
+    header.height = pyramid->height;
+    header.shift = pyramid->shift;
+    header.num_levels = pyramid->num_levels;
+    header.brightness = brightness;
+    header.warmth = warmth;
+
+    int err = fwrite(&header, sizeof(CacheHeader), 1, file) != 1;
+
+    for(int l = 0; l < pyramid->num_levels && !err; l++) {
+        CacheLevel level;
+        level.width = pyramid->levels[l].width;
+        level.height = pyramid->levels[l].height;
+        err = fwrite(&level, sizeof(CacheLevel), 1, file) != 1;
+    }
+
+    for(int l = 0; l < pyramid->num_levels && !err; l++) {
+        PyramidLevel* level = pyramid->levels + l;
+        size_t samples = (size_t) level->width * level->height;
+        err = fwrite(level->bright, sizeof(float), samples, file) != samples ||
+            fwrite(level->bright2, sizeof(float), samples, file) != samples ||
+            fwrite(level->warmth, sizeof(float), samples, file) != samples;
+    }
+
+    if(fclose(file) != 0)
+        err = 1;
+    if(!err)
+        err = rename(tempname, filename) != 0;
+
+    if(err) {
+        printf("Error writing feature cache for %s\n", image_filename);
+        remove(tempname);
+    }
+
+    free(filename);
+    free(tempname);
+    return err;
+    #endif
+}
+
+
+
+
+/*
+ * cache_filename():
+ * Returns the malloc'ed filename of the cache file for the given image, with
+ * the given suffix added to the end.
+ *
+ * image_filename:  The filename of the image
+ * suffix:          A string to add after CACHE_EXTENSION
+ *
+ * return:          The malloc'ed filename, or NULL on error
+ */
+char* cache_filename(char* image_filename, char* suffix) {
+    size_t len = strlen(image_filename) + strlen(CACHE_EXTENSION) + strlen(suffix) + 1;
+    char* filename = (char*) malloc(len);
+    if(filename != NULL)
+        snprintf(filename, len, "%s%s%s", image_filename, CACHE_EXTENSION, suffix);
+    return filename;
+}
+
+
+/*
+ * cache_size():
+ * Returns the size in bytes a cache file with the given levels should be.
+ *
+ * levels:      The file's table of CacheLevel's
+ * num_levels:  The number of levels
+ *
+ * return:      The expected size of the file
+ */
+size_t cache_size(CacheLevel* levels, int num_levels) {
+    size_t size = sizeof(CacheHeader) + num_levels*sizeof(CacheLevel);
+    for(int l = 0; l < num_levels; l++) {
+        if(levels[l].width <= 0 || levels[l].height <= 0)
+            return 0;
+        size += 3 * sizeof(float) * (size_t) levels[l].width * levels[l].height;
+    }
+    return size;
+}
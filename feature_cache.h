@@ -0,0 +1,103 @@
+#ifndef FEATURE_CACHE_H
+#define FEATURE_CACHE_H
+
+#include <stdint.h>
+
+#include "pyramid.h"
+
+/* The version of the analysis stored in cache files. Increase this whenever
+ * the way pyramids or overall stats are computed changes, so that older cache
+ * files are ignored instead of giving different results. */
+#define ANALYSIS_VERSION 1
+
+// Appended to an image's filename to get its cache file's name
+#define CACHE_EXTENSION ".alfeat"
+
+
+/*
+ * CacheHeader:
+ * The start of a cache file. It's followed by a CacheLevel for each pyramid
+ * level, and then by each level's bright, bright2 and warmth planes in order.
+ * All values are stored in the byte order of the machine that wrote them.
+ */
+typedef struct cache_header {
+    char magic[8]; // "ALFEAT" followed by two 0s
+    uint32_t version; // ANALYSIS_VERSION of the program that wrote the file
+    uint32_t byte_order; // 0x01020304 as written by the writing machine
+
+    uint64_t hash; // hash_file() of the image the file was made from
+
+    // Pyramid settings and dimensions
+    int32_t width;
+    int32_t height;
+    int32_t shift;
+    int32_t num_levels;
+
+    // Overall stats of the image
+    float brightness;
+    float warmth;
+} CacheHeader;
+
+
+/*
+ * CacheLevel:
+ * The dimensions of one pyramid level in a cache file.
+ */
+typedef struct cache_level {
+    int32_t width;
+    int32_t height;
+} CacheLevel;
+
+
+
+/*
+ * hash_file():
+ * Computes a 64-bit hash of the contents of the given file, used to check that
+ * a cache file was made from the same image.
+ *
+ * filename:    The file to hash
+ * hash:        Pointer to an integer in which the hash will be stored
+ *
+ * return:      0 on success, 1 on error
+ */
+int hash_file(char* filename, uint64_t* hash);
+
+
+/*
+ * load_feature_cache():
+ * Maps the cache file of the given image into memory, if there is a valid one,
+ * and returns a Pyramid whose levels point into the mapped file. Nothing is
+ * copied or decoded, and the mapping is released by free_pyramid().
+ *
+ * A cache file is only used if its hash matches the given one and it was
+ * written with the current ANALYSIS_VERSION.
+ *
+ * image_filename:  The filename of the image, not of the cache file
+ * hash:            hash_file() of the image
+ * brightness:      Pointer to a float in which the image's average brightness
+ *                  will be stored
+ * warmth:          Pointer to a float in which the image's average warmth will
+ *                  be stored
+ *
+ * return:          A malloc'ed Pyramid, or NULL if there is no valid cache file
+ */
+Pyramid* load_feature_cache(char* image_filename, uint64_t hash, float* brightness, float* warmth);
+
+
+/*
+ * save_feature_cache():
+ * Writes the given Pyramid and overall stats to the cache file of the given
+ * image, replacing any existing one.
+ *
+ * image_filename:  The filename of the image, not of the cache file
+ * hash:            hash_file() of the image
+ * pyramid:         The image's Pyramid
+ * brightness:      The image's average brightness
+ * warmth:          The image's average warmth
+ *
+ * return:          0 on success, 1 on error
+ */
+int save_feature_cache(char* image_filename, uint64_t hash, Pyramid* pyramid,
+        float brightness, float warmth);
+
+#endif
@@ -0,0 +1,395 @@
+#include "frame_queue.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <glob.h>
+#endif
+
+#include "trace.h"
+
+
+/* Internal function declarations */
+void* load_frames(void* vargp);
+int compare_filenames(const void* a, const void* b);
+char** list_directory(char* dirname, int* num_frames);
+
+
+
+/*
+ * list_frames():
+ * Lists the image files of a sequence in order, from either a directory, in
+ * which case every .png, .ppm and .pam file in it is listed, or a glob
+ * pattern such as "frames/frame_*.png".
+ *
+ * The user must call free_frame_list() on the returned list.
+ *
+ * pattern:     The directory or glob pattern
+ * num_frames:  Pointer to an int in which the number of files will be stored
+ *
+ * return:      A malloc'ed array of malloc'ed filenames in sorted order, or
+ *              NULL on error or if there are no matching files
+ */
+char** list_frames(char* pattern, int* num_frames) {
+    struct stat st;
+    if(stat(pattern, &st) == 0 && S_ISDIR(st.st_mode))
+        return list_directory(pattern, num_frames);
+
+    #ifdef _WIN32
+    printf("Error listing frames: glob patterns aren't supported on Windows\n");
+    return NULL;
+    #else
+    glob_t matches;
+    if(glob(pattern, 0, NULL, &matches) != 0) {
+        printf("Error listing frames: no files match %s\n", pattern);
+        return NULL;
+    }
+
+    // glob() sorts its matches already
+    char** filenames = (char**) malloc(sizeof(char*) * matches.gl_pathc);
+    int count = 0;
+    for(size_t i = 0; filenames != NULL && i < matches.gl_pathc; i++) {
+        if((filenames[count] = strdup(matches.gl_pathv[i])) == NULL) {
+            free_frame_list(filenames, count);
+            filenames = NULL;
+            break;
+        }
+        count++;
+    }
+    globfree(&matches);
+
+    if(filenames == NULL) {
+        printf("Error allocating frame list\n");
+        return NULL;
+    }
+
+    *num_frames = count;
+    return filenames;
+    #endif
+}
+
+
+
+/*
+ * free_frame_list():
+ * Frees a list of filenames returned by list_frames().
+ *
+ * filenames:   The list to free
+ * num_frames:  The number of filenames in the list
+ */
+void free_frame_list(char** filenames, int num_frames) {
+    for(int i = 0; i < num_frames; i++)
+        free(filenames[i]);
+    free(filenames);
+}
+
+
+
+/*
+ * is_frame_sequence():
+ * Returns whether the given input names an image sequence rather than one
+ * image: a directory, or a pattern with glob characters in it.
+ *
+ * input:       The input given on the command line
+ *
+ * return:      Boolean, 1 if it's an image sequence
+ */
+int is_frame_sequence(char* input) {
+    struct stat st;
+    if(stat(input, &st) == 0)
+        return S_ISDIR(st.st_mode);
+    return strpbrk(input, "*?[") != NULL;
+}
+
+
+
+/*
+ * has_image_extension():
+ * Returns whether the given filename ends in .png, .ppm or .pam.
+ *
+ * filename:    The filename to check
+ *
+ * return:      Boolean, 1 if it has one of the extensions
+ */
+int has_image_extension(char* filename) {
+    char* dot = strrchr(filename, '.');
+    if(dot == NULL)
+        return 0;
+    return strcmp(dot, ".png") == 0 || strcmp(dot, ".ppm") == 0 || strcmp(dot, ".pam") == 0;
+}
+
+
+
+/*
+ * new_frame_queue():
+ * Creates a malloc'ed FrameQueue and starts loading the given frames on its
+ * own thread.
+ *
+ * The user must call free_frame_queue() on the returned struct.
+ *
+ * filenames:   The image files of the sequence in order, as from list_frames().
+ *              The queue takes the list, and frees it when it's freed.
+ * num_frames:  The number of files
+ * settings:    A pointer to the LandscapeSettings to load each frame with
+ * capacity:    The most frames to load ahead of time
+ *
+ * return:      A malloc'ed FrameQueue, or NULL on error
+ */
+FrameQueue* new_frame_queue(char** filenames, int num_frames, LandscapeSettings* settings,
+        int capacity) {
+    FrameQueue* queue = (FrameQueue*) calloc(1, sizeof(FrameQueue));
+    if(queue == NULL) {
+        printf("Error allocating FrameQueue\n");
+        return NULL;
+    }
+
+    queue->frames = (Landscape**) calloc(capacity, sizeof(Landscape*));
+    if(queue->frames == NULL) {
+        printf("Error allocating FrameQueue\n");
+        free(queue);
+        return NULL;
+    }
+
+    queue->filenames = filenames;
+    queue->num_frames = num_frames;
+    queue->settings = *settings;
+    queue->capacity = capacity;
+
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->changed, NULL);
+
+    if(pthread_create(&queue->thread, NULL, load_frames, queue) != 0) {
+        printf("Error starting frame loading thread\n");
+        pthread_mutex_destroy(&queue->lock);
+        pthread_cond_destroy(&queue->changed);
+        free(queue->frames);
+        free(queue);
+        return NULL;
+    }
+
+    return queue;
+}
+
+
+
+/*
+ * frame_queue_take():
+ * Takes the next frame of the sequence if it has been loaded, without
+ * waiting.
+ *
+ * The user must call free_landscape() on the returned frame.
+ *
+ * queue:       A pointer to the FrameQueue
+ *
+ * return:      The next frame's Landscape, or NULL if it isn't loaded yet
+ */
+Landscape* frame_queue_take(FrameQueue* queue) {
+    Landscape* frame = NULL;
+
+    pthread_mutex_lock(&queue->lock);
+    if(queue->count > 0) {
+        frame = queue->frames[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+        pthread_cond_broadcast(&queue->changed);
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return frame;
+}
+
+
+
+/*
+ * frame_queue_wait():
+ * Takes the next frame of the sequence, waiting for it to be loaded if it
+ * hasn't been yet. Used for the first frame, before there's anything else to
+ * show.
+ *
+ * The user must call free_landscape() on the returned frame.
+ *
+ * queue:       A pointer to the FrameQueue
+ *
+ * return:      The next frame's Landscape, or NULL if no frame can be loaded
+ */
+Landscape* frame_queue_wait(FrameQueue* queue) {
+    pthread_mutex_lock(&queue->lock);
+    while(queue->count == 0 && !queue->done)
+        pthread_cond_wait(&queue->changed, &queue->lock);
+    pthread_mutex_unlock(&queue->lock);
+
+    return frame_queue_take(queue);
+}
+
+
+
+/*
+ * free_frame_queue():
+ * Stops the loading thread, waiting for it to finish the frame it's loading,
+ * and frees the queue, its list of files and every frame that wasn't taken.
+ *
+ * queue:       A pointer to the FrameQueue to free
+ */
+void free_frame_queue(FrameQueue* queue) {
+    pthread_mutex_lock(&queue->lock);
+    queue->stop = 1;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+
+    pthread_join(queue->thread, NULL);
+
+    for(int i = 0; i < queue->count; i++)
+        free_landscape(queue->frames[(queue->head + i) % queue->capacity]);
+
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->changed);
+    free_frame_list(queue->filenames, queue->num_frames);
+    free(queue->frames);
+    free(queue);
+}
+
+
+
+
+/*
+ * load_frames():
+ * Loads the frames of a FrameQueue in order, looping back to the first after
+ * the last, and waits whenever the queue is full. Frames that can't be loaded
+ * or aren't the size of the first frame are skipped. Runs on its own thread
+ * until the queue is freed, or until a whole pass over the sequence loads
+ * nothing.
+ *
+ * vargp:       Pointer to the FrameQueue
+ *
+ * return:      NULL
+ */
+void* load_frames(void* vargp) {
+    FrameQueue* queue = (FrameQueue*) vargp;
+    int failures = 0; // Frames skipped in a row
+    trace_thread_name("frame loader");
+
+    while(failures < queue->num_frames) {
+        // Wait for room in the queue
+        pthread_mutex_lock(&queue->lock);
+        while(queue->count == queue->capacity && !queue->stop)
+            pthread_cond_wait(&queue->changed, &queue->lock);
+        int stop = queue->stop;
+        pthread_mutex_unlock(&queue->lock);
+        if(stop)
+            break;
+
+        /* Only this thread touches next_frame, width and height, so the frame
+         * can be loaded without holding the lock */
+        char* filename = queue->filenames[queue->next_frame];
+        queue->next_frame = (queue->next_frame + 1) % queue->num_frames;
+
+        Landscape* frame = load_landscape(filename, &queue->settings);
+        if(frame == NULL) {
+            printf("Skipping frame %s: couldn't be loaded\n", filename);
+            failures++;
+            continue;
+        }
+
+        if(queue->width == 0) {
+            queue->width = frame->width;
+            queue->height = frame->height;
+        }
+        else if(frame->width != queue->width || frame->height != queue->height) {
+            printf("Skipping frame %s: %dx%d, but the sequence is %dx%d\n", filename,
+                    frame->width, frame->height, queue->width, queue->height);
+            free_landscape(frame);
+            failures++;
+            continue;
+        }
+        failures = 0;
+
+        pthread_mutex_lock(&queue->lock);
+        queue->frames[(queue->head + queue->count) % queue->capacity] = frame;
+        queue->count++;
+        pthread_cond_broadcast(&queue->changed);
+        pthread_mutex_unlock(&queue->lock);
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    queue->done = 1;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+
+    return NULL;
+}
+
+
+/*
+ * compare_filenames():
+ * Compares two filenames for qsort().
+ *
+ * a:           Pointer to the first filename
+ * b:           Pointer to the second filename
+ *
+ * return:      Negative, zero or positive as a sorts before, with or after b
+ */
+int compare_filenames(const void* a, const void* b) {
+    return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+
+/*
+ * list_directory():
+ * Lists the .png, .ppm and .pam files in the given directory, sorted by name.
+ *
+ * dirname:     The directory to list
+ * num_frames:  Pointer to an int in which the number of files will be stored
+ *
+ * return:      A malloc'ed array of malloc'ed filenames, or NULL on error or if
+ *              there are no image files
+ */
+char** list_directory(char* dirname, int* num_frames) {
+    DIR* dir = opendir(dirname);
+    if(dir == NULL) {
+        printf("Error opening directory %s\n", dirname);
+        return NULL;
+    }
+
+    char** filenames = NULL;
+    int count = 0;
+    int capacity = 0;
+    struct dirent* entry;
+    while((entry = readdir(dir)) != NULL) {
+        if(!has_image_extension(entry->d_name))
+            continue;
+
+        if(count == capacity) {
+            capacity = capacity ? 2*capacity : 64;
+            char** grown = (char**) realloc(filenames, sizeof(char*) * capacity);
+            if(grown == NULL)
+                break;
+            filenames = grown;
+        }
+
+        size_t len = strlen(dirname) + strlen(entry->d_name) + 2;
+        if((filenames[count] = (char*) malloc(len)) == NULL)
+            break;
+        snprintf(filenames[count], len, "%s/%s", dirname, entry->d_name);
+        count++;
+    }
+    closedir(dir);
+
+    if(entry != NULL) {
+        printf("Error allocating frame list\n");
+        free_frame_list(filenames, count);
+        return NULL;
+    }
+    if(count == 0) {
+        printf("Error listing frames: no .png, .ppm or .pam files in %s\n", dirname);
+        free(filenames);
+        return NULL;
+    }
+
+    qsort(filenames, count, sizeof(char*), compare_filenames);
+    *num_frames = count;
+    return filenames;
+}
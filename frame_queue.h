@@ -0,0 +1,151 @@
+#ifndef FRAME_QUEUE_H
+#define FRAME_QUEUE_H
+
+#include <pthread.h>
+
+#include "landscape.h"
+
+/*
+ * FrameQueue:
+ * Loads the frames of an image sequence, such as a time-lapse, on a
+ * background thread. Up to capacity frames are decoded and analyzed ahead of
+ * time into a ring of Landscapes, so taking the next frame never waits on
+ * decoding. The sequence loops back to its first frame after the last.
+ */
+typedef struct frame_queue {
+    char** filenames;
+    int num_frames;
+    int next_frame; // The index of the next file to load
+
+    LandscapeSettings settings;
+
+    // The dimensions of the first frame, which every other frame must match
+    int width;
+    int height;
+
+    // The ring of loaded frames waiting to be taken
+    Landscape** frames;
+    int capacity;
+    int head; // The index of the oldest frame
+    int count;
+
+    /* Boolean, set when the loading thread has stopped, because it was told
+     * to or because no frame of the sequence could be loaded */
+    int done;
+    int stop; // Boolean, tells the loading thread to stop
+
+    pthread_mutex_t lock;
+    pthread_cond_t changed; // Signaled when a frame is added or taken
+    pthread_t thread;
+} FrameQueue;
+
+
+
+/*
+ * list_frames():
+ * Lists the image files of a sequence in order, from either a directory, in
+ * which case every .png, .ppm and .pam file in it is listed, or a glob
+ * pattern such as "frames/frame_*.png".
+ *
+ * The user must call free_frame_list() on the returned list.
+ *
+ * pattern:     The directory or glob pattern
+ * num_frames:  Pointer to an int in which the number of files will be stored
+ *
+ * return:      A malloc'ed array of malloc'ed filenames in sorted order, or
+ *              NULL on error or if there are no matching files
+ */
+char** list_frames(char* pattern, int* num_frames);
+
+
+/*
+ * free_frame_list():
+ * Frees a list of filenames returned by list_frames().
+ *
+ * filenames:   The list to free
+ * num_frames:  The number of filenames in the list
+ */
+void free_frame_list(char** filenames, int num_frames);
+
+
+/*
+ * is_frame_sequence():
+ * Returns whether the given input names an image sequence rather than one
+ * image: a directory, or a pattern with glob characters in it.
+ *
+ * input:       The input given on the command line
+ *
+ * return:      Boolean, 1 if it's an image sequence
+ */
+int is_frame_sequence(char* input);
+
+
+/*
+ * has_image_extension():
+ * Returns whether the given filename ends in .png, .ppm or .pam.
+ *
+ * filename:    The filename to check
+ *
+ * return:      Boolean, 1 if it has one of the extensions
+ */
+int has_image_extension(char* filename);
+
+
+/*
+ * new_frame_queue():
+ * Creates a malloc'ed FrameQueue and starts loading the given frames on its
+ * own thread.
+ *
+ * The user must call free_frame_queue() on the returned struct.
+ *
+ * filenames:   The image files of the sequence in order, as from list_frames().
+ *              The queue takes the list, and frees it when it's freed.
+ * num_frames:  The number of files
+ * settings:    A pointer to the LandscapeSettings to load each frame with
+ * capacity:    The most frames to load ahead of time
+ *
+ * return:      A malloc'ed FrameQueue, or NULL on error
+ */
+FrameQueue* new_frame_queue(char** filenames, int num_frames, LandscapeSettings* settings,
+        int capacity);
+
+
+/*
+ * frame_queue_take():
+ * Takes the next frame of the sequence if it has been loaded, without
+ * waiting.
+ *
+ * The user must call free_landscape() on the returned frame.
+ *
+ * queue:       A pointer to the FrameQueue
+ *
+ * return:      The next frame's Landscape, or NULL if it isn't loaded yet
+ */
+Landscape* frame_queue_take(FrameQueue* queue);
+
+
+/*
+ * frame_queue_wait():
+ * Takes the next frame of the sequence, waiting for it to be loaded if it
+ * hasn't been yet. Used for the first frame, before there's anything else to
+ * show.
+ *
+ * The user must call free_landscape() on the returned frame.
+ *
+ * queue:       A pointer to the FrameQueue
+ *
+ * return:      The next frame's Landscape, or NULL if no frame can be loaded
+ */
+Landscape* frame_queue_wait(FrameQueue* queue);
+
+
+/*
+ * free_frame_queue():
+ * Stops the loading thread, waiting for it to finish the frame it's loading,
+ * and frees the queue, its list of files and every frame that wasn't taken.
+ *
+ * queue:       A pointer to the FrameQueue to free
+ */
+void free_frame_queue(FrameQueue* queue);
+
+#endif
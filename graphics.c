@@ -1,25 +1,42 @@
 #include "graphics.h"
 
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "trace.h"
+
+// The largest window to make when the screen size can't be found
+#define DEFAULT_SCREEN_W 1280
+#define DEFAULT_SCREEN_H 720
+
 
 /* Internal function declarations */
-void clear_rect(Graphics* graphics);
-void set_disp_pixel(Graphics* graphics, int x, int y, Uint32 rgba);
-Uint32 get_orig_pixel(Graphics* graphics, int x, int y);
+int handle_event(Graphics* graphics, SDL_Event* event);
+void zoom(Graphics* graphics, int level);
+int level_size(int size, int level);
+void view_origin(Graphics* graphics, int* vx, int* vy);
+GraphicsTile* get_tile(Graphics* graphics, int level, int tx, int ty);
+GraphicsTile* find_tile(Graphics* graphics, int level, int tx, int ty);
+int fill_tile(Graphics* graphics, GraphicsTile* tile, int level, int tx, int ty);
+void draw_viz(Graphics* graphics, VizSnapshot* snapshot);
 
 
 
 /*
  * create_graphics():
  * Creates a malloc'ed Graphics struct with the specified settings and
- * initializes all the SDL objects. 
+ * initializes all the SDL objects.
+ *
+ * The window is the size of the image, averaged down by powers of 2 until it
+ * fits on the screen.
  *
  * When the user is done, they should call free_graphics() to free
  * all its resources.
  *
  * title:       The title of the graphics window
- * w:           The width of the graphics window
- * h:           The height of the graphics window
+ * w:           The width of the image to display
+ * h:           The height of the image to display
  *
  * return:      A pointer to a malloc'ed Graphics struct.
  */
@@ -30,43 +47,66 @@ Graphics* create_graphics(char* title, int w, int h) {
         return NULL;
     }
 
-    Graphics* graphics = (Graphics*) malloc(sizeof(Graphics));
-    graphics->pixels = NULL;
-    graphics->disp_pixels = NULL;
+    Graphics* graphics = (Graphics*) calloc(1, sizeof(Graphics));
+    if(graphics == NULL) {
+        printf("Error allocating Graphics\n");
+        SDL_Quit();
+        return NULL;
+    }
+    graphics->width = w;
+    graphics->height = h;
+
+    /* Average the image down until it fits on the screen, leaving a margin
+     * for the window's borders and the desktop's panels */
+    int screen_w = DEFAULT_SCREEN_W;
+    int screen_h = DEFAULT_SCREEN_H;
+    SDL_DisplayMode mode;
+    if(SDL_GetDesktopDisplayMode(0, &mode) == 0) {
+        screen_w = mode.w * 9/10;
+        screen_h = mode.h * 9/10;
+    }
+    while(level_size(w, graphics->fit_level) > screen_w || level_size(h, graphics->fit_level) > screen_h)
+        graphics->fit_level++;
+    graphics->level = graphics->fit_level;
+    graphics->win_w = level_size(w, graphics->fit_level);
+    graphics->win_h = level_size(h, graphics->fit_level);
+    graphics->center_x = w/2;
+    graphics->center_y = h/2;
+
+    /* A view that isn't aligned to the tiles shows parts of at most one more
+     * tile across and down than fit in the window */
+    graphics->num_tiles = (graphics->win_w / TILE_SIZE + 2) * (graphics->win_h / TILE_SIZE + 2);
+    graphics->tiles = (GraphicsTile*) calloc(graphics->num_tiles, sizeof(GraphicsTile));
+    graphics->tile_pixels = (unsigned char*) malloc(TILE_SIZE*TILE_SIZE*4);
+    graphics->tile_sums = (unsigned long long*) malloc(TILE_SIZE*4 * sizeof(unsigned long long));
+    if(graphics->tiles == NULL || graphics->tile_pixels == NULL || graphics->tile_sums == NULL) {
+        printf("Error allocating tiles\n");
+        free(graphics->tiles);
+        free(graphics->tile_pixels);
+        free(graphics->tile_sums);
+        free(graphics);
+        SDL_Quit();
+        return NULL;
+    }
+    for(int i = 0; i < graphics->num_tiles; i++)
+        graphics->tiles[i].level = -1;
 
     // Init window
-    graphics->window = SDL_CreateWindow(title, 100, 100, w, h, SDL_WINDOW_SHOWN);
+    graphics->window = SDL_CreateWindow(title, 100, 100, graphics->win_w, graphics->win_h, SDL_WINDOW_SHOWN);
     if(graphics->window == NULL) {
         printf("[SDL] Error creating window: %s\n", SDL_GetError());
-        SDL_Quit();
-        free(graphics);
+        free_graphics(graphics);
         return NULL;
     }
 
     // Init renderer
     graphics->renderer = SDL_CreateRenderer(graphics->window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
     if(graphics->renderer == NULL) {
-        SDL_DestroyWindow(graphics->window);
         printf("[SDL] Error creating renderer: %s\n", SDL_GetError());
-        SDL_Quit();
-        free(graphics);
+        free_graphics(graphics);
         return NULL;
     }
 
-    // Init texture
-    graphics->texture = SDL_CreateTexture(graphics->renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STATIC, w, h);
-    if(graphics->texture == NULL) {
-        SDL_DestroyRenderer(graphics->renderer);
-        SDL_DestroyWindow(graphics->window);
-        printf("[SDL] Error creating texture: %s\n", SDL_GetError());
-        SDL_Quit();
-        free(graphics);
-        return NULL;
-    }
-
-    graphics->width = w;
-    graphics->height = h;
-
     return graphics;
 }
 
@@ -74,215 +114,493 @@ Graphics* create_graphics(char* title, int w, int h) {
 
 /*
  * setPixels():
- * Sets the image of the given Graphics struct to the given pixels. Will
- * overwite any overlays on the previous image.
+ * Sets the image of the given Graphics struct to the given pixels. The tiles
+ * are uploaded from them as they're shown.
+ *
+ * The pixels are kept, not copied, so they must stay valid until they're
+ * replaced or the Graphics is freed.
  *
- * The pixels are in a 1d array, so the width and height arguments specify
- * how to draw the image. The pixel array must have a length of width*height.
+ * The pixels are in a 1d array of RGBA chars, so the width and height
+ * arguments specify how to draw the image. The pixel array must have a length
+ * of width*height*4, and the image must be the size given to
+ * create_graphics().
  *
  * graphics:    A pointer to the Graphics object to alter
- * pixels:      The pixels to save into the Graphics object
+ * pixels:      The RGBA pixels to display
  * width:       The width of the pixel array
  * height:      The height of the pixel array
  */
-void setPixels(Graphics* graphics, Uint32* pixels, int width, int height) {
+void setPixels(Graphics* graphics, unsigned char* pixels, int width, int height) {
     graphics->pixels = pixels;
-    graphics->width = width;
-    graphics->height = height;
+    update_pixels(graphics, 0, 0, width, height);
+}
 
-    // If there were old display pixels, free them
-    if(graphics->disp_pixels != NULL)
-        free(graphics->disp_pixels);
 
-    // Make copy of image in display pixels
-    graphics->disp_pixels = (Uint32*) malloc(sizeof(Uint32)*width*height);
-    memcpy(graphics->disp_pixels, pixels, sizeof(Uint32)*width*height);
 
-    SDL_UpdateTexture(graphics->texture, NULL, graphics->disp_pixels, width*4);
+/*
+ * update_pixels():
+ * Marks one area of the image's pixels as changed, so only the tiles that
+ * cover it are uploaded again.
+ *
+ * graphics:    A pointer to the Graphics object to alter
+ * x:           The top left x coordinate of the area
+ * y:           The top left y coordinate of the area
+ * w:           The width of the area
+ * h:           The height of the area
+ */
+void update_pixels(Graphics* graphics, int x, int y, int w, int h) {
+    for(int i = 0; i < graphics->num_tiles; i++) {
+        GraphicsTile* tile = graphics->tiles + i;
+        if(tile->level < 0)
+            continue;
+
+        // The area the tile covers, in image pixels
+        int span = TILE_SIZE << tile->level;
+        int tile_x = tile->tx * span;
+        int tile_y = tile->ty * span;
+        if(tile_x < x+w && x < tile_x+span && tile_y < y+h && y < tile_y+span)
+            tile->level = -1;
+    }
 }
 
 
 
 /*
- * add_rect():
+ * draw_rect():
  * Displays a rectangle overlayed on the image with the given dimensions.
- * Will clear any previously displayed rectangle.
+ * Will clear any previously displayed rectangle. Shows once the window is
+ * next updated. When zoomed in, the view moves to center on the rectangle.
  *
  * graphics:    A pointer to the graphics object to draw on
- * x:           The top left x coordinate of the rectangle
- * y:           The top left y coordinate of the rectangle
+ * x:           The top left x coordinate of the rectangle in image pixels
+ * y:           The top left y coordinate of the rectangle in image pixels
  * w:           The width of the rectangle
  * h:           The height of the rectangle
  *
  */
 void draw_rect(Graphics* graphics, int x, int y, int width, int height) {
-    clear_rect(graphics);
+    graphics->rect.x = x;
+    graphics->rect.y = y;
+    graphics->rect.w = width;
+    graphics->rect.h = height;
+    graphics->show_rect = 1;
+
+    graphics->center_x = x + width/2;
+    graphics->center_y = y + height/2;
+}
 
-    Uint32 color = 0xFFFFFFFF;
 
-    // Set the borders of this rectangle to white
-    for(int i = x; i < x+width; i++) {
-        set_disp_pixel(graphics, i, y, color);
-        set_disp_pixel(graphics, i, y+height, color);
-    }
-    for(int i = y; i < y+height; i++) {
-        set_disp_pixel(graphics, x, i, color);
-        set_disp_pixel(graphics, x+width, i, color);
+
+/*
+ * updateWindow():
+ * Triggers a redraw of the graphics window with any new image changes.
+ *
+ * graphics:    A pointer to the Graphics struct to redraw
+ */
+void updateWindow(Graphics* graphics) {
+    uint64_t start = trace_begin();
+    SDL_RenderClear(graphics->renderer);
+
+    if(graphics->pixels != NULL) {
+        int level = graphics->level;
+        int lw = level_size(graphics->width, level);
+        int lh = level_size(graphics->height, level);
+        int vx, vy;
+        view_origin(graphics, &vx, &vy);
+
+        // The tiles the view shows
+        int tx0 = vx / TILE_SIZE;
+        int ty0 = vy / TILE_SIZE;
+        int tx1 = (vx + graphics->win_w < lw ? vx + graphics->win_w : lw) - 1;
+        int ty1 = (vy + graphics->win_h < lh ? vy + graphics->win_h : lh) - 1;
+        tx1 /= TILE_SIZE;
+        ty1 /= TILE_SIZE;
+
+        /* Mark the tiles already uploaded that are still needed, so none of
+         * them is reused for a tile that isn't */
+        for(int i = 0; i < graphics->num_tiles; i++)
+            graphics->tiles[i].visible = 0;
+        for(int ty = ty0; ty <= ty1; ty++) {
+            for(int tx = tx0; tx <= tx1; tx++) {
+                GraphicsTile* tile = find_tile(graphics, level, tx, ty);
+                if(tile != NULL)
+                    tile->visible = 1;
+            }
+        }
+
+        for(int ty = ty0; ty <= ty1; ty++) {
+            for(int tx = tx0; tx <= tx1; tx++) {
+                GraphicsTile* tile = get_tile(graphics, level, tx, ty);
+                if(tile == NULL)
+                    continue;
+
+                int tw = lw - tx*TILE_SIZE < TILE_SIZE ? lw - tx*TILE_SIZE : TILE_SIZE;
+                int th = lh - ty*TILE_SIZE < TILE_SIZE ? lh - ty*TILE_SIZE : TILE_SIZE;
+                SDL_Rect src = {0, 0, tw, th};
+                SDL_Rect dst = {tx*TILE_SIZE - vx, ty*TILE_SIZE - vy, tw, th};
+                SDL_RenderCopy(graphics->renderer, tile->texture, &src, &dst);
+            }
+        }
+
+        // Outline the rectangle in white over the image
+        if(graphics->show_rect) {
+            SDL_Rect rect;
+            rect.x = (graphics->rect.x >> level) - vx;
+            rect.y = (graphics->rect.y >> level) - vy;
+            rect.w = graphics->rect.w >> level > 0 ? graphics->rect.w >> level : 1;
+            rect.h = graphics->rect.h >> level > 0 ? graphics->rect.h >> level : 1;
+
+            SDL_SetRenderDrawColor(graphics->renderer, 255, 255, 255, 255);
+            SDL_RenderDrawRect(graphics->renderer, &rect);
+            SDL_SetRenderDrawColor(graphics->renderer, 0, 0, 0, 255);
+        }
     }
 
-    graphics->rect_x = x;
-    graphics->rect_y = y;
-    graphics->rect_w = width;
-    graphics->rect_h = height;
+    if(graphics->viz != NULL)
+        draw_viz(graphics, viz_tap_read(graphics->viz));
+    trace_end("draw window", start);
+
+    // Presenting may wait for the screen's refresh, so it's marked on its own
+    start = trace_begin();
+    SDL_RenderPresent(graphics->renderer);
+    trace_end("present window", start);
 }
 
 
+
 /*
- * clear_rect():
- * Removes the previously created rectangle overlay, setting those pixels
- * back to the original image's
+ * handle_events():
+ * Waits up to the given time for window events, then handles every event
+ * that has arrived: redraws the window if it was uncovered, zooms in and out
+ * with the mouse wheel or the +, - and 0 keys, and reports whether it was
+ * closed. Must be called from the thread that created the Graphics. Sleeps
+ * while waiting, so a loop of calls uses no CPU while the window is idle.
  *
- * graphics:    A pointer to the Graphics struct to clear
+ * graphics:    A pointer to the Graphics object to poll
+ * timeout:     The longest time to wait for an event, in milliseconds
  *
+ * return:      Boolean, whether the window is still open
  */
-void clear_rect(Graphics* graphics) {
-    int x = graphics->rect_x;
-    int y = graphics->rect_y;
-    int w = graphics->rect_w;
-    int h = graphics->rect_h;
+int handle_events(Graphics* graphics, int timeout) {
+    SDL_Event event;
+    if(!SDL_WaitEventTimeout(&event, timeout))
+        return 1;
 
+    // Handle the first event, then any others that are already queued
+    int open = handle_event(graphics, &event);
+    while(SDL_PollEvent(&event))
+        open = handle_event(graphics, &event) && open;
 
-    for(int i = x; i < x + w; i++) {
-        set_disp_pixel(graphics, i, y, get_orig_pixel(graphics, i, y));
-        set_disp_pixel(graphics, i, y+h, get_orig_pixel(graphics, i, y+h));
-    }
-    for(int i = y; i < y + h; i++) {
-        set_disp_pixel(graphics, x, i, get_orig_pixel(graphics, x, i));
-        set_disp_pixel(graphics, x+w, i, get_orig_pixel(graphics, x+w, i));
-    }
+    return open;
 }
 
 
+
 /*
- * set_disp_pixel():
- * Sets the display pixel at the given location to the given value
+ * free_graphics():
+ * Frees any resources associated with SDL. Also frees the passed in pointer.
+ *
+ * graphics:    A pointer to the Graphics object to free
  *
- * graphics:    A pointer to the Graphics struct to alter
- * x:           The x coordinate of the pixel
- * y:           The y coordinate of the pixel
- * rgba:        The color value to set the pixel to
  */
-void set_disp_pixel(Graphics* graphics, int x, int y, Uint32 rgba) {
-    graphics->disp_pixels[graphics->width*y + x] = rgba;
+void free_graphics(Graphics* graphics) {
+    for(int i = 0; i < graphics->num_tiles; i++) {
+        if(graphics->tiles[i].texture != NULL)
+            SDL_DestroyTexture(graphics->tiles[i].texture);
+    }
+    if(graphics->renderer != NULL)
+        SDL_DestroyRenderer(graphics->renderer);
+    if(graphics->window != NULL)
+        SDL_DestroyWindow(graphics->window);
+    SDL_Quit();
+
+    free(graphics->tiles);
+    free(graphics->tile_pixels);
+    free(graphics->tile_sums);
+    free(graphics);
 }
 
+
+
+
 /*
- * get_orig_pixel():
- * Get the original image's pixel value at the given location, without any
- * overlays.
+ * handle_event():
+ * Handles one window event.
  *
- * graphics:    A pointer to the Graphics struct
- * x:           The x coordinate of the pixel
- * y:           The y coordinate of the pixel
+ * graphics:    A pointer to the Graphics object the event is for
+ * event:       The event to handle
  *
- * return :     The color value of the pixel
+ * return:      Boolean, 0 if the event closes the window, 1 otherwise
  */
-Uint32 get_orig_pixel(Graphics* graphics, int x, int y) {
-    return graphics->pixels[graphics->width*y + x];
-}
+int handle_event(Graphics* graphics, SDL_Event* event) {
+    if(event->type == SDL_QUIT)
+        return 0;
+
+    if(event->type == SDL_WINDOWEVENT) {
+        if(event->window.event == SDL_WINDOWEVENT_CLOSE)
+            return 0;
+        if(event->window.event == SDL_WINDOWEVENT_EXPOSED)
+            updateWindow(graphics);
+    }
+    else if(event->type == SDL_MOUSEWHEEL) {
+        if(event->wheel.y > 0)
+            zoom(graphics, graphics->level - 1);
+        else if(event->wheel.y < 0)
+            zoom(graphics, graphics->level + 1);
+    }
+    else if(event->type == SDL_KEYDOWN) {
+        // + shares a key with =
+        if(event->key.keysym.sym == SDLK_EQUALS)
+            zoom(graphics, graphics->level - 1);
+        else if(event->key.keysym.sym == SDLK_MINUS)
+            zoom(graphics, graphics->level + 1);
+        else if(event->key.keysym.sym == SDLK_0)
+            zoom(graphics, graphics->fit_level);
+    }
 
+    return 1;
+}
 
 
 /*
- * updateWindow():
- * Triggers a redraw of the graphics window with any new image changes.
+ * zoom():
+ * Shows the image at the given level of detail, if it's between full
+ * resolution and the fit level, and redraws the window.
  *
- * graphics:    A pointer to the Graphics struct to redraw
+ * graphics:    A pointer to the Graphics object to zoom
+ * level:       The level of detail to show
  */
-void updateWindow(Graphics* graphics) {
-    SDL_UpdateTexture(graphics->texture, NULL, graphics->disp_pixels, graphics->width*4);
-
-    SDL_RenderClear(graphics->renderer);
-    SDL_RenderCopy(graphics->renderer, graphics->texture, NULL, NULL);
-    SDL_RenderPresent(graphics->renderer);
+void zoom(Graphics* graphics, int level) {
+    if(level < 0 || level > graphics->fit_level || level == graphics->level)
+        return;
+    graphics->level = level;
+    updateWindow(graphics);
 }
 
 
-
 /*
- * isWindowOpen():
- * Returns whether the user has pressed the close on the SDL window.
+ * level_size():
+ * Returns the size of one dimension of the image averaged down to the given
+ * level of detail, counting a partial block at the edge.
  *
- * graphics:    A pointer to the Graphics object to poll
+ * size:        The width or height of the image
+ * level:       The level of detail
  *
- * return:      Boolean, whether the close button has been pressed.
+ * return:      The width or height at that level
  */
-int isWindowOpen(Graphics* graphics) {
-    SDL_Event event;
-    SDL_PollEvent(&event);
-    if(event.type == SDL_QUIT || (event.type == SDL_WINDOWEVENT &&
-                event.window.event == SDL_WINDOWEVENT_CLOSE)) {
-        return 0;
-    }
-    return 1;
+int level_size(int size, int level) {
+    return (size + (1 << level) - 1) >> level;
 }
 
 
+/*
+ * view_origin():
+ * Finds the pixel of the current level shown at the window's top left, so
+ * the view is centered where it should be without going past the image.
+ *
+ * graphics:    A pointer to the Graphics object
+ * vx:          Pointer to an int to set to the x coordinate
+ * vy:          Pointer to an int to set to the y coordinate
+ */
+void view_origin(Graphics* graphics, int* vx, int* vy) {
+    int max_x = level_size(graphics->width, graphics->level) - graphics->win_w;
+    int max_y = level_size(graphics->height, graphics->level) - graphics->win_h;
+
+    *vx = (graphics->center_x >> graphics->level) - graphics->win_w/2;
+    *vy = (graphics->center_y >> graphics->level) - graphics->win_h/2;
+    if(*vx > max_x)
+        *vx = max_x;
+    if(*vy > max_y)
+        *vy = max_y;
+    if(*vx < 0)
+        *vx = 0;
+    if(*vy < 0)
+        *vy = 0;
+}
+
 
 /*
- * convert_rgba_ints_to_Uint32():
- * Converts image data from a LodePNG format to an SDL format.
+ * get_tile():
+ * Returns the texture of the given tile, averaging it down and uploading it
+ * in place of a tile that isn't visible if it's not already there.
  *
- * LodePNG format: each R, G, B, A value is a separate char in an array
- * SDL format: each pixel stores RGBA in one Uint32
+ * graphics:    A pointer to the Graphics object
+ * level:       The level of detail of the tile
+ * tx:          The column of the tile
+ * ty:          The row of the tile
  *
- * Because each Uint32 holds 4 char values, the length of the input array 
- * must be divisible by 4.
+ * return:      The tile, or NULL if it couldn't be uploaded
+ */
+GraphicsTile* get_tile(Graphics* graphics, int level, int tx, int ty) {
+    GraphicsTile* tile = find_tile(graphics, level, tx, ty);
+    if(tile != NULL)
+        return tile;
+
+    for(int i = 0; i < graphics->num_tiles; i++) {
+        tile = graphics->tiles + i;
+        if(!tile->visible) {
+            tile->visible = 1;
+            return fill_tile(graphics, tile, level, tx, ty) == 0 ? tile : NULL;
+        }
+    }
+    return NULL;
+}
+
+
+/*
+ * find_tile():
+ * Returns the given tile if it's already uploaded.
  *
- * Returns a malloc'ed array of Uint32s, must be freed unless set as
- * a Graphics struct's pixels. Then, free_graphics() will free it.
+ * graphics:    A pointer to the Graphics object
+ * level:       The level of detail of the tile
+ * tx:          The column of the tile
+ * ty:          The row of the tile
  *
- * pixels:      An array of the char-format pixels
- * length:      The length of the pixel array, must be divisible by 4
+ * return:      The tile, or NULL if it isn't uploaded
+ */
+GraphicsTile* find_tile(Graphics* graphics, int level, int tx, int ty) {
+    for(int i = 0; i < graphics->num_tiles; i++) {
+        GraphicsTile* tile = graphics->tiles + i;
+        if(tile->level == level && tile->tx == tx && tile->ty == ty)
+            return tile;
+    }
+    return NULL;
+}
+
+
+/*
+ * fill_tile():
+ * Uploads one tile of the image to a tile texture, averaging each 2^level by
+ * 2^level block of image pixels into one texture pixel. At full resolution,
+ * the image pixels are uploaded straight from the image.
  *
- * return:      A pointer to a malloc'ed array of Uint32 pixel values
+ * graphics:    A pointer to the Graphics object
+ * tile:        The tile texture to upload to, created if need be
+ * level:       The level of detail of the tile
+ * tx:          The column of the tile
+ * ty:          The row of the tile
  *
+ * return:      0 on success, 1 on error
  */
-Uint32* convert_rgba_ints_to_Uint32(unsigned char* pixels, int length) {
-    if(pixels == NULL)
-        return NULL;
-
-    // 4 RGBA chars to 1 RGBA Uint32
-    if(length % 4 != 0) {
-        printf("Couldn't convert rgba int pixels to Uint32: Must be a multiple of 4 ints\n");
-        return NULL;
+int fill_tile(Graphics* graphics, GraphicsTile* tile, int level, int tx, int ty) {
+    tile->level = -1;
+    if(tile->texture == NULL) {
+        tile->texture = SDL_CreateTexture(graphics->renderer, SDL_PIXELFORMAT_RGBA32,
+                SDL_TEXTUREACCESS_STATIC, TILE_SIZE, TILE_SIZE);
+        if(tile->texture == NULL) {
+            printf("[SDL] Error creating texture: %s\n", SDL_GetError());
+            return 1;
+        }
     }
 
-    Uint32* newpix = (Uint32*) malloc(sizeof(Uint32) * length/4);
-
-    for(int i = 0; i < length; i+= 4) {
-        newpix[i/4] = pixels[i] | (pixels[i+1] << 8) | (pixels[i+2]) << 16 |
-            (pixels[i+2] << 24);
+    int w = graphics->width;
+    int h = graphics->height;
+    int x0 = tx*TILE_SIZE;
+    int y0 = ty*TILE_SIZE;
+    int tw = level_size(w, level) - x0 < TILE_SIZE ? level_size(w, level) - x0 : TILE_SIZE;
+    int th = level_size(h, level) - y0 < TILE_SIZE ? level_size(h, level) - y0 : TILE_SIZE;
+    SDL_Rect area = {0, 0, tw, th};
+
+    /* The texture's RGBA32 format is RGBA bytes in memory order, so full
+     * resolution pixels can be uploaded as they are */
+    if(level == 0) {
+        SDL_UpdateTexture(tile->texture, &area, graphics->pixels + ((size_t) y0*w + x0)*4, w*4);
+    }
+    else {
+        int n = 1 << level;
+        unsigned long long* sums = graphics->tile_sums;
+        for(int oy = 0; oy < th; oy++) {
+            int sy0 = (y0+oy) << level;
+            int sy1 = sy0+n < h ? sy0+n : h;
+
+            memset(sums, 0, tw*4 * sizeof(unsigned long long));
+            for(int sy = sy0; sy < sy1; sy++) {
+                unsigned char* row = graphics->pixels + (size_t) sy*w*4;
+                for(int ox = 0; ox < tw; ox++) {
+                    int sx0 = (x0+ox) << level;
+                    int sx1 = sx0+n < w ? sx0+n : w;
+                    for(int sx = sx0; sx < sx1; sx++) {
+                        for(int c = 0; c < 4; c++)
+                            sums[ox*4 + c] += row[sx*4 + c];
+                    }
+                }
+            }
+
+            unsigned char* out = graphics->tile_pixels + (size_t) oy*tw*4;
+            for(int ox = 0; ox < tw; ox++) {
+                int sx0 = (x0+ox) << level;
+                int sx1 = sx0+n < w ? sx0+n : w;
+                unsigned long long count = (unsigned long long) (sy1-sy0) * (sx1-sx0);
+                for(int c = 0; c < 4; c++)
+                    out[ox*4 + c] = sums[ox*4 + c] / count;
+            }
+        }
+        SDL_UpdateTexture(tile->texture, &area, graphics->tile_pixels, tw*4);
     }
 
-    return newpix;
+    tile->level = level;
+    tile->tx = tx;
+    tile->ty = ty;
+    return 0;
 }
 
 
 /*
- * free_graphics():
- * Frees any resources associated with SDL and frees the saved pixel arrays.
- * Also frees the passed in pointer.
- *
- * graphics:    A pointer to the Graphics object to free
+ * draw_viz():
+ * Draws a snapshot of the audio over the bottom quarter of the window, on a
+ * darkened background: a scope of the output, and a bar for each note
+ * playing, placed by its frequency, whose height is its amplitude now and
+ * whose outline is its base amplitude.
  *
+ * graphics:    A pointer to the Graphics object to draw on
+ * snapshot:    The snapshot to draw
  */
-void free_graphics(Graphics* graphics) {
-    SDL_DestroyTexture(graphics->texture);
-    SDL_DestroyRenderer(graphics->renderer);
-    SDL_DestroyWindow(graphics->window);
-    SDL_Quit();
-    free(graphics->pixels);
-    free(graphics->disp_pixels);
-    free(graphics);
+void draw_viz(Graphics* graphics, VizSnapshot* snapshot) {
+    SDL_Renderer* renderer = graphics->renderer;
+    int w = graphics->win_w;
+    int h = graphics->win_h / 4;
+    int top = graphics->win_h - h;
+
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 160);
+    SDL_Rect band = {0, top, w, h};
+    SDL_RenderFillRect(renderer, &band);
+
+    /* The scope, a vertical line from the lowest to the highest sample of
+     * each point */
+    int mid = top + h/2;
+    SDL_SetRenderDrawColor(renderer, 120, 200, 255, 200);
+    for(int i = 0; i < SCOPE_POINTS; i++) {
+        int x = i * w / SCOPE_POINTS;
+        float lo = snapshot->scope_min[i] < -1 ? -1 : snapshot->scope_min[i];
+        float hi = snapshot->scope_max[i] > 1 ? 1 : snapshot->scope_max[i];
+        SDL_RenderDrawLine(renderer, x, mid - hi*(h/2), x, mid - lo*(h/2));
+    }
+
+    /* The notes, placed on a log scale of frequency */
+    float octaves = log2f(VIZ_MAX_FREQ / (float) VIZ_MIN_FREQ);
+    for(int i = 0; i < snapshot->num_voices; i++) {
+        VizVoice* voice = snapshot->voices + i;
+        float pos = log2f(voice->freq / VIZ_MIN_FREQ) / octaves;
+        if(pos < 0)
+            pos = 0;
+        if(pos > 1)
+            pos = 1;
+        int x = pos * (w - VIZ_BAR_W);
+
+        int full = voice->amplitude / VIZ_MAX_AMP * h;
+        int now = voice->level / VIZ_MAX_AMP * h;
+        full = full > h ? h : full;
+        now = now > h ? h : now;
+
+        SDL_Rect outline = {x, top + h - full, VIZ_BAR_W, full};
+        SDL_Rect bar = {x, top + h - now, VIZ_BAR_W, now};
+        SDL_SetRenderDrawColor(renderer, 255, 200, 120, 90);
+        SDL_RenderDrawRect(renderer, &outline);
+        SDL_SetRenderDrawColor(renderer, 255, 200, 120, 220);
+        SDL_RenderFillRect(renderer, &bar);
+    }
+
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
 }
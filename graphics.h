@@ -3,32 +3,84 @@
 
 #include "SDL2/SDL.h"
 
+#include "viz_tap.h"
+
+// The width and height of each tile texture of the image
+#define TILE_SIZE 256
+
+
+/*
+ * GraphicsTile:
+ * One texture holding a TILE_SIZE by TILE_SIZE tile of the image, at one
+ * level of detail.
+ */
+typedef struct graphics_tile {
+    SDL_Texture* texture; // NULL until the tile is first used
+
+    // Which tile this is, or a level of -1 if it holds nothing
+    int level;
+    int tx;
+    int ty;
+
+    int visible; // Boolean, whether the current view shows this tile
+} GraphicsTile;
+
+
 /*
  * Graphics:
  * Contains all the SDL structs needed do display one image in a graphical
  * window. Also contains variables for drawing a rectangle on top of this
  * image.
+ *
+ * The image is shown at a level of detail: averaged down by 2^level, from
+ * the fit level, where the whole image fits in the window, down to level 0 at
+ * full resolution. The view is drawn from tile textures, which are averaged
+ * down from the image and uploaded the first time they're shown. Only as
+ * many tiles as fill the window are kept, so the textures and uploads are
+ * bounded by the window size however large the image is, and no texture is
+ * ever larger than TILE_SIZE.
+ *
+ * The rectangle is drawn over the tiles by the renderer each time the window
+ * is redrawn, so moving it uploads nothing. So is the visualization of the
+ * audio, if there's a VizTap to read it from.
  */
 typedef struct graphics_container {
     /* SDL Variables */
     SDL_Window* window;
     SDL_Renderer* renderer;
-    SDL_Texture* texture;
 
-    // Holds the unmodified image pixels
-    Uint32* pixels; 
-    // Holds modifications to the original image. This is what's displayed.
-    Uint32* disp_pixels; 
+    // The RGBA image pixels, which aren't owned
+    unsigned char* pixels;
 
-    // Width and height of the image/graphics window
+    // Width and height of the image
     int width;
     int height;
 
+    // Width and height of the window
+    int win_w;
+    int win_h;
+
+    // The current level of detail, and the level the whole image fits at
+    int level;
+    int fit_level;
+
+    // The image pixel at the center of the view when zoomed in
+    int center_x;
+    int center_y;
+
+    // The tile textures, enough to cover the window
+    GraphicsTile* tiles;
+    int num_tiles;
+    unsigned char* tile_pixels; // Scratch space for averaging one tile
+    unsigned long long* tile_sums;
+
     // Dimensions for the rectangle to overlay on the image
-    int rect_x;
-    int rect_y;
-    int rect_w;
-    int rect_h;
+    SDL_Rect rect;
+    int show_rect; // Boolean, whether a rectangle has been drawn
+
+    /* If not NULL, the notes playing and a scope of the output are drawn
+     * along the bottom of the window from the newest snapshot of this */
+    VizTap* viz;
 } Graphics;
 
 
@@ -36,14 +88,17 @@ typedef struct graphics_container {
 /*
  * create_graphics():
  * Creates a malloc'ed Graphics struct with the specified settings and
- * initializes all the SDL objects. 
+ * initializes all the SDL objects.
+ *
+ * The window is the size of the image, averaged down by powers of 2 until it
+ * fits on the screen.
  *
  * When the user is done, they should call free_graphics() to free
  * all its resources.
  *
  * title:       The title of the graphics window
- * w:           The width of the graphics window
- * h:           The height of the graphics window
+ * w:           The width of the image to display
+ * h:           The height of the image to display
  *
  * return:      A pointer to a malloc'ed Graphics struct.
  */
@@ -60,13 +115,14 @@ void updateWindow(Graphics* graphics);
 
 
 /*
- * add_rect():
+ * draw_rect():
  * Displays a rectangle overlayed on the image with the given dimensions.
- * Will clear any previously displayed rectangle.
+ * Will clear any previously displayed rectangle. Shows once the window is
+ * next updated. When zoomed in, the view moves to center on the rectangle.
  *
  * graphics:    A pointer to the graphics object to draw on
- * x:           The top left x coordinate of the rectangle
- * y:           The top left y coordinate of the rectangle
+ * x:           The top left x coordinate of the rectangle in image pixels
+ * y:           The top left y coordinate of the rectangle in image pixels
  * w:           The width of the rectangle
  * h:           The height of the rectangle
  *
@@ -77,60 +133,60 @@ void draw_rect(Graphics* graphics, int x, int y, int width, int height);
 
 /*
  * setPixels():
- * Sets the image of the given Graphics struct to the given pixels. Will
- * overwite any overlays on the previous image.
+ * Sets the image of the given Graphics struct to the given pixels. The tiles
+ * are uploaded from them as they're shown.
+ *
+ * The pixels are kept, not copied, so they must stay valid until they're
+ * replaced or the Graphics is freed.
  *
- * The pixels are in a 1d array, so the width and height arguments specify
- * how to draw the image. The pixel array must have a length of width*height.
+ * The pixels are in a 1d array of RGBA chars, so the width and height
+ * arguments specify how to draw the image. The pixel array must have a length
+ * of width*height*4, and the image must be the size given to
+ * create_graphics().
  *
  * graphics:    A pointer to the Graphics object to alter
- * pixels:      The pixels to save into the Graphics object
+ * pixels:      The RGBA pixels to display
  * width:       The width of the pixel array
  * height:      The height of the pixel array
  */
-void setPixels(Graphics* graphics, Uint32* pixels, int width, int height);
-
+void setPixels(Graphics* graphics, unsigned char* pixels, int width, int height);
 
 
 /*
- * isWindowOpen():
- * Returns whether the user has pressed the close on the SDL window.
- *
- * graphics:    A pointer to the Graphics object to poll
+ * update_pixels():
+ * Marks one area of the image's pixels as changed, so only the tiles that
+ * cover it are uploaded again.
  *
- * return:      Boolean, whether the close button has been pressed.
+ * graphics:    A pointer to the Graphics object to alter
+ * x:           The top left x coordinate of the area
+ * y:           The top left y coordinate of the area
+ * w:           The width of the area
+ * h:           The height of the area
  */
-int isWindowOpen(Graphics* graphics);
+void update_pixels(Graphics* graphics, int x, int y, int w, int h);
 
 
 
 /*
- * convert_rgba_ints_to_Uint32():
- * Converts image data from a LodePNG format to an SDL format.
- *
- * LodePNG format: each R, G, B, A value is a separate char in an array
- * SDL format: each pixel stores RGBA in one Uint32
- *
- * Because each Uint32 holds 4 char values, the length of the input array 
- * must be divisible by 4.
+ * handle_events():
+ * Waits up to the given time for window events, then handles every event
+ * that has arrived: redraws the window if it was uncovered, zooms in and out
+ * with the mouse wheel or the +, - and 0 keys, and reports whether it was
+ * closed. Must be called from the thread that created the Graphics. Sleeps
+ * while waiting, so a loop of calls uses no CPU while the window is idle.
  *
- * Returns a malloc'ed array of Uint32s, must be freed unless set as
- * a Graphics struct's pixels. Then, free_graphics() will free it.
- *
- * pixels:      An array of the char-format pixels
- * length:      The length of the pixel array, must be divisible by 4
- *
- * return:      A pointer to a malloc'ed array of Uint32 pixel values
+ * graphics:    A pointer to the Graphics object to poll
+ * timeout:     The longest time to wait for an event, in milliseconds
  *
+ * return:      Boolean, whether the window is still open
  */
-Uint32* convert_rgba_ints_to_Uint32(unsigned char* pixels, int length);
+int handle_events(Graphics* graphics, int timeout);
 
 
 
 /*
  * free_graphics():
- * Frees any resources associated with SDL and frees the saved pixel arrays.
- * Also frees the passed in pointer.
+ * Frees any resources associated with SDL. Also frees the passed in pointer.
  *
  * graphics:    A pointer to the Graphics object to free
  *
@@ -3,41 +3,256 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "zlib_backend.h"
 
 #define BYTEDEPTH 1 // Number of bytes per value (r, g, b, a)
 #define BYTESPP (BYTEDEPTH*4) // Number of bytes per pixel
 
 
 /* Internal function declarations */
+unsigned char* decode_png(unsigned char* data, size_t size, unsigned int* w, unsigned int* h, int trusted);
+void skip_pnm_space(unsigned char* data, size_t size, size_t* pos);
+int read_pnm_number(unsigned char* data, size_t size, size_t* pos, unsigned* value);
+int read_pnm_token(unsigned char* data, size_t size, size_t* pos, char* token, size_t len);
 void set_pixel(Image* image, int x, int y, int r, int g, int b, int a);
 Pixel* get_pixel(Image* image, int x, int y);
 
 
+/*
+ * open_imagefile():
+ * Decodes the given image file to 8-bit RGBA pixels. The file is mapped into
+ * memory rather than read into a buffer, and .png data is decoded straight
+ * from the mapping, its image data inflated with the backend compiled into
+ * zlib_backend.c. Raw .ppm and .pam files are converted from the mapping, or
+ * used as they are when they're already RGBA.
+ *
+ * The user must call close_imagefile() when done with the image.
+ *
+ * filename:    The image file to load (.png, .ppm or .pam)
+ * trusted:     Boolean, whether to skip checking a .png file's CRC and Adler-32
+ *              checksums. Faster, but a corrupted file may decode to garbage
+ *              instead of giving an error.
+ *
+ * return:      A malloc'ed ImageFile, or NULL on error
+ */
+ImageFile* open_imagefile(char* filename, int trusted) {
+    MappedFile* file = map_file(filename);
+    if(file == NULL)
+        return NULL;
+
+    ImageFile* image = (ImageFile*) malloc(sizeof(ImageFile));
+    if(image == NULL) {
+        unmap_file(file);
+        return NULL;
+    }
+    image->pixels = NULL;
+    image->file = NULL;
+
+    RawHeader header;
+    if(parse_raw_header(file->data, file->size, &header)) {
+        image->width = header.width;
+        image->height = header.height;
+
+        // RGBA files are already in the right format, so use them in place
+        if(header.channels == BYTESPP) {
+            image->pixels = file->data + header.offset;
+            image->file = file;
+            return image;
+        }
+
+        image->pixels = (unsigned char*) malloc((size_t) header.width*header.height*BYTESPP);
+        if(image->pixels != NULL)
+            convert_raw_rows(file->data, &header, 0, header.height, image->pixels);
+    }
+    else
+        image->pixels = decode_png(file->data, file->size, &image->width, &image->height, trusted);
+
+    unmap_file(file);
+
+    if(image->pixels == NULL) {
+        free(image);
+        return NULL;
+    }
+    return image;
+}
+
+
+/*
+ * close_imagefile():
+ * Frees or unmaps the given image's pixels, and frees the passed pointer.
+ *
+ * image:       The ImageFile to close
+ */
+void close_imagefile(ImageFile* image) {
+    if(image->file != NULL)
+        unmap_file(image->file);
+    else
+        free(image->pixels);
+    free(image);
+}
+
+
 /*
  * load_imagefile():
- * Loads a given .png image file to raw pixel data in char format. Sets the
- * image's width and height in the specified pointers. Returns a malloc'ed
- * struct of pixel data, where each char is an R, G, B, or A value of the
- * pixels in order. 
+ * Loads a given image file to raw pixel data in char format. Sets the image's
+ * width and height in the specified pointers. Returns a malloc'ed struct of
+ * pixel data, where each char is an R, G, B, or A value of the pixels in
+ * order. Decodes as open_imagefile() does, but always returns a buffer the
+ * user owns.
  *
  * The user will need to free the array when done with it.
  *
- * filename:    The image file to load (must be .png)
+ * filename:    The image file to load (.png, .ppm or .pam)
  * w:           Pointer to an int in which the image's width will be stored
  * h:           Pointer to an int in which the image's height will be stored
+ * trusted:     Boolean, whether to skip checking a .png file's checksums, as
+ *              in open_imagefile()
  *
  * return:      A malloc'ed array of pixel data, size w*h*4
  */
-unsigned char* load_imagefile(char* filename, unsigned int* w, unsigned int* h) {
-    unsigned char* pixels = 0;
-    if(lodepng_decode_file(&pixels, w, h,
-            filename, LCT_RGBA, BYTEDEPTH*8) != 0) {
+unsigned char* load_imagefile(char* filename, unsigned int* w, unsigned int* h, int trusted) {
+    ImageFile* image = open_imagefile(filename, trusted);
+    if(image == NULL)
         return NULL;
+
+    *w = image->width;
+    *h = image->height;
+
+    // Take the pixels from the image, copying them if they're in the file
+    unsigned char* pixels = image->pixels;
+    if(image->file != NULL) {
+        size_t size = (size_t) image->width*image->height*BYTESPP;
+        pixels = (unsigned char*) malloc(size);
+        if(pixels != NULL)
+            memcpy(pixels, image->pixels, size);
     }
+    else
+        image->pixels = NULL;
 
+    close_imagefile(image);
     return pixels;
 }
 
+
+/*
+ * parse_raw_header():
+ * Reads the header of a raw .ppm or .pam image from the start of a file, and
+ * checks that the file holds all of its pixels.
+ *
+ * data:        The file's contents
+ * size:        The size of the file in bytes
+ * header:      Pointer to a RawHeader to fill in
+ *
+ * return:      1 if the file is a supported raw image, 0 otherwise
+ */
+int parse_raw_header(unsigned char* data, size_t size, RawHeader* header) {
+    if(size < 3 || data[0] != 'P' || (data[1] != '6' && data[1] != '7'))
+        return 0;
+
+    size_t pos = 2;
+    unsigned maxval = 0;
+    header->width = header->height = 0;
+
+    /* PPM: "P6 width height maxval" and then a single whitespace character
+     * before the pixels */
+    if(data[1] == '6') {
+        header->channels = 3;
+        if(!read_pnm_number(data, size, &pos, &header->width) ||
+                !read_pnm_number(data, size, &pos, &header->height) ||
+                !read_pnm_number(data, size, &pos, &maxval) || pos >= size)
+            return 0;
+        pos++;
+    }
+    /* PAM: "P7" and then lines of "NAME value", ending with "ENDHDR" */
+    else {
+        unsigned depth = 0;
+        char token[16];
+        while(1) {
+            if(!read_pnm_token(data, size, &pos, token, sizeof(token)))
+                return 0;
+
+            if(strcmp(token, "ENDHDR") == 0)
+                break;
+            else if(strcmp(token, "WIDTH") == 0) {
+                if(!read_pnm_number(data, size, &pos, &header->width))
+                    return 0;
+            }
+            else if(strcmp(token, "HEIGHT") == 0) {
+                if(!read_pnm_number(data, size, &pos, &header->height))
+                    return 0;
+            }
+            else if(strcmp(token, "DEPTH") == 0) {
+                if(!read_pnm_number(data, size, &pos, &depth))
+                    return 0;
+            }
+            else if(strcmp(token, "MAXVAL") == 0) {
+                if(!read_pnm_number(data, size, &pos, &maxval))
+                    return 0;
+            }
+
+            // Skip the rest of the line, such as a TUPLTYPE's value
+            while(pos < size && data[pos] != '\n')
+                pos++;
+        }
+
+        // The pixels start on the line after ENDHDR
+        while(pos < size && data[pos] != '\n')
+            pos++;
+        pos++;
+
+        if(depth != 3 && depth != 4)
+            return 0;
+        header->channels = depth;
+    }
+
+    // Only 8 bits per value are supported
+    if(maxval != 255 || header->width == 0 || header->height == 0 || pos > size)
+        return 0;
+    header->offset = pos;
+
+    // Make sure the file is long enough, without overflowing
+    size_t pixels = (size - pos) / header->channels;
+    if(header->height > pixels / header->width)
+        return 0;
+
+    return 1;
+}
+
+
+/*
+ * convert_raw_rows():
+ * Converts rows of a raw image's pixels to 8-bit RGBA.
+ *
+ * data:        The raw image file's contents
+ * header:      The file's RawHeader
+ * y:           The first row to convert
+ * rows:        The number of rows to convert
+ * out:         A buffer to fill, must hold rows*width*4 chars
+ */
+void convert_raw_rows(unsigned char* data, RawHeader* header, unsigned y, unsigned rows,
+        unsigned char* out) {
+    size_t channels = header->channels;
+    unsigned char* in = data + header->offset + (size_t) y*header->width*channels;
+    size_t num_pixels = (size_t) rows*header->width;
+
+    if(channels == BYTESPP) {
+        memcpy(out, in, num_pixels*BYTESPP);
+        return;
+    }
+
+    // RGB, so add an opaque alpha value to each pixel
+    for(size_t i = 0; i < num_pixels; i++) {
+        out[BYTESPP*i] = in[channels*i];
+        out[BYTESPP*i + 1] = in[channels*i + 1];
+        out[BYTESPP*i + 2] = in[channels*i + 2];
+        out[BYTESPP*i + 3] = 255;
+    }
+}
+
+
 /*
  * load_to_image():
  * Converts an array of char pixel data to an Image struct.
@@ -202,3 +417,124 @@ void free_image(Image* image) {
     free(image);
 }
 
+
+
+
+
+/*
+ * decode_png():
+ * Decodes .png data in memory to 8-bit RGBA pixels.
+ *
+ * data:        The .png file's contents
+ * size:        The size of the data in bytes
+ * w:           Pointer to an int in which the image's width will be stored
+ * h:           Pointer to an int in which the image's height will be stored
+ * trusted:     Boolean, whether to skip checking the CRC and Adler-32 checksums
+ *
+ * return:      A malloc'ed array of pixel data, size w*h*4, or NULL on error
+ */
+unsigned char* decode_png(unsigned char* data, size_t size, unsigned int* w, unsigned int* h, int trusted) {
+    LodePNGState state;
+    lodepng_state_init(&state);
+    state.info_raw.colortype = LCT_RGBA;
+    state.info_raw.bitdepth = BYTEDEPTH*8;
+
+    /* Knowing the size of the inflated image data lets the backend allocate it
+     * once. Each scanline has an extra byte saying how it's filtered. */
+    ZlibBackendContext context;
+    context.expected_size = 0;
+    if(lodepng_inspect(w, h, &state, data, size) == 0 && state.info_png.interlace_method == 0)
+        context.expected_size = (size_t) *h * (lodepng_get_raw_size(*w, 1, &state.info_png.color) + 1);
+    use_zlib_backend(&state.decoder.zlibsettings, &context);
+
+    if(trusted) {
+        state.decoder.ignore_crc = 1;
+        state.decoder.zlibsettings.ignore_adler32 = 1;
+    }
+
+    unsigned char* pixels = NULL;
+    unsigned err = lodepng_decode(&pixels, w, h, &state, data, size);
+    lodepng_state_cleanup(&state);
+
+    if(err) {
+        free(pixels);
+        return NULL;
+    }
+
+    return pixels;
+}
+
+
+/*
+ * skip_pnm_space():
+ * Moves past any whitespace and comments in a .ppm or .pam header.
+ *
+ * data:        The file's contents
+ * size:        The size of the file in bytes
+ * pos:         Pointer to the position in the file, which is advanced
+ */
+void skip_pnm_space(unsigned char* data, size_t size, size_t* pos) {
+    while(*pos < size) {
+        if(data[*pos] == '#') {
+            while(*pos < size && data[*pos] != '\n')
+                (*pos)++;
+        }
+        else if(isspace(data[*pos]))
+            (*pos)++;
+        else
+            break;
+    }
+}
+
+
+/*
+ * read_pnm_number():
+ * Reads the next decimal number in a .ppm or .pam header.
+ *
+ * data:        The file's contents
+ * size:        The size of the file in bytes
+ * pos:         Pointer to the position in the file, which is advanced
+ * value:       Pointer to an int in which the number will be stored
+ *
+ * return:      1 on success, 0 if there is no number or it's too large
+ */
+int read_pnm_number(unsigned char* data, size_t size, size_t* pos, unsigned* value) {
+    skip_pnm_space(data, size, pos);
+    if(*pos >= size || !isdigit(data[*pos]))
+        return 0;
+
+    unsigned long long n = 0;
+    while(*pos < size && isdigit(data[*pos])) {
+        n = n*10 + (data[(*pos)++] - '0');
+        if(n > 0xFFFFFFFFULL)
+            return 0;
+    }
+    *value = n;
+    return 1;
+}
+
+
+/*
+ * read_pnm_token():
+ * Reads the next word in a .pam header.
+ *
+ * data:        The file's contents
+ * size:        The size of the file in bytes
+ * pos:         Pointer to the position in the file, which is advanced
+ * token:       A buffer in which the word will be stored
+ * len:         The size of the buffer
+ *
+ * return:      1 on success, 0 if there is no word or it doesn't fit
+ */
+int read_pnm_token(unsigned char* data, size_t size, size_t* pos, char* token, size_t len) {
+    skip_pnm_space(data, size, pos);
+
+    size_t n = 0;
+    while(*pos < size && !isspace(data[*pos])) {
+        if(n+1 >= len)
+            return 0;
+        token[n++] = data[(*pos)++];
+    }
+    token[n] = '\0';
+    return n > 0;
+}
@@ -1,7 +1,10 @@
 #ifndef image_h
 #define image_h
 
+#include <stddef.h>
+
 #include "lodepng.h"
+#include "mapped_file.h"
 
 /* 
  * Pixel:
@@ -26,22 +29,111 @@ typedef struct image {
 } Image;
 
 
+/*
+ * RawHeader:
+ * The header of a raw, uncompressed image file: a binary PPM (P6) holding RGB
+ * pixels or a PAM (P7) holding RGB or RGBA pixels, 8 bits per value.
+ */
+typedef struct raw_header {
+    unsigned width;
+    unsigned height;
+    int channels; // 3 for RGB, 4 for RGBA
+    size_t offset; // Where the pixel data starts in the file
+} RawHeader;
+
+
+/*
+ * ImageFile:
+ * A decoded image file's pixels. For PAM files that hold RGBA pixels, the
+ * pixels are the file's own data, mapped into memory and never copied.
+ */
+typedef struct image_file {
+    unsigned char* pixels; // 8-bit RGBA pixel data, width*height*4 chars
+    unsigned width;
+    unsigned height;
+
+    /* The mapped file when pixels point into it, in which case they must not
+     * be freed. Otherwise NULL, and pixels are malloc'ed. */
+    MappedFile* file;
+} ImageFile;
+
+
+/*
+ * open_imagefile():
+ * Decodes the given image file to 8-bit RGBA pixels. The file is mapped into
+ * memory rather than read into a buffer, and .png data is decoded straight
+ * from the mapping, its image data inflated with the backend compiled into
+ * zlib_backend.c. Raw .ppm and .pam files are converted from the mapping, or
+ * used as they are when they're already RGBA.
+ *
+ * The user must call close_imagefile() when done with the image.
+ *
+ * filename:    The image file to load (.png, .ppm or .pam)
+ * trusted:     Boolean, whether to skip checking a .png file's CRC and Adler-32
+ *              checksums. Faster, but a corrupted file may decode to garbage
+ *              instead of giving an error.
+ *
+ * return:      A malloc'ed ImageFile, or NULL on error
+ */
+ImageFile* open_imagefile(char* filename, int trusted);
+
+
+/*
+ * close_imagefile():
+ * Frees or unmaps the given image's pixels, and frees the passed pointer.
+ *
+ * image:       The ImageFile to close
+ */
+void close_imagefile(ImageFile* image);
+
+
 /*
  * load_imagefile():
- * Loads a given .png image file to raw pixel data in char format. Sets the
- * image's width and height in the specified pointers. Returns a malloc'ed
- * struct of pixel data, where each char is an R, G, B, or A value of the
- * pixels in order. 
+ * Loads a given image file to raw pixel data in char format. Sets the image's
+ * width and height in the specified pointers. Returns a malloc'ed struct of
+ * pixel data, where each char is an R, G, B, or A value of the pixels in
+ * order. Decodes as open_imagefile() does, but always returns a buffer the
+ * user owns.
  *
  * The user will need to free the array when done with it.
  *
- * filename:    The image file to load (must be .png)
+ * filename:    The image file to load (.png, .ppm or .pam)
  * w:           Pointer to an int in which the image's width will be stored
  * h:           Pointer to an int in which the image's height will be stored
+ * trusted:     Boolean, whether to skip checking a .png file's checksums, as
+ *              in open_imagefile()
  *
  * return:      A malloc'ed array of pixel data, size w*h*4
  */
-unsigned char* load_imagefile(char* filename, unsigned int* w, unsigned int* h);
+unsigned char* load_imagefile(char* filename, unsigned int* w, unsigned int* h, int trusted);
+
+
+/*
+ * parse_raw_header():
+ * Reads the header of a raw .ppm or .pam image from the start of a file, and
+ * checks that the file holds all of its pixels.
+ *
+ * data:        The file's contents
+ * size:        The size of the file in bytes
+ * header:      Pointer to a RawHeader to fill in
+ *
+ * return:      1 if the file is a supported raw image, 0 otherwise
+ */
+int parse_raw_header(unsigned char* data, size_t size, RawHeader* header);
+
+
+/*
+ * convert_raw_rows():
+ * Converts rows of a raw image's pixels to 8-bit RGBA.
+ *
+ * data:        The raw image file's contents
+ * header:      The file's RawHeader
+ * y:           The first row to convert
+ * rows:        The number of rows to convert
+ * out:         A buffer to fill, must hold rows*width*4 chars
+ */
+void convert_raw_rows(unsigned char* data, RawHeader* header, unsigned y, unsigned rows,
+        unsigned char* out);
 
 
 /*
@@ -0,0 +1,352 @@
+#include "image_watcher.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+#include "frame_queue.h"
+#include "trace.h"
+
+// How often the loading thread checks whether it should stop, in ms
+#define POLL_MS 200
+
+// How long to sleep between checks for readers to finish, in ms
+#define GRACE_POLL_MS 1
+
+
+/* Internal function declarations */
+#ifdef __linux__
+void* watch_images(void* vargp);
+void load_image(ImageWatcher* watcher, char* filename);
+void publish_landscape(ImageWatcher* watcher, Landscape* landscape);
+void wait_for_readers(ImageWatcher* watcher);
+char* newest_image(char* dirname);
+#endif
+void sleep_ms(int ms);
+
+
+
+/*
+ * new_image_watcher():
+ * Creates a malloc'ed ImageWatcher and starts watching the given directory.
+ * The newest .png, .ppm or .pam image already in the directory, if any, is
+ * loaded first, then each image written or moved into the directory after.
+ * Images that can't be loaded or aren't the size of the first are skipped.
+ *
+ * The user must call free_image_watcher() on the returned struct.
+ *
+ * dirname:     The directory to watch
+ * settings:    A pointer to the LandscapeSettings to load each image with
+ *
+ * return:      A malloc'ed ImageWatcher, or NULL on error
+ */
+ImageWatcher* new_image_watcher(char* dirname, LandscapeSettings* settings) {
+    #ifndef __linux__
+    printf("Error watching %s: only supported on Linux\n", dirname);
+    return NULL;
+    #else
+    ImageWatcher* watcher = (ImageWatcher*) calloc(1, sizeof(ImageWatcher));
+    if(watcher == NULL) {
+        printf("Error allocating ImageWatcher\n");
+        return NULL;
+    }
+    watcher->dirname = dirname;
+    watcher->settings = *settings;
+
+    /* Start watching before looking for existing images, so an image written
+     * in between isn't missed */
+    watcher->inotify_fd = inotify_init();
+    if(watcher->inotify_fd < 0 ||
+            inotify_add_watch(watcher->inotify_fd, dirname, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        printf("Error watching directory %s\n", dirname);
+        if(watcher->inotify_fd >= 0)
+            close(watcher->inotify_fd);
+        free(watcher);
+        return NULL;
+    }
+
+    if(pthread_create(&watcher->thread, NULL, watch_images, watcher) != 0) {
+        printf("Error starting image watching thread\n");
+        close(watcher->inotify_fd);
+        free(watcher);
+        return NULL;
+    }
+
+    return watcher;
+    #endif
+}
+
+
+
+/*
+ * image_watcher_read_lock():
+ * Starts reading the watcher's current Landscape. The Landscape won't be
+ * freed until image_watcher_read_unlock() is called, even if a new one is
+ * published in the meantime. Never waits.
+ *
+ * watcher:     A pointer to the ImageWatcher
+ * reader:      Pointer to an ImageReader to fill in, which must be passed to
+ *              image_watcher_read_unlock()
+ *
+ * return:      The current Landscape, or NULL if no image has been loaded yet
+ */
+Landscape* image_watcher_read_lock(ImageWatcher* watcher, ImageReader* reader) {
+    reader->parity = __atomic_load_n(&watcher->epoch, __ATOMIC_SEQ_CST) & 1;
+    __atomic_add_fetch(&watcher->readers[reader->parity], 1, __ATOMIC_SEQ_CST);
+
+    /* The generation is read first: if it's new, the Landscape read after it
+     * is at least as new */
+    reader->generation = __atomic_load_n(&watcher->generation, __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&watcher->current, __ATOMIC_SEQ_CST);
+}
+
+
+
+/*
+ * image_watcher_read_unlock():
+ * Finishes reading the Landscape returned by image_watcher_read_lock().
+ *
+ * watcher:     A pointer to the ImageWatcher
+ * reader:      The ImageReader filled in by image_watcher_read_lock()
+ */
+void image_watcher_read_unlock(ImageWatcher* watcher, ImageReader* reader) {
+    __atomic_sub_fetch(&watcher->readers[reader->parity], 1, __ATOMIC_SEQ_CST);
+}
+
+
+
+/*
+ * image_watcher_wait():
+ * Waits for the watcher's first image to be loaded, then starts reading it as
+ * image_watcher_read_lock() does. Gives up if the given function says to
+ * stop, which is checked every time the watcher is polled.
+ *
+ * watcher:     A pointer to the ImageWatcher
+ * reader:      Pointer to an ImageReader to fill in, which must be passed to
+ *              image_watcher_read_unlock() unless NULL is returned
+ * stop:        A function that returns nonzero to stop waiting, e.g. when the
+ *              user asks to quit
+ *
+ * return:      The current Landscape, or NULL if told to stop first
+ */
+Landscape* image_watcher_wait(ImageWatcher* watcher, ImageReader* reader, int (*stop)()) {
+    Landscape* landscape;
+    while((landscape = image_watcher_read_lock(watcher, reader)) == NULL) {
+        image_watcher_read_unlock(watcher, reader);
+        if(stop())
+            return NULL;
+        sleep_ms(POLL_MS);
+    }
+    return landscape;
+}
+
+
+
+/*
+ * free_image_watcher():
+ * Stops watching, waiting for the image being loaded if there is one, and
+ * frees the watcher and its current Landscape. There must be no readers left.
+ *
+ * watcher:     A pointer to the ImageWatcher to free
+ */
+void free_image_watcher(ImageWatcher* watcher) {
+    #ifdef __linux__
+    __atomic_store_n(&watcher->stop, 1, __ATOMIC_SEQ_CST);
+    pthread_join(watcher->thread, NULL);
+    close(watcher->inotify_fd);
+    #endif
+
+    if(watcher->current != NULL)
+        free_landscape(watcher->current);
+    free(watcher);
+}
+
+
+
+
+#ifdef __linux__
+/*
+ * watch_images():
+ * Loads the newest image already in the watched directory, then waits for
+ * new ones and loads each as it arrives. Runs on its own thread until the
+ * watcher is freed.
+ *
+ * vargp:       Pointer to the ImageWatcher
+ *
+ * return:      NULL
+ */
+void* watch_images(void* vargp) {
+    ImageWatcher* watcher = (ImageWatcher*) vargp;
+    trace_thread_name("image watcher");
+
+    char* filename = newest_image(watcher->dirname);
+    if(filename != NULL) {
+        load_image(watcher, filename);
+        free(filename);
+    }
+    else
+        printf("Waiting for an image in %s, press any key to quit...\n", watcher->dirname);
+
+    // Events must be read into a buffer aligned for struct inotify_event
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd pfd;
+    pfd.fd = watcher->inotify_fd;
+    pfd.events = POLLIN;
+
+    while(!__atomic_load_n(&watcher->stop, __ATOMIC_SEQ_CST)) {
+        if(poll(&pfd, 1, POLL_MS) <= 0)
+            continue;
+
+        ssize_t len = read(watcher->inotify_fd, events, sizeof(events));
+        if(len <= 0)
+            continue;
+
+        /* If several images arrived at once, only the last is worth loading,
+         * since it would replace the others straight away */
+        char* last = NULL;
+        for(char* p = events; p < events + len; ) {
+            struct inotify_event* event = (struct inotify_event*) p;
+            if(event->len > 0 && has_image_extension(event->name))
+                last = event->name;
+            p += sizeof(struct inotify_event) + event->len;
+        }
+        if(last == NULL)
+            continue;
+
+        size_t size = strlen(watcher->dirname) + strlen(last) + 2;
+        filename = (char*) malloc(size);
+        if(filename == NULL) {
+            printf("Error allocating filename of %s\n", last);
+            continue;
+        }
+        snprintf(filename, size, "%s/%s", watcher->dirname, last);
+        load_image(watcher, filename);
+        free(filename);
+    }
+
+    return NULL;
+}
+
+
+/*
+ * load_image():
+ * Loads the given image and publishes it as the watcher's current Landscape,
+ * unless it can't be loaded or isn't the size of the first image.
+ *
+ * watcher:     A pointer to the ImageWatcher
+ * filename:    The image file to load
+ */
+void load_image(ImageWatcher* watcher, char* filename) {
+    Landscape* landscape = load_landscape(filename, &watcher->settings);
+    if(landscape == NULL) {
+        printf("Skipping image %s: couldn't be loaded\n", filename);
+        return;
+    }
+
+    if(watcher->width == 0) {
+        watcher->width = landscape->width;
+        watcher->height = landscape->height;
+    }
+    else if(landscape->width != watcher->width || landscape->height != watcher->height) {
+        printf("Skipping image %s: %dx%d, but the first image was %dx%d\n", filename,
+                landscape->width, landscape->height, watcher->width, watcher->height);
+        free_landscape(landscape);
+        return;
+    }
+
+    publish_landscape(watcher, landscape);
+    printf("Now playing %s\n", filename);
+}
+
+
+/*
+ * publish_landscape():
+ * Swaps the given Landscape in as the watcher's current one, then frees the
+ * old one once no reader can still be using it.
+ *
+ * watcher:     A pointer to the ImageWatcher
+ * landscape:   The Landscape to publish
+ */
+void publish_landscape(ImageWatcher* watcher, Landscape* landscape) {
+    Landscape* old = __atomic_exchange_n(&watcher->current, landscape, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&watcher->generation, 1, __ATOMIC_SEQ_CST);
+
+    if(old != NULL) {
+        wait_for_readers(watcher);
+        free_landscape(old);
+    }
+}
+
+
+/*
+ * wait_for_readers():
+ * Waits until every reader that started before this call has finished.
+ *
+ * Moving to a new epoch sends new readers to the other counter, so the
+ * counter of the previous epoch only goes down. A reader that read the epoch
+ * just before the move may still join the old counter, so this is done twice,
+ * which leaves both counters clear of readers from before the call.
+ *
+ * watcher:     A pointer to the ImageWatcher
+ */
+void wait_for_readers(ImageWatcher* watcher) {
+    for(int i = 0; i < 2; i++) {
+        unsigned old_epoch = __atomic_fetch_add(&watcher->epoch, 1, __ATOMIC_SEQ_CST);
+        while(__atomic_load_n(&watcher->readers[old_epoch & 1], __ATOMIC_SEQ_CST) != 0)
+            sleep_ms(GRACE_POLL_MS);
+    }
+}
+
+
+/*
+ * newest_image():
+ * Returns the filename of the most recently modified .png, .ppm or .pam image
+ * in the given directory.
+ *
+ * dirname:     The directory to look in
+ *
+ * return:      The malloc'ed filename, or NULL if there are no images
+ */
+char* newest_image(char* dirname) {
+    int num_images;
+    char** images = list_frames(dirname, &num_images);
+    if(images == NULL)
+        return NULL;
+
+    struct stat st;
+    int newest = -1;
+    time_t newest_time = 0;
+    for(int i = 0; i < num_images; i++) {
+        if(stat(images[i], &st) == 0 && (newest < 0 || st.st_mtime >= newest_time)) {
+            newest = i;
+            newest_time = st.st_mtime;
+        }
+    }
+
+    char* filename = newest >= 0 ? strdup(images[newest]) : NULL;
+    free_frame_list(images, num_images);
+    return filename;
+}
+#endif
+
+
+/*
+ * sleep_ms():
+ * Sleeps for the given number of milliseconds.
+ *
+ * ms:          The time to sleep in milliseconds
+ */
+void sleep_ms(int ms) {
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000L;
+    nanosleep(&ts, NULL);
+}
@@ -0,0 +1,128 @@
+#ifndef IMAGE_WATCHER_H
+#define IMAGE_WATCHER_H
+
+#include <pthread.h>
+
+#include "landscape.h"
+
+/* Watching a directory needs inotify, so is only supported on Linux */
+
+
+/*
+ * ImageWatcher:
+ * Watches a directory for new images, and loads each one on a background
+ * thread as it's written. The loaded Landscape is then published in place of
+ * the current one with an atomic pointer swap.
+ *
+ * Readers use the current Landscape between image_watcher_read_lock() and
+ * image_watcher_read_unlock(), which never block. Readers are counted in one
+ * of two counters, picked by the parity of the epoch when they start. After a
+ * swap, the loading thread moves on through two epochs, waiting each time for
+ * the readers of the previous one to finish, before freeing the old
+ * Landscape. Any reader that could have seen the old Landscape has finished
+ * by then.
+ */
+typedef struct image_watcher {
+    char* dirname;
+    LandscapeSettings settings;
+
+    // The dimensions of the first image, which every other image must match
+    int width;
+    int height;
+
+    // Only read or written with atomic operations
+    Landscape* current; // The published Landscape, NULL until the first one
+    unsigned generation; // Incremented each time a Landscape is published
+    unsigned epoch;
+    int readers[2]; // The number of readers started in even and odd epochs
+
+    int inotify_fd;
+    int stop; // Boolean, tells the loading thread to stop
+    pthread_t thread;
+} ImageWatcher;
+
+
+/*
+ * ImageReader:
+ * A reader of an ImageWatcher's current Landscape, from
+ * image_watcher_read_lock() until image_watcher_read_unlock().
+ */
+typedef struct image_reader {
+    int parity; // Which of the watcher's reader counters this reader is in
+
+    /* The generation of the Landscape being read. Differs from the one read
+     * before whenever a new image has been published since. */
+    unsigned generation;
+} ImageReader;
+
+
+
+/*
+ * new_image_watcher():
+ * Creates a malloc'ed ImageWatcher and starts watching the given directory.
+ * The newest .png, .ppm or .pam image already in the directory, if any, is
+ * loaded first, then each image written or moved into the directory after.
+ * Images that can't be loaded or aren't the size of the first are skipped.
+ *
+ * The user must call free_image_watcher() on the returned struct.
+ *
+ * dirname:     The directory to watch
+ * settings:    A pointer to the LandscapeSettings to load each image with
+ *
+ * return:      A malloc'ed ImageWatcher, or NULL on error
+ */
+ImageWatcher* new_image_watcher(char* dirname, LandscapeSettings* settings);
+
+
+/*
+ * image_watcher_read_lock():
+ * Starts reading the watcher's current Landscape. The Landscape won't be
+ * freed until image_watcher_read_unlock() is called, even if a new one is
+ * published in the meantime. Never waits.
+ *
+ * watcher:     A pointer to the ImageWatcher
+ * reader:      Pointer to an ImageReader to fill in, which must be passed to
+ *              image_watcher_read_unlock()
+ *
+ * return:      The current Landscape, or NULL if no image has been loaded yet
+ */
+Landscape* image_watcher_read_lock(ImageWatcher* watcher, ImageReader* reader);
+
+
+/*
+ * image_watcher_read_unlock():
+ * Finishes reading the Landscape returned by image_watcher_read_lock().
+ *
+ * watcher:     A pointer to the ImageWatcher
+ * reader:      The ImageReader filled in by image_watcher_read_lock()
+ */
+void image_watcher_read_unlock(ImageWatcher* watcher, ImageReader* reader);
+
+
+/*
+ * image_watcher_wait():
+ * Waits for the watcher's first image to be loaded, then starts reading it as
+ * image_watcher_read_lock() does. Gives up if the given function says to
+ * stop, which is checked every time the watcher is polled.
+ *
+ * watcher:     A pointer to the ImageWatcher
+ * reader:      Pointer to an ImageReader to fill in, which must be passed to
+ *              image_watcher_read_unlock() unless NULL is returned
+ * stop:        A function that returns nonzero to stop waiting, e.g. when the
+ *              user asks to quit
+ *
+ * return:      The current Landscape, or NULL if told to stop first
+ */
+Landscape* image_watcher_wait(ImageWatcher* watcher, ImageReader* reader, int (*stop)());
+
+
+/*
+ * free_image_watcher():
+ * Stops watching, waiting for the image being loaded if there is one, and
+ * frees the watcher and its current Landscape. There must be no readers left.
+ *
+ * watcher:     A pointer to the ImageWatcher to free
+ */
+void free_image_watcher(ImageWatcher* watcher);
+
+#endif
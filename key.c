@@ -2,42 +2,254 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+
+// The most notes in an octave of any ScaleMode
+#define MAX_STEPS 7
+
+
+/*
+ * ScaleDef:
+ * The name of a ScaleMode and its steps up from the root, in semitones.
+ */
+typedef struct scale_def {
+    char* name;
+    int len;
+    int steps[MAX_STEPS];
+} ScaleDef;
+
+
+/*
+ * TuningDef:
+ * The name of a Tuning and the size in cents of each of the 12 semitones
+ * above the root. Any other temperament is one more row of cents.
+ */
+typedef struct tuning_def {
+    char* name;
+    double cents[12];
+} TuningDef;
+
+
+/* Indexed by ScaleMode */
+static const ScaleDef SCALES[] = {
+    {"major",            7, {0, 2, 4, 5, 7, 9, 11}},
+    {"minor",            7, {0, 2, 3, 5, 7, 8, 10}},
+    {"harmonic",         7, {0, 2, 3, 5, 7, 8, 11}},
+    {"melodic",          7, {0, 2, 3, 5, 7, 9, 11}},
+    {"dorian",           7, {0, 2, 3, 5, 7, 9, 10}},
+    {"phrygian",         7, {0, 1, 3, 5, 7, 8, 10}},
+    {"lydian",           7, {0, 2, 4, 6, 7, 9, 11}},
+    {"mixolydian",       7, {0, 2, 4, 5, 7, 9, 10}},
+    {"locrian",          7, {0, 1, 3, 5, 6, 8, 10}},
+    {"pentatonic",       5, {0, 2, 4, 7, 9}},
+    {"minor-pentatonic", 5, {0, 3, 5, 7, 10}}
+};
+#define NUM_SCALES (int) (sizeof(SCALES) / sizeof(SCALES[0]))
+
+
+/* Indexed by Tuning. Just intonation is 5-limit, and meantone is
+ * quarter-comma, with the wolf fifth between G# and Eb. */
+static const TuningDef TUNINGS[] = {
+    {"equal",       {0, 100, 200, 300, 400, 500, 600, 700, 800, 900, 1000, 1100}},
+    {"just",        {0, 111.73, 203.91, 315.64, 386.31, 498.04, 590.22, 701.96, 813.69, 884.36, 1017.60, 1088.27}},
+    {"pythagorean", {0, 90.22, 203.91, 294.13, 407.82, 498.04, 611.73, 701.96, 792.18, 905.87, 996.09, 1109.78}},
+    {"meantone",    {0, 76.05, 193.16, 310.26, 386.31, 503.42, 579.47, 696.58, 772.63, 889.74, 1006.84, 1082.89}}
+};
+#define NUM_TUNINGS (int) (sizeof(TUNINGS) / sizeof(TUNINGS[0]))
+
+
+
+/*
+ * make_key():
+ * Computes the frequencies of a scale and saves them in a malloc'ed Key
+ * struct, from the root in the lowest octave up to the root of the octave
+ * above the highest, in order.
+ *
+ * Ex: make_key(0, MODE_MAJOR, 2, 5, TUNING_EQUAL) is C major from C2 (65.41
+ * Hz) up to C7 (2093 Hz), 36 notes.
+ *
+ * The user must call free_key() on this struct.
+ *
+ * root:        The root of the scale, in semitones above C, from 0 to 11
+ * mode:        The ScaleMode of the scale
+ * low_octave:  The octave of the lowest root, in scientific pitch notation
+ * octaves:     The number of octaves the scale spans
+ * tuning:      The Tuning of the notes
+ *
+ * return:      A malloc'ed Key struct, or NULL on error
+ */
+Key* make_key(int root, int mode, int low_octave, int octaves, int tuning) {
+    if(root < 0 || root > 11 || mode < 0 || mode >= NUM_SCALES
+            || tuning < 0 || tuning >= NUM_TUNINGS || octaves < 1) {
+        printf("Error making key: invalid root, mode, tuning or octaves\n");
+        return NULL;
+    }
+    const ScaleDef* scale = SCALES + mode;
+    const double* cents = TUNINGS[tuning].cents;
+
+    Key* key = (Key*) malloc(sizeof(Key));
+    if(key == NULL) {
+        printf("Error allocating Key\n");
+        return NULL;
+    }
+    key->len = octaves * scale->len + 1;
+    key->freqs = (float*) malloc(sizeof(float) * key->len);
+    if(key->freqs == NULL) {
+        printf("Error allocating Key\n");
+        free(key);
+        return NULL;
+    }
+
+    // The lowest root, in equal temperament from A4, 9 semitones above C4
+    double low_root = REFERENCE_A4 * pow(2, (root - 9) / 12.0 + (low_octave - 4));
+
+    int i = 0;
+    for(int octave = 0; octave < octaves; octave++) {
+        for(int step = 0; step < scale->len; step++)
+            key->freqs[i++] = low_root * pow(2, octave + cents[scale->steps[step]] / 1200);
+    }
+    key->freqs[i] = low_root * pow(2, octaves);
+
+    return key;
+}
+
+
+
+/*
+ * parse_root():
+ * Converts the name of a note, such as "c", "F#" or "Bb", to its number of
+ * semitones above C.
+ *
+ * name:        The name of the note
+ *
+ * return:      The semitones above C, from 0 to 11, or -1 if the name isn't
+ *              recognized
+ */
+int parse_root(char* name) {
+    // Semitones above C of the notes A to G
+    int letters[7] = {9, 11, 0, 2, 4, 5, 7};
+
+    char letter = name[0] | 32; // Lower case
+    if(letter < 'a' || letter > 'g')
+        return -1;
+    int root = letters[letter - 'a'];
+
+    if(name[1] == '#')
+        root++;
+    else if(name[1] == 'b')
+        root--;
+    if(name[1] != '\0' && name[2] != '\0')
+        return -1;
+    if(name[1] != '\0' && name[1] != '#' && name[1] != 'b')
+        return -1;
+
+    return (root + 12) % 12;
+}
+
+
+
+/*
+ * parse_mode():
+ * Converts the name of a scale, as given on the command line, to its
+ * ScaleMode value.
+ *
+ * name:        The name of the scale, such as "major" or "dorian"
+ *
+ * return:      The ScaleMode, or -1 if the name isn't recognized
+ */
+int parse_mode(char* name) {
+    for(int i = 0; i < NUM_SCALES; i++) {
+        if(strcasecmp(name, SCALES[i].name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+
+
+/*
+ * parse_tuning():
+ * Converts the name of a tuning, as given on the command line, to its Tuning
+ * value.
+ *
+ * name:        The name of the tuning, such as "equal" or "just"
+ *
+ * return:      The Tuning, or -1 if the name isn't recognized
+ */
+int parse_tuning(char* name) {
+    for(int i = 0; i < NUM_TUNINGS; i++) {
+        if(strcasecmp(name, TUNINGS[i].name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+
 
 /*
  * load_key():
  * Reads in a file of frequencies and saves them in a malloc'ed Key struct.
- * The file must contain one frequency value per line and nothing else.
+ * The frequencies must be positive numbers separated by whitespace, usually
+ * one per line, and nothing else. The file is read in one pass.
  *
  * The user must call free_key() on this struct.
  *
  * filename:    The file to read
  *
- * return:      A malloc'ed Key struct
+ * return:      A malloc'ed Key struct, or NULL on error
  */
 Key* load_key(char* filename) {
-    Key* key = (Key*) malloc(sizeof(Key));
     FILE* f = fopen(filename, "r");
-
-    int len = 0;
-    char c;
-    /* First read through the file, figure out its length */
-    while((c = fgetc(f)) != EOF) {
-        if(c == '\n')
-            len++;
+    if(f == NULL) {
+        printf("Error opening key file %s\n", filename);
+        return NULL;
     }
-    
-    // Go to beginning of file
-    rewind(f);
 
-    key->freqs = (float*) malloc(sizeof(float) * len);
+    float* freqs = NULL;
+    int len = 0;
+    int capacity = 0;
+    int err = 0;
 
-    /* Now scan in each freq. */
-    for(int i = 0; i < len; i++) {
-        fscanf(f, "%f", key->freqs+i);
+    /* Scan in each freq., growing the array as it fills */
+    float freq;
+    int read;
+    while((read = fscanf(f, "%f", &freq)) == 1) {
+        if(freq <= 0) {
+            err = 1;
+            break;
+        }
+        if(len == capacity) {
+            capacity = capacity > 0 ? capacity*2 : 64;
+            float* more = (float*) realloc(freqs, sizeof(float) * capacity);
+            if(more == NULL) {
+                err = 1;
+                break;
+            }
+            freqs = more;
+        }
+        freqs[len++] = freq;
     }
 
+    // Anything but the end of the file stopped the scan
+    if(read != EOF || ferror(f))
+        err = 1;
     fclose(f);
 
+    if(err || len == 0) {
+        printf("Error reading key file %s: expected positive frequencies\n", filename);
+        free(freqs);
+        return NULL;
+    }
+
+    Key* key = (Key*) malloc(sizeof(Key));
+    if(key == NULL) {
+        printf("Error allocating Key\n");
+        free(freqs);
+        return NULL;
+    }
+    key->freqs = freqs;
     key->len = len;
 
     return key;
@@ -1,6 +1,9 @@
 #ifndef KEY_H
 #define KEY_H
 
+// The frequency of A4, which every tuning's notes are pitched from
+#define REFERENCE_A4 440.0
+
 /*
  * Key:
  * Holds the frequencies associated with a given key signature/scale
@@ -11,16 +14,105 @@ typedef struct key {
 } Key;
 
 
+/* The scales a Key can be made in, as the steps up from the root of each
+ * note of an octave. MODE_MELODIC is the ascending melodic minor. */
+typedef enum scale_mode {
+    MODE_MAJOR,
+    MODE_MINOR,
+    MODE_HARMONIC,
+    MODE_MELODIC,
+    MODE_DORIAN,
+    MODE_PHRYGIAN,
+    MODE_LYDIAN,
+    MODE_MIXOLYDIAN,
+    MODE_LOCRIAN,
+    MODE_PENTATONIC,
+    MODE_MINOR_PENTATONIC
+} ScaleMode;
+
+
+/* How the 12 notes of an octave are tuned above the root of a Key. The root
+ * itself is always tuned in equal temperament from REFERENCE_A4, so keys in
+ * every tuning share their roots. */
+typedef enum tuning {
+    TUNING_EQUAL,
+    TUNING_JUST,
+    TUNING_PYTHAGOREAN,
+    TUNING_MEANTONE
+} Tuning;
+
+
+
+/*
+ * make_key():
+ * Computes the frequencies of a scale and saves them in a malloc'ed Key
+ * struct, from the root in the lowest octave up to the root of the octave
+ * above the highest, in order.
+ *
+ * Ex: make_key(0, MODE_MAJOR, 2, 5, TUNING_EQUAL) is C major from C2 (65.41
+ * Hz) up to C7 (2093 Hz), 36 notes.
+ *
+ * The user must call free_key() on this struct.
+ *
+ * root:        The root of the scale, in semitones above C, from 0 to 11
+ * mode:        The ScaleMode of the scale
+ * low_octave:  The octave of the lowest root, in scientific pitch notation
+ * octaves:     The number of octaves the scale spans
+ * tuning:      The Tuning of the notes
+ *
+ * return:      A malloc'ed Key struct, or NULL on error
+ */
+Key* make_key(int root, int mode, int low_octave, int octaves, int tuning);
+
+
+/*
+ * parse_root():
+ * Converts the name of a note, such as "c", "F#" or "Bb", to its number of
+ * semitones above C.
+ *
+ * name:        The name of the note
+ *
+ * return:      The semitones above C, from 0 to 11, or -1 if the name isn't
+ *              recognized
+ */
+int parse_root(char* name);
+
+
+/*
+ * parse_mode():
+ * Converts the name of a scale, as given on the command line, to its
+ * ScaleMode value.
+ *
+ * name:        The name of the scale, such as "major" or "dorian"
+ *
+ * return:      The ScaleMode, or -1 if the name isn't recognized
+ */
+int parse_mode(char* name);
+
+
+/*
+ * parse_tuning():
+ * Converts the name of a tuning, as given on the command line, to its Tuning
+ * value.
+ *
+ * name:        The name of the tuning, such as "equal" or "just"
+ *
+ * return:      The Tuning, or -1 if the name isn't recognized
+ */
+int parse_tuning(char* name);
+
+
 /*
  * load_key():
  * Reads in a file of frequencies and saves them in a malloc'ed Key struct.
- * The file must contain one frequency value per line and nothing else.
+ * The frequencies must be positive numbers separated by whitespace, usually
+ * one per line, and nothing else. The file is read in one pass.
  *
  * The user must call free_key() on this struct.
  *
  * filename:    The file to read
  *
- * return:      A malloc'ed Key struct
+ * return:      A malloc'ed Key struct, or NULL on error
  */
 Key* load_key(char* filename);
 
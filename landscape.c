@@ -0,0 +1,403 @@
+#include "landscape.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "image.h"
+#include "png_stream.h"
+#include "feature_cache.h"
+#include "trace.h"
+
+#define BYTESPP 4 // Number of bytes per pixel of RGBA data
+
+// How many rows to decode at a time when streaming
+#define STREAM_BAND_ROWS 64
+
+/* When streaming, the largest number of samples level 0 of the pyramid can
+ * have. The image is averaged down by powers of 2 until it fits. */
+#define STREAM_MAX_SAMPLES (1 << 22)
+
+/* The minimum number of samples across the whole image when computing its
+ * overall stats. The image pyramid is read at the coarsest level that still
+ * has this many. */
+#define IMAGE_SAMPLES 64
+
+
+/* Internal function declarations */
+int load_whole(Landscape* landscape, char* filename, LandscapeSettings* settings);
+int load_streamed(Landscape* landscape, char* filename, LandscapeSettings* settings);
+int stream_shift(int w, int h);
+int analysis_shift(int w, int h, LandscapeSettings* settings);
+void add_display_rows(Landscape* landscape, unsigned long long* sums, int shift,
+        unsigned char* rows, int y, int num_rows);
+
+
+
+/*
+ * load_landscape():
+ * Decodes and analyzes the given image file, returning a malloc'ed Landscape.
+ *
+ * When decoding the whole image at once, the pyramid has one sample per pixel
+ * and the display pixels are the image itself, or a copy of it if the image
+ * is mapped straight from the file. When streaming, both are
+ * averaged down as the rows are decoded, far enough that the pyramid's level 0
+ * stays under a fixed number of samples however large the image is. With
+ * settings->analysis_size, the pyramid alone is averaged down further, and the
+ * display pixels keep their resolution.
+ *
+ * If settings->use_cache is set, the pyramid and overall stats are mapped from
+ * the image's cache file when it has a valid one, and the image is only decoded
+ * if display pixels are wanted. Otherwise they're computed and the cache file
+ * is written for next time.
+ *
+ * The user must call free_landscape() on the returned struct.
+ *
+ * filename:    The image file to load (.png, .ppm or .pam)
+ * settings:    A pointer to the LandscapeSettings to load with
+ *
+ * return:      A malloc'ed Landscape, or NULL on error
+ */
+Landscape* load_landscape(char* filename, LandscapeSettings* settings) {
+    Landscape* landscape = (Landscape*) calloc(1, sizeof(Landscape));
+    if(landscape == NULL) {
+        printf("Error allocating Landscape\n");
+        return NULL;
+    }
+    uint64_t load_start = trace_begin();
+
+    // Try to skip the analysis by mapping a cache file from an earlier run
+    uint64_t hash;
+    int hashed = settings->use_cache && hash_file(filename, &hash) == 0;
+    if(hashed) {
+        uint64_t start = trace_begin();
+        landscape->pyramid = load_feature_cache(filename, hash,
+                &landscape->brightness, &landscape->warmth);
+        trace_end("load feature cache", start);
+        if(landscape->pyramid != NULL) {
+            landscape->width = landscape->pyramid->width;
+            landscape->height = landscape->pyramid->height;
+        }
+
+        /* A cached pyramid coarser than these settings ask for is made again.
+         * A finer one is only read at the levels needed. */
+        if(landscape->pyramid != NULL && landscape->pyramid->shift >
+                analysis_shift(landscape->width, landscape->height, settings)) {
+            free_pyramid(landscape->pyramid);
+            landscape->pyramid = NULL;
+        }
+    }
+    int cached = landscape->pyramid != NULL;
+
+    // Decode the image, building its pyramid unless it was cached
+    if(!cached || settings->keep_display) {
+        int err;
+        if(settings->stream)
+            err = load_streamed(landscape, filename, settings);
+        else
+            err = load_whole(landscape, filename, settings);
+
+        if(err) {
+            free_landscape(landscape);
+            return NULL;
+        }
+    }
+
+    /* Precompute the features of each region, so regions can be picked by
+     * content without rescanning pixels */
+    uint64_t start = trace_begin();
+    landscape->index = build_feature_index(landscape->pyramid, settings->region_w, settings->region_h);
+    trace_end("build feature index", start);
+    if(landscape->index == NULL) {
+        free_landscape(landscape);
+        return NULL;
+    }
+
+    if(!cached) {
+        // The overall brightness and warmth, which pick the key
+        start = trace_begin();
+        float variance;
+        pyramid_region_stats(landscape->pyramid, 0, 0, landscape->width, landscape->height,
+                IMAGE_SAMPLES, &landscape->brightness, &landscape->warmth, &variance);
+        trace_end("image stats", start);
+
+        // A failed write only costs the next run its head start
+        if(hashed) {
+            start = trace_begin();
+            save_feature_cache(filename, hash, landscape->pyramid,
+                    landscape->brightness, landscape->warmth);
+            trace_end("save feature cache", start);
+        }
+    }
+
+    trace_end("load landscape", load_start);
+    return landscape;
+}
+
+
+
+/*
+ * free_landscape():
+ * Frees the given Landscape and all of its resources.
+ *
+ * landscape:   A pointer to the Landscape to free
+ */
+void free_landscape(Landscape* landscape) {
+    if(landscape->pyramid != NULL)
+        free_pyramid(landscape->pyramid);
+    if(landscape->index != NULL)
+        free_feature_index(landscape->index);
+    if(landscape->image != NULL)
+        close_imagefile(landscape->image);
+    else
+        free(landscape->display);
+    free(landscape);
+}
+
+
+
+
+/*
+ * load_whole():
+ * Decodes the whole image into memory at once and builds its Pyramid, unless
+ * the Landscape already has one.
+ *
+ * landscape:   A pointer to the Landscape to fill in
+ * filename:    The image file to load
+ * settings:    A pointer to the LandscapeSettings to load with
+ *
+ * return:      0 on success, 1 on error
+ */
+int load_whole(Landscape* landscape, char* filename, LandscapeSettings* settings) {
+    uint64_t start = trace_begin();
+    ImageFile* image = open_imagefile(filename, settings->trusted);
+    trace_end("decode", start);
+    if(image == NULL) {
+        printf("Error loading image file %s\n", filename);
+        return 1;
+    }
+
+    int w = image->width;
+    int h = image->height;
+    landscape->width = w;
+    landscape->height = h;
+
+    if(landscape->pyramid == NULL) {
+        start = trace_begin();
+        landscape->pyramid = build_pyramid(image->pixels, w, h,
+                analysis_shift(w, h, settings), settings->threads);
+        trace_end("build pyramid", start);
+        if(landscape->pyramid == NULL) {
+            close_imagefile(image);
+            return 1;
+        }
+    }
+
+    /* Pixels mapped straight from the file are copied for display, as drawing
+     * reads them long after loading, and would crash if the file were
+     * rewritten in place meanwhile, as a watched file may be */
+    if(settings->keep_display && image->file != NULL) {
+        size_t size = (size_t) w*h*BYTESPP;
+        landscape->display = (unsigned char*) malloc(size);
+        if(landscape->display == NULL) {
+            printf("Error allocating display pixels\n");
+            close_imagefile(image);
+            return 1;
+        }
+        memcpy(landscape->display, image->pixels, size);
+        landscape->display_w = w;
+        landscape->display_h = h;
+        landscape->display_scale = 1;
+        close_imagefile(image);
+    }
+    // Otherwise the decoded pixels can be displayed as they are
+    else if(settings->keep_display) {
+        landscape->image = image;
+        landscape->display = image->pixels;
+        landscape->display_w = w;
+        landscape->display_h = h;
+        landscape->display_scale = 1;
+    }
+    else
+        close_imagefile(image);
+
+    return 0;
+}
+
+
+/*
+ * load_streamed():
+ * Decodes the image a band of rows at a time, feeding each band into the
+ * Pyramid and the display pixels before decoding the next, so the full
+ * resolution image is never in memory. If the Landscape already has a Pyramid,
+ * only the display pixels are made.
+ *
+ * landscape:   A pointer to the Landscape to fill in
+ * filename:    The image file to load
+ * settings:    A pointer to the LandscapeSettings to load with
+ *
+ * return:      0 on success, 1 on error
+ */
+int load_streamed(Landscape* landscape, char* filename, LandscapeSettings* settings) {
+    PngStream* stream = open_png_stream(filename, settings->trusted);
+    if(stream == NULL) {
+        printf("Error loading image file %s\n", filename);
+        return 1;
+    }
+
+    int w = stream->width;
+    int h = stream->height;
+    landscape->width = w;
+    landscape->height = h;
+
+    // The display pixels are averaged down until they're few enough
+    int shift = stream_shift(w, h);
+
+    int build = landscape->pyramid == NULL;
+    PyramidBuilder* builder = build ? new_pyramid_builder(w, h,
+            analysis_shift(w, h, settings), settings->threads) : NULL;
+    unsigned char* band = (unsigned char*) malloc((size_t) STREAM_BAND_ROWS*w*BYTESPP);
+    unsigned long long* sums = NULL;
+
+    if(settings->keep_display) {
+        landscape->display_scale = 1 << shift;
+        landscape->display_w = (w + (1 << shift) - 1) >> shift;
+        landscape->display_h = (h + (1 << shift) - 1) >> shift;
+        landscape->display = (unsigned char*) malloc((size_t) landscape->display_w *
+                landscape->display_h*BYTESPP);
+        sums = (unsigned long long*) calloc(landscape->display_w*BYTESPP, sizeof(unsigned long long));
+    }
+
+    if((build && builder == NULL) || band == NULL ||
+            (settings->keep_display && (landscape->display == NULL || sums == NULL))) {
+        printf("Error allocating buffers to stream %s\n", filename);
+        if(builder != NULL)
+            free_pyramid_builder(builder);
+        free(band);
+        free(sums);
+        close_png_stream(stream);
+        return 1;
+    }
+
+    /* Decode one band at a time, handing each one to the builders */
+    int y = 0;
+    int rows;
+    uint64_t start = trace_begin();
+    while((rows = png_stream_read_rows(stream, band, STREAM_BAND_ROWS)) > 0) {
+        trace_end("decode band", start);
+        start = trace_begin();
+        if(build)
+            pyramid_builder_add_rows(builder, band, rows);
+        if(settings->keep_display)
+            add_display_rows(landscape, sums, shift, band, y, rows);
+        y += rows;
+        trace_end("analyze band", start);
+        start = trace_begin();
+    }
+
+    free(band);
+    free(sums);
+    close_png_stream(stream);
+
+    if(rows < 0) {
+        if(build)
+            free_pyramid_builder(builder);
+        return 1;
+    }
+
+    if(build) {
+        landscape->pyramid = pyramid_builder_finish(builder);
+        if(landscape->pyramid == NULL)
+            return 1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * stream_shift():
+ * Returns how many times an image of the given size is halved when streaming
+ * it, so that it has at most STREAM_MAX_SAMPLES samples.
+ *
+ * w:           The width of the image in pixels
+ * h:           The height of the image in pixels
+ *
+ * return:      Log2 of the number of pixels across each sample
+ */
+int stream_shift(int w, int h) {
+    int shift = 0;
+    while((long long) ((w + (1 << shift) - 1) >> shift) *
+            ((h + (1 << shift) - 1) >> shift) > STREAM_MAX_SAMPLES)
+        shift++;
+    return shift;
+}
+
+
+/*
+ * analysis_shift():
+ * Returns how many times an image of the given size is halved for level 0 of
+ * its Pyramid: enough to fit settings->analysis_size, and at least as much as
+ * stream_shift() when streaming.
+ *
+ * w:           The width of the image in pixels
+ * h:           The height of the image in pixels
+ * settings:    A pointer to the LandscapeSettings being loaded with
+ *
+ * return:      Log2 of the number of pixels across each level 0 sample
+ */
+int analysis_shift(int w, int h, LandscapeSettings* settings) {
+    int shift = settings->stream ? stream_shift(w, h) : 0;
+    if(settings->analysis_size > 0) {
+        while(((w + (1 << shift) - 1) >> shift) > settings->analysis_size ||
+                ((h + (1 << shift) - 1) >> shift) > settings->analysis_size)
+            shift++;
+    }
+    return shift;
+}
+
+
+/*
+ * add_display_rows():
+ * Adds rows of decoded pixels to the Landscape's display pixels, averaging
+ * each 2^shift by 2^shift block into one display pixel.
+ *
+ * landscape:   A pointer to the Landscape being loaded
+ * sums:        Running RGBA sums for the row of display pixels being
+ *              accumulated, 4 per display pixel
+ * shift:       Log2 of the number of image pixels across each display pixel
+ * rows:        The char RGBA pixel data of the rows
+ * y:           The image row of the first row given
+ * num_rows:    The number of rows given
+ */
+void add_display_rows(Landscape* landscape, unsigned long long* sums, int shift,
+        unsigned char* rows, int y, int num_rows) {
+    int w = landscape->width;
+    int block = 1 << shift;
+
+    for(int r = 0; r < num_rows; r++, y++) {
+        unsigned char* row = rows + (size_t) r*w*BYTESPP;
+        for(int x = 0; x < w; x++) {
+            for(int c = 0; c < BYTESPP; c++)
+                sums[BYTESPP*(x >> shift) + c] += row[BYTESPP*x + c];
+        }
+
+        // Once the last row of a block is added, average it
+        if(((y+1) & (block-1)) != 0 && y+1 != landscape->height)
+            continue;
+
+        int dy = y >> shift;
+        int block_h = y+1 - (dy << shift);
+        unsigned char* out = landscape->display + (size_t) dy*landscape->display_w*BYTESPP;
+        for(int dx = 0; dx < landscape->display_w; dx++) {
+            int block_w = w - (dx << shift);
+            if(block_w > block)
+                block_w = block;
+
+            for(int c = 0; c < BYTESPP; c++) {
+                out[BYTESPP*dx + c] = sums[BYTESPP*dx + c] / (block_w*block_h);
+                sums[BYTESPP*dx + c] = 0;
+            }
+        }
+    }
+}
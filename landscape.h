@@ -0,0 +1,111 @@
+#ifndef LANDSCAPE_H
+#define LANDSCAPE_H
+
+#include "image.h"
+#include "pyramid.h"
+#include "region_index.h"
+
+/*
+ * LandscapeSettings:
+ * Options for how load_landscape() decodes and analyzes an image.
+ */
+typedef struct landscape_settings {
+    // The size of each region of the image indexed, in pixels
+    int region_w;
+    int region_h;
+
+    /* The largest width and height of the image's analysis in samples. The
+     * image is averaged down by powers of 2 until level 0 of its pyramid fits,
+     * so the pyramid's size is bounded however large the image is. 0 to
+     * analyze at full resolution. */
+    int analysis_size;
+
+    /* Boolean, whether to decode the image a band of rows at a time instead of
+     * all at once. Memory use then grows with the image's width rather than
+     * its area. */
+    int stream;
+
+    // Boolean, whether to keep pixels for displaying the image
+    int keep_display;
+
+    /* Boolean, whether to load the analysis from the image's cache file (see
+     * feature_cache.h) when it has one, and write one when it doesn't */
+    int use_cache;
+
+    /* Boolean, whether to skip checking the image file's checksums, for images
+     * known to be intact. See load_imagefile(). */
+    int trusted;
+
+    // The number of threads to analyze the image with, 0 for one per processor
+    int threads;
+} LandscapeSettings;
+
+
+/*
+ * Landscape:
+ * Everything the composition needs from an image: its analysis Pyramid, the
+ * FeatureIndex of its regions and its overall stats. Optionally also holds
+ * pixels to display the image with.
+ */
+typedef struct landscape {
+    Pyramid* pyramid;
+    FeatureIndex* index;
+
+    // The dimensions of the image in pixels
+    int width;
+    int height;
+
+    float brightness; // Average brightness of the whole image, between 0 and 1
+    float warmth; // Average warmth of the whole image, between -255 and 255
+
+    /* Char RGBA pixel data for display, display_w*display_h pixels, or NULL if
+     * not kept. Each display pixel is the average of a display_scale by
+     * display_scale block of image pixels. */
+    unsigned char* display;
+    int display_w;
+    int display_h;
+    int display_scale;
+
+    /* The decoded image when the display pixels are its own pixels, which are
+     * then freed with it, or NULL if the display pixels are malloc'ed */
+    ImageFile* image;
+} Landscape;
+
+
+
+/*
+ * load_landscape():
+ * Decodes and analyzes the given image file, returning a malloc'ed Landscape.
+ *
+ * When decoding the whole image at once, the pyramid has one sample per pixel
+ * and the display pixels are the image itself, or a copy of it if the image
+ * is mapped straight from the file. When streaming, both are
+ * averaged down as the rows are decoded, far enough that the pyramid's level 0
+ * stays under a fixed number of samples however large the image is. With
+ * settings->analysis_size, the pyramid alone is averaged down further, and the
+ * display pixels keep their resolution.
+ *
+ * If settings->use_cache is set, the pyramid and overall stats are mapped from
+ * the image's cache file when it has a valid one, and the image is only decoded
+ * if display pixels are wanted. Otherwise they're computed and the cache file
+ * is written for next time.
+ *
+ * The user must call free_landscape() on the returned struct.
+ *
+ * filename:    The image file to load (.png, .ppm or .pam)
+ * settings:    A pointer to the LandscapeSettings to load with
+ *
+ * return:      A malloc'ed Landscape, or NULL on error
+ */
+Landscape* load_landscape(char* filename, LandscapeSettings* settings);
+
+
+/*
+ * free_landscape():
+ * Frees the given Landscape and all of its resources.
+ *
+ * landscape:   A pointer to the Landscape to free
+ */
+void free_landscape(Landscape* landscape);
+
+#endif
@@ -39,6 +39,18 @@ Rename this file to lodepng.cpp to use it for C++, or to lodepng.c to use it for
 #include <stdlib.h> /* allocations */
 #endif /* LODEPNG_COMPILE_ALLOCATORS */
 
+/*SIMD scanline unfiltering, see unfilterScanlineSIMD. Define LODEPNG_NO_SIMD to disable.*/
+#if !defined(LODEPNG_NO_SIMD) && defined(__SSE2__)
+#define LODEPNG_SIMD_SSE2
+#include <emmintrin.h>
+#if defined(__SSSE3__)
+#include <tmmintrin.h> /* _mm_abs_epi16 */
+#endif /* __SSSE3__ */
+#elif !defined(LODEPNG_NO_SIMD) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define LODEPNG_SIMD_NEON
+#include <arm_neon.h>
+#endif /* LODEPNG_NO_SIMD */
+
 #if defined(_MSC_VER) && (_MSC_VER >= 1310) /*Visual Studio: A few warning types are not desired here.*/
 #pragma warning( disable : 4244 ) /*implicit conversions: not warned by gcc -Wall -Wextra and requires too much casts*/
 #pragma warning( disable : 4996 ) /*VS does not like fopen, but fopen_s is not standard C so unusable here*/
@@ -4098,6 +4110,198 @@ unsigned lodepng_inspect(unsigned* w, unsigned* h, LodePNGState* state,
   return state->error;
 }
 
+#if defined(LODEPNG_SIMD_SSE2) || defined(LODEPNG_SIMD_NEON)
+/*
+SIMD versions of the PNG filters for images with 3 or 4 bytes per pixel (8-bit RGB and RGBA,
+or 16-bit grey with alpha), the most common kinds of image. Sub, Average and Paeth depend on
+the pixel to the left, so they work on one whole pixel at a time, all of its channels at once.
+Up has no such dependency and works on 16 bytes at a time for any bytewidth.
+The pixels are read and written a byte at a time since recon and scanline may be the same
+memory, and a 4 byte access of a 3 byte pixel would touch the next one.
+*/
+
+static unsigned simdLoadPixel(const unsigned char* p, size_t bytewidth) {
+  unsigned v = (unsigned)p[0] | ((unsigned)p[1] << 8u) | ((unsigned)p[2] << 16u);
+  if(bytewidth == 4) v |= (unsigned)p[3] << 24u;
+  return v;
+}
+
+static void simdStorePixel(unsigned char* p, unsigned v, size_t bytewidth) {
+  p[0] = (unsigned char)v;
+  p[1] = (unsigned char)(v >> 8u);
+  p[2] = (unsigned char)(v >> 16u);
+  if(bytewidth == 4) p[3] = (unsigned char)(v >> 24u);
+}
+
+#if defined(LODEPNG_SIMD_SSE2)
+
+static __m128i sse2LoadPixel(const unsigned char* p, size_t bytewidth) {
+  return _mm_cvtsi32_si128((int)simdLoadPixel(p, bytewidth));
+}
+
+static void sse2StorePixel(unsigned char* p, __m128i v, size_t bytewidth) {
+  simdStorePixel(p, (unsigned)_mm_cvtsi128_si32(v), bytewidth);
+}
+
+static __m128i sse2Abs16(__m128i x) {
+#if defined(__SSSE3__)
+  return _mm_abs_epi16(x);
+#else
+  return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+#endif
+}
+
+/*mask ? a : b for each 16-bit value*/
+static __m128i sse2Select(__m128i mask, __m128i a, __m128i b) {
+  return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+static void unfilterSubSIMD(unsigned char* recon, const unsigned char* scanline, size_t bytewidth, size_t length) {
+  __m128i a = _mm_setzero_si128();
+  size_t i;
+  for(i = 0; i < length; i += bytewidth) {
+    a = _mm_add_epi8(a, sse2LoadPixel(&scanline[i], bytewidth));
+    sse2StorePixel(&recon[i], a, bytewidth);
+  }
+}
+
+static void unfilterUpSIMD(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                           size_t length) {
+  size_t i = 0;
+  for(; i + 16 <= length; i += 16) {
+    __m128i s = _mm_loadu_si128((const __m128i*)&scanline[i]);
+    __m128i p = _mm_loadu_si128((const __m128i*)&precon[i]);
+    _mm_storeu_si128((__m128i*)&recon[i], _mm_add_epi8(s, p));
+  }
+  for(; i != length; ++i) recon[i] = scanline[i] + precon[i];
+}
+
+static void unfilterAverageSIMD(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                                size_t bytewidth, size_t length) {
+  const __m128i ones = _mm_set1_epi8(1);
+  __m128i a = _mm_setzero_si128();
+  size_t i;
+  for(i = 0; i < length; i += bytewidth) {
+    __m128i b = sse2LoadPixel(&precon[i], bytewidth);
+    /*_mm_avg_epu8 rounds up where the filter rounds down, so subtract the lost low bit*/
+    __m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), ones));
+    a = _mm_add_epi8(sse2LoadPixel(&scanline[i], bytewidth), avg);
+    sse2StorePixel(&recon[i], a, bytewidth);
+  }
+}
+
+static void unfilterPaethSIMD(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                              size_t bytewidth, size_t length) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i low = _mm_set1_epi16(255);
+  /*the left and upper left pixels, widened to 16 bits so the predictor can't overflow*/
+  __m128i a = zero, c = zero;
+  size_t i;
+  for(i = 0; i < length; i += bytewidth) {
+    __m128i b = _mm_unpacklo_epi8(sse2LoadPixel(&precon[i], bytewidth), zero);
+    __m128i x = _mm_unpacklo_epi8(sse2LoadPixel(&scanline[i], bytewidth), zero);
+    /*same as paethPredictor: the distances of a + b - c to a, b and c*/
+    __m128i pa = _mm_sub_epi16(b, c);
+    __m128i pb = _mm_sub_epi16(a, c);
+    __m128i pc = sse2Abs16(_mm_add_epi16(pa, pb));
+    __m128i smallest;
+    pa = sse2Abs16(pa);
+    pb = sse2Abs16(pb);
+    smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+    /*on ties, a is preferred over b and b over c*/
+    a = sse2Select(_mm_cmpeq_epi16(smallest, pa), a, sse2Select(_mm_cmpeq_epi16(smallest, pb), b, c));
+    a = _mm_and_si128(_mm_add_epi16(x, a), low);
+    sse2StorePixel(&recon[i], _mm_packus_epi16(a, a), bytewidth);
+    c = b;
+  }
+}
+
+#else /* LODEPNG_SIMD_NEON */
+
+static uint8x8_t neonLoadPixel(const unsigned char* p, size_t bytewidth) {
+  return vreinterpret_u8_u32(vdup_n_u32(simdLoadPixel(p, bytewidth)));
+}
+
+static void neonStorePixel(unsigned char* p, uint8x8_t v, size_t bytewidth) {
+  simdStorePixel(p, vget_lane_u32(vreinterpret_u32_u8(v), 0), bytewidth);
+}
+
+static void unfilterSubSIMD(unsigned char* recon, const unsigned char* scanline, size_t bytewidth, size_t length) {
+  uint8x8_t a = vdup_n_u8(0);
+  size_t i;
+  for(i = 0; i < length; i += bytewidth) {
+    a = vadd_u8(a, neonLoadPixel(&scanline[i], bytewidth));
+    neonStorePixel(&recon[i], a, bytewidth);
+  }
+}
+
+static void unfilterUpSIMD(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                           size_t length) {
+  size_t i = 0;
+  for(; i + 16 <= length; i += 16) {
+    vst1q_u8(&recon[i], vaddq_u8(vld1q_u8(&scanline[i]), vld1q_u8(&precon[i])));
+  }
+  for(; i != length; ++i) recon[i] = scanline[i] + precon[i];
+}
+
+static void unfilterAverageSIMD(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                                size_t bytewidth, size_t length) {
+  uint8x8_t a = vdup_n_u8(0);
+  size_t i;
+  for(i = 0; i < length; i += bytewidth) {
+    /*vhadd_u8 rounds down, as the filter does*/
+    a = vadd_u8(neonLoadPixel(&scanline[i], bytewidth), vhadd_u8(a, neonLoadPixel(&precon[i], bytewidth)));
+    neonStorePixel(&recon[i], a, bytewidth);
+  }
+}
+
+static void unfilterPaethSIMD(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                              size_t bytewidth, size_t length) {
+  uint8x8_t a = vdup_n_u8(0), c = vdup_n_u8(0);
+  size_t i;
+  for(i = 0; i < length; i += bytewidth) {
+    uint8x8_t b = neonLoadPixel(&precon[i], bytewidth);
+    /*same as paethPredictor: the distances of a + b - c to a, b and c, widened to 16 bits*/
+    uint16x8_t pa = vabdl_u8(b, c);
+    uint16x8_t pb = vabdl_u8(a, c);
+    uint16x8_t pc = vabdq_u16(vaddl_u8(a, b), vaddl_u8(c, c));
+    /*on ties, a is preferred over b and b over c*/
+    uint8x8_t use_a = vmovn_u16(vandq_u16(vcleq_u16(pa, pb), vcleq_u16(pa, pc)));
+    uint8x8_t use_b = vmovn_u16(vcleq_u16(pb, pc));
+    a = vadd_u8(neonLoadPixel(&scanline[i], bytewidth), vbsl_u8(use_a, a, vbsl_u8(use_b, b, c)));
+    neonStorePixel(&recon[i], a, bytewidth);
+    c = b;
+  }
+}
+
+#endif /* LODEPNG_SIMD_SSE2 */
+
+/*Unfilters the scanline with SIMD if it can. Returns 1 if it did, 0 if the portable code must be used.*/
+static unsigned unfilterScanlineSIMD(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                                     size_t bytewidth, unsigned char filterType, size_t length) {
+  if(filterType == 2 && precon) {
+    unfilterUpSIMD(recon, scanline, precon, length);
+    return 1;
+  }
+  if(bytewidth != 3 && bytewidth != 4) return 0;
+  if(filterType == 1) {
+    unfilterSubSIMD(recon, scanline, bytewidth, length);
+    return 1;
+  }
+  /*without a previous scanline, Average and Paeth are simple enough for the portable code*/
+  if(!precon) return 0;
+  if(filterType == 3) {
+    unfilterAverageSIMD(recon, scanline, precon, bytewidth, length);
+    return 1;
+  }
+  if(filterType == 4) {
+    unfilterPaethSIMD(recon, scanline, precon, bytewidth, length);
+    return 1;
+  }
+  return 0;
+}
+#endif /* LODEPNG_SIMD_SSE2 || LODEPNG_SIMD_NEON */
+
 static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
                                  size_t bytewidth, unsigned char filterType, size_t length) {
   /*
@@ -4110,6 +4314,10 @@ static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scan
   */
 
   size_t i;
+
+#if defined(LODEPNG_SIMD_SSE2) || defined(LODEPNG_SIMD_NEON)
+  if(unfilterScanlineSIMD(recon, scanline, precon, bytewidth, filterType, length)) return 0;
+#endif /* LODEPNG_SIMD_SSE2 || LODEPNG_SIMD_NEON */
   switch(filterType) {
     case 0:
       for(i = 0; i != length; ++i) recon[i] = scanline[i];
@@ -4225,6 +4433,12 @@ static unsigned unfilter(unsigned char* out, const unsigned char* in, unsigned w
   return 0;
 }
 
+unsigned lodepng_unfilter_scanline(unsigned char* recon, const unsigned char* scanline,
+                                   const unsigned char* precon, size_t bytewidth,
+                                   unsigned char filterType, size_t length) {
+  return unfilterScanline(recon, scanline, precon, bytewidth, filterType, length);
+}
+
 /*
 in: Adam7 interlaced image, with no padding bits between scanlines, but between
  reduced images so that each reduced image starts at a byte.
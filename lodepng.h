@@ -797,6 +797,21 @@ information is placed in the info_png field of the LodePNGState.
 unsigned lodepng_inspect(unsigned* w, unsigned* h,
                          LodePNGState* state,
                          const unsigned char* in, size_t insize);
+
+/*
+Unfilters one scanline of a non-interlaced image, for decoders that inflate the
+image data themselves one scanline at a time.
+recon: output, the unfiltered scanline, length bytes
+scanline: the filtered scanline, without its filter type byte
+precon: the previous unfiltered scanline, or NULL for the first scanline
+bytewidth: bytes per pixel, rounded up, 1 if bpp < 8
+filterType: the filter type byte that preceded the scanline
+length: bytes in the scanline, not including the filter type byte
+Returns error code, 36 for an invalid filter type.
+*/
+unsigned lodepng_unfilter_scanline(unsigned char* recon, const unsigned char* scanline,
+                                   const unsigned char* precon, size_t bytewidth,
+                                   unsigned char filterType, size_t length);
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 /*
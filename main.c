@@ -19,13 +19,16 @@
 #include <time.h>
 #include <sys/time.h>
 #include <portaudio.h>
-#include <pthread.h>
 #include <string.h>
 
 #include "audio_player.h"
-#include "breakpoints.h"
-#include "image.h"
-#include "key.h"
+#include "composer.h"
+#include "landscape.h"
+#include "frame_queue.h"
+#include "image_watcher.h"
+#include "batch.h"
+#include "export.h"
+#include "trace.h"
 
 
 /* Include platform specific libraries that control terminal input, for use with
@@ -54,19 +57,32 @@
 
 #define SAMPLE_RATE 48000
 
-// The size of the region of pixels to analyze at one time
+// The default size of the region of pixels to analyze at one time
 #define RECT_WIDTH 50
 #define RECT_HEIGHT 50
 
+// The default number of seconds to stay on each frame of an image sequence
+#define FRAME_TIME 30
 
-#ifdef USE_GRAPHICS
-/* A boolean that keeps track of whether the program should close. If graphics
- * are enabled, another thread is spawned that detects if the SDL window is
- * closed. This is the way that the thread communicates with the main thread to
- * say that the window has been closed.
+// The default number of frames of an image sequence to load ahead of time
+#define PREFETCH_FRAMES 2
+
+// The default length and frame rate of an exported video
+#define EXPORT_DURATION 60
+#define EXPORT_FPS 30
+
+// How often the graphics mode main loop checks for quits from other threads
+#define QUIT_POLL_MS 100
+
+// How often the visualization of the audio is redrawn, about 30 times a second
+#define VIZ_FRAME_MS 33
+
+
+/* A boolean that keeps track of whether the program should close. Only read
+ * and written with atomic operations, so any thread can ask the main loop to
+ * quit with request_close().
  */
 int should_close = 0;
-#endif
 
 
 
@@ -77,15 +93,12 @@ int should_close = 0;
  * FUNCTION DECLARATIONS *
  *************************/
 
-// Mathy functions
-float randfloat(float beg, float end);
-int randint(int beg, int end);
-float percent_in_range(float perc, float beg, float end);
-
 // Detecting quit functions
 int shouldClose();
+void request_close();
+int stop_waiting();
 #ifdef USE_GRAPHICS
-void* detect_close(void *vargp);
+void wait_for_step(Graphics* graphics, int ms);
 #endif
 
 // "press-any-button-to-quit" mode
@@ -93,6 +106,12 @@ char getchar_immediate();
 void enable_special_input();
 void disable_special_input();
 
+// Image sources
+void free_image_source(Landscape* landscape, FrameQueue* frames, ImageWatcher* watcher);
+#ifdef USE_GRAPHICS
+void show_landscape(Graphics* graphics, Landscape* landscape);
+#endif
+
 // Misc
 void usage();
 
@@ -109,21 +128,162 @@ void usage();
  * graphics mode, USE_GRAPHICS is defined, and this program depends on SDL2.
  *
  * Graphics mode will display the image in a window, and will mark the currently
- * selected region of pixels with a white rectangle.
+ * selected region of pixels with a white rectangle. Images larger than the
+ * screen are shown scaled down, and the mouse wheel or the +, - and 0 keys
+ * zoom in on the selected region and back out.
+ *
+ * Supports .png image files, and raw binary .ppm and .pam files, which are
+ * used straight from the mapped file without decoding.
+ *
+ * The input can also be an image sequence, such as a time-lapse: a directory
+ * of images or a quoted glob pattern. The images are played in order, moving
+ * to the next every few seconds, while a background thread loads the next
+ * ones ahead of time.
  *
- * Currently, only .png image files are supported.
+ * With --watch, the input is a directory to watch for new images instead. Each
+ * new image is loaded on a background thread and swapped in once it's ready,
+ * without stopping the music.
+ *
+ * With --batch, the input is a manifest of images to render to .wav files
+ * offline instead of playing, as fast as the machine allows. See batch.h.
+ *
+ * With --export, the image is rendered offline to a .wav file and a PNG
+ * sequence of what graphics mode would show, for making a video without
+ * playing or displaying anything. See export.h.
  *
  *
  * -----Command line arguments------:
- * ./aural_landscapes input.png [-o output.wav] [--hide_rect]
+ * ./aural_landscapes input.png [-o output.wav] [--format name]
+ *                    [--rotate-minutes minutes] [--rotate-mb megabytes]
+ *                    [--select strategy]
+ *                    [--scale root mode] [--tuning name] [--key file]
+ *                    [--seed number]
+ *                    [--region-size pixels] [--analysis-size samples]
+ *                    [--stream] [--cache] [--trusted] [--frame-time seconds]
+ *                    [--prefetch frames] [--watch] [--batch]
+ *                    [--export dir] [--duration seconds] [--fps frames]
+ *                    [--threads count] [--viz] [--hide_rect]
+ *                    [--trace file] [--profile]
  *
- * input.png:                   filepath to the image file to use
+ * input.png:                   filepath to the image file to use (.png, .ppm
+ *                              or .pam), or a directory or quoted glob pattern
+ *                              ("frames/frame_*.png") of an image sequence
  *
  * -o output.wav (optional):    if an output file is specified, will write the
  *                              generated audio data into that output file.
+ *                              It's written on a thread of its own, so the
+ *                              disk never holds up the audio.
+ *
+ * --format name (optional):    the output file's format: rf64 (default), w64
+ *                              or wav. RF64 files are plain WAV files until
+ *                              they outgrow one, which happens after about 6
+ *                              hours. Plain WAV output is rotated before then.
+ *
+ * --rotate-minutes minutes (optional): starts a new output file after this
+ *                              many minutes of audio. The first file has the
+ *                              given name, the next output_0001.wav and so on.
+ *
+ * --rotate-mb megabytes (optional): starts a new output file after this many
+ *                              megabytes (MiB) of audio, or after --rotate-minutes,
+ *                              whichever comes first
+ *
+ * --select strategy (optional): how to choose each region of the image. One of
+ *                              random (default), dark, bright, cold, warm or
+ *                              busy (regions with the most brightness variation)
+ *
+ * --scale root mode (optional): always composes in the given key, such as
+ *                              "d dorian" or "f# minor", instead of choosing
+ *                              C, D or E major or harmonic minor by the
+ *                              image's warmth. The modes are major, minor,
+ *                              harmonic, melodic, dorian, phrygian, lydian,
+ *                              mixolydian, locrian, pentatonic and
+ *                              minor-pentatonic.
+ *
+ * --tuning name (optional):    how the keys are tuned. One of equal (default),
+ *                              just, pythagorean or meantone
+ *
+ * --key file (optional):       always composes with the frequencies in the
+ *                              given text file, one per line, such as those in
+ *                              resources/keys, or the key of that name in the
+ *                              resource bundle, such as gmin
+ *
+ * --seed number (optional):    the seed of the piece's random numbers, so a
+ *                              piece can be played or exported again exactly.
+ *                              Taken from the clock by default, and printed.
+ *
+ * --region-size pixels (optional): the width and height of each region of the
+ *                              image, 50 by default
+ *
+ * --analysis-size samples (optional): analyzes the image averaged down by
+ *                              powers of 2 until it's at most this many
+ *                              samples wide and high, which caps the memory
+ *                              and time the analysis takes however large the
+ *                              image is. The image is still displayed at its
+ *                              own resolution.
+ *
+ * --stream (optional):         decodes the image a band of rows at a time, so
+ *                              the full resolution image is never in memory.
+ *                              For images too large to decode all at once.
+ *
+ * --cache (optional):          saves the image's analysis next to it in a
+ *                              .alfeat file, and on later runs maps that file
+ *                              instead of analyzing the image again
+ *
+ * --trusted (optional):        skips checking the image file's checksums, which
+ *                              decodes faster. Only for images known to be
+ *                              intact, as corruption won't be detected.
+ *
+ * --frame-time seconds (optional): for an image sequence, how long to stay on
+ *                              each image, 30 by default. The image changes
+ *                              when a new region is chosen after this time.
+ *
+ * --prefetch frames (optional): for an image sequence, how many images to load
+ *                              ahead of time, 2 by default
+ *
+ * --watch (optional):          the input is a directory, and each new image
+ *                              written to it replaces the current one. Starts
+ *                              with the newest image already there, or waits
+ *                              for one, until a key is pressed. Linux only.
+ *
+ * --batch (optional):          the input is a manifest with one job per line:
+ *                              an image, a duration in seconds, a seed and an
+ *                              output .wav file. Renders every job offline on
+ *                              a pool of threads and prints how long each
+ *                              took, then quits without playing anything.
+ *
+ * --export dir (optional):     renders the piece offline into the given
+ *                              directory, as audio.wav and frame_000000.png
+ *                              onwards, then quits without playing anything.
+ *                              Works without graphics mode.
  *
- *  --hide-rect (optional):     if graphics mode is enabled, will not display the
- *                              rectangle that marks the currently selected region
+ * --duration seconds (optional): how long a piece to export, 60 by default
+ *
+ * --fps frames (optional):     the frame rate to export at, 30 by default
+ *
+ * --threads count (optional):  how many threads to analyze images with, or to
+ *                              render a batch or encode exported frames on.
+ *                              One per processor by default.
+ *
+ * --viz (optional):            shows the notes playing and a scope of the
+ *                              output along the bottom of the window in
+ *                              graphics mode, or of the exported frames
+ *
+ *  --hide-rect (optional):     will not display the rectangle that marks the
+ *                              currently selected region, in graphics mode or
+ *                              in exported frames
+ *
+ * --trace file (optional):     records how long loading, composing, drawing
+ *                              and each audio callback take on every thread,
+ *                              and writes them to the given file as Chrome
+ *                              Trace Event JSON on exit, or on Unix whenever
+ *                              the process gets SIGUSR1. See trace.h.
+ *
+ * --profile (optional):        times every audio callback and, on Linux,
+ *                              reads the CPU's cycle, instruction, cache miss
+ *                              and branch miss counters around it, then prints
+ *                              a histogram of the times and the counters per
+ *                              sample for each number of voices on exit. See
+ *                              callback_profile.h.
  *
  */
 int main(int argc, char** argv) {
@@ -144,10 +304,71 @@ int main(int argc, char** argv) {
     // Output filename, NULL if not write enabled
     char* output_filename = NULL;
 
-    #ifdef USE_GRAPHICS
+    // The output file's format, and when to start a new one
+    RecorderSettings recording = {NULL, RECORD_RF64, 0, 0};
+
+    // How to choose regions of the image
+    int strategy = SELECT_RANDOM;
+
+    /* How to tune the keys, and the key to always use, if any: a root of -1
+     * chooses the key from the image */
+    int tuning = TUNING_EQUAL;
+    int root = -1;
+    int mode = MODE_MAJOR;
+    char* key_file = NULL;
+
+    // The seed of the piece's random numbers
+    unsigned int seed = time(NULL);
+
+    // The file to write a trace of the run to, or NULL
+    char* trace_file = NULL;
+
+    // The size of each region of the image
+    int region_w = RECT_WIDTH;
+    int region_h = RECT_HEIGHT;
+
+    // The largest width and height to analyze the image at, 0 for no limit
+    int analysis_size = 0;
+
+    // Whether to decode the image a band of rows at a time
+    int stream = 0;
+
+    // Whether to load and save the image's analysis in a cache file
+    int use_cache = 0;
+
+    // Whether to skip checking the image file's checksums
+    int trusted = 0;
+
+    // How long to stay on each frame of an image sequence, in seconds
+    int frame_time = FRAME_TIME;
+
+    // How many frames of an image sequence to load ahead of time
+    int prefetch = PREFETCH_FRAMES;
+
+    // Whether to watch the input directory for new images
+    int watch = 0;
+
+    // Whether the input is a manifest of jobs to render offline
+    int batch = 0;
+
+    // The directory to export a video to, NULL to play instead
+    char* export_dir = NULL;
+
+    // The length and frame rate of an exported video
+    float duration = EXPORT_DURATION;
+    int fps = EXPORT_FPS;
+
+    // The number of threads to use, 0 for one per processor
+    int threads = 0;
+
     // Whether or not to display the currently selected region on the image
     int hide_rect = 0;
-    #endif
+
+    // Whether to show the notes playing and the output in the window
+    int show_viz = 0;
+
+    // Whether to profile the audio callback
+    int profile_callback = 0;
 
     /* Process command line arguments */
     for(int i = 2; i < argc; i++) {
@@ -162,12 +383,195 @@ int main(int argc, char** argv) {
 
             output_filename = argv[++i];
         }
-        #ifdef USE_GRAPHICS
+        // Should write the output file in the given format
+        else if(strcmp(argv[i], "--format") == 0) {
+            if(i+1 == argc || (recording.format = parse_record_format(argv[i+1])) == -1) {
+                usage();
+                printf("\nMust provide rf64, w64 or wav for --format\n");
+                return 1;
+            }
+            i++;
+        }
+        // Should start a new output file after the given number of minutes
+        else if(strcmp(argv[i], "--rotate-minutes") == 0) {
+            if(i+1 == argc || (recording.rotate_minutes = atof(argv[i+1])) <= 0) {
+                usage();
+                printf("\nMust provide a positive number of minutes for --rotate-minutes\n");
+                return 1;
+            }
+            i++;
+        }
+        // Should start a new output file after the given number of megabytes
+        else if(strcmp(argv[i], "--rotate-mb") == 0) {
+            if(i+1 == argc || (recording.rotate_bytes = atof(argv[i+1]) * 1024 * 1024) <= 0) {
+                usage();
+                printf("\nMust provide a positive number of megabytes for --rotate-mb\n");
+                return 1;
+            }
+            i++;
+        }
+        // Should always compose in the given key
+        else if(strcmp(argv[i], "--scale") == 0) {
+            if(i+2 >= argc || (root = parse_root(argv[i+1])) == -1
+                    || (mode = parse_mode(argv[i+2])) == -1) {
+                usage();
+                printf("\nMust provide a valid root note and mode for --scale\n");
+                return 1;
+            }
+            i += 2;
+        }
+        // Should tune the keys the given way
+        else if(strcmp(argv[i], "--tuning") == 0) {
+            if(i+1 == argc || (tuning = parse_tuning(argv[i+1])) == -1) {
+                usage();
+                printf("\nMust provide a valid tuning for --tuning\n");
+                return 1;
+            }
+            i++;
+        }
+        // Should always compose with the frequencies in the given file
+        else if(strcmp(argv[i], "--key") == 0) {
+            if(i+1 == argc) {
+                usage();
+                printf("\nMust provide a key file for --key\n");
+                return 1;
+            }
+            key_file = argv[++i];
+        }
+        // Should compose with the given seed
+        else if(strcmp(argv[i], "--seed") == 0) {
+            char* end = NULL;
+            if(i+1 < argc)
+                seed = strtoul(argv[i+1], &end, 10);
+            if(end == NULL || end == argv[i+1] || *end != '\0') {
+                usage();
+                printf("\nMust provide a number for --seed\n");
+                return 1;
+            }
+            i++;
+        }
+        // Should choose regions with the given strategy
+        else if(strcmp(argv[i], "--select") == 0) {
+            if(i+1 == argc || (strategy = parse_strategy(argv[i+1])) == -1) {
+                usage();
+                printf("\nMust provide a valid strategy for --select\n");
+                return 1;
+            }
+            i++;
+        }
+        // Should use regions of the given size
+        else if(strcmp(argv[i], "--region-size") == 0) {
+            if(i+1 == argc || (region_w = region_h = atoi(argv[i+1])) <= 0) {
+                usage();
+                printf("\nMust provide a positive size for --region-size\n");
+                return 1;
+            }
+            i++;
+        }
+        // Should analyze the image at a limited resolution
+        else if(strcmp(argv[i], "--analysis-size") == 0) {
+            if(i+1 == argc || (analysis_size = atoi(argv[i+1])) <= 0) {
+                usage();
+                printf("\nMust provide a positive size for --analysis-size\n");
+                return 1;
+            }
+            i++;
+        }
+        // Should stream the image instead of decoding it all at once
+        else if(strcmp(argv[i], "--stream") == 0) {
+            stream = 1;
+        }
+        // Should reuse the image's analysis from earlier runs
+        else if(strcmp(argv[i], "--cache") == 0) {
+            use_cache = 1;
+        }
+        // Should trust the image file to be intact
+        else if(strcmp(argv[i], "--trusted") == 0) {
+            trusted = 1;
+        }
+        // Should stay on each frame of a sequence for the given time
+        else if(strcmp(argv[i], "--frame-time") == 0) {
+            if(i+1 == argc || (frame_time = atoi(argv[i+1])) <= 0) {
+                usage();
+                printf("\nMust provide a positive number of seconds for --frame-time\n");
+                return 1;
+            }
+            i++;
+        }
+        // Should load the given number of frames of a sequence ahead
+        else if(strcmp(argv[i], "--prefetch") == 0) {
+            if(i+1 == argc || (prefetch = atoi(argv[i+1])) <= 0) {
+                usage();
+                printf("\nMust provide a positive number of frames for --prefetch\n");
+                return 1;
+            }
+            i++;
+        }
+        // Should watch the input directory for new images
+        else if(strcmp(argv[i], "--watch") == 0) {
+            watch = 1;
+        }
+        // Should render the jobs of a manifest offline
+        else if(strcmp(argv[i], "--batch") == 0) {
+            batch = 1;
+        }
+        // Should export a video to the given directory
+        else if(strcmp(argv[i], "--export") == 0) {
+            if(i+1 == argc) {
+                usage();
+                printf("\nMust provide a directory for --export\n");
+                return 1;
+            }
+            export_dir = argv[++i];
+        }
+        // Should export a piece of the given length
+        else if(strcmp(argv[i], "--duration") == 0) {
+            if(i+1 == argc || (duration = atof(argv[i+1])) <= 0) {
+                usage();
+                printf("\nMust provide a positive number of seconds for --duration\n");
+                return 1;
+            }
+            i++;
+        }
+        // Should export at the given frame rate
+        else if(strcmp(argv[i], "--fps") == 0) {
+            if(i+1 == argc || (fps = atoi(argv[i+1])) <= 0 || fps > SAMPLE_RATE) {
+                usage();
+                printf("\nMust provide a positive frame rate for --fps\n");
+                return 1;
+            }
+            i++;
+        }
+        // Should use the given number of threads
+        else if(strcmp(argv[i], "--threads") == 0) {
+            if(i+1 == argc || (threads = atoi(argv[i+1])) <= 0) {
+                usage();
+                printf("\nMust provide a positive number of threads for --threads\n");
+                return 1;
+            }
+            i++;
+        }
         // Should hide the rectangle on the image
         else if(strcmp(argv[i], "--hide-rect") == 0) {
             hide_rect = 1; 
         }
-        #endif
+        // Should show what's playing
+        else if(strcmp(argv[i], "--viz") == 0) {
+            show_viz = 1;
+        }
+        // Should write a trace of the run to the given file
+        else if(strcmp(argv[i], "--trace") == 0) {
+            if(i+1 == argc) {
+                usage();
+                printf("\nMust provide a file for --trace\n");
+                return 1;
+            }
+            trace_file = argv[++i];
+        }
+        // Should profile the audio callback
+        else if(strcmp(argv[i], "--profile") == 0) {
+            profile_callback = 1;
+        }
         else {
             usage();
             printf("\nUnrecognized flag: %s\n", argv[i]);
@@ -182,25 +586,99 @@ int main(int argc, char** argv) {
      **********************/
 
 
+    // Tracing must start before any other thread does
+    if(trace_file != NULL && start_trace(trace_file))
+        return 1;
+
     printf("Initializing...\n");
+    if(!batch)
+        printf("Seed: %u\n", seed);
+
+    /* Load and analyze the image: builds its analysis pyramid, so any region
+     * can be analyzed at a fixed cost, and indexes the features of each region
+     * so the main loop can pick regions without rescanning pixels */
+    LandscapeSettings settings;
+    settings.region_w = region_w;
+    settings.region_h = region_h;
+    settings.analysis_size = analysis_size;
+    settings.stream = stream;
+    settings.use_cache = use_cache;
+    settings.trusted = trusted;
+    settings.threads = threads;
+    #ifdef USE_GRAPHICS
+    settings.keep_display = 1;
+    #else
+    settings.keep_display = 0;
+    #endif
 
-    srand(time(NULL));
+    /* The keys are computed at startup, unless one is read from a file */
+    ScaleSettings scale;
+    scale.tuning = tuning;
+    scale.root = root;
+    scale.mode = mode;
+    scale.key_file = key_file;
+
+    /* A batch renders its own images, and plays nothing */
+    if(batch)
+        return run_batch(input_filename, &settings, &scale, strategy, threads, SAMPLE_RATE);
+
+    /* An export renders its own image, and plays and displays nothing */
+    if(export_dir != NULL) {
+        ExportSettings export;
+        export.duration = duration;
+        export.fps = fps;
+        export.seed = seed;
+        export.show_rect = !hide_rect;
+        export.show_viz = show_viz;
+        export.threads = threads;
+        return run_export(input_filename, export_dir, &export, &settings, &scale, strategy, SAMPLE_RATE);
+    }
 
-    // Load image pixels 
-    unsigned int imagew, imageh;
-    unsigned char* rawpix = load_imagefile(input_filename, &imagew, &imageh);
-    if(rawpix == NULL) {
-        printf("Error loading image file.\n");
-        return 1;
+    /* For an image sequence, frames are loaded ahead on another thread, and
+     * the first is waited for. In watch mode, the watcher owns the image,
+     * which may only be used while reading it. */
+    FrameQueue* frames = NULL;
+    ImageWatcher* watcher = NULL;
+    ImageReader reader;
+    Landscape* landscape;
+    if(watch) {
+        /* There may be no image until one arrives, so any key quits while
+         * waiting, as there's no window yet to close */
+        watcher = new_image_watcher(input_filename, &settings);
+        if(watcher != NULL) {
+            enable_special_input();
+            landscape = image_watcher_wait(watcher, &reader, stop_waiting);
+            disable_special_input();
+        }
+        else
+            landscape = NULL;
+
+        if(watcher != NULL && landscape == NULL) {
+            free_image_watcher(watcher);
+            return 0;
+        }
+    }
+    else if(is_frame_sequence(input_filename)) {
+        int num_frames;
+        char** frame_files = list_frames(input_filename, &num_frames);
+        if(frame_files != NULL) {
+            frames = new_frame_queue(frame_files, num_frames, &settings, prefetch);
+            if(frames == NULL)
+                free_frame_list(frame_files, num_frames);
+        }
+        landscape = frames != NULL ? frame_queue_wait(frames) : NULL;
     }
+    else
+        landscape = load_landscape(input_filename, &settings);
 
-    /* Load image into Image struct */
-    Image* image = load_to_image(rawpix, imagew, imageh);
-    if(image == NULL) {
+    if(landscape == NULL) {
         printf("Error loading image... quitting\n");
-        free(rawpix);
+        if(frames != NULL)
+            free_frame_queue(frames);
         return 1;
     }
+    FeatureIndex* index = landscape->index;
+    float tot_warmth = landscape->warmth;
 
 
     /*
@@ -216,37 +694,43 @@ int main(int argc, char** argv) {
     /* Initialize graphics */
 
     // Initialize SDL structs
-    Graphics* graphics = create_graphics("Aural Landscapes", imagew, imageh);
+    int dispw = landscape->display_w;
+    int disph = landscape->display_h;
+    Graphics* graphics = create_graphics("Aural Landscapes", dispw, disph);
     if(graphics == NULL) {
         printf("Error loading SDL graphics... quitting\n");
-        free(rawpix);
-        free_image(image);
+        if(watcher != NULL)
+            image_watcher_read_unlock(watcher, &reader);
+        free_image_source(landscape, frames, watcher);
         return 1;
     }
     
-    // Convert char pixels into Uint32, the format SDL uses
-    Uint32* pixels = convert_rgba_ints_to_Uint32(rawpix, imagew*imageh*4);
-
     // Display the image and reload the window
-    setPixels(graphics, pixels, imagew, imageh);
-    updateWindow(graphics);
-
+    show_landscape(graphics, landscape);
 
-    /* SDL doesn't seem to save the fact that someone clicked the window's
-     * close button, so spawn another thread that continually checks.
-     * See detect_close() */
-    pthread_t tid;
-    pthread_create(&tid, NULL, detect_close, NULL);
+    // The generation of the watcher's image on display
+    unsigned generation = watcher != NULL ? reader.generation : 0;
     #endif
 
-
-
-    /* Load the amplitude breakpoint file for the Oscillators */
-    Breakpoints* bp = load_bp_file("resources/bps/bp2.txt");
-    if(bp == NULL) {
-        printf("Error loading breakpoint file... quitting\n");
-        free(rawpix);
-        free_image(image);
+    // The main loop reads the watcher's image afresh each time
+    if(watcher != NULL)
+        image_watcher_read_unlock(watcher, &reader);
+
+
+
+    /* Load the lookup tables, breakpoints and keys that notes are made from,
+     * and pick the key of the piece from the overall warmth of the image */
+    uint64_t start = trace_begin();
+    Instruments* instruments = load_instruments(SAMPLE_RATE, &scale);
+    trace_end("load instruments", start);
+    Composer* composer = NULL;
+    if(instruments != NULL)
+        composer = new_composer(instruments, strategy, tot_warmth, seed);
+    if(composer == NULL) {
+        printf("Error loading instruments... quitting\n");
+        if(instruments != NULL)
+            free_instruments(instruments);
+        free_image_source(landscape, frames, watcher);
         #ifdef USE_GRAPHICS
         free_graphics(graphics);
         #endif
@@ -256,152 +740,20 @@ int main(int argc, char** argv) {
 
 
     /* Initialize the audio player struct (PA and libsndfile) */
-    AudioPlayer* player = new_audio_player(output_filename, SAMPLE_RATE);
+    recording.filename = output_filename;
+    AudioPlayer* player = new_audio_player(output_filename != NULL ? &recording : NULL, SAMPLE_RATE);
     if(player == NULL) {
         printf("Error loading audio player... quitting\n");
-        free(rawpix);
-        free_image(image);
-        #ifdef USE_GRAPHICS
-        free_graphics(graphics);
-        #endif
-        free_breakpoints(bp);
-        return 1;
-    }
-
-
-
-    /* Load lookup tables */
-    int tablen = SAMPLE_RATE; //Table length as SR supports freqs down to 1
-
-    int NUM_TABS = 8;
-    float* tabs[8] = {
-        gen_warmth_tab(tablen, 7),
-        gen_warmth_tab(tablen, 6),
-        gen_warmth_tab(tablen, 5),
-        gen_warmth_tab(tablen, 4),
-        gen_warmth_tab(tablen, 3),
-        gen_warmth_tab(tablen, 2),
-        gen_warmth_tab(tablen, 1),
-        gen_warmth_tab(tablen, 0)
-    };
-    /* Make sure none failed loading */
-    int err = 0;
-    // See if any failed to load
-    for(int i = 0; i < NUM_TABS; i++) {
-        if(tabs[i] == NULL) {
-            err = 1;
-            break;
-        }
-    }
-    // If any failed loading, go through and free all of them, then free
-    // everything and exit
-    if(err) {
-        for(int i = 0; i < NUM_TABS; i++) {
-            if(tabs[i] != NULL)
-                free(tabs[i]);
-        }
-        printf("Error loading table... quitting\n");
-        free(rawpix);
-        free_image(image);
+        free_image_source(landscape, frames, watcher);
         #ifdef USE_GRAPHICS
         free_graphics(graphics);
         #endif
-        free_breakpoints(bp);
-        free_audio_player(player);
+        free_composer(composer);
+        free_instruments(instruments);
         return 1;
     }
 
 
-
-    /* Load major keys */
-    int MAJOR_KEYS_LEN = 3;
-    Key* major_keys[3];
-    major_keys[0] = load_key("resources/keys/cmaj.txt");
-    major_keys[1] = load_key("resources/keys/dmaj.txt");
-    major_keys[2] = load_key("resources/keys/emaj.txt");
-
-    err = 0;
-    // See if any failed to load
-    for(int i = 0; i < MAJOR_KEYS_LEN; i++) {
-        if(major_keys[i] == NULL) {
-            err = 1;
-            break;
-        }
-    }
-    // If any failed to load, free all of them and exit
-    if(err) {
-        printf("Error loading major key... quitting\n");
-        for(int i = 0; i < MAJOR_KEYS_LEN; i++) {
-            if(major_keys[i] != NULL)
-                free(major_keys[i]);
-            return 1;
-        }
-        free(rawpix);
-        free_image(image);
-        #ifdef USE_GRAPHICS
-        free_graphics(graphics);
-        #endif
-        free_breakpoints(bp);
-        free_audio_player(player);
-        for(int j = 0; j < NUM_TABS; j++)
-            free(tabs[j]);
-    }
-
-
-
-    /* Load harmonic keys */
-    int HARMONIC_KEYS_LEN = 3;
-    Key* harmonic_keys[3];
-    harmonic_keys[0] = load_key("resources/keys/charm.txt");
-    harmonic_keys[1] = load_key("resources/keys/dharm.txt");
-    harmonic_keys[2] = load_key("resources/keys/eharm.txt");
-
-    err = 0;
-    // See if any failed to load
-    for(int i = 0; i < HARMONIC_KEYS_LEN; i++) {
-        if(harmonic_keys[i] == NULL) {
-            err = 1;
-            break;
-        }
-    }
-    // If any failed to load, free all of them and exit
-    if(err) {
-        printf("Error loading harmonic key... quitting\n");
-        for(int i = 0; i < HARMONIC_KEYS_LEN; i++) {
-            if(harmonic_keys[i] != NULL)
-                free(harmonic_keys[i]);
-        }
-        for(int i = 0; i < MAJOR_KEYS_LEN; i++)
-            free(major_keys[i]);
-        free(rawpix);
-        free_image(image);
-        #ifdef USE_GRAPHICS
-        free_graphics(graphics);
-        #endif
-        free_breakpoints(bp);
-        free_audio_player(player);
-        for(int j = 0; j < NUM_TABS; j++)
-            free(tabs[j]);
-        return 1;
-    }
-
-
-
-
-    /* Pick a key based on the overall warmth of the image */
-    Key* key;
-    int tot_warmth = tot_avg_warmth(image);
-
-    // If image is cold overall, choose a harmonic minor key
-    if(tot_warmth < 0) {
-        key = harmonic_keys[randint(0, HARMONIC_KEYS_LEN)];
-    }
-    // If image is cold overall, choose a major key
-    else {
-        key = major_keys[randint(0, MAJOR_KEYS_LEN)];
-    }
-
-
     printf("Done\n\n");
 
 
@@ -420,8 +772,17 @@ int main(int argc, char** argv) {
     enable_special_input();
     #endif
 
-    // Unlock the AudioPlayer's list of oscillators for use
-    pthread_mutex_unlock(&player->osc_list_lock);
+    #ifdef USE_GRAPHICS
+    /* If enabled, the audio publishes what's playing for the window to show,
+     * without either ever waiting for the other */
+    VizTap* viz = show_viz ? new_viz_tap() : NULL;
+    player->viz = viz;
+    graphics->viz = viz;
+    #endif
+
+    // If enabled, the callback records its times and counters
+    CallbackProfile* profile = profile_callback ? new_callback_profile(SAMPLE_RATE) : NULL;
+    player->profile = profile;
 
     // Start PortAudio streaming
     start_stream(player);
@@ -429,92 +790,99 @@ int main(int argc, char** argv) {
     // Each oscillator has a unique id, increment this when you create one
     unsigned int oscID = 0;
 
+    // When the current frame of an image sequence was first shown
+    time_t frame_start = time(NULL);
+
     /* Loop until the user ends the program. For different settings, this means
-     * different things. See shouldClose() for more details. Note that because this
-     * loop sleeps at the end, there will be a delay between when the user presses
-     * quit and the program actually quits. */
+     * different things. See shouldClose() for more details. Note that without
+     * graphics this loop sleeps at the end, so there will be a delay between
+     * when the user presses quit and the program actually quits. In graphics
+     * mode the window's events are handled while waiting, so closing it quits
+     * straight away. */
     while(!shouldClose()) {
         // Update the oscillator list (removes completed oscillators)
         synch_update(player);
 
-        // Choose a random region of the image
-        int startx = randint(0, imagew-RECT_WIDTH);
-        int starty = randint(0, imageh-RECT_HEIGHT);
+        /* Move on to the next frame of an image sequence once it's due. If it
+         * hasn't finished loading, stay on this one and check again next time
+         * rather than waiting. */
+        if(frames != NULL && difftime(time(NULL), frame_start) >= frame_time) {
+            Landscape* next = frame_queue_take(frames);
+            if(next != NULL) {
+                free_landscape(landscape);
+                landscape = next;
+                index = landscape->index;
+                frame_start = time(NULL);
+
+                #ifdef USE_GRAPHICS
+                show_landscape(graphics, landscape);
+                #endif
+            }
+        }
+
+        /* In watch mode, read the watcher's newest image. It can't be freed
+         * until this pass of the loop is done with it, even if a newer one
+         * is swapped in meanwhile. */
+        if(watcher != NULL) {
+            landscape = image_watcher_read_lock(watcher, &reader);
+            index = landscape->index;
+
+            #ifdef USE_GRAPHICS
+            if(reader.generation != generation) {
+                show_landscape(graphics, landscape);
+                generation = reader.generation;
+            }
+            #endif
+        }
+
+        // Choose a region of the image
+        start = trace_begin();
+        RegionFeatures* region = choose_region(composer, index);
+        trace_end("choose region", start);
 
         #ifdef USE_GRAPHICS
         // If enabled, update the window to highlight the new region
         if(!hide_rect) {
-            draw_rect(graphics, startx, starty, RECT_WIDTH, RECT_HEIGHT);
+            // The display may be scaled down from the full image
+            int scale = landscape->display_scale;
+            draw_rect(graphics, region->x/scale, region->y/scale, region->w/scale, region->h/scale);
             updateWindow(graphics);
         }
         #endif
 
 
-        /* Calculate the average brightness and warmth of this region
-         * Average brightness is between 0 and 1 */
-        float avg_brightness = avg_perc_brightness(image, startx, starty, RECT_WIDTH, RECT_HEIGHT);
-        int avg_warm = avg_warmth(image, startx, starty, RECT_WIDTH, RECT_HEIGHT);
-
-        /* Pick number of notes to generate
-         * If the brightness is low, then the notes will be lower in frequency.
-         * Generate fewer to avoid as much clashing between them. */
-        int num_notes;
-        if(avg_brightness < 0.5)
-            num_notes = randint(1, 3);
-        else
-            num_notes = randint(1, 4);
-
-        /* Generate each note */
+        /* Compose notes from the region's brightness and warmth, and add an
+         * oscillator to play each one */
+        start = trace_begin();
+        Note notes[MAX_NOTES];
+        int num_notes = compose_notes(composer, region, notes);
         for(int i = 0; i < num_notes; i++) {
-
-            /* Pick a brightness value near the calculated average. Ensure
-             * brightness values is between 0 and 1. Then use this to choose
-             * from the higher or lower end of the frequency list */
-            float brightness = randfloat(0.5*avg_brightness, 1.2*avg_brightness);
-            if(brightness > 1)
-                brightness = 1;
-            float freq = key->freqs[(int) percent_in_range(brightness, 0, key->len)];
-
-            /* Higher notes (from brighter colors) tend to be louder, so
-             * calculate an amplitude that decreases as brightness increases */
-            float amp = (1-brightness) * 0.7 + 0.3;
-
-
-
-            /* Pick a warmth value nearby the calculated average. Process the
-             * warmth value so it's between 0 & 1, then use that to pick an
-             * appropriate lookup table from the list of tables. */
-            float warmth = randint(avg_warm-10, avg_warm+10);
-            warmth -= 30; // Adjust where warmth maps to arr of harmonic content
-            if(warmth < -100) // min value: -100
-                warmth = -100;
-            if(warmth > 100) // max value: 100
-                warmth = 100;
-            warmth += 100; // warmth between 0 and 200
-            warmth /= 200.0; //warmth between 0 and 1
-
-            int ind = NUM_TABS*warmth; // Lookup table index
-
-
-
-            // Pick random future start time and note length
-            float start = randfloat(0.1, 5);
-            float len = randfloat(3, 10);
-
-            // Add the note's oscillator to the list.
-            // 0.4 is a hardcoded base amplitude so everything isn't really loud
-            add_osc(player, oscID++, tabs[ind], tablen, bp, freq, 0.4*amp, len, start);
+            add_osc(player, oscID++, notes[i].tab, instruments->tablen, instruments->bp,
+                    notes[i].freq, notes[i].amplitude, notes[i].length, notes[i].start);
         }
+        trace_end("compose notes", start);
 
 
         /* Sleep for 6 seconds before moving the image region and generating
          * new notes */
-        Pa_Sleep(6000);
+        #ifdef USE_GRAPHICS
+        wait_for_step(graphics, STEP_SECONDS * 1000);
+        #else
+        Pa_Sleep(STEP_SECONDS * 1000);
+        #endif
+
+        /* The window draws from the watcher's image while waiting, so it's
+         * only finished with here */
+        if(watcher != NULL)
+            image_watcher_read_unlock(watcher, &reader);
     }
 
     // Stop the PortAudio stream
     stop_stream(player);
 
+    if(profile != NULL)
+        print_callback_profile(profile);
+
     #ifndef USE_GRAPHICS
     // Disable the "press-any-key-to-quit" mode
     disable_special_input();
@@ -527,10 +895,7 @@ int main(int argc, char** argv) {
      * FREE RESOURCES *
      ******************/
 
-    free(rawpix);
-    free_image(image);
-
-    free_breakpoints(bp);
+    free_image_source(landscape, frames, watcher);
 
     #ifdef USE_GRAPHICS
     free_graphics(graphics);
@@ -538,13 +903,16 @@ int main(int argc, char** argv) {
 
     free_audio_player(player);
 
-    for(int i = 0; i < NUM_TABS; i++)
-        free(tabs[i]);
+    if(profile != NULL)
+        free_callback_profile(profile);
+
+    #ifdef USE_GRAPHICS
+    if(viz != NULL)
+        free_viz_tap(viz);
+    #endif
 
-    for(int i = 0; i < MAJOR_KEYS_LEN; i++)
-        free_key(major_keys[i]);
-    for(int i = 0; i < HARMONIC_KEYS_LEN; i++)
-        free_key(harmonic_keys[i]);
+    free_composer(composer);
+    free_instruments(instruments);
 
 
     return 0;    
@@ -552,52 +920,49 @@ int main(int argc, char** argv) {
 
 
 
-/*******************
- * MATHY FUNCTIONS *
- *******************/
+/*****************
+ * IMAGE SOURCES *
+ *****************/
 
 /*
- * randfloat():
- * Returns a random float in the range specified, including both ends of the range
+ * free_image_source():
+ * Frees the current Landscape along with the FrameQueue or ImageWatcher it
+ * came from, if any. In watch mode the watcher owns the Landscape, and frees
+ * it itself.
  *
- * beg: the lower end of the range to generate from
- * end: the upper end of the range to generate from
- *
- * return: A randomly generated float in the range given
+ * landscape:   The current Landscape
+ * frames:      The FrameQueue of an image sequence, or NULL
+ * watcher:     The ImageWatcher in watch mode, or NULL
  */
-float randfloat(float beg, float end) {
-    return ((float) rand() / (float) RAND_MAX) * (end-beg) + beg;
-}
+void free_image_source(Landscape* landscape, FrameQueue* frames, ImageWatcher* watcher) {
+    if(watcher != NULL) {
+        free_image_watcher(watcher);
+        return;
+    }
 
-/*
- * randint():
- * Returns a random integer in the range specified, not-including the end of the range.
- *
- * beg: the lower end of the range to generate from, inclusive
- * end: the higher end of the range to generate from, exclusive
- *
- * return: A randomly generated int in the range given
- */
-int randint(int beg, int end) {
-    return rand() % (end-beg) + beg;
+    free_landscape(landscape);
+    if(frames != NULL)
+        free_frame_queue(frames);
 }
 
 
+
+#ifdef USE_GRAPHICS
 /*
- * percent_in_range():
- * Returns a float that is a certain percentage through the given range.
- *
- * Ex: if the range was 0-10, perc=0.5 would return halfway through the range: 5
+ * show_landscape():
+ * Displays the given Landscape's image in the window, in place of the image
+ * shown before. The new image must be the same size as the first. The
+ * window draws from the Landscape's display pixels, so it must stay loaded
+ * until another is shown.
  *
- * perc: The percentage, between 0 and 1, of how far through the range we go
- * beg: The beginning of the range
- * end: The end of the range
- *
- * return: The float at a certain percentage of the way through the given range.
+ * graphics:    A pointer to the Graphics of the window
+ * landscape:   The Landscape to display
  */
-float percent_in_range(float perc, float beg, float end) {
-    return perc*(end-beg) + beg;
+void show_landscape(Graphics* graphics, Landscape* landscape) {
+    setPixels(graphics, landscape->display, landscape->display_w, landscape->display_h);
+    updateWindow(graphics);
 }
+#endif
 
 
 
@@ -612,41 +977,72 @@ float percent_in_range(float perc, float beg, float end) {
  *
  * If graphics mode is enabled, quitting means the user has pressed the close button
  * on the graphical window. Otherwise, quitting means the user has pressed any key.
+ * Either way, another thread may also have called request_close().
  *
  * return: a boolean representing whether the user has triggered the program to quit
  */
 int shouldClose() {
-    #ifdef USE_GRAPHICS
-        // detect_close() lives on a seperate thread and sets this
-        return should_close;
-    #else
-        return (getchar_immediate() != -1);
+    #ifndef USE_GRAPHICS
+        if(getchar_immediate() != -1)
+            request_close();
     #endif
+    return __atomic_load_n(&should_close, __ATOMIC_SEQ_CST);
+}
+
+
+/*
+ * stop_waiting():
+ * Returns whether the user has pressed a key, or another thread has called
+ * request_close(), while waiting for the first image in watch mode. Needs
+ * enable_special_input() on Unix, as in text mode.
+ *
+ * return: a boolean representing whether to stop waiting and quit
+ */
+int stop_waiting() {
+    if(getchar_immediate() != -1)
+        request_close();
+    return __atomic_load_n(&should_close, __ATOMIC_SEQ_CST);
+}
+
+
+/*
+ * request_close():
+ * Tells the main loop to quit once it next checks shouldClose(). Safe to call
+ * from any thread.
+ */
+void request_close() {
+    if(!__atomic_exchange_n(&should_close, 1, __ATOMIC_SEQ_CST))
+        printf("Closing, please wait...\n");
 }
 
 
 
 #ifdef USE_GRAPHICS
 /*
- * detect_close():
- * Detects whether the user has pressed the close button the SDL window.
- * Designed to be the callback function of a separate thread, since SDL
- * doesn't seem to save whether or not the close button has been pressed.
+ * wait_for_step():
+ * Waits the given time before the main loop moves on to its next region,
+ * handling the window's events meanwhile. Returns early if the window is
+ * closed or another thread asks to quit.
  *
- * vargp: void pointer to thread arguments. Here, should be pointer to Graphics
- *      struct
+ * SDL's events must be handled on the thread that created the window, so
+ * this sleeps in SDL_WaitEventTimeout() on the main thread rather than
+ * polling on another. It wakes at least every QUIT_POLL_MS to notice quits
+ * asked for by other threads. If the audio is being visualized, it also
+ * wakes every VIZ_FRAME_MS to redraw the window.
  *
- * return: 1 if the close button has been pressed, 0 otherwise
+ * graphics:    A pointer to the Graphics of the window
+ * ms:          The time to wait, in milliseconds
  */
-void* detect_close(void* vargp) {
-    while(1) {
-        if(!isWindowOpen((Graphics*) vargp)) {
-            should_close = 1;
-            printf("Closing, please wait...\n");
-            return NULL;
-        }
+void wait_for_step(Graphics* graphics, int ms) {
+    int poll_ms = graphics->viz != NULL ? VIZ_FRAME_MS : QUIT_POLL_MS;
+    Uint32 end = SDL_GetTicks() + ms;
+    Sint32 left;
+    while(!shouldClose() && (left = (Sint32) (end - SDL_GetTicks())) > 0) {
+        if(!handle_events(graphics, left < poll_ms ? left : poll_ms))
+            request_close();
+        else if(graphics->viz != NULL)
+            updateWindow(graphics);
     }
-    return NULL;
 }
 #endif
 
@@ -764,22 +1160,48 @@ void usage() {
 
     #ifdef _WIN32
         #ifdef USE_GRAPHICS
-        printf("aural_landscapes.exe input.png -o output.png --hide-rect\n");
+        printf("aural_landscapes.exe input.png -o output.png --select random --region-size 50 --hide-rect\n");
         #else
-        printf("aural_landscapes.exe input.png -o output.png\n");
+        printf("aural_landscapes.exe input.png -o output.png --select random --region-size 50\n");
         #endif
     #else
         #ifdef USE_GRAPHICS
-        printf("./aural_landscapes input.png -o output.png --hide-rect\n");
+        printf("./aural_landscapes input.png -o output.png --select random --region-size 50 --hide-rect\n");
         #else
-        printf("./aural_landscapes input.png -o output.png\n");
+        printf("./aural_landscapes input.png -o output.png --select random --region-size 50\n");
         #endif
     #endif
 
-    printf("input.png:                  input file must be a png image\n");
+    printf("input.png:                  input file must be a png, ppm or pam image, or a\n");
+    printf("                            directory or quoted glob of an image sequence\n");
     printf("-o output.wav (optional):   writes audio to the given filename\n");
-    
-    #ifdef USE_GRAPHICS
-    printf("--hide-rect (optional):     hides the rectangle display on the image\n\n");
-    #endif
+    printf("--format name (optional):   output file format: rf64 (default), w64 or wav\n");
+    printf("--rotate-minutes minutes (optional): starts a new output file this often\n");
+    printf("--rotate-mb megabytes (optional): starts a new output file at this size\n");
+    printf("--select strategy (optional): chooses regions of the image by content.\n");
+    printf("                            one of random, dark, bright, cold, warm, busy\n");
+    printf("--scale root mode (optional): always uses the given key, such as d dorian\n");
+    printf("--tuning name (optional):   one of equal, just, pythagorean, meantone\n");
+    printf("--key file (optional):      always uses the frequencies in the given file\n");
+    printf("--seed number (optional):   seed of the random numbers, to repeat a piece\n");
+    printf("--region-size pixels (optional): width and height of each region\n");
+    printf("--analysis-size samples (optional): largest width and height to analyze at\n");
+    printf("--stream (optional):        decodes the image a band of rows at a time\n");
+    printf("--cache (optional):         reuses the image's analysis from earlier runs\n");
+    printf("--trusted (optional):       skips checking the image file's checksums\n");
+    printf("--frame-time seconds (optional): time on each image of a sequence\n");
+    printf("--prefetch frames (optional): images of a sequence to load ahead\n");
+    printf("--watch (optional):         plays each new image written to the input directory\n");
+    printf("--batch (optional):         renders a manifest of image, duration, seed, output\n");
+    printf("                            jobs offline\n");
+    printf("--export dir (optional):    renders audio and video frames offline to dir\n");
+    printf("--duration seconds (optional): length of an export, 60 by default\n");
+    printf("--fps frames (optional):    frame rate of an export, 30 by default\n");
+    printf("--threads count (optional): threads to analyze images, render a batch or\n");
+    printf("                            encode frames with\n");
+    printf("--viz (optional):           shows the notes playing and the output\n");
+    printf("--hide-rect (optional):     hides the rectangle display on the image\n");
+    printf("--trace file (optional):    writes a Chrome trace of the run to file\n");
+    printf("--profile (optional):       prints the audio callback's times and hardware\n");
+    printf("                            counters by number of voices on exit\n\n");
 }
@@ -0,0 +1,86 @@
+#include "mapped_file.h"
+
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include "lodepng.h"
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+
+
+/*
+ * map_file():
+ * Maps the given file into memory, advising the OS that it will be read from
+ * start to end so it reads ahead and drops pages behind.
+ *
+ * The user must call unmap_file() when done with the file.
+ *
+ * filename:    The file to map
+ *
+ * return:      A malloc'ed MappedFile, or NULL on error or if the file is empty
+ */
+MappedFile* map_file(char* filename) {
+    MappedFile* file = (MappedFile*) malloc(sizeof(MappedFile));
+    if(file == NULL)
+        return NULL;
+
+    #ifdef _WIN32
+    file->mapped = 0;
+    if(lodepng_load_file(&file->data, &file->size, filename) != 0 || file->size == 0) {
+        free(file->data);
+        free(file);
+        return NULL;
+    }
+    #else
+    file->mapped = 1;
+
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0) {
+        free(file);
+        return NULL;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        free(file);
+        return NULL;
+    }
+    file->size = st.st_size;
+
+    // The mapping stays valid after the file is closed
+    file->data = (unsigned char*) mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(file->data == MAP_FAILED) {
+        free(file);
+        return NULL;
+    }
+    madvise(file->data, file->size, MADV_SEQUENTIAL);
+    #endif
+
+    return file;
+}
+
+
+
+/*
+ * unmap_file():
+ * Unmaps or frees the given file's contents, and frees the passed pointer.
+ *
+ * file:        The MappedFile to unmap
+ */
+void unmap_file(MappedFile* file) {
+    if(file->mapped) {
+        #ifndef _WIN32
+        munmap(file->data, file->size);
+        #endif
+    }
+    else
+        free(file->data);
+    free(file);
+}
@@ -0,0 +1,42 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <stddef.h>
+
+/*
+ * MappedFile:
+ * The contents of a file, mapped read-only into memory so they're paged in
+ * from the OS's cache as they're read instead of being copied into a buffer.
+ * On systems without mmap(), the file is read into a malloc'ed buffer instead.
+ */
+typedef struct mapped_file {
+    unsigned char* data;
+    size_t size;
+    int mapped; // Boolean, whether data is mapped rather than malloc'ed
+} MappedFile;
+
+
+
+/*
+ * map_file():
+ * Maps the given file into memory, advising the OS that it will be read from
+ * start to end so it reads ahead and drops pages behind.
+ *
+ * The user must call unmap_file() when done with the file.
+ *
+ * filename:    The file to map
+ *
+ * return:      A malloc'ed MappedFile, or NULL on error or if the file is empty
+ */
+MappedFile* map_file(char* filename);
+
+
+/*
+ * unmap_file():
+ * Unmaps or frees the given file's contents, and frees the passed pointer.
+ *
+ * file:        The MappedFile to unmap
+ */
+void unmap_file(MappedFile* file);
+
+#endif
@@ -95,7 +95,7 @@ float oscil_tick(Oscillator* osc) {
 
     // Update the table index, keep it below the table length
     osc->index += osc->inc;
-    if(osc->index > osc->tablen)
+    if(osc->index >= osc->tablen)
         osc->index -= osc->tablen;
 
     // Update current time (relative to sample 0)
@@ -224,6 +224,55 @@ void oscil_list_remove(OscilNode** head, int id) {
 }
 
 
+/*
+ * oscil_list_remove_expired():
+ * Removes and frees every expired Oscillator in the given list.
+ *
+ * head:        A double pointer to the head of the list
+ */
+void oscil_list_remove_expired(OscilNode** head) {
+    OscilNode* curr = *head;
+    while(curr != NULL) {
+        OscilNode* temp = curr->next;
+
+        //If oscillator is expired, remove it
+        if(oscil_expired(curr->osc))
+            oscil_list_remove(head, curr->osc->id);
+
+        curr = temp;
+    }
+}
+
+
+/*
+ * oscil_list_mix():
+ * Ticks every Oscillator in the given list for the given number of samples,
+ * and writes the sum of their values at each sample to the output buffer.
+ *
+ * head:        A pointer to the head of the list
+ * out:         The buffer to write the samples to
+ * frames:      The number of samples to generate
+ */
+void oscil_list_mix(OscilNode* head, float* out, int frames) {
+    OscilNode* curr;
+    float val;
+    // For each sample
+    for(int i = 0; i < frames; i++) {
+        val = 0;
+
+        // Tick each oscillator in list and sum their values
+        curr = head;
+        while(curr != NULL) {
+            val += oscil_tick(curr->osc);
+            curr = curr->next;
+        }
+
+        // The output sample is the summed oscillator values
+        out[i] = val;
+    }
+}
+
+
 /*
  * oscil_list_free():
  * Frees the given list and any oscillators in it.
@@ -234,6 +234,25 @@ void oscil_list_add(OscilNode** head, Oscillator* osc);
  */
 void oscil_list_free(OscilNode* head);
 
+/*
+ * oscil_list_remove_expired():
+ * Removes and frees every expired Oscillator in the given list.
+ *
+ * head:        A double pointer to the head of the list
+ */
+void oscil_list_remove_expired(OscilNode** head);
+
+/*
+ * oscil_list_mix():
+ * Ticks every Oscillator in the given list for the given number of samples,
+ * and writes the sum of their values at each sample to the output buffer.
+ *
+ * head:        A pointer to the head of the list
+ * out:         The buffer to write the samples to
+ * frames:      The number of samples to generate
+ */
+void oscil_list_mix(OscilNode* head, float* out, int frames);
+
 /*
  * oscil_list_remove():
  * Removes and frees the oscillator with the given id from the given list.
@@ -0,0 +1,447 @@
+#include "png_stream.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "image.h"
+
+#define BYTESPP 4 // Number of bytes per pixel of the RGBA output
+
+
+/* Internal function declarations */
+#ifdef USE_ZLIB
+int open_streaming(PngStream* stream, char* filename, int trusted);
+int refill_input(PngStream* stream);
+int finish_data(PngStream* stream);
+unsigned read_uint32(unsigned char* bytes);
+#endif
+
+
+
+/*
+ * open_png_stream():
+ * Opens the given .png file and reads its header, leaving the stream ready to
+ * decode rows from the top of the image. The image's dimensions are in the
+ * returned stream's width and height.
+ *
+ * The user must call close_png_stream() when done with the stream.
+ *
+ * filename:    The image file to open (.png, .ppm or .pam)
+ * trusted:     Boolean, whether to skip checking the file's checksums, as in
+ *              load_imagefile()
+ *
+ * return:      A malloc'ed PngStream, or NULL on error
+ */
+PngStream* open_png_stream(char* filename, int trusted) {
+    PngStream* stream = (PngStream*) calloc(1, sizeof(PngStream));
+    if(stream == NULL) {
+        printf("Error allocating PngStream\n");
+        return NULL;
+    }
+
+    // Raw images can be converted a few rows at a time from the mapped file
+    MappedFile* file = map_file(filename);
+    if(file != NULL && parse_raw_header(file->data, file->size, &stream->raw)) {
+        stream->raw_file = file;
+        stream->width = stream->raw.width;
+        stream->height = stream->raw.height;
+        return stream;
+    }
+    if(file != NULL)
+        unmap_file(file);
+
+    #ifdef USE_ZLIB
+    int err = open_streaming(stream, filename, trusted);
+    if(err == 0)
+        return stream;
+    else if(err == 1) {
+        close_png_stream(stream);
+        return NULL;
+    }
+    // Otherwise the image can't be streamed, so use the fallback below
+    #endif
+
+    stream->image = open_imagefile(filename, trusted);
+    if(stream->image == NULL) {
+        close_png_stream(stream);
+        return NULL;
+    }
+    stream->width = stream->image->width;
+    stream->height = stream->image->height;
+
+    return stream;
+}
+
+
+
+/*
+ * png_stream_read_rows():
+ * Decodes the next rows of the image as 8-bit RGBA pixel data, in the same
+ * format as load_imagefile(). Unless the stream was opened as trusted, the
+ * checksums are checked as the data is read, and the call that decodes the
+ * last row fails if the image data's Adler-32 is wrong or any data is left
+ * after it.
+ *
+ * stream:      The PngStream to read from
+ * out:         A buffer to fill, must hold max_rows*width*4 chars
+ * max_rows:    The maximum number of rows to decode
+ *
+ * return:      The number of rows decoded, 0 at the end of the image, or -1 on
+ *              error
+ */
+int png_stream_read_rows(PngStream* stream, unsigned char* out, int max_rows) {
+    size_t rowbytes = (size_t) stream->width * BYTESPP;
+
+    if(max_rows > stream->height - stream->row)
+        max_rows = stream->height - stream->row;
+
+    /* Fallback: the image is already decoded, so just copy the rows out */
+    if(stream->image != NULL) {
+        memcpy(out, stream->image->pixels + stream->row*rowbytes, max_rows*rowbytes);
+        stream->row += max_rows;
+        return max_rows;
+    }
+
+    if(stream->raw_file != NULL) {
+        convert_raw_rows(stream->raw_file->data, &stream->raw, stream->row, max_rows, out);
+        stream->row += max_rows;
+        return max_rows;
+    }
+
+    #ifdef USE_ZLIB
+    LodePNGColorMode rgba;
+    lodepng_color_mode_init(&rgba); // Defaults to 8-bit RGBA
+
+    int rows = 0;
+    for(; rows < max_rows; rows++) {
+        /* Inflate until the scanline and its filter byte are filled */
+        while(stream->scan_filled < stream->linebytes+1) {
+            if(stream->zs.avail_in == 0) {
+                int ret = refill_input(stream);
+                if(ret == 1)
+                    printf("Error streaming PNG: image data ended early\n");
+                if(ret != 0)
+                    return -1;
+            }
+
+            stream->zs.next_out = stream->scanline + stream->scan_filled;
+            stream->zs.avail_out = stream->linebytes+1 - stream->scan_filled;
+
+            int ret = inflate(&stream->zs, Z_NO_FLUSH);
+            stream->scan_filled = stream->linebytes+1 - stream->zs.avail_out;
+
+            if(ret == Z_STREAM_END && stream->scan_filled < stream->linebytes+1) {
+                printf("Error streaming PNG: image data ended early\n");
+                return -1;
+            }
+            else if(ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+                printf("Error streaming PNG: %s\n", stream->zs.msg ? stream->zs.msg : "inflate failed");
+                return -1;
+            }
+        }
+
+        // The first byte of each scanline says which filter it uses
+        unsigned err = lodepng_unfilter_scanline(stream->curr, stream->scanline+1,
+                stream->row == 0 ? NULL : stream->prev, stream->bytewidth,
+                stream->scanline[0], stream->linebytes);
+        if(!err)
+            err = lodepng_convert(out + rows*rowbytes, stream->curr, &rgba, &stream->color, stream->width, 1);
+        if(err) {
+            printf("Error streaming PNG: %s\n", lodepng_error_text(err));
+            return -1;
+        }
+
+        // The current scanline is the next one's previous scanline
+        unsigned char* temp = stream->prev;
+        stream->prev = stream->curr;
+        stream->curr = temp;
+
+        stream->scan_filled = 0;
+        stream->row++;
+    }
+
+    if(stream->row == stream->height && !stream->trusted && finish_data(stream) != 0)
+        return -1;
+
+    return rows;
+    #else
+    return -1;
+    #endif
+}
+
+
+
+/*
+ * close_png_stream():
+ * Closes the file and frees all resources associated with the given stream.
+ * Also frees the passed pointer.
+ *
+ * stream:      The PngStream to close
+ */
+void close_png_stream(PngStream* stream) {
+    if(stream->image != NULL)
+        close_imagefile(stream->image);
+    if(stream->raw_file != NULL)
+        unmap_file(stream->raw_file);
+
+    #ifdef USE_ZLIB
+    if(stream->file != NULL) {
+        fclose(stream->file);
+        inflateEnd(&stream->zs);
+        lodepng_color_mode_cleanup(&stream->color);
+    }
+    free(stream->scanline);
+    free(stream->curr);
+    free(stream->prev);
+    #endif
+
+    free(stream);
+}
+
+
+
+
+#ifdef USE_ZLIB
+/*
+ * open_streaming():
+ * Opens the file and reads every chunk up to the first IDAT chunk, which hold
+ * the image's dimensions and color mode, and prepares zlib to inflate the
+ * image data.
+ *
+ * stream:      The PngStream to set up
+ * filename:    The image file to open
+ * trusted:     Boolean, whether to skip the CRC checks of the IDAT chunks and
+ *              the Adler-32 check of the image data
+ *
+ * return:      0 on success, 1 on error, or 2 if the image can't be streamed
+ */
+int open_streaming(PngStream* stream, char* filename, int trusted) {
+    if((stream->file = fopen(filename, "rb")) == NULL) {
+        printf("Error opening image file %s\n", filename);
+        return 1;
+    }
+
+    /* Read the signature and the chunks before the image data into memory, so
+     * LodePNG can parse them */
+    size_t size = 8;
+    unsigned char* header = (unsigned char*) malloc(size);
+    if(header == NULL || fread(header, 1, 8, stream->file) != 8) {
+        printf("Error reading PNG header of %s\n", filename);
+        free(header);
+        return 1;
+    }
+
+    while(1) {
+        unsigned char chunkhead[8];
+        if(fread(chunkhead, 1, 8, stream->file) != 8) {
+            printf("Error reading PNG %s: no image data\n", filename);
+            free(header);
+            return 1;
+        }
+        unsigned len = read_uint32(chunkhead);
+
+        if(memcmp(chunkhead+4, "IDAT", 4) == 0) {
+            stream->chunk_left = len;
+            stream->crc = crc32(0L, chunkhead+4, 4);
+            break;
+        }
+
+        // Add the chunk (header, data and CRC) to the buffer
+        unsigned char* grown = (unsigned char*) realloc(header, size + 12 + len);
+        if(grown == NULL) {
+            printf("Out of memory reading PNG header of %s\n", filename);
+            free(header);
+            return 1;
+        }
+        header = grown;
+        memcpy(header + size, chunkhead, 8);
+        if(fread(header + size + 8, 1, len + 4, stream->file) != len + 4) {
+            printf("Error reading PNG %s: file ended early\n", filename);
+            free(header);
+            return 1;
+        }
+        size += 12 + len;
+    }
+
+    /* Parse the header and color chunks */
+    LodePNGState state;
+    lodepng_state_init(&state);
+
+    unsigned err = lodepng_inspect(&stream->width, &stream->height, &state, header, size);
+    const unsigned char* chunk = header + 8;
+    while(!err && chunk + 12 <= header + size) {
+        if(!lodepng_chunk_type_equals(chunk, "IHDR"))
+            err = lodepng_inspect_chunk(&state, chunk - header, header, size);
+        chunk = lodepng_chunk_next_const(chunk, header + size);
+    }
+    free(header);
+
+    if(err) {
+        printf("Error reading PNG header of %s: %s\n", filename, lodepng_error_text(err));
+        lodepng_state_cleanup(&state);
+        return 1;
+    }
+
+    // Interlaced rows aren't stored top to bottom, so they can't be streamed
+    if(state.info_png.interlace_method != 0) {
+        lodepng_state_cleanup(&state);
+        fclose(stream->file);
+        stream->file = NULL;
+        return 2;
+    }
+
+    lodepng_color_mode_init(&stream->color);
+    lodepng_color_mode_copy(&stream->color, &state.info_png.color);
+    lodepng_state_cleanup(&state);
+
+    stream->linebytes = lodepng_get_raw_size(stream->width, 1, &stream->color);
+    stream->bytewidth = (lodepng_get_bpp(&stream->color) + 7) / 8;
+
+    stream->scanline = (unsigned char*) malloc(stream->linebytes + 1);
+    stream->curr = (unsigned char*) malloc(stream->linebytes);
+    stream->prev = (unsigned char*) malloc(stream->linebytes);
+
+    stream->zs.zalloc = Z_NULL;
+    stream->zs.zfree = Z_NULL;
+    stream->zs.opaque = Z_NULL;
+    stream->zs.next_in = Z_NULL;
+    stream->zs.avail_in = 0;
+    stream->trusted = trusted;
+    stream->header_left = trusted ? 2 : 0;
+    if(inflateInit2(&stream->zs, trusted ? -MAX_WBITS : MAX_WBITS) != Z_OK) {
+        printf("Error initializing zlib\n");
+        fclose(stream->file);
+        stream->file = NULL;
+        return 1;
+    }
+
+    if(stream->scanline == NULL || stream->curr == NULL || stream->prev == NULL) {
+        printf("Error allocating PNG scanlines\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * refill_input():
+ * Reads the next block of compressed image data from the file into the
+ * stream's input buffer, moving on to the next IDAT chunk when the current one
+ * has been read. Unless trusted, each chunk's CRC is checked once it's read.
+ *
+ * stream:      The PngStream to refill
+ *
+ * return:      0 on success, 1 if there is no more image data, or 2 if a
+ *              chunk's CRC is wrong or the file can't be read
+ */
+int refill_input(PngStream* stream) {
+    while(stream->chunk_left == 0) {
+        if(stream->data_done)
+            return 1;
+
+        // Check the finished chunk's CRC and read the next chunk's header
+        unsigned char buf[12];
+        if(fread(buf, 1, 12, stream->file) != 12) {
+            printf("Error streaming PNG: file ended early\n");
+            return 2;
+        }
+        if(!stream->trusted && read_uint32(buf) != stream->crc) {
+            printf("Error streaming PNG: CRC mismatch in image data\n");
+            return 2;
+        }
+        if(memcmp(buf+8, "IDAT", 4) != 0) {
+            stream->data_done = 1;
+            return 1;
+        }
+        stream->chunk_left = read_uint32(buf+4);
+        if(!stream->trusted)
+            stream->crc = crc32(0L, buf+8, 4);
+    }
+
+    size_t n = stream->chunk_left;
+    if(n > PNG_STREAM_INBUF)
+        n = PNG_STREAM_INBUF;
+    n = fread(stream->inbuf, 1, n, stream->file);
+    if(n == 0) {
+        printf("Error streaming PNG: file ended early\n");
+        return 2;
+    }
+
+    if(!stream->trusted)
+        stream->crc = crc32(stream->crc, stream->inbuf, n);
+    stream->chunk_left -= n;
+    stream->zs.next_in = stream->inbuf;
+    stream->zs.avail_in = n;
+
+    // Step over the zlib header when inflating raw
+    while(stream->header_left > 0 && stream->zs.avail_in > 0) {
+        stream->zs.next_in++;
+        stream->zs.avail_in--;
+        stream->header_left--;
+    }
+    return 0;
+}
+
+
+/*
+ * finish_data():
+ * Once every row has been decoded, inflates the rest of the image data so
+ * zlib checks its Adler-32, and reads to the end of the last IDAT chunk to
+ * check its CRC. Any data left after the image's rows is an error.
+ *
+ * stream:      The PngStream, all of whose rows have been decoded
+ *
+ * return:      0 on success, 1 if the image data is corrupt
+ */
+int finish_data(PngStream* stream) {
+    // Nothing should come out, only the Adler-32 should be left to read
+    unsigned char extra;
+    while(1) {
+        stream->zs.next_out = &extra;
+        stream->zs.avail_out = 1;
+        int ret = inflate(&stream->zs, Z_NO_FLUSH);
+        if(ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+            printf("Error streaming PNG: %s\n", stream->zs.msg ? stream->zs.msg : "inflate failed");
+            return 1;
+        }
+        if(stream->zs.avail_out == 0) {
+            printf("Error streaming PNG: more image data than the image holds\n");
+            return 1;
+        }
+        if(ret == Z_STREAM_END)
+            break;
+
+        if(stream->zs.avail_in == 0) {
+            int refill = refill_input(stream);
+            if(refill == 1)
+                printf("Error streaming PNG: image data ended early\n");
+            if(refill != 0)
+                return 1;
+        }
+    }
+
+    // Read past the end of the image data, checking the last chunk's CRC
+    int refill = 0;
+    while(stream->zs.avail_in == 0 && refill == 0)
+        refill = refill_input(stream);
+    if(refill == 2)
+        return 1;
+    if(stream->zs.avail_in > 0) {
+        printf("Error streaming PNG: data after the end of the image data\n");
+        return 1;
+    }
+    return 0;
+}
+
+
+/*
+ * read_uint32():
+ * Returns the big-endian 32-bit integer stored in the given bytes, the byte
+ * order PNG uses.
+ */
+unsigned read_uint32(unsigned char* bytes) {
+    return ((unsigned) bytes[0] << 24) | ((unsigned) bytes[1] << 16) |
+        ((unsigned) bytes[2] << 8) | bytes[3];
+}
+#endif
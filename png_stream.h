@@ -0,0 +1,115 @@
+#ifndef PNG_STREAM_H
+#define PNG_STREAM_H
+
+#include <stdio.h>
+
+#include "lodepng.h"
+#include "image.h"
+
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
+
+// How many bytes of compressed data to read from the file at a time
+#define PNG_STREAM_INBUF 65536
+
+
+/*
+ * PngStream:
+ * Decodes a .png file a few rows at a time, so the whole image never has to
+ * be in memory at once. Only the file's compressed data is read as it's
+ * needed, and only the current and previous scanlines are kept.
+ *
+ * Streaming needs zlib to inflate the image data incrementally, so it is only
+ * available when compiled with USE_ZLIB. Without it, or for interlaced images
+ * (whose rows aren't stored in order), the stream falls back to decoding the
+ * whole image with LodePNG when opened and hands out its rows from memory.
+ *
+ * Raw .ppm and .pam files are streamed too, converting rows straight from the
+ * mapped file as they're read.
+ */
+typedef struct png_stream {
+    unsigned width;
+    unsigned height;
+    unsigned row; // The next row to be read
+
+    // Fallback: the fully decoded image, NULL when streaming
+    ImageFile* image;
+
+    // For raw images, the mapped file and its header, NULL otherwise
+    MappedFile* raw_file;
+    RawHeader raw;
+
+    #ifdef USE_ZLIB
+    FILE* file;
+    z_stream zs;
+    unsigned chunk_left; // Bytes of the current IDAT chunk not yet read
+    int data_done; // Boolean, whether the last IDAT chunk has been read
+    /* Boolean, whether to skip the checksums. Otherwise each IDAT chunk's CRC
+     * is computed as it's read and compared with the one stored after it, and
+     * the data is inflated to its end, so zlib checks its Adler-32. */
+    int trusted;
+    uLong crc; // The CRC of the current IDAT chunk so far, when not trusted
+    /* Bytes of the zlib header still to skip. When trusted, the header is
+     * skipped and the data inflated raw, so its Adler-32 isn't computed. */
+    int header_left;
+    unsigned char inbuf[PNG_STREAM_INBUF];
+
+    LodePNGColorMode color; // The color mode of the file's scanlines
+    size_t linebytes; // Bytes per scanline, not including the filter byte
+    size_t bytewidth; // Bytes per pixel, rounded up
+
+    unsigned char* scanline; // The filtered scanline being inflated
+    size_t scan_filled; // How many bytes of the scanline are inflated so far
+    unsigned char* curr; // The unfiltered current scanline
+    unsigned char* prev; // The unfiltered previous scanline
+    #endif
+} PngStream;
+
+
+
+/*
+ * open_png_stream():
+ * Opens the given .png file and reads its header, leaving the stream ready to
+ * decode rows from the top of the image. The image's dimensions are in the
+ * returned stream's width and height.
+ *
+ * The user must call close_png_stream() when done with the stream.
+ *
+ * filename:    The image file to open (.png, .ppm or .pam)
+ * trusted:     Boolean, whether to skip checking the file's checksums, as in
+ *              load_imagefile()
+ *
+ * return:      A malloc'ed PngStream, or NULL on error
+ */
+PngStream* open_png_stream(char* filename, int trusted);
+
+
+/*
+ * png_stream_read_rows():
+ * Decodes the next rows of the image as 8-bit RGBA pixel data, in the same
+ * format as load_imagefile(). Unless the stream was opened as trusted, the
+ * checksums are checked as the data is read, and the call that decodes the
+ * last row fails if the image data's Adler-32 is wrong or any data is left
+ * after it.
+ *
+ * stream:      The PngStream to read from
+ * out:         A buffer to fill, must hold max_rows*width*4 chars
+ * max_rows:    The maximum number of rows to decode
+ *
+ * return:      The number of rows decoded, 0 at the end of the image, or -1 on
+ *              error
+ */
+int png_stream_read_rows(PngStream* stream, unsigned char* out, int max_rows);
+
+
+/*
+ * close_png_stream():
+ * Closes the file and frees all resources associated with the given stream.
+ * Also frees the passed pointer.
+ *
+ * stream:      The PngStream to close
+ */
+void close_png_stream(PngStream* stream);
+
+#endif
@@ -0,0 +1,628 @@
+#include "pyramid.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#include "thread_pool.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define BYTESPP 4 // Number of bytes per pixel of the RGBA input
+
+/* With -DUSE_TARGET_CLONES (as in "make release"), the SIMD kernels are also
+ * compiled for AVX2, and the version the CPU supports is picked when the
+ * program starts. Not FMA, which would round differently. */
+#if defined(USE_TARGET_CLONES) && defined(__x86_64__) && defined(__linux__)
+#define SIMD_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define SIMD_CLONES
+#endif
+
+/* Fewer pixels than this are added on the calling thread alone, as handing
+ * them to other threads would take longer than the work */
+#define MIN_THREAD_PIXELS (1 << 16)
+
+
+/*
+ * BuilderJob:
+ * The rows being added to a PyramidBuilder, whose columns are split into
+ * ranges that are added as separate tasks.
+ */
+typedef struct builder_job {
+    PyramidBuilder* builder;
+    unsigned char* rows;
+    int num_rows;
+    int num_ranges;
+} BuilderJob;
+
+
+/* Internal function declarations */
+int alloc_level(PyramidLevel* level, int width, int height);
+void free_level(PyramidLevel* level);
+void add_columns(void* arg, int task, int worker);
+void row_values(unsigned char* pixels, int n, float* bright, float* bright2, float* warmth);
+void downsample_plane(float* src, int sw, int sh, float* dst, int dw, int dh);
+void pixel_values(unsigned char* p, float* bright, float* bright2, float* warmth);
+
+
+
+/*
+ * build_pyramid():
+ * Computes the analysis planes of the given pixel data and builds a malloc'ed
+ * Pyramid from them, down to a level of 1x1 samples.
+ *
+ * The user must call free_pyramid() on the returned struct.
+ *
+ * rawpix:      The array of char RGBA pixel data, as from load_imagefile()
+ * width:       The width of the data
+ * height:      The height of the data
+ * shift:       Log2 of the number of pixels across each level 0 sample, 0 to
+ *              analyze the image at full resolution
+ * threads:     The number of threads to analyze with, 0 for one per processor
+ *
+ * return:      A malloc'ed Pyramid, or NULL on error
+ */
+Pyramid* build_pyramid(unsigned char* rawpix, int width, int height, int shift, int threads) {
+    PyramidBuilder* builder = new_pyramid_builder(width, height, shift, threads);
+    if(builder == NULL)
+        return NULL;
+
+    pyramid_builder_add_rows(builder, rawpix, height);
+    return pyramid_builder_finish(builder);
+}
+
+
+
+/*
+ * new_pyramid_builder():
+ * Creates a malloc'ed PyramidBuilder for an image of the given size.
+ *
+ * The pixel rows must then be added in order from the top of the image with
+ * pyramid_builder_add_rows(), and the Pyramid taken with
+ * pyramid_builder_finish(), which also frees the builder.
+ *
+ * width:       The width of the image in pixels
+ * height:      The height of the image in pixels
+ * shift:       Log2 of the number of pixels across each level 0 sample
+ * threads:     The number of threads to add rows with, 0 for one per processor
+ *
+ * return:      A malloc'ed PyramidBuilder, or NULL on error
+ */
+PyramidBuilder* new_pyramid_builder(int width, int height, int shift, int threads) {
+    PyramidBuilder* builder = (PyramidBuilder*) calloc(1, sizeof(PyramidBuilder));
+    Pyramid* pyramid = (Pyramid*) malloc(sizeof(Pyramid));
+    if(builder == NULL || pyramid == NULL) {
+        printf("Error allocating Pyramid\n");
+        free(builder);
+        free(pyramid);
+        return NULL;
+    }
+    builder->pyramid = pyramid;
+
+    pyramid->width = width;
+    pyramid->height = height;
+    pyramid->shift = shift;
+    pyramid->mapped = NULL;
+    pyramid->mapped_size = 0;
+
+    // Level 0 has one sample for each 2^shift by 2^shift block, rounded up
+    int base_w = (width + (1 << shift) - 1) >> shift;
+    int base_h = (height + (1 << shift) - 1) >> shift;
+
+    // Count the levels needed to get down to 1x1
+    pyramid->num_levels = 1;
+    for(int w = base_w, h = base_h; w > 1 || h > 1; w = (w+1)/2, h = (h+1)/2)
+        pyramid->num_levels++;
+
+    pyramid->levels = (PyramidLevel*) calloc(pyramid->num_levels, sizeof(PyramidLevel));
+    if(pyramid->levels == NULL) {
+        printf("Error allocating Pyramid levels\n");
+        free(pyramid);
+        free(builder);
+        return NULL;
+    }
+
+    if(alloc_level(pyramid->levels, base_w, base_h) != 0) {
+        free_pyramid(pyramid);
+        free(builder);
+        return NULL;
+    }
+
+    if(shift > 0) {
+        builder->sums = (float*) calloc(3*base_w, sizeof(float));
+        builder->values = (float*) malloc(3*sizeof(float)*width);
+        if(builder->sums == NULL || builder->values == NULL) {
+            printf("Error allocating PyramidBuilder sums\n");
+            free_pyramid(pyramid);
+            free(builder->sums);
+            free(builder->values);
+            free(builder);
+            return NULL;
+        }
+    }
+
+    builder->threads = threads > 0 ? threads : count_cpus();
+
+    return builder;
+}
+
+
+
+/*
+ * pyramid_builder_add_rows():
+ * Adds the next rows of pixel data to the Pyramid being built.
+ *
+ * The columns are split into a range for each of the builder's threads, at
+ * the edges of level 0 samples, and the ranges are added with run_tasks(), so
+ * each range has its own samples to write and sums to add to.
+ *
+ * builder:     A pointer to the PyramidBuilder
+ * rows:        The char RGBA pixel data of the rows, as from load_imagefile()
+ * num_rows:    The number of rows of pixel data
+ */
+void pyramid_builder_add_rows(PyramidBuilder* builder, unsigned char* rows, int num_rows) {
+    Pyramid* pyramid = builder->pyramid;
+    int samples = pyramid->levels[0].width;
+
+    int threads = builder->threads;
+    if((long long) pyramid->width * num_rows < MIN_THREAD_PIXELS)
+        threads = 1;
+    if(threads > samples)
+        threads = samples;
+
+    BuilderJob job;
+    job.builder = builder;
+    job.rows = rows;
+    job.num_rows = num_rows;
+    job.num_ranges = threads;
+    if(threads > 1)
+        run_tasks(threads, threads, add_columns, &job);
+    else
+        add_columns(&job, 0, 0);
+
+    builder->row += num_rows;
+}
+
+
+
+/*
+ * pyramid_builder_finish():
+ * Computes the remaining levels of the Pyramid from the rows added to the
+ * builder, and frees the builder.
+ *
+ * The user must call free_pyramid() on the returned struct.
+ *
+ * builder:     A pointer to the PyramidBuilder, all image rows must be added
+ *
+ * return:      A malloc'ed Pyramid, or NULL on error
+ */
+Pyramid* pyramid_builder_finish(PyramidBuilder* builder) {
+    Pyramid* pyramid = builder->pyramid;
+
+    if(builder->row != pyramid->height) {
+        printf("Error building Pyramid: only %d of %d rows added\n", builder->row, pyramid->height);
+        free_pyramid(pyramid);
+        pyramid = NULL;
+    }
+
+    free(builder->sums);
+    free(builder->values);
+    free(builder);
+
+    if(pyramid == NULL)
+        return NULL;
+
+    /* Every level after 0: box filter the level before it */
+    for(int l = 1; l < pyramid->num_levels; l++) {
+        PyramidLevel* src = pyramid->levels + l-1;
+        PyramidLevel* dst = pyramid->levels + l;
+
+        if(alloc_level(dst, (src->width+1)/2, (src->height+1)/2) != 0) {
+            free_pyramid(pyramid);
+            return NULL;
+        }
+
+        downsample_plane(src->bright, src->width, src->height, dst->bright, dst->width, dst->height);
+        downsample_plane(src->bright2, src->width, src->height, dst->bright2, dst->width, dst->height);
+        downsample_plane(src->warmth, src->width, src->height, dst->warmth, dst->width, dst->height);
+    }
+
+    return pyramid;
+}
+
+
+
+/*
+ * free_pyramid_builder():
+ * Frees the given PyramidBuilder and the Pyramid it was building, for when the
+ * image's rows can't all be added.
+ *
+ * builder:     A pointer to the PyramidBuilder to free
+ */
+void free_pyramid_builder(PyramidBuilder* builder) {
+    free_pyramid(builder->pyramid);
+    free(builder->sums);
+    free(builder->values);
+    free(builder);
+}
+
+
+
+/*
+ * pyramid_level_for():
+ * Returns the coarsest level at which a region of the given size still spans
+ * at least the given number of samples in each direction.
+ *
+ * pyramid:     A pointer to the Pyramid
+ * w:           The width of the region in pixels
+ * h:           The height of the region in pixels
+ * samples:     The minimum number of samples across the region
+ *
+ * return:      The index of the level
+ */
+int pyramid_level_for(Pyramid* pyramid, int w, int h, int samples) {
+    int shift = pyramid->shift;
+    int level = 0;
+    while(level+1 < pyramid->num_levels &&
+            (w >> (shift+level+1)) >= samples && (h >> (shift+level+1)) >= samples)
+        level++;
+    return level;
+}
+
+
+
+/*
+ * pyramid_region_stats():
+ * Computes the average brightness, average warmth and brightness variance of
+ * a region of the image, reading it at the level returned by
+ * pyramid_level_for().
+ *
+ * pyramid:     A pointer to the Pyramid to analyze
+ * x:           The top left x coordinate of the region in pixels
+ * y:           The top left y coordinate of the region in pixels
+ * w:           The width of the region in pixels
+ * h:           The height of the region in pixels
+ * samples:     The minimum number of samples across the region
+ * brightness:  Pointer to a float in which the average brightness will be
+ *              stored, between 0 and 1
+ * warmth:      Pointer to a float in which the average warmth will be stored,
+ *              between -255 and 255
+ * variance:    Pointer to a float in which the brightness variance will be
+ *              stored
+ */
+void pyramid_region_stats(
+        Pyramid* pyramid,
+        int x,
+        int y,
+        int w,
+        int h,
+        int samples,
+        float* brightness,
+        float* warmth,
+        float* variance)
+{
+    int l = pyramid_level_for(pyramid, w, h, samples);
+    PyramidLevel* level = pyramid->levels + l;
+
+    // Convert the region to sample coordinates at this level
+    int shift = pyramid->shift + l;
+    int x0 = x >> shift;
+    int y0 = y >> shift;
+    int x1 = (x+w) >> shift;
+    int y1 = (y+h) >> shift;
+
+    // Always read at least one sample, and stay inside the level
+    if(x1 > level->width)
+        x1 = level->width;
+    if(y1 > level->height)
+        y1 = level->height;
+    if(x0 >= x1)
+        x0 = x1-1;
+    if(y0 >= y1)
+        y0 = y1-1;
+
+    double sum_bright = 0;
+    double sum_bright2 = 0;
+    double sum_warmth = 0;
+    for(int j = y0; j < y1; j++) {
+        for(int i = x0; i < x1; i++) {
+            sum_bright += level->bright[j*level->width + i];
+            sum_bright2 += level->bright2[j*level->width + i];
+            sum_warmth += level->warmth[j*level->width + i];
+        }
+    }
+
+    double count = (x1-x0) * (y1-y0);
+    double mean = sum_bright / count;
+
+    *brightness = mean;
+    *warmth = sum_warmth / count;
+    *variance = sum_bright2 / count - mean*mean;
+
+    // Rounding can push a flat region's variance just below 0
+    if(*variance < 0)
+        *variance = 0;
+}
+
+
+
+/*
+ * free_pyramid():
+ * Frees the given Pyramid and all of its levels, or unmaps its cache file if
+ * it was loaded from one.
+ *
+ * pyramid:     A pointer to the Pyramid to free
+ */
+void free_pyramid(Pyramid* pyramid) {
+    if(pyramid->mapped != NULL) {
+        #ifndef _WIN32
+        munmap(pyramid->mapped, pyramid->mapped_size);
+        #endif
+    }
+    else {
+        for(int l = 0; l < pyramid->num_levels; l++)
+            free_level(pyramid->levels + l);
+    }
+    free(pyramid->levels);
+    free(pyramid);
+}
+
+
+
+
+/*
+ * alloc_level():
+ * Allocates the planes of the given level at the given size.
+ *
+ * level:       A pointer to the PyramidLevel to allocate
+ * width:       The width of the level in samples
+ * height:      The height of the level in samples
+ *
+ * return:      0 on success, 1 on error
+ */
+int alloc_level(PyramidLevel* level, int width, int height) {
+    level->width = width;
+    level->height = height;
+    level->bright = (float*) malloc(sizeof(float)*width*height);
+    level->bright2 = (float*) malloc(sizeof(float)*width*height);
+    level->warmth = (float*) malloc(sizeof(float)*width*height);
+
+    if(level->bright == NULL || level->bright2 == NULL || level->warmth == NULL) {
+        printf("Error allocating %dx%d Pyramid level\n", width, height);
+        return 1;
+    }
+    return 0;
+}
+
+
+/*
+ * free_level():
+ * Frees the planes of the given level, but not the level pointer itself.
+ *
+ * level:       A pointer to the PyramidLevel to free
+ */
+void free_level(PyramidLevel* level) {
+    free(level->bright);
+    free(level->bright2);
+    free(level->warmth);
+}
+
+
+/*
+ * pixel_values():
+ * Computes the analysis values of one pixel.
+ *
+ * p:           A pointer to the pixel's RGBA chars
+ * bright:      Pointer to a float in which the brightness will be stored
+ * bright2:     Pointer to a float in which the squared brightness will be stored
+ * warmth:      Pointer to a float in which the warmth will be stored
+ */
+void pixel_values(unsigned char* p, float* bright, float* bright2, float* warmth) {
+    // Taken from http://alienryderflex.com/hsp.html, see perc_brightness().
+    // The weights add up to 1, so the maximum brightness is 255.
+    float b = sqrtf(0.299f*p[0]*p[0] + 0.587f*p[1]*p[1] + 0.114f*p[2]*p[2]) / 255;
+
+    *bright = b;
+    *bright2 = b*b;
+    *warmth = p[0] - p[2]; // Warmth is red - blue
+}
+
+
+/*
+ * row_values():
+ * Computes the analysis values of a run of pixels, as pixel_values() does for
+ * each one.
+ *
+ * pixels:      A pointer to the first pixel's RGBA chars
+ * n:           The number of pixels
+ * bright:      An array of n floats in which the brightnesses will be stored
+ * bright2:     An array of n floats in which the squared brightnesses will be
+ *              stored
+ * warmth:      An array of n floats in which the warmths will be stored
+ */
+SIMD_CLONES
+void row_values(unsigned char* pixels, int n, float* bright, float* bright2, float* warmth) {
+    int x = 0;
+
+    /* 4 pixels at a time. The operations are the same as in pixel_values() and
+     * in the same order, and square root and division are exact, so the values
+     * are the same as computing them one by one. */
+    #if defined(__SSE2__)
+    __m128i mask = _mm_set1_epi32(0xFF);
+    __m128 wr = _mm_set1_ps(0.299f);
+    __m128 wg = _mm_set1_ps(0.587f);
+    __m128 wb = _mm_set1_ps(0.114f);
+    __m128 max = _mm_set1_ps(255.0f);
+    for(; x + 4 <= n; x += 4) {
+        // Each 32 bit lane holds one pixel, red in the lowest byte
+        __m128i p = _mm_loadu_si128((__m128i*) (pixels + BYTESPP*x));
+        __m128 r = _mm_cvtepi32_ps(_mm_and_si128(p, mask));
+        __m128 g = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(p, 8), mask));
+        __m128 b = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(p, 16), mask));
+
+        __m128 sum = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(wr, r), r),
+                    _mm_mul_ps(_mm_mul_ps(wg, g), g)), _mm_mul_ps(_mm_mul_ps(wb, b), b));
+        __m128 br = _mm_div_ps(_mm_sqrt_ps(sum), max);
+
+        _mm_storeu_ps(bright + x, br);
+        _mm_storeu_ps(bright2 + x, _mm_mul_ps(br, br));
+        _mm_storeu_ps(warmth + x, _mm_sub_ps(r, b));
+    }
+    #elif defined(__ARM_NEON) && defined(__aarch64__)
+    // 32 bit NEON has no vector square root or division
+    for(; x + 4 <= n; x += 4) {
+        // vld4 splits the red, green, blue and alpha chars into val[0] to val[3]
+        uint8x8x4_t p = vld4_u8(pixels + BYTESPP*x);
+        float32x4_t r = vcvtq_f32_u32(vmovl_u16(vget_low_u16(vmovl_u8(p.val[0]))));
+        float32x4_t g = vcvtq_f32_u32(vmovl_u16(vget_low_u16(vmovl_u8(p.val[1]))));
+        float32x4_t b = vcvtq_f32_u32(vmovl_u16(vget_low_u16(vmovl_u8(p.val[2]))));
+
+        float32x4_t sum = vaddq_f32(vaddq_f32(vmulq_f32(vmulq_n_f32(r, 0.299f), r),
+                    vmulq_f32(vmulq_n_f32(g, 0.587f), g)), vmulq_f32(vmulq_n_f32(b, 0.114f), b));
+        float32x4_t br = vdivq_f32(vsqrtq_f32(sum), vdupq_n_f32(255.0f));
+
+        vst1q_f32(bright + x, br);
+        vst1q_f32(bright2 + x, vmulq_f32(br, br));
+        vst1q_f32(warmth + x, vsubq_f32(r, b));
+    }
+    #endif
+
+    for(; x < n; x++)
+        pixel_values(pixels + BYTESPP*x, bright + x, bright2 + x, warmth + x);
+}
+
+
+/*
+ * add_columns():
+ * Adds one range of columns of the rows being added to a PyramidBuilder. A
+ * TaskFunction for run_tasks().
+ *
+ * arg:         A pointer to the BuilderJob with the rows to add
+ * task:        The index of the range of columns to add
+ * worker:      The index of the thread adding them
+ */
+void add_columns(void* arg, int task, int worker) {
+    BuilderJob* j = (BuilderJob*) arg;
+    PyramidBuilder* builder = j->builder;
+    Pyramid* pyramid = builder->pyramid;
+    PyramidLevel* base = pyramid->levels;
+    int width = pyramid->width;
+    int shift = pyramid->shift;
+
+    // The range starts and ends at the edges of level 0 samples
+    int samples = base->width;
+    int x0 = ((long long) samples*task / j->num_ranges) << shift;
+    int x1 = ((long long) samples*(task+1) / j->num_ranges) << shift;
+    if(x1 > width)
+        x1 = width;
+    int n = x1 - x0;
+
+    for(int r = 0; r < j->num_rows; r++) {
+        unsigned char* row = j->rows + ((size_t) r*width + x0)*BYTESPP;
+        int y = builder->row + r;
+
+        /* One sample per pixel: write the values straight into level 0 */
+        if(shift == 0) {
+            size_t start = (size_t) y*width + x0;
+            row_values(row, n, base->bright + start, base->bright2 + start, base->warmth + start);
+            continue;
+        }
+
+        /* Otherwise add each pixel to the sums of the sample it falls in */
+        float* bright = builder->values + x0;
+        float* bright2 = bright + width;
+        float* warmth = bright2 + width;
+        row_values(row, n, bright, bright2, warmth);
+        for(int x = 0; x < n; x++) {
+            float* sum = builder->sums + 3*((x0 + x) >> shift);
+            sum[0] += bright[x];
+            sum[1] += bright2[x];
+            sum[2] += warmth[x];
+        }
+
+        // Once the last row of a block of samples is added, average it
+        if(((y+1) & ((1 << shift) - 1)) != 0 && y+1 != pyramid->height)
+            continue;
+
+        int by = y >> shift;
+        int block_h = y+1 - (by << shift);
+        for(int s = x0 >> shift; s < base->width && (s << shift) < x1; s++) {
+            int block_w = width - (s << shift);
+            if(block_w > (1 << shift))
+                block_w = 1 << shift;
+
+            float* sum = builder->sums + 3*s;
+            float count = block_w * block_h;
+            base->bright[by*base->width + s] = sum[0] / count;
+            base->bright2[by*base->width + s] = sum[1] / count;
+            base->warmth[by*base->width + s] = sum[2] / count;
+
+            sum[0] = sum[1] = sum[2] = 0;
+        }
+    }
+}
+
+
+/*
+ * downsample_plane():
+ * Box filters a plane down to half its width and height: each destination
+ * sample is the average of a 2x2 block of source samples. If the source has an
+ * odd width or height, the last column or row is averaged with itself.
+ *
+ * The inner loop handles four destination samples at a time with SSE2 or
+ * NEON when available, and falls back to scalar code for the rest.
+ *
+ * src:         The source plane
+ * sw:          The width of the source plane
+ * sh:          The height of the source plane
+ * dst:         The destination plane, must hold dw*dh floats
+ * dw:          The width of the destination plane, (sw+1)/2
+ * dh:          The height of the destination plane, (sh+1)/2
+ */
+SIMD_CLONES
+void downsample_plane(float* src, int sw, int sh, float* dst, int dw, int dh) {
+    for(int j = 0; j < dh; j++) {
+        float* a = src + 2*j*sw;
+        float* b = (2*j+1 < sh) ? a + sw : a;
+        float* out = dst + j*dw;
+
+        int i = 0;
+
+        #if defined(__SSE2__)
+        __m128 quarter = _mm_set1_ps(0.25f);
+        for(; 2*i+8 <= sw; i += 4) {
+            __m128 s0 = _mm_add_ps(_mm_loadu_ps(a + 2*i), _mm_loadu_ps(b + 2*i));
+            __m128 s1 = _mm_add_ps(_mm_loadu_ps(a + 2*i+4), _mm_loadu_ps(b + 2*i+4));
+
+            // Separate the even and odd columns, then add them together
+            __m128 even = _mm_shuffle_ps(s0, s1, _MM_SHUFFLE(2, 0, 2, 0));
+            __m128 odd = _mm_shuffle_ps(s0, s1, _MM_SHUFFLE(3, 1, 3, 1));
+            _mm_storeu_ps(out + i, _mm_mul_ps(_mm_add_ps(even, odd), quarter));
+        }
+        #elif defined(__ARM_NEON)
+        for(; 2*i+8 <= sw; i += 4) {
+            // vld2q splits the even and odd columns into val[0] and val[1]
+            float32x4x2_t ra = vld2q_f32(a + 2*i);
+            float32x4x2_t rb = vld2q_f32(b + 2*i);
+            float32x4_t sum = vaddq_f32(vaddq_f32(ra.val[0], rb.val[0]),
+                    vaddq_f32(ra.val[1], rb.val[1]));
+            vst1q_f32(out + i, vmulq_n_f32(sum, 0.25f));
+        }
+        #endif
+
+        for(; i < dw; i++) {
+            int x0 = 2*i;
+            int x1 = (2*i+1 < sw) ? 2*i+1 : 2*i;
+            out[i] = ((a[x0] + b[x0]) + (a[x1] + b[x1])) * 0.25f;
+        }
+    }
+}
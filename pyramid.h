@@ -0,0 +1,204 @@
+#ifndef PYRAMID_H
+#define PYRAMID_H
+
+#include <stddef.h>
+
+/*
+ * PyramidLevel:
+ * One level of a Pyramid. Holds the analysis planes of the image at one
+ * resolution, one float per sample for each plane.
+ */
+typedef struct pyramid_level {
+    float* bright; // Average brightness of each sample, between 0 and 1
+    float* bright2; // Average squared brightness of each sample, for variance
+    float* warmth; // Average warmth (red - blue) of each sample
+
+    int width;
+    int height;
+} PyramidLevel;
+
+
+/*
+ * Pyramid:
+ * A mip pyramid of an image's analysis planes. Each sample of level 0 covers
+ * a 2^shift by 2^shift block of pixels (one pixel when shift is 0), and each
+ * level after that is half the width and height of the one before, so a
+ * sample at level n covers a 2^(shift+n) by 2^(shift+n) block of pixels.
+ *
+ * Any region of the image can then be analyzed at the level where it covers a
+ * fixed number of samples, so the cost of analyzing a region doesn't depend
+ * on its size or on the resolution of the image.
+ */
+typedef struct pyramid {
+    PyramidLevel* levels;
+    int num_levels;
+
+    // The dimensions of the source image in pixels
+    int width;
+    int height;
+
+    int shift; // Log2 of the number of pixels across each level 0 sample
+
+    /* If the levels' planes point into a mapped cache file (see
+     * feature_cache.h), the mapping, which free_pyramid() unmaps instead of
+     * freeing the planes. Otherwise NULL. */
+    void* mapped;
+    size_t mapped_size;
+} Pyramid;
+
+
+/*
+ * PyramidBuilder:
+ * Builds a Pyramid from pixel data fed to it a few rows at a time, so the
+ * whole image never needs to be in memory. When shift is above 0, rows are
+ * averaged into level 0 as they arrive, so only one row of level 0 samples is
+ * being accumulated at a time.
+ */
+typedef struct pyramid_builder {
+    Pyramid* pyramid; // The Pyramid being built, only level 0 is allocated
+
+    int row; // The next row of pixels expected
+
+    /* Running sums of brightness, squared brightness and warmth for the row
+     * of level 0 samples being accumulated, 3 per sample. NULL if shift is 0 */
+    float* sums;
+
+    /* The brightness, squared brightness and warmth of each pixel of the row
+     * being added, width floats each. NULL if shift is 0 */
+    float* values;
+
+    /* The number of threads rows are added with, each taking its own range of
+     * columns */
+    int threads;
+} PyramidBuilder;
+
+
+
+/*
+ * build_pyramid():
+ * Computes the analysis planes of the given pixel data and builds a malloc'ed
+ * Pyramid from them, down to a level of 1x1 samples.
+ *
+ * The user must call free_pyramid() on the returned struct.
+ *
+ * rawpix:      The array of char RGBA pixel data, as from load_imagefile()
+ * width:       The width of the data
+ * height:      The height of the data
+ * shift:       Log2 of the number of pixels across each level 0 sample, 0 to
+ *              analyze the image at full resolution
+ * threads:     The number of threads to analyze with, 0 for one per processor
+ *
+ * return:      A malloc'ed Pyramid, or NULL on error
+ */
+Pyramid* build_pyramid(unsigned char* rawpix, int width, int height, int shift, int threads);
+
+
+/*
+ * new_pyramid_builder():
+ * Creates a malloc'ed PyramidBuilder for an image of the given size.
+ *
+ * The pixel rows must then be added in order from the top of the image with
+ * pyramid_builder_add_rows(), and the Pyramid taken with
+ * pyramid_builder_finish(), which also frees the builder.
+ *
+ * width:       The width of the image in pixels
+ * height:      The height of the image in pixels
+ * shift:       Log2 of the number of pixels across each level 0 sample
+ * threads:     The number of threads to add rows with, 0 for one per processor
+ *
+ * return:      A malloc'ed PyramidBuilder, or NULL on error
+ */
+PyramidBuilder* new_pyramid_builder(int width, int height, int shift, int threads);
+
+
+/*
+ * pyramid_builder_add_rows():
+ * Adds the next rows of pixel data to the Pyramid being built.
+ *
+ * builder:     A pointer to the PyramidBuilder
+ * rows:        The char RGBA pixel data of the rows, as from load_imagefile()
+ * num_rows:    The number of rows of pixel data
+ */
+void pyramid_builder_add_rows(PyramidBuilder* builder, unsigned char* rows, int num_rows);
+
+
+/*
+ * pyramid_builder_finish():
+ * Computes the remaining levels of the Pyramid from the rows added to the
+ * builder, and frees the builder.
+ *
+ * The user must call free_pyramid() on the returned struct.
+ *
+ * builder:     A pointer to the PyramidBuilder, all image rows must be added
+ *
+ * return:      A malloc'ed Pyramid, or NULL on error
+ */
+Pyramid* pyramid_builder_finish(PyramidBuilder* builder);
+
+
+/*
+ * free_pyramid_builder():
+ * Frees the given PyramidBuilder and the Pyramid it was building, for when the
+ * image's rows can't all be added.
+ *
+ * builder:     A pointer to the PyramidBuilder to free
+ */
+void free_pyramid_builder(PyramidBuilder* builder);
+
+
+/*
+ * pyramid_level_for():
+ * Returns the coarsest level at which a region of the given size still spans
+ * at least the given number of samples in each direction.
+ *
+ * pyramid:     A pointer to the Pyramid
+ * w:           The width of the region in pixels
+ * h:           The height of the region in pixels
+ * samples:     The minimum number of samples across the region
+ *
+ * return:      The index of the level
+ */
+int pyramid_level_for(Pyramid* pyramid, int w, int h, int samples);
+
+
+/*
+ * pyramid_region_stats():
+ * Computes the average brightness, average warmth and brightness variance of
+ * a region of the image, reading it at the level returned by
+ * pyramid_level_for().
+ *
+ * pyramid:     A pointer to the Pyramid to analyze
+ * x:           The top left x coordinate of the region in pixels
+ * y:           The top left y coordinate of the region in pixels
+ * w:           The width of the region in pixels
+ * h:           The height of the region in pixels
+ * samples:     The minimum number of samples across the region
+ * brightness:  Pointer to a float in which the average brightness will be
+ *              stored, between 0 and 1
+ * warmth:      Pointer to a float in which the average warmth will be stored,
+ *              between -255 and 255
+ * variance:    Pointer to a float in which the brightness variance will be
+ *              stored
+ */
+void pyramid_region_stats(
+        Pyramid* pyramid,
+        int x,
+        int y,
+        int w,
+        int h,
+        int samples,
+        float* brightness,
+        float* warmth,
+        float* variance);
+
+
+/*
+ * free_pyramid():
+ * Frees the given Pyramid and all of its levels, or unmaps its cache file if
+ * it was loaded from one.
+ *
+ * pyramid:     A pointer to the Pyramid to free
+ */
+void free_pyramid(Pyramid* pyramid);
+
+#endif
@@ -0,0 +1,333 @@
+#include "recorder.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+// The longest name of a rotated file
+#define MAX_NAME 4096
+
+static const struct {
+    char* name;
+    int format;
+} FORMATS[] = {
+    {"rf64", SF_FORMAT_RF64},
+    {"w64", SF_FORMAT_W64},
+    {"wav", SF_FORMAT_WAV}
+};
+#define NUM_FORMATS (int) (sizeof(FORMATS) / sizeof(FORMATS[0]))
+
+
+/* Internal function declarations */
+void* write_recording(void* vargp);
+void write_frames(Recorder* recorder, float* samples, long long frames);
+int rotate_file(Recorder* recorder);
+SNDFILE* open_file(Recorder* recorder, int index);
+void file_name(Recorder* recorder, int index, char* name);
+
+
+
+/*
+ * parse_record_format():
+ * Converts the name of a file format, as given on the command line, to its
+ * RecordFormat value.
+ *
+ * name:        The name of the format: "rf64", "w64" or "wav"
+ *
+ * return:      The RecordFormat, or -1 if the name isn't recognized
+ */
+int parse_record_format(char* name) {
+    for(int i = 0; i < NUM_FORMATS; i++) {
+        if(strcasecmp(name, FORMATS[i].name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+
+
+/*
+ * new_recorder():
+ * Creates a malloc'ed Recorder, opens its first file and starts its writing
+ * thread.
+ *
+ * The user must call free_recorder() on the returned struct.
+ *
+ * settings:    A pointer to the RecorderSettings to record with. The filename
+ *              must last as long as the Recorder.
+ * samplerate:  The sample rate of the audio
+ *
+ * return:      A malloc'ed Recorder, or NULL on error
+ */
+Recorder* new_recorder(RecorderSettings* settings, int samplerate) {
+    Recorder* recorder = (Recorder*) calloc(1, sizeof(Recorder));
+    if(recorder == NULL) {
+        printf("Error allocating Recorder\n");
+        return NULL;
+    }
+    recorder->settings = *settings;
+    recorder->samplerate = samplerate;
+
+    // At least RECORDER_SECONDS, rounded up to a power of 2
+    recorder->capacity = 1;
+    while(recorder->capacity < (unsigned long long) samplerate * RECORDER_SECONDS)
+        recorder->capacity <<= 1;
+    recorder->ring = (float*) malloc(recorder->capacity * sizeof(float));
+    if(recorder->ring == NULL) {
+        printf("Error allocating Recorder\n");
+        free(recorder);
+        return NULL;
+    }
+
+    /* Rotate at whichever limit comes first. Plain WAV files must always be
+     * rotated before they outgrow their 32 bit sizes. */
+    long long max_frames = 0;
+    if(settings->rotate_minutes > 0)
+        max_frames = (long long) (settings->rotate_minutes * 60 * samplerate);
+    if(settings->rotate_bytes > 0) {
+        long long byte_frames = settings->rotate_bytes / sizeof(float);
+        if(max_frames == 0 || byte_frames < max_frames)
+            max_frames = byte_frames;
+    }
+    if(settings->format == RECORD_WAV && (max_frames == 0 || max_frames > WAV_MAX_FRAMES))
+        max_frames = WAV_MAX_FRAMES;
+    recorder->max_file_frames = max_frames;
+
+    // Open the first file here, so a bad filename is reported straight away
+    if((recorder->file = open_file(recorder, 0)) == NULL) {
+        free(recorder->ring);
+        free(recorder);
+        return NULL;
+    }
+
+    if(pthread_create(&recorder->thread, NULL, write_recording, recorder) != 0) {
+        printf("Error starting the recording thread\n");
+        sf_close(recorder->file);
+        free(recorder->ring);
+        free(recorder);
+        return NULL;
+    }
+
+    return recorder;
+}
+
+
+
+/*
+ * recorder_write():
+ * Adds a block of audio to be written. Meant to be called by the audio
+ * thread, which must be the only thread that calls it. Never waits: if the
+ * block doesn't fit in the ring, it's dropped.
+ *
+ * recorder:    A pointer to the Recorder
+ * samples:     The block's samples
+ * frames:      The number of samples in the block
+ */
+void recorder_write(Recorder* recorder, float* samples, int frames) {
+    unsigned long long written = recorder->written;
+    unsigned long long read = __atomic_load_n(&recorder->read, __ATOMIC_ACQUIRE);
+    if(written - read + frames > recorder->capacity) {
+        __atomic_store_n(&recorder->dropped, recorder->dropped + frames, __ATOMIC_RELAXED);
+        return;
+    }
+
+    // Copy the block in, in two parts if it wraps around the end of the ring
+    unsigned long long pos = written & (recorder->capacity - 1);
+    unsigned long long first = recorder->capacity - pos;
+    if(first > (unsigned long long) frames)
+        first = frames;
+    memcpy(recorder->ring + pos, samples, first * sizeof(float));
+    memcpy(recorder->ring, samples + first, (frames - first) * sizeof(float));
+
+    __atomic_store_n(&recorder->written, written + frames, __ATOMIC_RELEASE);
+}
+
+
+
+/*
+ * free_recorder():
+ * Writes out whatever audio is still buffered, stops the writing thread,
+ * closes the file, and frees the Recorder. Must only be called once the audio
+ * thread has stopped calling recorder_write().
+ *
+ * recorder:    A pointer to the Recorder
+ */
+void free_recorder(Recorder* recorder) {
+    __atomic_store_n(&recorder->stop, 1, __ATOMIC_RELEASE);
+    pthread_join(recorder->thread, NULL);
+
+    if(recorder->file != NULL)
+        sf_close(recorder->file);
+
+    // The next file was opened ahead of time but never used, so remove it
+    if(recorder->next_file != NULL) {
+        char name[MAX_NAME];
+        sf_close(recorder->next_file);
+        file_name(recorder, recorder->file_index + 1, name);
+        remove(name);
+    }
+
+    if(recorder->dropped > 0) {
+        printf("%llu samples weren't recorded, as writing the file fell behind\n",
+                recorder->dropped);
+    }
+
+    free(recorder->ring);
+    free(recorder);
+}
+
+
+
+
+/*
+ * write_recording():
+ * The writing thread: writes out the samples in the ring every
+ * RECORDER_POLL_MS until told to stop, then writes out the rest.
+ */
+void* write_recording(void* vargp) {
+    Recorder* recorder = (Recorder*) vargp;
+
+    // Open the next file ahead of time, if there will be one
+    if(recorder->max_file_frames > 0)
+        recorder->next_file = open_file(recorder, 1);
+
+    int stop = 0;
+    while(!stop) {
+        // Check before reading, so the samples added before stopping are written
+        stop = __atomic_load_n(&recorder->stop, __ATOMIC_ACQUIRE);
+
+        unsigned long long read = recorder->read;
+        unsigned long long written = __atomic_load_n(&recorder->written, __ATOMIC_ACQUIRE);
+        while(read < written) {
+            unsigned long long pos = read & (recorder->capacity - 1);
+            unsigned long long frames = recorder->capacity - pos;
+            if(frames > written - read)
+                frames = written - read;
+
+            write_frames(recorder, recorder->ring + pos, frames);
+            read += frames;
+            __atomic_store_n(&recorder->read, read, __ATOMIC_RELEASE);
+        }
+
+        if(!stop) {
+            struct timespec ts = {0, RECORDER_POLL_MS * 1000000L};
+            nanosleep(&ts, NULL);
+        }
+    }
+
+    return NULL;
+}
+
+
+/*
+ * write_frames():
+ * Writes samples to the current file, rotating to the next file whenever
+ * the current one is full. After an error, the samples are thrown away.
+ */
+void write_frames(Recorder* recorder, float* samples, long long frames) {
+    while(frames > 0 && !recorder->failed) {
+        if(recorder->max_file_frames > 0 && recorder->file_frames == recorder->max_file_frames) {
+            if(rotate_file(recorder))
+                return;
+        }
+
+        long long count = frames;
+        if(recorder->max_file_frames > 0 && count > recorder->max_file_frames - recorder->file_frames)
+            count = recorder->max_file_frames - recorder->file_frames;
+
+        if(sf_write_float(recorder->file, samples, count) != count) {
+            printf("Error writing output file: %s\n", sf_strerror(recorder->file));
+            recorder->failed = 1;
+            return;
+        }
+
+        recorder->file_frames += count;
+        samples += count;
+        frames -= count;
+    }
+}
+
+
+/*
+ * rotate_file():
+ * Closes the current file and switches to the next one, which is opened now
+ * if it couldn't be opened ahead of time. Then opens the one after it.
+ *
+ * return:      0 on success, 1 if the next file couldn't be opened, which
+ *              stops the recording
+ */
+int rotate_file(Recorder* recorder) {
+    SNDFILE* file = recorder->next_file;
+    recorder->next_file = NULL;
+    if(file == NULL)
+        file = open_file(recorder, recorder->file_index + 1);
+
+    sf_close(recorder->file);
+    recorder->file = file;
+    recorder->file_index++;
+    recorder->file_frames = 0;
+    if(file == NULL) {
+        recorder->failed = 1;
+        return 1;
+    }
+
+    recorder->next_file = open_file(recorder, recorder->file_index + 1);
+    return 0;
+}
+
+
+/*
+ * open_file():
+ * Opens the file of the given number for writing mono float audio in the
+ * Recorder's format.
+ *
+ * return:      The libsndfile file pointer, or NULL on error
+ */
+SNDFILE* open_file(Recorder* recorder, int index) {
+    char name[MAX_NAME];
+    file_name(recorder, index, name);
+
+    SF_INFO sfinfo;
+    memset(&sfinfo, 0, sizeof(sfinfo));
+    sfinfo.samplerate = recorder->samplerate;
+    sfinfo.channels = 1;
+    sfinfo.format = FORMATS[recorder->settings.format].format | SF_FORMAT_FLOAT;
+
+    SNDFILE* file = sf_open(name, SFM_WRITE, &sfinfo);
+    if(file == NULL) {
+        printf("Error opening output file %s\n", name);
+        puts(sf_strerror(NULL));
+        return NULL;
+    }
+
+    // Written as plain WAV if it turns out small enough
+    if(recorder->settings.format == RECORD_RF64)
+        sf_command(file, SFC_RF64_AUTO_DOWNGRADE, NULL, SF_TRUE);
+
+    return file;
+}
+
+
+/*
+ * file_name():
+ * Writes the name of the file of the given number to name, which must hold
+ * MAX_NAME chars: the given filename for the first file, with _0001, _0002
+ * and so on added before the extension for the rest.
+ */
+void file_name(Recorder* recorder, int index, char* name) {
+    char* filename = recorder->settings.filename;
+    if(index == 0) {
+        snprintf(name, MAX_NAME, "%s", filename);
+        return;
+    }
+
+    // The extension is from the last dot after the last slash, if any
+    char* slash = strrchr(filename, '/');
+    char* dot = strrchr(filename, '.');
+    if(dot == NULL || (slash != NULL && dot < slash))
+        dot = filename + strlen(filename);
+
+    snprintf(name, MAX_NAME, "%.*s_%04d%s", (int) (dot - filename), filename, index, dot);
+}
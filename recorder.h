@@ -0,0 +1,135 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <pthread.h>
+#include <sndfile.h>
+
+// The seconds of audio buffered for the writing thread to catch up on
+#define RECORDER_SECONDS 4
+
+// How often the writing thread writes out what's been buffered, in ms
+#define RECORDER_POLL_MS 50
+
+/* The most samples of mono float audio a plain WAV file can hold: its sizes
+ * are 32 bit, so it breaks after about 6 hours at 48 kHz. Leaves room for
+ * the header. */
+#define WAV_MAX_FRAMES ((0xFFFFFFFFLL - 4096) / 4)
+
+
+/* The file format to record in. RF64 and W64 have 64 bit sizes, so they have
+ * no practical limit. RF64 files are written as plain WAV as long as they fit
+ * in one. */
+typedef enum record_format {
+    RECORD_RF64,
+    RECORD_W64,
+    RECORD_WAV
+} RecordFormat;
+
+
+/*
+ * RecorderSettings:
+ * Where and how to record the audio.
+ */
+typedef struct recorder_settings {
+    char* filename;
+    int format; // A RecordFormat
+
+    /* Start a new file after this many minutes or bytes of audio, whichever
+     * comes first, or 0 for never. The first file has the given name, and the
+     * rest have _0001, _0002 and so on added before the extension. */
+    float rotate_minutes;
+    long long rotate_bytes;
+} RecorderSettings;
+
+
+/*
+ * Recorder:
+ * Writes audio to a file on a thread of its own, so the audio callback never
+ * waits on the disk. The callback copies each block into a ring buffer, and
+ * the writing thread writes out whatever's in it every RECORDER_POLL_MS.
+ *
+ * When the files are rotated, the next file is opened ahead of time on the
+ * writing thread, so switching to it is just a pointer swap, and the old one
+ * is closed after. If the ring fills because the disk can't keep up, the
+ * blocks that don't fit are dropped rather than making the audio wait.
+ */
+typedef struct recorder {
+    RecorderSettings settings;
+    int samplerate;
+
+    /* The ring of samples waiting to be written. The audio thread only moves
+     * written, and the writing thread only moves read, each with atomic
+     * operations. They count every sample since the start, and the ring's
+     * capacity is a power of 2, so masking them gives the position. */
+    float* ring;
+    unsigned long long capacity;
+    unsigned long long written;
+    unsigned long long read;
+    unsigned long long dropped; // Samples that didn't fit, only set by the audio thread
+
+    /* The files, only used by the writing thread once it's started */
+    SNDFILE* file;
+    SNDFILE* next_file; // The next file, opened ahead of time, or NULL
+    int file_index; // The number of the current file, 0 for the first
+    long long file_frames; // The samples written to the current file
+    long long max_file_frames; // The samples after which to rotate, 0 for never
+    int failed; // Boolean, set if writing failed and recording stopped
+
+    int stop; // Boolean, tells the writing thread to finish
+    pthread_t thread;
+} Recorder;
+
+
+
+/*
+ * parse_record_format():
+ * Converts the name of a file format, as given on the command line, to its
+ * RecordFormat value.
+ *
+ * name:        The name of the format: "rf64", "w64" or "wav"
+ *
+ * return:      The RecordFormat, or -1 if the name isn't recognized
+ */
+int parse_record_format(char* name);
+
+
+/*
+ * new_recorder():
+ * Creates a malloc'ed Recorder, opens its first file and starts its writing
+ * thread.
+ *
+ * The user must call free_recorder() on the returned struct.
+ *
+ * settings:    A pointer to the RecorderSettings to record with. The filename
+ *              must last as long as the Recorder.
+ * samplerate:  The sample rate of the audio
+ *
+ * return:      A malloc'ed Recorder, or NULL on error
+ */
+Recorder* new_recorder(RecorderSettings* settings, int samplerate);
+
+
+/*
+ * recorder_write():
+ * Adds a block of audio to be written. Meant to be called by the audio
+ * thread, which must be the only thread that calls it. Never waits: if the
+ * block doesn't fit in the ring, it's dropped.
+ *
+ * recorder:    A pointer to the Recorder
+ * samples:     The block's samples
+ * frames:      The number of samples in the block
+ */
+void recorder_write(Recorder* recorder, float* samples, int frames);
+
+
+/*
+ * free_recorder():
+ * Writes out whatever audio is still buffered, stops the writing thread,
+ * closes the file, and frees the Recorder. Must only be called once the audio
+ * thread has stopped calling recorder_write().
+ *
+ * recorder:    A pointer to the Recorder
+ */
+void free_recorder(Recorder* recorder);
+
+#endif
@@ -0,0 +1,279 @@
+#include "region_index.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+
+// The minimum number of samples across each cell when computing its features
+#define CELL_SAMPLES 16
+
+
+/* A feature value paired with its cell, used to sort cells by feature */
+typedef struct sort_entry {
+    float val;
+    int cell;
+} SortEntry;
+
+
+/* Internal function declarations */
+float get_feature(RegionFeatures* cell, FeatureType feature);
+int compare_entries(const void* a, const void* b);
+int sort_cells(FeatureIndex* index, FeatureType feature);
+
+
+
+/*
+ * build_feature_index():
+ * Computes the features of each cell of the given image and returns them in
+ * a malloc'ed FeatureIndex. Only whole cells are indexed, so a strip of
+ * pixels at the right and bottom edges may be left out. If the image is
+ * smaller than a cell, the cell size is shrunk to fit the image.
+ *
+ * Each cell is read from the pyramid level where it spans a fixed number of
+ * samples, so building the index costs the same for any cell size.
+ *
+ * The user must call free_feature_index() on the returned struct.
+ *
+ * pyramid:     A pointer to the image's Pyramid
+ * cell_w:      The width of each cell in pixels
+ * cell_h:      The height of each cell in pixels
+ *
+ * return:      A malloc'ed FeatureIndex, or NULL on error
+ */
+FeatureIndex* build_feature_index(Pyramid* pyramid, int cell_w, int cell_h) {
+    FeatureIndex* index = (FeatureIndex*) malloc(sizeof(FeatureIndex));
+    if(index == NULL) {
+        printf("Error allocating FeatureIndex\n");
+        return NULL;
+    }
+
+    if(cell_w > pyramid->width)
+        cell_w = pyramid->width;
+    if(cell_h > pyramid->height)
+        cell_h = pyramid->height;
+
+    index->pyramid = pyramid;
+    index->cell_w = cell_w;
+    index->cell_h = cell_h;
+    index->cols = pyramid->width / cell_w;
+    index->rows = pyramid->height / cell_h;
+
+    for(int f = 0; f < NUM_FEATURES; f++)
+        index->sorted[f] = NULL;
+
+    index->cells = (RegionFeatures*) malloc(sizeof(RegionFeatures) * index->cols*index->rows);
+    if(index->cells == NULL) {
+        printf("Error allocating FeatureIndex cells\n");
+        free_feature_index(index);
+        return NULL;
+    }
+
+    for(int row = 0; row < index->rows; row++) {
+        for(int col = 0; col < index->cols; col++) {
+            RegionFeatures* cell = get_cell(index, col, row);
+
+            cell->x = col*cell_w;
+            cell->y = row*cell_h;
+            cell->w = cell_w;
+            cell->h = cell_h;
+
+            pyramid_region_stats(pyramid, cell->x, cell->y, cell_w, cell_h, CELL_SAMPLES,
+                    &cell->brightness, &cell->warmth, &cell->variance);
+        }
+    }
+
+    // Sort the cells by each feature for range and quantile queries
+    for(int f = 0; f < NUM_FEATURES; f++) {
+        if(sort_cells(index, f) != 0) {
+            free_feature_index(index);
+            return NULL;
+        }
+    }
+
+    return index;
+}
+
+
+
+/*
+ * get_cell():
+ * Returns the features of the cell at the given grid position.
+ *
+ * index:       A pointer to the FeatureIndex to look in
+ * col:         The column of the cell, between 0 and index->cols
+ * row:         The row of the cell, between 0 and index->rows
+ *
+ * return:      A pointer to the cell's RegionFeatures
+ */
+RegionFeatures* get_cell(FeatureIndex* index, int col, int row) {
+    return index->cells + row*index->cols + col;
+}
+
+
+/*
+ * get_region():
+ * Computes the features of a cell-sized region at any position, not just on
+ * the grid, reading it from the pyramid as the cells were.
+ *
+ * index:       A pointer to the FeatureIndex of the image
+ * x:           The top left x coordinate of the region, between 0 and the
+ *              image width minus index->cell_w
+ * y:           The top left y coordinate of the region, between 0 and the
+ *              image height minus index->cell_h
+ * region:      A pointer to the RegionFeatures to fill in
+ */
+void get_region(FeatureIndex* index, int x, int y, RegionFeatures* region) {
+    region->x = x;
+    region->y = y;
+    region->w = index->cell_w;
+    region->h = index->cell_h;
+
+    pyramid_region_stats(index->pyramid, x, y, index->cell_w, index->cell_h, CELL_SAMPLES,
+            &region->brightness, &region->warmth, &region->variance);
+}
+
+
+/*
+ * get_sorted_cell():
+ * Returns the cell with the given rank when all cells are sorted by the given
+ * feature. Rank 0 has the lowest value.
+ *
+ * index:       A pointer to the FeatureIndex to look in
+ * feature:     The feature the cells are sorted by
+ * rank:        The position in the sorted order, between 0 and cols*rows
+ *
+ * return:      A pointer to the cell's RegionFeatures
+ */
+RegionFeatures* get_sorted_cell(FeatureIndex* index, FeatureType feature, int rank) {
+    return index->cells + index->sorted[feature][rank];
+}
+
+
+/*
+ * feature_rank():
+ * Returns the number of cells whose value of the given feature is less than
+ * the given value. Together with get_sorted_cell(), this finds every cell in
+ * a range of values: the cells from feature_rank(min) up to, but not
+ * including, feature_rank(max).
+ *
+ * index:       A pointer to the FeatureIndex to look in
+ * feature:     The feature to compare
+ * value:       The value to compare against
+ *
+ * return:      The number of cells with a smaller value
+ */
+int feature_rank(FeatureIndex* index, FeatureType feature, float value) {
+    // Binary search for the first cell that isn't less than value
+    int lo = 0;
+    int hi = index->cols * index->rows;
+    while(lo < hi) {
+        int mid = lo + (hi-lo)/2;
+        if(get_feature(get_sorted_cell(index, feature, mid), feature) < value)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+
+/*
+ * feature_quantile():
+ * Returns the cell at the given quantile of the given feature. For example,
+ * a quantile of 0.5 returns the cell with the median brightness.
+ *
+ * index:       A pointer to the FeatureIndex to look in
+ * feature:     The feature to compare
+ * quantile:    The quantile, between 0 and 1
+ *
+ * return:      A pointer to the cell's RegionFeatures
+ */
+RegionFeatures* feature_quantile(FeatureIndex* index, FeatureType feature, float quantile) {
+    if(quantile < 0)
+        quantile = 0;
+    if(quantile > 1)
+        quantile = 1;
+
+    int rank = quantile * (index->cols*index->rows - 1) + 0.5;
+    return get_sorted_cell(index, feature, rank);
+}
+
+
+/*
+ * free_feature_index():
+ * Frees the given FeatureIndex and its associated resources.
+ *
+ * index:       A pointer to the FeatureIndex to free
+ */
+void free_feature_index(FeatureIndex* index) {
+    for(int f = 0; f < NUM_FEATURES; f++)
+        free(index->sorted[f]);
+    free(index->cells);
+    free(index);
+}
+
+
+
+
+/*
+ * get_feature():
+ * Returns the value of the given feature for the given cell.
+ *
+ * cell:        A pointer to the cell's RegionFeatures
+ * feature:     The feature to get
+ *
+ * return:      The value of the feature
+ */
+float get_feature(RegionFeatures* cell, FeatureType feature) {
+    if(feature == FEATURE_BRIGHTNESS)
+        return cell->brightness;
+    else if(feature == FEATURE_WARMTH)
+        return cell->warmth;
+    else
+        return cell->variance;
+}
+
+
+/*
+ * compare_entries():
+ * qsort() comparison function, orders SortEntry's by increasing value.
+ */
+int compare_entries(const void* a, const void* b) {
+    float va = ((SortEntry*) a)->val;
+    float vb = ((SortEntry*) b)->val;
+    return (va > vb) - (va < vb);
+}
+
+
+/*
+ * sort_cells():
+ * Fills in the index's sorted list of cells for the given feature.
+ *
+ * index:       A pointer to the FeatureIndex to sort
+ * feature:     The feature to sort the cells by
+ *
+ * return:      0 on success, 1 on error
+ */
+int sort_cells(FeatureIndex* index, FeatureType feature) {
+    int num_cells = index->cols * index->rows;
+
+    SortEntry* entries = (SortEntry*) malloc(sizeof(SortEntry) * num_cells);
+    index->sorted[feature] = (int*) malloc(sizeof(int) * num_cells);
+    if(entries == NULL || index->sorted[feature] == NULL) {
+        printf("Error allocating FeatureIndex sort list\n");
+        free(entries);
+        return 1;
+    }
+
+    for(int i = 0; i < num_cells; i++) {
+        entries[i].val = get_feature(index->cells + i, feature);
+        entries[i].cell = i;
+    }
+
+    qsort(entries, num_cells, sizeof(SortEntry), compare_entries);
+
+    for(int i = 0; i < num_cells; i++)
+        index->sorted[feature][i] = entries[i].cell;
+
+    free(entries);
+    return 0;
+}
@@ -0,0 +1,167 @@
+#ifndef REGION_INDEX_H
+#define REGION_INDEX_H
+
+#include "pyramid.h"
+
+/*
+ * RegionFeatures:
+ * Holds the precomputed color statistics of one region (cell) of an image.
+ */
+typedef struct region_features {
+    // Position and size of the region in image pixels
+    int x;
+    int y;
+    int w;
+    int h;
+
+    float brightness; // Average brightness, between 0 and 1
+    float warmth; // Average warmth, between -255 and 255
+    float variance; // Variance of the brightness values in the region
+} RegionFeatures;
+
+
+/*
+ * FeatureType:
+ * The features stored for each region, used to pick which feature to query
+ * a FeatureIndex by.
+ */
+typedef enum feature_type {
+    FEATURE_BRIGHTNESS,
+    FEATURE_WARMTH,
+    FEATURE_VARIANCE,
+    NUM_FEATURES
+} FeatureType;
+
+
+/*
+ * FeatureIndex:
+ * Divides an image into a grid of equally sized cells and holds the
+ * RegionFeatures of each one, so regions can be chosen by their content
+ * without rescanning the pixels.
+ *
+ * Cells can be looked up directly by their grid position. For each feature,
+ * the index also keeps the cells sorted by that feature, so they can be
+ * queried by a range of values or by quantile.
+ */
+typedef struct feature_index {
+    // The cells in row-major order, cols*rows long
+    RegionFeatures* cells;
+    int cols;
+    int rows;
+
+    // The size of each cell in pixels
+    int cell_w;
+    int cell_h;
+
+    /* For each feature, the indices into cells sorted by increasing value of
+     * that feature */
+    int* sorted[NUM_FEATURES];
+
+    // The pyramid the cells were read from, which the index doesn't free
+    Pyramid* pyramid;
+} FeatureIndex;
+
+
+
+/*
+ * build_feature_index():
+ * Computes the features of each cell of the given image and returns them in
+ * a malloc'ed FeatureIndex. Only whole cells are indexed, so a strip of
+ * pixels at the right and bottom edges may be left out. If the image is
+ * smaller than a cell, the cell size is shrunk to fit the image.
+ *
+ * Each cell is read from the pyramid level where it spans a fixed number of
+ * samples, so building the index costs the same for any cell size.
+ *
+ * The user must call free_feature_index() on the returned struct.
+ *
+ * pyramid:     A pointer to the image's Pyramid
+ * cell_w:      The width of each cell in pixels
+ * cell_h:      The height of each cell in pixels
+ *
+ * return:      A malloc'ed FeatureIndex, or NULL on error
+ */
+FeatureIndex* build_feature_index(Pyramid* pyramid, int cell_w, int cell_h);
+
+
+/*
+ * get_cell():
+ * Returns the features of the cell at the given grid position.
+ *
+ * index:       A pointer to the FeatureIndex to look in
+ * col:         The column of the cell, between 0 and index->cols
+ * row:         The row of the cell, between 0 and index->rows
+ *
+ * return:      A pointer to the cell's RegionFeatures
+ */
+RegionFeatures* get_cell(FeatureIndex* index, int col, int row);
+
+
+/*
+ * get_region():
+ * Computes the features of a cell-sized region at any position, not just on
+ * the grid, reading it from the pyramid as the cells were.
+ *
+ * index:       A pointer to the FeatureIndex of the image
+ * x:           The top left x coordinate of the region, between 0 and the
+ *              image width minus index->cell_w
+ * y:           The top left y coordinate of the region, between 0 and the
+ *              image height minus index->cell_h
+ * region:      A pointer to the RegionFeatures to fill in
+ */
+void get_region(FeatureIndex* index, int x, int y, RegionFeatures* region);
+
+
+/*
+ * get_sorted_cell():
+ * Returns the cell with the given rank when all cells are sorted by the given
+ * feature. Rank 0 has the lowest value.
+ *
+ * index:       A pointer to the FeatureIndex to look in
+ * feature:     The feature the cells are sorted by
+ * rank:        The position in the sorted order, between 0 and cols*rows
+ *
+ * return:      A pointer to the cell's RegionFeatures
+ */
+RegionFeatures* get_sorted_cell(FeatureIndex* index, FeatureType feature, int rank);
+
+
+/*
+ * feature_rank():
+ * Returns the number of cells whose value of the given feature is less than
+ * the given value. Together with get_sorted_cell(), this finds every cell in
+ * a range of values: the cells from feature_rank(min) up to, but not
+ * including, feature_rank(max).
+ *
+ * index:       A pointer to the FeatureIndex to look in
+ * feature:     The feature to compare
+ * value:       The value to compare against
+ *
+ * return:      The number of cells with a smaller value
+ */
+int feature_rank(FeatureIndex* index, FeatureType feature, float value);
+
+
+/*
+ * feature_quantile():
+ * Returns the cell at the given quantile of the given feature. For example,
+ * a quantile of 0.5 returns the cell with the median brightness.
+ *
+ * index:       A pointer to the FeatureIndex to look in
+ * feature:     The feature to compare
+ * quantile:    The quantile, between 0 and 1
+ *
+ * return:      A pointer to the cell's RegionFeatures
+ */
+RegionFeatures* feature_quantile(FeatureIndex* index, FeatureType feature, float quantile);
+
+
+/*
+ * free_feature_index():
+ * Frees the given FeatureIndex and its associated resources.
+ *
+ * index:       A pointer to the FeatureIndex to free
+ */
+void free_feature_index(FeatureIndex* index);
+
+#endif
@@ -0,0 +1,112 @@
+#include "render.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+
+
+/* Internal function declarations */
+void render_step(Renderer* renderer);
+
+
+
+/*
+ * new_renderer():
+ * Creates a malloc'ed Renderer that composes with the given Composer from
+ * the regions of the given FeatureIndex. The first region is chosen at the
+ * first sample rendered.
+ *
+ * The user must call free_renderer() on the returned struct.
+ *
+ * composer:    A pointer to the Composer, which the Renderer doesn't free
+ * index:       The FeatureIndex of the image, which the Renderer doesn't free
+ * samplerate:  The sample rate to render at
+ *
+ * return:      A malloc'ed Renderer, or NULL on error
+ */
+Renderer* new_renderer(Composer* composer, FeatureIndex* index, int samplerate) {
+    Renderer* renderer = (Renderer*) malloc(sizeof(Renderer));
+    if(renderer == NULL) {
+        printf("Error allocating Renderer\n");
+        return NULL;
+    }
+
+    renderer->composer = composer;
+    renderer->index = index;
+    renderer->samplerate = samplerate;
+    renderer->osc_list = NULL;
+    renderer->next_id = 0;
+    renderer->step_frames = STEP_SECONDS * samplerate;
+    renderer->until_step = 0;
+    renderer->region = NULL;
+
+    return renderer;
+}
+
+
+
+/*
+ * render_audio():
+ * Renders the next samples of the piece.
+ *
+ * renderer:    A pointer to the Renderer
+ * out:         The buffer to write the samples to
+ * frames:      The number of samples to render
+ */
+void render_audio(Renderer* renderer, float* out, int frames) {
+    while(frames > 0) {
+        if(renderer->until_step == 0) {
+            render_step(renderer);
+            renderer->until_step = renderer->step_frames;
+        }
+
+        // Mix up to the next step, where the notes change
+        int n = frames < renderer->until_step ? frames : renderer->until_step;
+        oscil_list_mix(renderer->osc_list, out, n);
+
+        out += n;
+        frames -= n;
+        renderer->until_step -= n;
+    }
+}
+
+
+
+/*
+ * free_renderer():
+ * Frees the given Renderer and the Oscillators still in it, but not its
+ * Composer or FeatureIndex.
+ *
+ * renderer:    A pointer to the Renderer to free
+ */
+void free_renderer(Renderer* renderer) {
+    oscil_list_free(renderer->osc_list);
+    free(renderer);
+}
+
+
+
+
+/*
+ * render_step():
+ * Removes the Oscillators that have finished, then chooses the next region
+ * and adds an Oscillator for each of its notes.
+ *
+ * renderer:    A pointer to the Renderer
+ */
+void render_step(Renderer* renderer) {
+    Composer* composer = renderer->composer;
+    Instruments* instruments = composer->instruments;
+
+    oscil_list_remove_expired(&renderer->osc_list);
+
+    renderer->region = choose_region(composer, renderer->index);
+
+    Note notes[MAX_NOTES];
+    int num_notes = compose_notes(composer, renderer->region, notes);
+    for(int i = 0; i < num_notes; i++) {
+        Oscillator* osc = new_osc(renderer->next_id++, notes[i].tab, instruments->tablen,
+                instruments->bp, renderer->samplerate, notes[i].freq, notes[i].amplitude,
+                notes[i].length, notes[i].start);
+        oscil_list_add(&renderer->osc_list, osc);
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "composer.h"
+#include "oscillator.h"
+#include "region_index.h"
+
+/*
+ * Renderer:
+ * Generates a piece offline, as fast as it can be computed rather than in
+ * realtime. Does what the main loop and AudioPlayer do when playing live:
+ * every STEP_SECONDS it chooses a region and adds its notes, and in between
+ * mixes the Oscillators that are playing. Two Renderers with Composers of the
+ * same seed render the same audio.
+ */
+typedef struct renderer {
+    Composer* composer;
+    FeatureIndex* index;
+    int samplerate;
+
+    OscilNode* osc_list; // The Oscillators that are playing or waiting to
+    unsigned int next_id; // The id of the next Oscillator added
+
+    int step_frames; // The number of samples between each region
+    int until_step; // The number of samples until the next region is chosen
+
+    RegionFeatures* region; // The region chosen last, NULL before the first
+} Renderer;
+
+
+
+/*
+ * new_renderer():
+ * Creates a malloc'ed Renderer that composes with the given Composer from
+ * the regions of the given FeatureIndex. The first region is chosen at the
+ * first sample rendered.
+ *
+ * The user must call free_renderer() on the returned struct.
+ *
+ * composer:    A pointer to the Composer, which the Renderer doesn't free
+ * index:       The FeatureIndex of the image, which the Renderer doesn't free
+ * samplerate:  The sample rate to render at
+ *
+ * return:      A malloc'ed Renderer, or NULL on error
+ */
+Renderer* new_renderer(Composer* composer, FeatureIndex* index, int samplerate);
+
+
+/*
+ * render_audio():
+ * Renders the next samples of the piece.
+ *
+ * renderer:    A pointer to the Renderer
+ * out:         The buffer to write the samples to
+ * frames:      The number of samples to render
+ */
+void render_audio(Renderer* renderer, float* out, int frames);
+
+
+/*
+ * free_renderer():
+ * Frees the given Renderer and the Oscillators still in it, but not its
+ * Composer or FeatureIndex.
+ *
+ * renderer:    A pointer to the Renderer to free
+ */
+void free_renderer(Renderer* renderer);
+
+#endif
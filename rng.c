@@ -0,0 +1,121 @@
+#include "rng.h"
+
+
+/* Internal function declarations */
+uint64_t splitmix64(uint64_t* state);
+uint32_t rotl(uint32_t x, int k);
+
+
+
+/*
+ * seed_rng():
+ * Sets the state of a generator from a seed. Every seed, including 0, gives a
+ * valid state, and nearby seeds give unrelated streams.
+ *
+ * rng:         A pointer to the Rng to seed
+ * seed:        The seed
+ */
+void seed_rng(Rng* rng, uint64_t seed) {
+    // Spread the seed's bits over the whole state, as xoshiro's authors advise
+    uint64_t a = splitmix64(&seed);
+    uint64_t b = splitmix64(&seed);
+    rng->s[0] = a;
+    rng->s[1] = a >> 32;
+    rng->s[2] = b;
+    rng->s[3] = b >> 32;
+}
+
+
+
+/*
+ * rng_next():
+ * Returns the next 32 random bits from a generator.
+ *
+ * rng:         A pointer to the Rng
+ *
+ * return:      A uniformly distributed random number
+ */
+uint32_t rng_next(Rng* rng) {
+    uint32_t* s = rng->s;
+    uint32_t result = rotl(s[1] * 5, 7) * 9;
+    uint32_t t = s[1] << 9;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 11);
+
+    return result;
+}
+
+
+
+/*
+ * rng_below():
+ * Returns a random integer from 0 up to, but not including, the given bound,
+ * without the bias towards small numbers of taking the remainder.
+ *
+ * rng:         A pointer to the Rng
+ * bound:       The bound, greater than 0
+ *
+ * return:      A uniformly distributed number in [0, bound)
+ */
+uint32_t rng_below(Rng* rng, uint32_t bound) {
+    /* Scale the 32 bits to the bound with a multiply, rejecting the few
+     * values that would make some results more likely (Lemire's method) */
+    uint64_t m = (uint64_t) rng_next(rng) * bound;
+    if((uint32_t) m < bound) {
+        uint32_t threshold = -bound % bound;
+        while((uint32_t) m < threshold)
+            m = (uint64_t) rng_next(rng) * bound;
+    }
+    return m >> 32;
+}
+
+
+
+/*
+ * rng_float():
+ * Returns a random float from 0 up to, but not including, 1.
+ *
+ * rng:         A pointer to the Rng
+ *
+ * return:      A uniformly distributed float in [0, 1), in steps of 2^-24
+ */
+float rng_float(Rng* rng) {
+    return (rng_next(rng) >> 8) * (1.0f / 16777216);
+}
+
+
+
+
+/*
+ * splitmix64():
+ * Advances a splitmix64 generator and returns its next output.
+ *
+ * state:       A pointer to the generator's state
+ *
+ * return:      The next 64 random bits
+ */
+uint64_t splitmix64(uint64_t* state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+
+/*
+ * rotl():
+ * Rotates the bits of x left by k.
+ *
+ * x:           The bits to rotate
+ * k:           The number of places to rotate by, from 1 to 31
+ *
+ * return:      The rotated bits
+ */
+uint32_t rotl(uint32_t x, int k) {
+    return (x << k) | (x >> (32 - k));
+}
@@ -0,0 +1,64 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+/*
+ * Rng:
+ * The state of a xoshiro128** random number generator. Small enough to keep
+ * one in every Composer, so each has its own stream of numbers, with no lock
+ * and nothing shared between threads, and the same seed always gives the same
+ * numbers on any platform.
+ */
+typedef struct rng {
+    uint32_t s[4];
+} Rng;
+
+
+
+/*
+ * seed_rng():
+ * Sets the state of a generator from a seed. Every seed, including 0, gives a
+ * valid state, and nearby seeds give unrelated streams.
+ *
+ * rng:         A pointer to the Rng to seed
+ * seed:        The seed
+ */
+void seed_rng(Rng* rng, uint64_t seed);
+
+
+/*
+ * rng_next():
+ * Returns the next 32 random bits from a generator.
+ *
+ * rng:         A pointer to the Rng
+ *
+ * return:      A uniformly distributed random number
+ */
+uint32_t rng_next(Rng* rng);
+
+
+/*
+ * rng_below():
+ * Returns a random integer from 0 up to, but not including, the given bound,
+ * without the bias towards small numbers of taking the remainder.
+ *
+ * rng:         A pointer to the Rng
+ * bound:       The bound, greater than 0
+ *
+ * return:      A uniformly distributed number in [0, bound)
+ */
+uint32_t rng_below(Rng* rng, uint32_t bound);
+
+
+/*
+ * rng_float():
+ * Returns a random float from 0 up to, but not including, 1.
+ *
+ * rng:         A pointer to the Rng
+ *
+ * return:      A uniformly distributed float in [0, 1), in steps of 2^-24
+ */
+float rng_float(Rng* rng);
+
+#endif
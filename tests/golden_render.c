@@ -0,0 +1,274 @@
+/*
+ * golden_render:
+ * Checks that the current synthesis engine still sounds the same. Renders a
+ * set of fixed-seed scenes, notes from a C major key with random tables,
+ * lengths, start times and volumes, through both the frozen reference engine
+ * in reference_synth.c and the current oscillator.c, breakpoints.c and
+ * gen_warmth_tab(), and compares the two.
+ *
+ * For each scene it prints the largest difference between any two samples,
+ * the signal to noise ratio of the current render against the reference, a
+ * hash of each render's bytes, and how long each engine took. The lookup
+ * tables are compared on their own first.
+ *
+ * By default a scene passes if the differences are inaudible, within
+ * MAX_ABS_ERROR and MIN_SNR_DB. With --exact it only passes if it's bit for
+ * bit the same as the reference. A scene the current engine renders faster
+ * but differently is pointed out either way, so a speedup can't hide a change
+ * in the sound.
+ *
+ * Returns 1 if any scene fails. Run from the top folder, as it reads
+ * resources/bps/bp2.txt.
+ *
+ * Usage: ./tests/golden_render [--exact]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "breakpoints.h"
+#include "key.h"
+#include "oscillator.h"
+#include "rng.h"
+#include "thread_pool.h"
+#include "reference_synth.h"
+
+#define SAMPLE_RATE 48000
+#define NUM_TABS 8
+
+// The samples mixed per call, as in the audio callback
+#define BLOCK_FRAMES 256
+
+// The envelope the program plays every note with
+#define ENVELOPE_FILE "resources/bps/bp2.txt"
+
+// The limits of an inaudible difference: -80 dBFS, and 80 dB below the signal
+#define MAX_ABS_ERROR 1e-4
+#define MIN_SNR_DB 80
+
+// The start of a 64 bit FNV-1a hash
+#define FNV_OFFSET 0xcbf29ce484222325
+
+// How much faster the current engine must be to count as a speedup
+#define SPEEDUP 1.05
+
+
+/*
+ * Scene:
+ * A fixed set of notes to render.
+ */
+typedef struct scene {
+    char* name;
+    int voices;
+    float seconds;
+    uint64_t seed;
+} Scene;
+
+static const Scene SCENES[] = {
+    {"solo",     1, 6, 1},
+    {"chord",    8, 8, 2},
+    {"dense",   64, 8, 3},
+    {"stress", 512, 3, 4}
+};
+#define NUM_SCENES (int) (sizeof(SCENES) / sizeof(SCENES[0]))
+
+
+/* Internal function declarations */
+uint64_t hash_samples(float* samples, int len, uint64_t hash);
+void compare(float* ref, float* cur, int len, float* max_err, double* snr);
+int check_tables(float** ref_tabs, float** cur_tabs, int exact);
+int run_scene(const Scene* scene, float** ref_tabs, float** cur_tabs, Breakpoints* bp,
+        Key* key, int exact);
+
+
+int main(int argc, char** argv) {
+    int exact = argc == 2 && strcmp(argv[1], "--exact") == 0;
+    if(argc > 2 || (argc == 2 && !exact)) {
+        printf("Usage: %s [--exact]\n", argv[0]);
+        return 1;
+    }
+
+    Breakpoints* bp = load_bp_file(ENVELOPE_FILE);
+    Key* key = make_key(0, MODE_MAJOR, 2, 5, TUNING_EQUAL);
+    float* ref_tabs[NUM_TABS];
+    float* cur_tabs[NUM_TABS];
+    int err = bp == NULL || key == NULL;
+    for(int i = 0; i < NUM_TABS; i++) {
+        ref_tabs[i] = ref_warmth_tab(SAMPLE_RATE, i);
+        cur_tabs[i] = gen_warmth_tab(SAMPLE_RATE, i);
+        err |= ref_tabs[i] == NULL || cur_tabs[i] == NULL;
+    }
+    if(err) {
+        printf("Error setting up the scenes\n");
+        return 1;
+    }
+
+    printf("mode: %s\n", exact ? "exact" : "tolerance");
+    printf("%-8s %6s %10s %10s %8s %10s %8s %-16s %-16s %s\n", "scene", "voices", "ref ms",
+            "cur ms", "speedup", "max err", "SNR dB", "ref hash", "cur hash", "result");
+
+    int failed = check_tables(ref_tabs, cur_tabs, exact);
+    for(int i = 0; i < NUM_SCENES; i++)
+        failed |= run_scene(SCENES + i, ref_tabs, cur_tabs, bp, key, exact);
+
+    printf(failed ? "\nFAILED: the current engine sounds different\n" : "\nAll scenes match\n");
+
+    for(int i = 0; i < NUM_TABS; i++) {
+        free(ref_tabs[i]);
+        free(cur_tabs[i]);
+    }
+    free_key(key);
+    free_breakpoints(bp);
+    return failed;
+}
+
+
+
+/*
+ * hash_samples():
+ * Continues a 64 bit FNV-1a hash, started from FNV_OFFSET, over the bytes of
+ * the samples.
+ */
+uint64_t hash_samples(float* samples, int len, uint64_t hash) {
+    unsigned char* bytes = (unsigned char*) samples;
+    for(size_t i = 0; i < len * sizeof(float); i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+
+/*
+ * compare():
+ * Finds the largest difference between the samples of the two renders, and
+ * the signal to noise ratio of the current render against the reference, in
+ * dB. The ratio is INFINITY if they're the same.
+ */
+void compare(float* ref, float* cur, int len, float* max_err, double* snr) {
+    double signal = 0;
+    double noise = 0;
+    *max_err = 0;
+    for(int i = 0; i < len; i++) {
+        float diff = fabsf(cur[i] - ref[i]);
+        if(diff > *max_err || isnan(diff))
+            *max_err = diff;
+        signal += (double) ref[i] * ref[i];
+        noise += (double) diff * diff;
+    }
+    *snr = noise > 0 ? 10 * log10(signal / noise) : INFINITY;
+}
+
+
+/*
+ * check_tables():
+ * Compares the current lookup tables with the reference ones, and prints the
+ * result as a scene.
+ *
+ * return:      1 if they differ by more than is allowed, 0 otherwise
+ */
+int check_tables(float** ref_tabs, float** cur_tabs, int exact) {
+    float max_err = 0;
+    double snr = INFINITY;
+    uint64_t ref_hash = FNV_OFFSET;
+    uint64_t cur_hash = FNV_OFFSET;
+    for(int i = 0; i < NUM_TABS; i++) {
+        float tab_err;
+        double tab_snr;
+        compare(ref_tabs[i], cur_tabs[i], SAMPLE_RATE, &tab_err, &tab_snr);
+        if(tab_err > max_err || isnan(tab_err))
+            max_err = tab_err;
+        if(tab_snr < snr)
+            snr = tab_snr;
+        ref_hash = hash_samples(ref_tabs[i], SAMPLE_RATE, ref_hash);
+        cur_hash = hash_samples(cur_tabs[i], SAMPLE_RATE, cur_hash);
+    }
+
+    int failed = exact ? ref_hash != cur_hash : !(max_err <= MAX_ABS_ERROR && snr >= MIN_SNR_DB);
+    printf("%-8s %6s %10s %10s %8s %10.3g %8.1f %016llx %016llx %s\n", "tables", "-", "-", "-", "-",
+            max_err, snr, (unsigned long long) ref_hash, (unsigned long long) cur_hash,
+            failed ? "FAIL" : "ok");
+    return failed;
+}
+
+
+/*
+ * run_scene():
+ * Renders the scene with both engines, a block at a time as the audio
+ * callback does, and prints how they compare.
+ *
+ * return:      1 if the renders differ by more than is allowed, 0 otherwise
+ */
+int run_scene(const Scene* scene, float** ref_tabs, float** cur_tabs, Breakpoints* bp,
+        Key* key, int exact) {
+    int len = scene->seconds * SAMPLE_RATE;
+    float* ref = (float*) calloc(len, sizeof(float));
+    float* cur = (float*) calloc(len, sizeof(float));
+    RefOscillator* ref_oscs = (RefOscillator*) malloc(sizeof(RefOscillator) * scene->voices);
+    if(ref == NULL || cur == NULL || ref_oscs == NULL) {
+        printf("Error allocating scene %s\n", scene->name);
+        free(ref);
+        free(cur);
+        free(ref_oscs);
+        return 1;
+    }
+
+    /* The same notes for both engines, chosen as the Composer would */
+    Rng rng;
+    seed_rng(&rng, scene->seed);
+    OscilNode* cur_oscs = NULL;
+    for(int i = 0; i < scene->voices; i++) {
+        int tab = rng_below(&rng, NUM_TABS);
+        float freq = key->freqs[rng_below(&rng, key->len)];
+        float amplitude = 0.05 + rng_float(&rng) * 0.2;
+        float length = 3 + rng_float(&rng) * 7;
+        float wait = rng_float(&rng) * scene->seconds / 2;
+
+        ref_init_osc(ref_oscs + i, ref_tabs[tab], SAMPLE_RATE, bp, SAMPLE_RATE,
+                freq, amplitude, length, wait);
+        oscil_list_add(&cur_oscs, new_osc(i, cur_tabs[tab], SAMPLE_RATE, bp, SAMPLE_RATE,
+                freq, amplitude, length, wait));
+    }
+
+    double start = now_seconds();
+    for(int i = 0; i < len; i += BLOCK_FRAMES) {
+        int frames = len - i < BLOCK_FRAMES ? len - i : BLOCK_FRAMES;
+        ref_mix(ref_oscs, scene->voices, ref + i, frames);
+    }
+    double ref_secs = now_seconds() - start;
+
+    start = now_seconds();
+    for(int i = 0; i < len; i += BLOCK_FRAMES) {
+        int frames = len - i < BLOCK_FRAMES ? len - i : BLOCK_FRAMES;
+        oscil_list_mix(cur_oscs, cur + i, frames);
+        oscil_list_remove_expired(&cur_oscs);
+    }
+    double cur_secs = now_seconds() - start;
+
+    float max_err;
+    double snr;
+    compare(ref, cur, len, &max_err, &snr);
+    uint64_t ref_hash = hash_samples(ref, len, FNV_OFFSET);
+    uint64_t cur_hash = hash_samples(cur, len, FNV_OFFSET);
+
+    int same = ref_hash == cur_hash && memcmp(ref, cur, len * sizeof(float)) == 0;
+    int inaudible = max_err <= MAX_ABS_ERROR && snr >= MIN_SNR_DB;
+    int failed = exact ? !same : !inaudible;
+    double speedup = ref_secs / cur_secs;
+
+    char* result = failed ? "FAIL" : "ok";
+    if(!same && speedup >= SPEEDUP)
+        result = failed ? "FAIL: faster but audibly different" : "ok, faster but not bit-exact";
+    printf("%-8s %6d %10.1f %10.1f %8.2f %10.3g %8.1f %016llx %016llx %s\n", scene->name,
+            scene->voices, ref_secs*1000, cur_secs*1000, speedup, max_err, snr,
+            (unsigned long long) ref_hash, (unsigned long long) cur_hash, result);
+
+    oscil_list_free(cur_oscs);
+    free(ref_oscs);
+    free(ref);
+    free(cur);
+    return failed;
+}
@@ -0,0 +1,156 @@
+#include "reference_synth.h"
+
+#include <stdlib.h>
+#include <math.h>
+
+// The harmonics of each warmth table, as in gen_warmth_tab()
+static const float WARMTH_AMPS[8][10] = {
+    {1, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0.8, 0.2, 0, 0, 0, 0, 0, 0, 0},
+    {0.6, 0.3, 0.05, 0.05, 0, 0, 0, 0, 0},
+    {0.4, 0.35, 0.1, 0.05, 0.04, 0, 0, 0, 0},
+    {0.2, 0.4, 0.15, 0.1, 0.05, 0.04, 0, 0, 0},
+    {0.15, 0.3, 0.3, 0.2, 0.025, 0.02, 0.005, 0, 0},
+    {0.1, 0.15, 0.15, 0.3, 0.05, 0.03, 0.02, 0.005, 0.005},
+    {0.05, 0.08, 0.1, 0.15, 0.2, 0.1, 0.08, 0.02, 0.01}
+};
+
+
+/* Internal function declarations */
+float ref_timeval(Breakpoints* bp, float time);
+float ref_tick(RefOscillator* osc);
+
+
+
+/*
+ * ref_init_osc():
+ * Sets up a RefOscillator as new_osc() sets up an Oscillator.
+ *
+ * osc:         A pointer to the RefOscillator to set up
+ * tab:         A pointer to the lookup table, holds one period of the wave
+ * tablen:      The length of the given lookup table
+ * vol_bp:      The Breakpoints to control the amplitude
+ * samplerate:  The rate to sample the wave
+ * freq:        The frequency at which to generate the wave
+ * amplitude:   The base amplitude of the Oscillator
+ * length:      How long the audio should play for (in seconds)
+ * waittime:    How long the Oscillator should wait before beginning (in seconds)
+ */
+void ref_init_osc(RefOscillator* osc, float* tab, int tablen, Breakpoints* vol_bp,
+        int samplerate, float freq, float amplitude, float length, float waittime) {
+    osc->tab = tab;
+    osc->tablen = tablen;
+    osc->vol_bp = vol_bp;
+    osc->samplerate = samplerate;
+    osc->freq = freq;
+    osc->amplitude = amplitude;
+    osc->slength = length*samplerate;
+
+    osc->index = 0;
+    osc->curr_t = 0;
+    osc->curr_sample = -waittime*samplerate;
+    osc->inc = freq * tablen / samplerate;
+    osc->tinc = 1.0 / samplerate;
+}
+
+
+
+/*
+ * ref_mix():
+ * Ticks every RefOscillator for the given number of samples, and writes the
+ * sum of their values at each sample to the output buffer, as
+ * oscil_list_mix() does.
+ *
+ * oscs:        The RefOscillators
+ * num_oscs:    The number of RefOscillators
+ * out:         The buffer to write the samples to
+ * frames:      The number of samples to generate
+ */
+void ref_mix(RefOscillator* oscs, int num_oscs, float* out, int frames) {
+    for(int i = 0; i < frames; i++) {
+        float val = 0;
+        for(int j = 0; j < num_oscs; j++)
+            val += ref_tick(oscs + j);
+        out[i] = val;
+    }
+}
+
+
+
+/*
+ * ref_warmth_tab():
+ * Generates a malloc'ed lookup table as gen_warmth_tab() does.
+ *
+ * len:         The length of the table to generate
+ * temp:        Higher values generates waves with higher harmonics. Supports 0-7
+ *
+ * return:      A malloc'ed lookup table, or NULL on error
+ */
+float* ref_warmth_tab(int len, int temp) {
+    const float* amps = WARMTH_AMPS[temp >= 0 && temp < 8 ? temp : 0];
+    float* table = (float*) malloc(sizeof(float)*len);
+    if(table == NULL)
+        return NULL;
+
+    for(int i = 0; i < len; i++) {
+        table[i] = 0;
+        for(int j = 0; j < 10; j++)
+            table[i] += amps[j] * sin(2*M_PI*(j+1)*i/(float)len);
+    }
+
+    return table;
+}
+
+
+
+
+/*
+ * ref_timeval():
+ * Linearly interpolates the envelope at the given time, as get_timeval().
+ */
+float ref_timeval(Breakpoints* bp, float time) {
+    if(time < 0 || bp->len == 0)
+        return 0;
+
+    int i;
+    for(i = 0; i < bp->len-1; i++)
+        if(bp->list[i+1].time > time)
+            break;
+
+    if(i == bp->len-1)
+        return bp->list[i].val;
+
+    float dt = bp->list[i+1].time - bp->list[i].time;
+    float da = bp->list[i+1].val - bp->list[i].val;
+
+    float frac = (time - bp->list[i].time)/dt;
+    return bp->list[i].val + da*frac;
+}
+
+
+/*
+ * ref_tick():
+ * Returns the RefOscillator's value at its current sample and moves it on to
+ * the next, as oscil_tick().
+ */
+float ref_tick(RefOscillator* osc) {
+    if(osc->curr_sample < 0 || osc->curr_sample > osc->slength) {
+        osc->curr_sample++;
+        return 0;
+    }
+
+    osc->curr_sample++;
+
+    float val = osc->amplitude * osc->tab[osc->index];
+
+    osc->inc = osc->freq * osc->tablen / (float) osc->samplerate;
+    osc->index += osc->inc;
+    if(osc->index >= osc->tablen)
+        osc->index -= osc->tablen;
+
+    osc->curr_t += osc->tinc;
+
+    // The envelope is stretched over the whole length, as get_percentval()
+    float perc = osc->curr_sample/(float)osc->slength;
+    return val * ref_timeval(osc->vol_bp, osc->vol_bp->maxtime * perc);
+}
@@ -0,0 +1,84 @@
+#ifndef REFERENCE_SYNTH_H
+#define REFERENCE_SYNTH_H
+
+#include "breakpoints.h"
+
+/*
+ * A frozen copy of the synthesis engine: the Oscillator, its envelope lookup,
+ * the mix and the warmth tables, exactly as they were before any of them were
+ * optimized. It's the reference golden_render compares the current engine
+ * against, so it must never change, even when oscillator.c or breakpoints.c
+ * do. It keeps its own struct so the current Oscillator's layout is free to
+ * change too.
+ */
+
+
+/*
+ * RefOscillator:
+ * The reference engine's Oscillator, with the same meaning as Oscillator.
+ */
+typedef struct ref_oscillator {
+    float* tab;
+    int tablen;
+
+    Breakpoints* vol_bp;
+
+    float freq;
+    float amplitude;
+    float slength;
+    int samplerate;
+
+    int curr_sample;
+    float curr_t;
+
+    int index;
+    int inc;
+    float tinc;
+} RefOscillator;
+
+
+
+/*
+ * ref_init_osc():
+ * Sets up a RefOscillator as new_osc() sets up an Oscillator.
+ *
+ * osc:         A pointer to the RefOscillator to set up
+ * tab:         A pointer to the lookup table, holds one period of the wave
+ * tablen:      The length of the given lookup table
+ * vol_bp:      The Breakpoints to control the amplitude
+ * samplerate:  The rate to sample the wave
+ * freq:        The frequency at which to generate the wave
+ * amplitude:   The base amplitude of the Oscillator
+ * length:      How long the audio should play for (in seconds)
+ * waittime:    How long the Oscillator should wait before beginning (in seconds)
+ */
+void ref_init_osc(RefOscillator* osc, float* tab, int tablen, Breakpoints* vol_bp,
+        int samplerate, float freq, float amplitude, float length, float waittime);
+
+
+/*
+ * ref_mix():
+ * Ticks every RefOscillator for the given number of samples, and writes the
+ * sum of their values at each sample to the output buffer, as
+ * oscil_list_mix() does.
+ *
+ * oscs:        The RefOscillators
+ * num_oscs:    The number of RefOscillators
+ * out:         The buffer to write the samples to
+ * frames:      The number of samples to generate
+ */
+void ref_mix(RefOscillator* oscs, int num_oscs, float* out, int frames);
+
+
+/*
+ * ref_warmth_tab():
+ * Generates a malloc'ed lookup table as gen_warmth_tab() does.
+ *
+ * len:         The length of the table to generate
+ * temp:        Higher values generates waves with higher harmonics. Supports 0-7
+ *
+ * return:      A malloc'ed lookup table, or NULL on error
+ */
+float* ref_warmth_tab(int len, int temp);
+
+#endif
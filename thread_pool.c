@@ -0,0 +1,363 @@
+#include "thread_pool.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "trace.h"
+
+// The most threads tasks are run on, counting the calling thread
+#define MAX_POOL_THREADS 256
+
+
+/*
+ * TaskRun:
+ * The tasks dealt to one thread of run_tasks() that haven't been taken yet.
+ * The owner takes tasks from the front, and other threads steal from the back.
+ */
+typedef struct task_run {
+    int front; // The next task for the owner
+    int back; // One past the last task
+    pthread_mutex_t lock;
+} TaskRun;
+
+
+/*
+ * TaskWorker:
+ * One of the pool's threads.
+ */
+typedef struct task_worker {
+    int index;
+    unsigned long long seen; // The last run it looked at
+    char name[16]; // Its name in the trace
+} TaskWorker;
+
+
+/*
+ * TaskPool:
+ * The pool's threads, and the tasks they're running. There is one, shared by
+ * every caller of run_tasks().
+ */
+typedef struct task_pool {
+    pthread_mutex_t use_lock; // Held from start_tasks() to finish_tasks()
+
+    pthread_mutex_t lock; // Guards the rest
+    pthread_cond_t wake; // Broadcast when a run starts
+    pthread_cond_t done; // Signaled when the last worker of a run is done
+
+    // The threads started, not counting the calling thread, which is worker 0
+    TaskWorker workers[MAX_POOL_THREADS];
+    int num_workers;
+
+    unsigned long long run; // The number of runs started
+    int active; // The workers still running tasks of the current run
+
+    // The current run
+    TaskRun* runs;
+    int num_threads;
+    TaskFunction function;
+    void* arg;
+} TaskPool;
+
+
+static TaskPool pool = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+    PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER
+};
+
+// Whether the calling thread is one of the pool's, or is running tasks on it
+static __thread int in_pool = 0;
+
+// The runs started by the calling thread while in the pool, which it ran itself
+static __thread int own_runs = 0;
+
+
+/* Internal function declarations */
+void* pool_thread(void* vargp);
+void work_tasks(int index);
+int take_task(TaskRun* run, int steal);
+
+
+
+/*
+ * count_cpus():
+ * Returns the number of processors online, at least 1.
+ *
+ * return:      The number of processors
+ */
+int count_cpus() {
+    #if !defined(_WIN32) && defined(_SC_NPROCESSORS_ONLN)
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if(cpus > 1)
+        return cpus;
+    #endif
+    return 1;
+}
+
+
+
+/*
+ * run_tasks():
+ * Runs the given number of tasks on a pool of threads, and returns once all of
+ * them are done.
+ *
+ * The threads are started the first time they're needed and then kept, each
+ * waiting for the next tasks, so running tasks often costs no more than
+ * running them once. Each thread keeps its worker index for good.
+ *
+ * The tasks are dealt out to the threads in equal runs up front. Each thread
+ * works through its own run from the front, and once it's out of tasks it
+ * steals from the back of the run of another thread that still has some, so
+ * threads that get quick tasks take over work from ones that get slow tasks.
+ *
+ * One thread runs tasks on the pool at a time, and others wait their turn.
+ * Tasks that run tasks of their own run them all on their own thread.
+ *
+ * num_tasks:   The number of tasks, which are numbered from 0
+ * num_threads: The number of threads to run them on, at most num_tasks are
+ *              used. The calling thread is one of them.
+ * function:    The function that runs each task
+ * arg:         An argument to pass to the function
+ *
+ * return:      0 on success, 1 if no thread could be started. The tasks all
+ *              run either way, on the calling thread if need be.
+ */
+int run_tasks(int num_tasks, int num_threads, TaskFunction function, void* arg) {
+    int err = start_tasks(num_tasks, num_threads, function, arg);
+    finish_tasks();
+    return err;
+}
+
+
+
+/*
+ * start_tasks():
+ * Starts running tasks as run_tasks() does, but returns straight away,
+ * without the calling thread taking any, so it can do other work meanwhile.
+ * finish_tasks() must be called next, before running any other tasks.
+ *
+ * num_tasks:   The number of tasks, which are numbered from 0
+ * num_threads: The number of threads to run them on, at most num_tasks are
+ *              used. The calling thread is one of them, and joins in once it
+ *              calls finish_tasks().
+ * function:    The function that runs each task
+ * arg:         An argument to pass to the function
+ *
+ * return:      0 on success, 1 if no thread could be started. The tasks all
+ *              run either way, on the calling thread if need be.
+ */
+int start_tasks(int num_tasks, int num_threads, TaskFunction function, void* arg) {
+    /* A task, or a thread between start_tasks() and finish_tasks(), already
+     * has the pool, so it runs these itself rather than wait for it */
+    if(in_pool) {
+        for(int t = 0; t < num_tasks; t++)
+            function(arg, t, 0);
+        own_runs++;
+        return 0;
+    }
+
+    if(num_threads > num_tasks)
+        num_threads = num_tasks;
+    if(num_threads > MAX_POOL_THREADS)
+        num_threads = MAX_POOL_THREADS;
+    if(num_threads < 1)
+        num_threads = 1;
+
+    pthread_mutex_lock(&pool.use_lock);
+    in_pool = 1;
+
+    /* Start any threads that are still needed. A thread that can't be started
+     * just means fewer are used, and the calling thread is always there. */
+    int err = 0;
+    pthread_mutex_lock(&pool.lock);
+    while(pool.num_workers < num_threads - 1 && !err) {
+        TaskWorker* worker = pool.workers + pool.num_workers;
+        worker->index = pool.num_workers + 1;
+        worker->seen = pool.run;
+        pthread_t id;
+        err = pthread_create(&id, NULL, pool_thread, worker) != 0;
+        if(!err) {
+            pthread_detach(id);
+            pool.num_workers++;
+        }
+    }
+    if(num_threads > pool.num_workers + 1)
+        num_threads = pool.num_workers + 1;
+    err = err && num_threads == 1;
+
+    TaskRun* runs = (TaskRun*) malloc(sizeof(TaskRun) * num_threads);
+    if(runs == NULL) {
+        printf("Error allocating thread pool, running tasks on one thread\n");
+        num_threads = 1;
+        err = 1;
+    }
+
+    /* Without any other threads, the tasks are all left for finish_tasks() on
+     * the calling thread, in one run */
+    pool.runs = runs;
+    pool.num_threads = num_threads;
+    pool.function = function;
+    pool.arg = arg;
+    for(int i = 0; i < num_threads && runs != NULL; i++) {
+        runs[i].front = (long long) num_tasks * i / num_threads;
+        runs[i].back = (long long) num_tasks * (i+1) / num_threads;
+        pthread_mutex_init(&runs[i].lock, NULL);
+    }
+
+    // Wake the threads used this run
+    pool.active = num_threads - 1;
+    pool.run++;
+    if(num_threads > 1)
+        pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+
+    // Without a run to take from, the calling thread runs them all
+    if(runs == NULL) {
+        for(int t = 0; t < num_tasks; t++)
+            function(arg, t, 0);
+    }
+
+    return err;
+}
+
+
+
+/*
+ * finish_tasks():
+ * Runs the tasks started by start_tasks() that haven't been taken yet on the
+ * calling thread along with the pool's, and returns once all of them are done.
+ */
+void finish_tasks() {
+    // Tasks started from within the pool have already been run
+    if(own_runs > 0) {
+        own_runs--;
+        return;
+    }
+
+    if(pool.runs != NULL)
+        work_tasks(0);
+
+    pthread_mutex_lock(&pool.lock);
+    while(pool.active > 0)
+        pthread_cond_wait(&pool.done, &pool.lock);
+    pthread_mutex_unlock(&pool.lock);
+
+    if(pool.runs != NULL) {
+        for(int i = 0; i < pool.num_threads; i++)
+            pthread_mutex_destroy(&pool.runs[i].lock);
+        free(pool.runs);
+        pool.runs = NULL;
+    }
+
+    in_pool = 0;
+    pthread_mutex_unlock(&pool.use_lock);
+}
+
+
+
+/*
+ * now_seconds():
+ * Returns the time in seconds on a clock that only moves forwards, for timing.
+ *
+ * return:      The time in seconds
+ */
+double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+
+
+/*
+ * pool_thread():
+ * One of the pool's threads: waits for each run to start, and runs its tasks
+ * if it's one of the threads the run uses. Runs until the program exits.
+ *
+ * vargp:       Pointer to the thread's TaskWorker
+ *
+ * return:      NULL, though it never returns
+ */
+void* pool_thread(void* vargp) {
+    TaskWorker* worker = (TaskWorker*) vargp;
+    in_pool = 1;
+
+    snprintf(worker->name, sizeof(worker->name), "worker %d", worker->index);
+    trace_thread_name(worker->name);
+
+    pthread_mutex_lock(&pool.lock);
+    while(1) {
+        while(worker->seen == pool.run)
+            pthread_cond_wait(&pool.wake, &pool.lock);
+        worker->seen = pool.run;
+        if(worker->index >= pool.num_threads)
+            continue;
+
+        pthread_mutex_unlock(&pool.lock);
+        work_tasks(worker->index);
+        pthread_mutex_lock(&pool.lock);
+
+        if(--pool.active == 0)
+            pthread_cond_signal(&pool.done);
+    }
+
+    return NULL;
+}
+
+
+/*
+ * work_tasks():
+ * Runs the tasks of one thread's run, then steals and runs tasks from the
+ * other threads until there are none left.
+ *
+ * index:       The index of the thread, 0 for the calling thread
+ */
+void work_tasks(int index) {
+    int task;
+
+    while((task = take_task(pool.runs + index, 0)) >= 0)
+        pool.function(pool.arg, task, index);
+
+    /* Steal from the other threads in turn, starting with the next one, until
+     * a full pass finds nothing. Runs only ever shrink, so once a pass comes
+     * up empty every task has been taken. */
+    int found = 1;
+    while(found) {
+        found = 0;
+        for(int i = 1; i < pool.num_threads; i++) {
+            TaskRun* victim = pool.runs + (index + i) % pool.num_threads;
+            if((task = take_task(victim, 1)) >= 0) {
+                pool.function(pool.arg, task, index);
+                found = 1;
+            }
+        }
+    }
+}
+
+
+/*
+ * take_task():
+ * Takes the next task from a TaskRun.
+ *
+ * run:         The TaskRun to take from
+ * steal:       Boolean, whether to take from the back of the run, as another
+ *              thread does, instead of the front, as its owner does
+ *
+ * return:      The task taken, or -1 if the run is empty
+ */
+int take_task(TaskRun* run, int steal) {
+    int task = -1;
+
+    pthread_mutex_lock(&run->lock);
+    if(run->front < run->back)
+        task = steal ? --run->back : run->front++;
+    pthread_mutex_unlock(&run->lock);
+
+    return task;
+}
@@ -0,0 +1,90 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+/*
+ * TaskFunction:
+ * A function that runs one task of run_tasks().
+ *
+ * arg:         The argument given to run_tasks()
+ * task:        The index of the task to run
+ * worker:      The index of the thread running it, from 0 to the number of
+ *              threads, for keeping per-thread state
+ */
+typedef void (*TaskFunction)(void* arg, int task, int worker);
+
+
+
+/*
+ * count_cpus():
+ * Returns the number of processors online, at least 1.
+ *
+ * return:      The number of processors
+ */
+int count_cpus();
+
+
+/*
+ * run_tasks():
+ * Runs the given number of tasks on a pool of threads, and returns once all of
+ * them are done.
+ *
+ * The threads are started the first time they're needed and then kept, each
+ * waiting for the next tasks, so running tasks often costs no more than
+ * running them once. Each thread keeps its worker index for good.
+ *
+ * The tasks are dealt out to the threads in equal runs up front. Each thread
+ * works through its own run from the front, and once it's out of tasks it
+ * steals from the back of the run of another thread that still has some, so
+ * threads that get quick tasks take over work from ones that get slow tasks.
+ *
+ * One thread runs tasks on the pool at a time, and others wait their turn.
+ * Tasks that run tasks of their own run them all on their own thread.
+ *
+ * num_tasks:   The number of tasks, which are numbered from 0
+ * num_threads: The number of threads to run them on, at most num_tasks are
+ *              used. The calling thread is one of them.
+ * function:    The function that runs each task
+ * arg:         An argument to pass to the function
+ *
+ * return:      0 on success, 1 if no thread could be started. The tasks all
+ *              run either way, on the calling thread if need be.
+ */
+int run_tasks(int num_tasks, int num_threads, TaskFunction function, void* arg);
+
+
+/*
+ * start_tasks():
+ * Starts running tasks as run_tasks() does, but returns straight away,
+ * without the calling thread taking any, so it can do other work meanwhile.
+ * finish_tasks() must be called next, before running any other tasks.
+ *
+ * num_tasks:   The number of tasks, which are numbered from 0
+ * num_threads: The number of threads to run them on, at most num_tasks are
+ *              used. The calling thread is one of them, and joins in once it
+ *              calls finish_tasks().
+ * function:    The function that runs each task
+ * arg:         An argument to pass to the function
+ *
+ * return:      0 on success, 1 if no thread could be started. The tasks all
+ *              run either way, on the calling thread if need be.
+ */
+int start_tasks(int num_tasks, int num_threads, TaskFunction function, void* arg);
+
+
+/*
+ * finish_tasks():
+ * Runs the tasks started by start_tasks() that haven't been taken yet on the
+ * calling thread along with the pool's, and returns once all of them are done.
+ */
+void finish_tasks();
+
+
+/*
+ * now_seconds():
+ * Returns the time in seconds on a clock that only moves forwards, for timing.
+ *
+ * return:      The time in seconds
+ */
+double now_seconds();
+
+#endif
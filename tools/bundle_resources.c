@@ -0,0 +1,156 @@
+/*
+ * bundle_resources:
+ * Packs the breakpoint envelopes and key files of a resources folder, and the
+ * lookup tables for one sample rate, into a resource bundle (see bundle.h),
+ * which Aural Landscapes maps at startup instead of reading the text files.
+ *
+ * Each file is named in the bundle by its filename without the folder or .txt,
+ * so resources/bps/bp2.txt is the envelope "bp2" and resources/keys/gmin.txt
+ * is the key "gmin". The tables are named "warmth0" to "warmth7", as made by
+ * gen_warmth_tab(samplerate, temp).
+ *
+ * Usage: ./tools/bundle_resources output.albundle samplerate resources
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glob.h>
+
+#include "breakpoints.h"
+#include "bundle.h"
+#include "key.h"
+#include "oscillator.h"
+
+// The number of lookup tables, as in composer.h
+#define NUM_TABS 8
+
+
+/* Internal function declarations */
+int add_files(char* pattern, int type, BundleItem** items, int* num_items);
+int add_item(BundleItem** items, int* num_items, char* name, int type, int count, float* data);
+
+
+int main(int argc, char** argv) {
+    if(argc != 4 || atoi(argv[2]) <= 0) {
+        printf("Usage: %s output.albundle samplerate resources\n", argv[0]);
+        return 1;
+    }
+    char* output = argv[1];
+    int samplerate = atoi(argv[2]);
+    char* dir = argv[3];
+
+    BundleItem* items = NULL;
+    int num_items = 0;
+
+    char pattern[4096];
+    snprintf(pattern, sizeof(pattern), "%s/bps/*.txt", dir);
+    int err = add_files(pattern, BUNDLE_BREAKPOINTS, &items, &num_items);
+    snprintf(pattern, sizeof(pattern), "%s/keys/*.txt", dir);
+    err |= add_files(pattern, BUNDLE_KEY, &items, &num_items);
+
+    for(int temp = 0; temp < NUM_TABS && !err; temp++) {
+        char name[BUNDLE_NAME_LEN];
+        snprintf(name, BUNDLE_NAME_LEN, "warmth%d", temp);
+        float* table = gen_warmth_tab(samplerate, temp);
+        err = table == NULL || add_item(&items, &num_items, name, BUNDLE_TABLE, samplerate, table);
+    }
+
+    if(!err)
+        err = write_bundle(output, items, num_items);
+    if(!err)
+        printf("Wrote %d resources to %s\n", num_items, output);
+
+    for(int i = 0; i < num_items; i++) {
+        free(items[i].name);
+        free(items[i].data);
+    }
+    free(items);
+
+    return err;
+}
+
+
+
+
+/*
+ * add_files():
+ * Reads every breakpoint or key file matching a pattern and adds it to the
+ * list of resources.
+ *
+ * pattern:     The glob pattern of the files
+ * type:        BUNDLE_BREAKPOINTS or BUNDLE_KEY
+ * items:       Pointer to the malloc'ed list of resources
+ * num_items:   Pointer to the number of resources
+ *
+ * return:      0 on success, 1 on error
+ */
+int add_files(char* pattern, int type, BundleItem** items, int* num_items) {
+    glob_t matches;
+    if(glob(pattern, 0, NULL, &matches) != 0) {
+        printf("No files match %s\n", pattern);
+        return 1;
+    }
+
+    int err = 0;
+    for(size_t i = 0; i < matches.gl_pathc && !err; i++) {
+        char* filename = matches.gl_pathv[i];
+
+        // The name is the filename without its folder or extension
+        char name[BUNDLE_NAME_LEN];
+        char* base = strrchr(filename, '/');
+        base = base != NULL ? base + 1 : filename;
+        snprintf(name, BUNDLE_NAME_LEN, "%.*s", (int) strcspn(base, "."), base);
+
+        /* Take the parsed data from the loaded struct, and free the rest */
+        if(type == BUNDLE_BREAKPOINTS) {
+            Breakpoints* bp = load_bp_file(filename);
+            err = bp == NULL || add_item(items, num_items, name, type, bp->len, (float*) bp->list);
+            free(bp);
+        }
+        else {
+            Key* key = load_key(filename);
+            err = key == NULL || add_item(items, num_items, name, type, key->len, key->freqs);
+            free(key);
+        }
+        if(err)
+            printf("Error reading %s\n", filename);
+    }
+
+    globfree(&matches);
+    return err;
+}
+
+
+/*
+ * add_item():
+ * Adds a resource to the list of resources, taking ownership of its data.
+ *
+ * items:       Pointer to the malloc'ed list of resources
+ * num_items:   Pointer to the number of resources
+ * name:        The name of the resource, which is copied
+ * type:        The BundleType of the resource
+ * count:       The number of items in the resource
+ * data:        The malloc'ed data of the resource
+ *
+ * return:      0 on success, 1 on error
+ */
+int add_item(BundleItem** items, int* num_items, char* name, int type, int count, float* data) {
+    BundleItem* more = (BundleItem*) realloc(*items, sizeof(BundleItem) * (*num_items + 1));
+    char* copy = strdup(name);
+    if(more != NULL)
+        *items = more;
+    if(more == NULL || copy == NULL) {
+        printf("Out of memory\n");
+        free(copy);
+        free(data);
+        return 1;
+    }
+
+    BundleItem* item = *items + (*num_items)++;
+    item->name = copy;
+    item->type = type;
+    item->count = count;
+    item->data = data;
+    return 0;
+}
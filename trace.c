@@ -0,0 +1,349 @@
+#include "trace.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#ifndef _WIN32
+#include <signal.h>
+#endif
+
+#include "thread_pool.h"
+
+/* The buffers allocated besides one per processor, for the main, audio,
+ * loading and other threads */
+#define TRACE_EXTRA_BUFFERS 8
+
+
+/*
+ * TraceEvent:
+ * One recorded event, in nanoseconds since the trace started.
+ */
+typedef struct trace_event {
+    const char* name;
+    uint64_t start;
+    uint64_t end;
+} TraceEvent;
+
+
+/*
+ * TraceBuffer:
+ * The events of one thread at a time. Only that thread writes to it, and it
+ * publishes each event by storing the count after it, so the events below
+ * the count can be read from any thread while it's still recording. When the
+ * thread exits, the buffer is handed on to the next thread that needs one,
+ * which carries on from its last event.
+ */
+typedef struct trace_buffer {
+    int in_use; // Boolean, whether a thread has it
+
+    int tid; // The buffer's number in the trace
+    const char* name; // The thread's name, or NULL
+
+    int count; // The number of events recorded
+    int dropped; // The number of events that didn't fit
+    TraceEvent events[TRACE_EVENTS];
+} TraceBuffer;
+
+
+// Whether events are being recorded
+static int tracing = 0;
+
+// The file to write to, and the time the trace started
+static char* trace_file = NULL;
+static uint64_t trace_origin = 0;
+
+/* The buffers, allocated and touched when tracing starts so recording never
+ * allocates or faults in memory, and the next one never handed out */
+static TraceBuffer* buffers = NULL;
+static int num_buffers = 0;
+static int next_buffer = 0;
+
+// The events of threads that started while every buffer was in use
+static int unbuffered = 0;
+
+// Hands a thread's buffer back when it exits
+static pthread_key_t buffer_key;
+
+// The calling thread's buffer, NULL until it records its first event
+static __thread TraceBuffer* thread_buffer = NULL;
+
+#ifndef _WIN32
+/* SIGUSR1 is blocked on every thread but one, which waits for it and writes
+ * the file, as the file can't safely be written from a signal handler */
+static sigset_t dump_signals;
+static pthread_t dump_thread;
+static int dump_quit = 0;
+#endif
+
+
+/* Internal function declarations */
+uint64_t trace_now();
+TraceBuffer* get_thread_buffer();
+void release_buffer(void* buffer);
+int dump_trace();
+void finish_trace();
+#ifndef _WIN32
+void* wait_for_dumps(void* vargp);
+#endif
+
+
+
+/*
+ * start_trace():
+ * Starts recording events, to be written to the given file on exit or on
+ * SIGUSR1.
+ *
+ * Must be called before any other threads are started, so they all leave
+ * SIGUSR1 to the thread that writes the file.
+ *
+ * filename:    The .json file to write the trace to
+ *
+ * return:      0 on success, 1 on error
+ */
+int start_trace(char* filename) {
+    trace_file = filename;
+    trace_origin = trace_now();
+
+    num_buffers = count_cpus() + TRACE_EXTRA_BUFFERS;
+    buffers = (TraceBuffer*) malloc(sizeof(TraceBuffer) * num_buffers);
+    if(buffers == NULL || pthread_key_create(&buffer_key, release_buffer) != 0) {
+        printf("Error starting trace\n");
+        free(buffers);
+        return 1;
+    }
+    // Writing every page now saves faulting them in while recording
+    memset(buffers, 0, sizeof(TraceBuffer) * num_buffers);
+    for(int i = 0; i < num_buffers; i++) {
+        buffers[i].in_use = 1; // Until it's handed out and its thread exits
+        buffers[i].tid = i+1;
+    }
+
+    #ifndef _WIN32
+    sigemptyset(&dump_signals);
+    sigaddset(&dump_signals, SIGUSR1);
+    if(pthread_sigmask(SIG_BLOCK, &dump_signals, NULL) != 0 ||
+            pthread_create(&dump_thread, NULL, wait_for_dumps, NULL) != 0) {
+        printf("Error starting trace\n");
+        return 1;
+    }
+    #endif
+
+    atexit(finish_trace);
+    __atomic_store_n(&tracing, 1, __ATOMIC_RELEASE);
+    trace_thread_name("main");
+    return 0;
+}
+
+
+
+/*
+ * trace_begin():
+ * Returns the start time of an event to pass to trace_end().
+ *
+ * return:      The time, or 0 if tracing isn't on
+ */
+uint64_t trace_begin() {
+    if(!__atomic_load_n(&tracing, __ATOMIC_RELAXED))
+        return 0;
+    return trace_now();
+}
+
+
+
+/*
+ * trace_end():
+ * Records an event that started at the given time and ends now, on the
+ * calling thread's timeline.
+ *
+ * name:        The name of the event. Must be a string literal, or otherwise
+ *              last for the rest of the program.
+ * start:       The start time returned by trace_begin()
+ */
+void trace_end(const char* name, uint64_t start) {
+    if(start == 0)
+        return;
+    uint64_t end = trace_now();
+
+    TraceBuffer* buffer = get_thread_buffer();
+    if(buffer == NULL) {
+        __atomic_add_fetch(&unbuffered, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    if(buffer->count == TRACE_EVENTS) {
+        __atomic_store_n(&buffer->dropped, buffer->dropped + 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    TraceEvent* event = buffer->events + buffer->count;
+    event->name = name;
+    event->start = start - trace_origin;
+    event->end = end - trace_origin;
+    __atomic_store_n(&buffer->count, buffer->count + 1, __ATOMIC_RELEASE);
+}
+
+
+
+/*
+ * trace_thread_name():
+ * Names the calling thread's timeline in the trace. Does nothing if tracing
+ * isn't on.
+ *
+ * name:        The name of the thread, a string literal
+ */
+void trace_thread_name(const char* name) {
+    if(!__atomic_load_n(&tracing, __ATOMIC_RELAXED))
+        return;
+    TraceBuffer* buffer = get_thread_buffer();
+    if(buffer != NULL)
+        __atomic_store_n(&buffer->name, name, __ATOMIC_RELEASE);
+}
+
+
+
+
+/*
+ * trace_now():
+ * Returns a monotonic time in nanoseconds.
+ */
+uint64_t trace_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/*
+ * get_thread_buffer():
+ * Returns the calling thread's buffer, handing it one the first time: the
+ * next buffer never used, or else one whose thread has exited. Returns NULL
+ * if every buffer is in use.
+ */
+TraceBuffer* get_thread_buffer() {
+    if(thread_buffer != NULL)
+        return thread_buffer;
+
+    TraceBuffer* buffer = NULL;
+    if(__atomic_load_n(&next_buffer, __ATOMIC_RELAXED) < num_buffers) {
+        int next = __atomic_fetch_add(&next_buffer, 1, __ATOMIC_RELAXED);
+        if(next < num_buffers)
+            buffer = buffers + next;
+    }
+
+    // A buffer handed back keeps its events, but not its old thread's name
+    for(int i = 0; i < num_buffers && buffer == NULL; i++) {
+        int unused = 0;
+        if(__atomic_compare_exchange_n(&buffers[i].in_use, &unused, 1, 0,
+                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            buffer = buffers + i;
+            __atomic_store_n(&buffer->name, NULL, __ATOMIC_RELEASE);
+        }
+    }
+    if(buffer == NULL)
+        return NULL;
+
+    pthread_setspecific(buffer_key, buffer);
+    thread_buffer = buffer;
+    return buffer;
+}
+
+
+/*
+ * release_buffer():
+ * Hands a thread's buffer back when the thread exits, so another can use it.
+ */
+void release_buffer(void* buffer) {
+    __atomic_store_n(&((TraceBuffer*) buffer)->in_use, 0, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * dump_trace():
+ * Writes every event recorded so far to the trace file, as Chrome Trace
+ * Event JSON. Threads can keep recording meanwhile. Writes to a temporary
+ * file first, so the trace file is always complete.
+ *
+ * return:      0 on success, 1 on error
+ */
+int dump_trace() {
+    char tempname[4096];
+    snprintf(tempname, sizeof(tempname), "%s.tmp", trace_file);
+    FILE* file = fopen(tempname, "w");
+    if(file == NULL) {
+        printf("Error writing trace file %s\n", trace_file);
+        return 1;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    fprintf(file, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"aural_landscapes\"}}");
+
+    int dropped = __atomic_load_n(&unbuffered, __ATOMIC_RELAXED);
+    for(int b = 0; b < num_buffers; b++) {
+        TraceBuffer* buffer = buffers + b;
+        const char* name = __atomic_load_n(&buffer->name, __ATOMIC_ACQUIRE);
+        if(name != NULL) {
+            fprintf(file, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+                    "\"args\": {\"name\": \"%s\"}}", buffer->tid, name);
+        }
+
+        // Complete events, in microseconds
+        int count = __atomic_load_n(&buffer->count, __ATOMIC_ACQUIRE);
+        for(int i = 0; i < count; i++) {
+            TraceEvent* event = buffer->events + i;
+            fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, "
+                    "\"ts\": %.3f, \"dur\": %.3f}", event->name, buffer->tid,
+                    event->start / 1e3, (event->end - event->start) / 1e3);
+        }
+        dropped += __atomic_load_n(&buffer->dropped, __ATOMIC_RELAXED);
+    }
+    fprintf(file, "\n]}\n");
+
+    int err = fclose(file) != 0;
+    #ifdef _WIN32
+    remove(trace_file);
+    #endif
+    if(err || rename(tempname, trace_file) != 0) {
+        printf("Error writing trace file %s\n", trace_file);
+        remove(tempname);
+        return 1;
+    }
+
+    printf("Wrote trace to %s", trace_file);
+    if(dropped > 0)
+        printf(" (%d events dropped, as threads' buffers filled or ran out)", dropped);
+    printf("\n");
+    return 0;
+}
+
+
+/*
+ * finish_trace():
+ * Stops the thread that waits for SIGUSR1, and writes the trace file. Called
+ * on exit. The buffers aren't freed, as other threads may still be running.
+ */
+void finish_trace() {
+    #ifndef _WIN32
+    __atomic_store_n(&dump_quit, 1, __ATOMIC_SEQ_CST);
+    if(pthread_kill(dump_thread, SIGUSR1) == 0)
+        pthread_join(dump_thread, NULL);
+    #endif
+
+    dump_trace();
+}
+
+
+#ifndef _WIN32
+/*
+ * wait_for_dumps():
+ * The thread that writes the trace file each time SIGUSR1 is received, until
+ * finish_trace() tells it to quit.
+ */
+void* wait_for_dumps(void* vargp) {
+    int sig;
+    while(sigwait(&dump_signals, &sig) == 0 && !__atomic_load_n(&dump_quit, __ATOMIC_SEQ_CST))
+        dump_trace();
+    return NULL;
+}
+#endif
@@ -0,0 +1,81 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+/*
+ * Timeline tracing: marks how long each step of loading, composing, drawing
+ * and playing takes, on every thread, and writes it out as a Chrome Trace
+ * Event JSON file that chrome://tracing or ui.perfetto.dev show as one
+ * timeline.
+ *
+ * Each step is marked with a pair of calls around it:
+ *
+ *     uint64_t start = trace_begin();
+ *     decode_the_image();
+ *     trace_end("decode", start);
+ *
+ * Events go into a buffer of the calling thread's own, so recording one takes
+ * no lock. The buffers are allocated and written through when tracing starts,
+ * one per processor and a few more, and handed to threads as they record
+ * their first event, so recording never allocates or faults in memory and is
+ * safe in the audio callback. A thread's buffer is handed on to another
+ * thread once it exits. While every buffer is in use, the events of any
+ * further threads are dropped. Until start_trace() is called, or if it fails,
+ * the calls do nothing but check a flag.
+ *
+ * The file is written when the program exits, and on Unix each time the
+ * process gets SIGUSR1 ("kill -USR1 pid"), so a run that's stuttering can be
+ * looked at without stopping it.
+ */
+
+// The most events each buffer records, after which its events are dropped
+#define TRACE_EVENTS 65536
+
+
+/*
+ * start_trace():
+ * Starts recording events, to be written to the given file on exit or on
+ * SIGUSR1.
+ *
+ * Must be called before any other threads are started, so they all leave
+ * SIGUSR1 to the thread that writes the file.
+ *
+ * filename:    The .json file to write the trace to
+ *
+ * return:      0 on success, 1 on error
+ */
+int start_trace(char* filename);
+
+
+/*
+ * trace_begin():
+ * Returns the start time of an event to pass to trace_end().
+ *
+ * return:      The time, or 0 if tracing isn't on
+ */
+uint64_t trace_begin();
+
+
+/*
+ * trace_end():
+ * Records an event that started at the given time and ends now, on the
+ * calling thread's timeline.
+ *
+ * name:        The name of the event. Must be a string literal, or otherwise
+ *              last for the rest of the program.
+ * start:       The start time returned by trace_begin()
+ */
+void trace_end(const char* name, uint64_t start);
+
+
+/*
+ * trace_thread_name():
+ * Names the calling thread's timeline in the trace. Does nothing if tracing
+ * isn't on.
+ *
+ * name:        The name of the thread, a string literal
+ */
+void trace_thread_name(const char* name);
+
+#endif
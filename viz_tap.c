@@ -0,0 +1,125 @@
+#include "viz_tap.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+// Marks the middle buffer as published since the reader last took it
+#define VIZ_FRESH 4
+
+
+
+/*
+ * new_viz_tap():
+ * Creates a malloc'ed VizTap with no snapshot published yet.
+ *
+ * The user must call free_viz_tap() on the returned struct.
+ *
+ * return:      A malloc'ed VizTap, or NULL on error
+ */
+VizTap* new_viz_tap() {
+    VizTap* tap = (VizTap*) calloc(1, sizeof(VizTap));
+    if(tap == NULL) {
+        printf("Error allocating VizTap\n");
+        return NULL;
+    }
+
+    tap->back = 0;
+    tap->middle = 1;
+    tap->front = 2;
+
+    return tap;
+}
+
+
+
+/*
+ * viz_tap_capture():
+ * Takes a snapshot of a block of audio and publishes it to the reader.
+ * Meant to be called at the end of each block by the audio thread, which
+ * must be the only thread that calls it. Never waits.
+ *
+ * tap:         A pointer to the VizTap
+ * voices:      The list of Oscillators playing
+ * out:         The block's output samples
+ * frames:      The number of samples in the block
+ */
+void viz_tap_capture(VizTap* tap, OscilNode* voices, float* out, int frames) {
+    VizSnapshot* snapshot = tap->buffers + tap->back;
+
+    /* Record the voices that have started and not yet finished */
+    int num_voices = 0;
+    for(OscilNode* curr = voices; curr != NULL && num_voices < MAX_VIZ_VOICES; curr = curr->next) {
+        Oscillator* osc = curr->osc;
+        if(osc->curr_sample < 0 || oscil_expired(osc))
+            continue;
+
+        VizVoice* voice = snapshot->voices + num_voices++;
+        voice->id = osc->id;
+        voice->freq = osc->freq;
+        voice->amplitude = osc->amplitude;
+        voice->progress = osc->curr_sample / osc->slength;
+        voice->level = osc->amplitude * get_percentval(osc->vol_bp, voice->progress);
+    }
+    snapshot->num_voices = num_voices;
+
+    /* Summarize the block into the scope's ring, a point at a time */
+    for(int i = 0; i < frames; i++) {
+        if(tap->bucket_count == 0 || out[i] < tap->bucket_min)
+            tap->bucket_min = out[i];
+        if(tap->bucket_count == 0 || out[i] > tap->bucket_max)
+            tap->bucket_max = out[i];
+
+        if(++tap->bucket_count == SCOPE_DECIMATION) {
+            tap->ring_min[tap->ring_pos] = tap->bucket_min;
+            tap->ring_max[tap->ring_pos] = tap->bucket_max;
+            tap->ring_pos = (tap->ring_pos + 1) % SCOPE_POINTS;
+            tap->bucket_count = 0;
+        }
+    }
+    tap->frames += frames;
+
+    // Unroll the ring from its oldest point
+    int older = SCOPE_POINTS - tap->ring_pos;
+    memcpy(snapshot->scope_min, tap->ring_min + tap->ring_pos, older * sizeof(float));
+    memcpy(snapshot->scope_min + older, tap->ring_min, tap->ring_pos * sizeof(float));
+    memcpy(snapshot->scope_max, tap->ring_max + tap->ring_pos, older * sizeof(float));
+    memcpy(snapshot->scope_max + older, tap->ring_max, tap->ring_pos * sizeof(float));
+    snapshot->frames = tap->frames;
+
+    // Publish the snapshot, and fill the one it replaces next time
+    int old = __atomic_exchange_n(&tap->middle, tap->back | VIZ_FRESH, __ATOMIC_ACQ_REL);
+    tap->back = old & ~VIZ_FRESH;
+}
+
+
+
+/*
+ * viz_tap_read():
+ * Returns the newest snapshot published. The snapshot stays valid and
+ * unchanged until the next call, which must be from the same thread. Never
+ * waits.
+ *
+ * tap:         A pointer to the VizTap
+ *
+ * return:      The newest snapshot, which is empty before the first
+ */
+VizSnapshot* viz_tap_read(VizTap* tap) {
+    if(__atomic_load_n(&tap->middle, __ATOMIC_ACQUIRE) & VIZ_FRESH) {
+        int old = __atomic_exchange_n(&tap->middle, tap->front, __ATOMIC_ACQ_REL);
+        tap->front = old & ~VIZ_FRESH;
+    }
+    return tap->buffers + tap->front;
+}
+
+
+
+/*
+ * free_viz_tap():
+ * Frees the given VizTap.
+ *
+ * tap:         A pointer to the VizTap to free
+ */
+void free_viz_tap(VizTap* tap) {
+    free(tap);
+}
@@ -0,0 +1,132 @@
+#ifndef VIZ_TAP_H
+#define VIZ_TAP_H
+
+#include "oscillator.h"
+
+// The most voices a snapshot holds
+#define MAX_VIZ_VOICES 64
+
+// The number of points in the scope of the output
+#define SCOPE_POINTS 256
+
+// The number of output samples summarized by each point of the scope
+#define SCOPE_DECIMATION 64
+
+// The range of frequencies across a drawing of a snapshot, in Hz
+#define VIZ_MIN_FREQ 60
+#define VIZ_MAX_FREQ 3200
+
+// The amplitude of the loudest note, which fills a drawing's height
+#define VIZ_MAX_AMP 0.4
+
+// The width of the bar drawn for each note
+#define VIZ_BAR_W 6
+
+
+/*
+ * VizVoice:
+ * What one playing Oscillator is doing.
+ */
+typedef struct viz_voice {
+    int id;
+    float freq;
+    float amplitude; // The base amplitude
+    float level; // The amplitude now, after the breakpoint envelope
+    float progress; // How far through the note it is, between 0 and 1
+} VizVoice;
+
+
+/*
+ * VizSnapshot:
+ * What the audio was doing at the end of one block: the voices playing, and
+ * a scope of the latest output.
+ */
+typedef struct viz_snapshot {
+    VizVoice voices[MAX_VIZ_VOICES];
+    int num_voices;
+
+    /* The lowest and highest output sample over each SCOPE_DECIMATION
+     * samples, from the oldest point to the newest */
+    float scope_min[SCOPE_POINTS];
+    float scope_max[SCOPE_POINTS];
+
+    unsigned long long frames; // The number of samples output so far
+} VizSnapshot;
+
+
+/*
+ * VizTap:
+ * Passes VizSnapshots from the audio thread to one reading thread through a
+ * triple buffer, so neither ever waits for the other.
+ *
+ * The audio thread fills the back buffer, then swaps it with the middle one.
+ * The reader swaps the middle buffer with its front one whenever the middle
+ * one is newer. Each swap is one atomic exchange, so the reader always gets
+ * the newest whole snapshot, and a slow reader just skips snapshots.
+ */
+typedef struct viz_tap {
+    VizSnapshot buffers[3];
+
+    int back; // Only used by the audio thread
+    int front; // Only used by the reader
+    int middle; // Only read or written with atomic operations
+
+    // The scope so far, as a ring of points. Only used by the audio thread.
+    float ring_min[SCOPE_POINTS];
+    float ring_max[SCOPE_POINTS];
+    int ring_pos; // The next point of the ring to write
+    int bucket_count; // The samples in the point being summarized
+    float bucket_min;
+    float bucket_max;
+    unsigned long long frames;
+} VizTap;
+
+
+
+/*
+ * new_viz_tap():
+ * Creates a malloc'ed VizTap with no snapshot published yet.
+ *
+ * The user must call free_viz_tap() on the returned struct.
+ *
+ * return:      A malloc'ed VizTap, or NULL on error
+ */
+VizTap* new_viz_tap();
+
+
+/*
+ * viz_tap_capture():
+ * Takes a snapshot of a block of audio and publishes it to the reader.
+ * Meant to be called at the end of each block by the audio thread, which
+ * must be the only thread that calls it. Never waits.
+ *
+ * tap:         A pointer to the VizTap
+ * voices:      The list of Oscillators playing
+ * out:         The block's output samples
+ * frames:      The number of samples in the block
+ */
+void viz_tap_capture(VizTap* tap, OscilNode* voices, float* out, int frames);
+
+
+/*
+ * viz_tap_read():
+ * Returns the newest snapshot published. The snapshot stays valid and
+ * unchanged until the next call, which must be from the same thread. Never
+ * waits.
+ *
+ * tap:         A pointer to the VizTap
+ *
+ * return:      The newest snapshot, which is empty before the first
+ */
+VizSnapshot* viz_tap_read(VizTap* tap);
+
+
+/*
+ * free_viz_tap():
+ * Frees the given VizTap.
+ *
+ * tap:         A pointer to the VizTap to free
+ */
+void free_viz_tap(VizTap* tap);
+
+#endif
@@ -0,0 +1,283 @@
+#include "zlib_backend.h"
+
+#include <stdlib.h>
+#include <limits.h>
+
+#if defined(USE_LIBDEFLATE)
+#include <libdeflate.h>
+#elif defined(USE_ZLIB)
+#include <zlib.h>
+#endif
+
+
+/* Internal function declarations */
+#if defined(USE_LIBDEFLATE) || defined(USE_ZLIB)
+int grow_output(unsigned char** out, size_t* capacity, size_t needed,
+        const LodePNGDecompressSettings* settings);
+#endif
+
+
+
+/*
+ * zlib_backend_name():
+ * Returns the name of the inflate implementation compiled in.
+ *
+ * return:      "libdeflate", "zlib" or "lodepng"
+ */
+const char* zlib_backend_name() {
+    #if defined(USE_LIBDEFLATE)
+    return "libdeflate";
+    #elif defined(USE_ZLIB)
+    return "zlib";
+    #else
+    return "lodepng";
+    #endif
+}
+
+
+
+/*
+ * use_zlib_backend():
+ * Sets the given LodePNG decompress settings to inflate with the compiled in
+ * backend. Does nothing if there is no backend other than LodePNG's own.
+ *
+ * settings:    The decompress settings to change, usually a LodePNGState's
+ *              decoder.zlibsettings
+ * context:     A ZlibBackendContext to hand the backend, which must stay valid
+ *              while the settings are used
+ */
+void use_zlib_backend(LodePNGDecompressSettings* settings, ZlibBackendContext* context) {
+    #if defined(USE_LIBDEFLATE) || defined(USE_ZLIB)
+    settings->custom_zlib = zlib_backend_decompress;
+    settings->custom_context = context;
+    #endif
+}
+
+
+
+/*
+ * zlib_backend_decompress():
+ * Inflates zlib data with the compiled in backend, in the form LodePNG expects
+ * of a custom_zlib function. The output is appended to *out, which is
+ * allocated or grown as needed.
+ *
+ * If settings->ignore_adler32 is set, the data's Adler-32 checksum is neither
+ * computed nor checked.
+ *
+ * out:         Pointer to the output buffer, which may be NULL
+ * outsize:     Pointer to the size of the output so far
+ * in:          The zlib data
+ * insize:      The size of the zlib data in bytes
+ * settings:    The decompress settings, whose custom_context may point to a
+ *              ZlibBackendContext
+ *
+ * return:      0 on success, nonzero on error
+ */
+unsigned zlib_backend_decompress(unsigned char** out, size_t* outsize,
+        const unsigned char* in, size_t insize, const LodePNGDecompressSettings* settings) {
+    #if defined(USE_LIBDEFLATE) || defined(USE_ZLIB)
+    const ZlibBackendContext* context = (const ZlibBackendContext*) settings->custom_context;
+
+    // Guess the output size if it isn't known, and grow it when it runs out
+    size_t guess = (context != NULL && context->expected_size) ? context->expected_size : insize*4 + 1024;
+    size_t capacity = *outsize;
+    if(grow_output(out, &capacity, *outsize + guess, settings))
+        return 1;
+
+    /* The 2 byte zlib header says which compression method is used and
+     * whether there's a preset dictionary, which PNG doesn't allow */
+    if(insize < 2 || (in[0] & 15) != 8 || (in[1] & 32) != 0 || ((in[0] << 8) | in[1]) % 31 != 0)
+        return 1;
+    #endif
+
+
+    #if defined(USE_LIBDEFLATE)
+    struct libdeflate_decompressor* decompressor = libdeflate_alloc_decompressor();
+    if(decompressor == NULL)
+        return 1;
+
+    /* libdeflate inflates in one call into a buffer of fixed size, so try
+     * again with a larger one if it doesn't fit. Skipping the zlib wrapper
+     * and inflating the raw deflate data also skips the Adler-32 check. */
+    enum libdeflate_result result;
+    size_t written;
+    while(1) {
+        if(settings->ignore_adler32)
+            result = libdeflate_deflate_decompress(decompressor, in + 2, insize - 2,
+                    *out + *outsize, capacity - *outsize, &written);
+        else
+            result = libdeflate_zlib_decompress(decompressor, in, insize,
+                    *out + *outsize, capacity - *outsize, &written);
+
+        if(result != LIBDEFLATE_INSUFFICIENT_SPACE)
+            break;
+        /* Past max_output_size, report everything that fit so LodePNG can tell
+         * the data was too large rather than corrupt */
+        if(grow_output(out, &capacity, capacity*2, settings)) {
+            *outsize = capacity;
+            break;
+        }
+    }
+    libdeflate_free_decompressor(decompressor);
+
+    if(result != LIBDEFLATE_SUCCESS)
+        return 1;
+    *outsize += written;
+    return 0;
+
+
+    #elif defined(USE_ZLIB)
+    /* Inflating the raw deflate data after the header skips the Adler-32
+     * check, and zlib doesn't compute the checksum either */
+    z_stream zs;
+    zs.zalloc = Z_NULL;
+    zs.zfree = Z_NULL;
+    zs.opaque = Z_NULL;
+    zs.next_in = Z_NULL;
+    zs.avail_in = 0;
+    if(settings->ignore_adler32) {
+        in += 2;
+        insize -= 2;
+    }
+    if(inflateInit2(&zs, settings->ignore_adler32 ? -MAX_WBITS : MAX_WBITS) != Z_OK)
+        return 1;
+
+    int ret = Z_OK;
+    while(ret == Z_OK) {
+        if(*outsize == capacity && grow_output(out, &capacity, capacity*2, settings)) {
+            ret = Z_MEM_ERROR;
+            break;
+        }
+
+        // zlib counts in 32 bits, so hand it at most UINT_MAX bytes at a time
+        if(zs.avail_in == 0) {
+            zs.avail_in = insize > UINT_MAX ? UINT_MAX : insize;
+            zs.next_in = (Bytef*) in;
+            in += zs.avail_in;
+            insize -= zs.avail_in;
+        }
+        size_t avail = capacity - *outsize;
+        zs.avail_out = avail > UINT_MAX ? UINT_MAX : avail;
+        zs.next_out = *out + *outsize;
+
+        ret = inflate(&zs, Z_NO_FLUSH);
+        *outsize += (avail > UINT_MAX ? UINT_MAX : avail) - zs.avail_out;
+
+        // Out of input before the end of the data
+        if(ret == Z_BUF_ERROR && zs.avail_in == 0 && insize == 0)
+            break;
+        if(ret == Z_BUF_ERROR)
+            ret = Z_OK;
+    }
+    inflateEnd(&zs);
+
+    return ret != Z_STREAM_END;
+
+
+    #else
+    return 1;
+    #endif
+}
+
+
+
+
+/*
+ * use_zlib_compress_backend():
+ * Sets the given LodePNG compress settings to deflate with the compiled in
+ * backend. Without one, makes LodePNG's own deflate search a smaller window
+ * instead, which is a good deal faster and compresses photos nearly as well.
+ *
+ * settings:    The compress settings to change, usually a LodePNGState's
+ *              encoder.zlibsettings
+ */
+void use_zlib_compress_backend(LodePNGCompressSettings* settings) {
+    #if defined(USE_LIBDEFLATE) || defined(USE_ZLIB)
+    settings->custom_zlib = zlib_backend_compress;
+    #else
+    settings->windowsize = 512;
+    #endif
+}
+
+
+
+/*
+ * zlib_backend_compress():
+ * Deflates data into the zlib format with the compiled in backend, in the
+ * form LodePNG expects of a custom_zlib function.
+ *
+ * out:         Pointer to set to the malloc'ed zlib data
+ * outsize:     Pointer to set to the size of the zlib data
+ * in:          The data to deflate
+ * insize:      The size of the data in bytes
+ * settings:    The compress settings
+ *
+ * return:      0 on success, nonzero on error
+ */
+unsigned zlib_backend_compress(unsigned char** out, size_t* outsize,
+        const unsigned char* in, size_t insize, const LodePNGCompressSettings* settings) {
+    #if defined(USE_LIBDEFLATE)
+    struct libdeflate_compressor* compressor = libdeflate_alloc_compressor(ZLIB_BACKEND_LEVEL);
+    if(compressor == NULL)
+        return 1;
+
+    size_t bound = libdeflate_zlib_compress_bound(compressor, insize);
+    *out = (unsigned char*) malloc(bound);
+    *outsize = *out != NULL ? libdeflate_zlib_compress(compressor, in, insize, *out, bound) : 0;
+    libdeflate_free_compressor(compressor);
+
+    return *outsize == 0;
+
+
+    #elif defined(USE_ZLIB)
+    // compress2() takes the sizes as uLong, which may be 32 bits
+    uLong bound = compressBound(insize);
+    if(insize > ULONG_MAX || bound < insize)
+        return 1;
+
+    *out = (unsigned char*) malloc(bound);
+    if(*out == NULL)
+        return 1;
+    uLongf written = bound;
+    if(compress2(*out, &written, in, insize, ZLIB_BACKEND_LEVEL) != Z_OK)
+        return 1;
+    *outsize = written;
+    return 0;
+
+
+    #else
+    return 1;
+    #endif
+}
+
+
+
+
+#if defined(USE_LIBDEFLATE) || defined(USE_ZLIB)
+/*
+ * grow_output():
+ * Grows an output buffer of the given capacity to hold at least the given
+ * number of bytes.
+ *
+ * out:         Pointer to the buffer, which may be NULL
+ * capacity:    Pointer to the size of the buffer, updated when it grows
+ * needed:      The number of bytes the buffer must hold
+ * settings:    The decompress settings, whose max_output_size is enforced
+ *
+ * return:      0 on success, 1 if out of memory or over max_output_size
+ */
+int grow_output(unsigned char** out, size_t* capacity, size_t needed,
+        const LodePNGDecompressSettings* settings) {
+    if(needed <= *capacity)
+        return 0;
+    if(settings->max_output_size && *capacity > settings->max_output_size)
+        return 1;
+
+    unsigned char* grown = (unsigned char*) realloc(*out, needed);
+    if(grown == NULL)
+        return 1;
+    *out = grown;
+    *capacity = needed;
+    return 0;
+}
+#endif
@@ -0,0 +1,105 @@
+#ifndef ZLIB_BACKEND_H
+#define ZLIB_BACKEND_H
+
+#include <stddef.h>
+
+#include "lodepng.h"
+
+/* LodePNG's own inflate is portable but slow. When compiled with
+ * USE_LIBDEFLATE or USE_ZLIB, PNG image data is inflated with that library
+ * instead, through LodePNG's custom_zlib hook. libdeflate is used if both are
+ * available. Without either, LodePNG's inflate is used as before.
+ *
+ * LodePNG's deflate is slower still, so images written with the encoder
+ * settings from use_zlib_compress_backend() are deflated the same way. */
+
+// The compression level the backends deflate at, which favors speed
+#define ZLIB_BACKEND_LEVEL 3
+
+
+/*
+ * ZlibBackendContext:
+ * Passed to zlib_backend_decompress() through the decompress settings'
+ * custom_context.
+ */
+typedef struct zlib_backend_context {
+    /* The expected size of the inflated data, so the output can be allocated
+     * once up front, or 0 if not known */
+    size_t expected_size;
+} ZlibBackendContext;
+
+
+
+/*
+ * zlib_backend_name():
+ * Returns the name of the inflate implementation compiled in.
+ *
+ * return:      "libdeflate", "zlib" or "lodepng"
+ */
+const char* zlib_backend_name();
+
+
+/*
+ * use_zlib_backend():
+ * Sets the given LodePNG decompress settings to inflate with the compiled in
+ * backend. Does nothing if there is no backend other than LodePNG's own.
+ *
+ * settings:    The decompress settings to change, usually a LodePNGState's
+ *              decoder.zlibsettings
+ * context:     A ZlibBackendContext to hand the backend, which must stay valid
+ *              while the settings are used
+ */
+void use_zlib_backend(LodePNGDecompressSettings* settings, ZlibBackendContext* context);
+
+
+/*
+ * zlib_backend_decompress():
+ * Inflates zlib data with the compiled in backend, in the form LodePNG expects
+ * of a custom_zlib function. The output is appended to *out, which is
+ * allocated or grown as needed.
+ *
+ * If settings->ignore_adler32 is set, the data's Adler-32 checksum is neither
+ * computed nor checked.
+ *
+ * out:         Pointer to the output buffer, which may be NULL
+ * outsize:     Pointer to the size of the output so far
+ * in:          The zlib data
+ * insize:      The size of the zlib data in bytes
+ * settings:    The decompress settings, whose custom_context may point to a
+ *              ZlibBackendContext
+ *
+ * return:      0 on success, nonzero on error
+ */
+unsigned zlib_backend_decompress(unsigned char** out, size_t* outsize,
+        const unsigned char* in, size_t insize, const LodePNGDecompressSettings* settings);
+
+
+/*
+ * use_zlib_compress_backend():
+ * Sets the given LodePNG compress settings to deflate with the compiled in
+ * backend. Without one, makes LodePNG's own deflate search a smaller window
+ * instead, which is a good deal faster and compresses photos nearly as well.
+ *
+ * settings:    The compress settings to change, usually a LodePNGState's
+ *              encoder.zlibsettings
+ */
+void use_zlib_compress_backend(LodePNGCompressSettings* settings);
+
+
+/*
+ * zlib_backend_compress():
+ * Deflates data into the zlib format with the compiled in backend, in the
+ * form LodePNG expects of a custom_zlib function.
+ *
+ * out:         Pointer to set to the malloc'ed zlib data
+ * outsize:     Pointer to set to the size of the zlib data
+ * in:          The data to deflate
+ * insize:      The size of the data in bytes
+ * settings:    The compress settings
+ *
+ * return:      0 on success, nonzero on error
+ */
+unsigned zlib_backend_compress(unsigned char** out, size_t* outsize,
+        const unsigned char* in, size_t insize, const LodePNGCompressSettings* settings);
+
+#endif